@@ -1,34 +1,116 @@
 #version 410
 
-#define NUM_LIGHTS 3
+// Same block as in default.vert
+in VertexData
+{
+    vec2 v2fTexCoord;
+    vec3 v2fNormal;
+    vec4 v2fTangent;
+
+    vec3 v2fAmbient;
+    vec3 v2fDiffuse;
+    vec3 v2fSpecular;
+    float v2fShininess;
+    vec3 v2fEmissive;
+    float v2fIllum;
+    float v2fOcclusion;
+
+    flat uint v2fDrawFlags;
+    flat int v2fNormalMapLayer;
+    flat uint v2fView;
+
+    vec3 v2fWorldPos;
+};
+
+// DrawRecord switches, see default.vert
+#define DRAW_TEXTURED   1u
+#define DRAW_NORMAL_MAP 4u
+#define DRAW_LIGHTMAP   8u
+
+// All lights, updated once per frame, see uniform_blocks.hpp
+layout( std140 ) uniform FrameBlock
+{
+    // Directional light
+    vec3 uDirectLightDir;
+    vec3 uDirectLightAmbient;
+    vec3 uDirectLightDiffuse;
+
+    // Stuff point lights
+    // Multiple lights - https://opentk.net/learn/chapter2/6-multiple-lights.html
+    // They are sorted into clusters, see light_clusters.hpp. Their ambient
+    // doesn't fall off, so it's the same everywhere and comes summed up.
+    // The emissive term used to be added once per light, and still counts
+    // that many times.
+    vec3 uPointLightAmbient;
+    float uEmissiveWeight;
+    uvec4 uLightGrid;       // Tiles along x and y, slices, lights
+    vec4 uLightSlices;      // Slice = log(view depth) * x + y
+};
+
+// Same block as in default.vert
+#define MAX_VIEWS 2
+
+layout( std140, row_major ) uniform ViewBlock
+{
+    mat4 uProjCamera[MAX_VIEWS];
+    vec4 uWorldCameraPos[MAX_VIEWS];
+    vec4 uWorldCameraRight[MAX_VIEWS];
+    vec4 uWorldCameraUp[MAX_VIEWS];
+    uint uViewCount;
+    uint uFirstView;        // See light_clusters.hpp
+};
+
+// Each light, each cluster's first index and count into the light lists,
+// and the light lists
+#ifdef DRAW_BUFFER
+struct PointLight
+{
+    vec4 position;          // xyz; w: range
+    vec4 diffuse;
+    vec4 specular;
+};
 
-in vec2 v2fTexCoord;
-in vec3 v2fNormal;
+layout( std430, binding = 0 ) readonly buffer LightBuffer
+{
+    PointLight uLights[];
+};
 
-in vec3 v2fAmbient;
-in vec3 v2fDiffuse;
-in vec3 v2fSpecular;
-in float v2fShininess;
-in vec3 v2fEmissive;
-in float v2fIllum;
+layout( std430, binding = 1 ) readonly buffer LightClusterBuffer
+{
+    uvec2 uLightClusters[];
+};
 
-in vec3 v2fWorldPos;
+layout( std430, binding = 2 ) readonly buffer LightIndexBuffer
+{
+    uint uLightIndices[];
+};
 
-uniform bool uUseTexture;
+uvec2 light_cluster( uint aCluster ) { return uLightClusters[aCluster]; }
+uint light_index( uint aEntry ) { return uLightIndices[aEntry]; }
 
-// Directional light
-uniform vec3 uDirectLightDir;
-uniform vec3 uDirectLightAmbient;
-uniform vec3 uDirectLightDiffuse;
+void light_at( uint aLight, out vec4 aPosition, out vec3 aDiffuse, out vec3 aSpecular )
+{
+    aPosition = uLights[aLight].position;
+    aDiffuse = uLights[aLight].diffuse.rgb;
+    aSpecular = uLights[aLight].specular.rgb;
+}
+#else
+// Texture buffers with this frame's data only
+uniform samplerBuffer uLightData;           // Three texels per light
+uniform usamplerBuffer uLightClusterData;
+uniform usamplerBuffer uLightIndexData;
 
-// Stuff point lights
-// Multiple lights - https://opentk.net/learn/chapter2/6-multiple-lights.html
-uniform vec3 uLightPos[NUM_LIGHTS];
-uniform vec3 uLightDiffuse[NUM_LIGHTS];
-uniform vec3 uLightSpecular[NUM_LIGHTS];
-uniform vec3 uSceneAmbient[NUM_LIGHTS];
+uvec2 light_cluster( uint aCluster ) { return texelFetch( uLightClusterData, int(aCluster) ).xy; }
+uint light_index( uint aEntry ) { return texelFetch( uLightIndexData, int(aEntry) ).x; }
 
-uniform vec3 uWorldCameraPos;
+void light_at( uint aLight, out vec4 aPosition, out vec3 aDiffuse, out vec3 aSpecular )
+{
+    int texel = int(3u * aLight);
+    aPosition = texelFetch( uLightData, texel );
+    aDiffuse = texelFetch( uLightData, texel + 1 ).rgb;
+    aSpecular = texelFetch( uLightData, texel + 2 ).rgb;
+}
+#endif
 
 layout( location = 0 ) out vec3 oColor;
 
@@ -36,27 +118,36 @@ layout( location = 0 ) out vec3 oColor;
 // layout( binding = 0 ) uniform sampler2D uTexture;
 uniform sampler2D uTexture; // No layout(binding) qualifier
 
+// Baked tangent space normals, one layer per simplified LOD
+uniform sampler2DArray uNormalMap;
+
+// Baked directional light (direct + one bounce) over the terrain. The UVs
+// come from the world position, see lightmap.hpp
+uniform vec4 uLightmapTransform;
+uniform sampler2D uLightmap;
+
+// The ambient and emissive terms are the same for every light, see main()
 vec3 calcBlinnPhongLighting( 
     vec3 normal, 
     vec3 lightDir, 
     vec3 viewDir, 
     vec3 aLightPos, 
-    vec3 aSceneAmbient, 
+    float aLightRange, 
     vec3 aLightDiffuse, 
     vec3 aLightSpecular 
 ) {
     
     
     // Calculate Blinn-Phong lighting
+    // The falloff fades out to nothing at the light's range, where the
+    // light is cut off
     float lightDist = length(aLightPos - v2fWorldPos);
-    float falloff = 1.0 / (lightDist * lightDist);
+    float window = clamp(1.0 - pow(lightDist / aLightRange, 4.0), 0.0, 1.0);
+    float falloff = window * window / (lightDist * lightDist);
 
     // return vec3(falloff);
 
     // Blinn-Phong Lighting 
-    // K_a * I_a
-    vec3 ambience = v2fAmbient * aSceneAmbient;
-
     // Diffuse contribution
     float nDotL = max( 0.0, dot( normal, lightDir ) );
     vec3 diffuse = (nDotL * aLightDiffuse * v2fDiffuse) * falloff;   // Apply falloff
@@ -69,13 +160,22 @@ vec3 calcBlinnPhongLighting(
     float hDotN = max(0.0, dot(H, normal));
     vec3 specular = (pow(hDotN, v2fShininess) * aLightSpecular * v2fSpecular) * spec_modifier * falloff;    // Apply falloff
 
-    // Combine the lighting
-    vec3 lighting = ambience + diffuse + specular + v2fEmissive;
-
     // return specular;     // Debugging
 
-    lighting *= v2fIllum;
-    return lighting;
+    return diffuse + specular;
+}
+
+// Which of the view's clusters the fragment is in, see light_clusters.hpp
+uint light_cluster_index()
+{
+    vec4 clip = uProjCamera[v2fView] * vec4( v2fWorldPos, 1.0 );
+    vec2 tile = clamp( (clip.xy / clip.w * 0.5 + 0.5) * vec2( uLightGrid.xy ), vec2( 0.0 ), vec2( uLightGrid.xy - 1u ) );
+
+    // clip.w is the view depth
+    float slice = clamp( floor( log( max( clip.w, 1e-4 ) ) * uLightSlices.x + uLightSlices.y ), 0.0, float( uLightGrid.z - 1u ) );
+
+    uint view = uFirstView + v2fView;
+    return ((view * uLightGrid.z + uint(slice)) * uLightGrid.y + uint(tile.y)) * uLightGrid.x + uint(tile.x);
 }
 
 
@@ -83,28 +183,58 @@ void main()
 {
     vec3 normal = normalize(v2fNormal);
 
+    // Replace the (coarse) vertex normal with the one baked from the full
+    // resolution mesh. The tangent frame is built the same way the baker did.
+    if ((v2fDrawFlags & DRAW_NORMAL_MAP) != 0u) {
+        vec3 tangent = normalize(v2fTangent.xyz - dot(v2fTangent.xyz, normal) * normal);
+        vec3 bitangent = (v2fTangent.w < 0.0 ? -1.0 : 1.0) * cross(normal, tangent);
+
+        vec3 mapped = texture( uNormalMap, vec3( v2fTexCoord, v2fNormalMapLayer ) ).xyz * 2.0 - 1.0;
+        normal = normalize(mat3(tangent, bitangent, normal) * mapped);
+    }
+
     // Original directional lighting
-    float nDotL = max( 0.0, dot( normal, uDirectLightDir ) );
+    float nDotL;
+    if ((v2fDrawFlags & DRAW_LIGHTMAP) != 0u) {
+        vec2 baked = texture( uLightmap, v2fWorldPos.xz * uLightmapTransform.xy + uLightmapTransform.zw ).rg;
+        nDotL = baked.r + baked.g;
+    }
+    else {
+        nDotL = max( 0.0, dot( normal, uDirectLightDir ) );
+    }
+
     // Just use the diffuse component of the material since this is what v2fcolor was originally
-    vec3 lighting = (uDirectLightAmbient + nDotL * uDirectLightDiffuse) * v2fDiffuse;
+    // The ambient light is scaled by the baked occlusion
+    vec3 lighting = (uDirectLightAmbient * v2fOcclusion + nDotL * uDirectLightDiffuse) * v2fDiffuse;
 
     // === Point lights ===
     // Calculate view direction
     // This is direction from fragment to camera
-    vec3 viewDir = normalize( uWorldCameraPos - v2fWorldPos );
+    vec3 viewDir = normalize( uWorldCameraPos[v2fView].xyz - v2fWorldPos );
 
-    for (int i = 0; i < NUM_LIGHTS; ++i) {
+    // K_a * I_a, less whatever the baked occlusion says can't reach here
+    vec3 pointLighting = v2fAmbient * uPointLightAmbient * v2fOcclusion + v2fEmissive * uEmissiveWeight;
 
-        vec3 lightDir = normalize(uLightPos[i] - v2fWorldPos);
-        lighting += calcBlinnPhongLighting(
+    // Only the lights that reach the fragment's cluster
+    uvec2 cluster = light_cluster( light_cluster_index() );
+
+    for (uint i = 0u; i < cluster.y; ++i) {
+        vec4 lightPos;
+        vec3 lightDiffuse, lightSpecular;
+        light_at( light_index( cluster.x + i ), lightPos, lightDiffuse, lightSpecular );
+
+        vec3 lightDir = normalize(lightPos.xyz - v2fWorldPos);
+        pointLighting += calcBlinnPhongLighting(
             normal, lightDir, viewDir,
-            uLightPos[i], uSceneAmbient[i],
-            uLightDiffuse[i], uLightSpecular[i]
+            lightPos.xyz, lightPos.w,
+            lightDiffuse, lightSpecular
         );
     }
 
+    lighting += pointLighting * v2fIllum;
+
     // Add the texture stuff
-    oColor = uUseTexture ? lighting * texture( uTexture, v2fTexCoord ).rgb : lighting;
+    oColor = (v2fDrawFlags & DRAW_TEXTURED) != 0u ? lighting * texture( uTexture, v2fTexCoord ).rgb : lighting;
     oColor = clamp( oColor, 0.0, 1.0 );
 
 }
@@ -1,5 +1,6 @@
 #version 410
 
+#ifndef VERTEX_PULLING
 layout( location = 0 ) in vec3 iPosition;
 layout( location = 1 ) in vec3 iNormal;
 layout( location = 2 ) in vec2 iTexCoord;
@@ -10,26 +11,217 @@ layout( location = 5 ) in vec3 iSpecular;
 layout( location = 6 ) in float iShininess;
 layout( location = 7 ) in vec3 iEmissive;
 layout( location = 8 ) in float iIllum;
+#endif
 
-uniform mat4 uProjCameraWorld;
-uniform mat3 uNormalMatrix;
-uniform mat4 uModel2World;
+// Index of this draw's DrawRecord, see draw_batch.hpp. With DRAW_BUFFER it
+// comes from the command's baseInstance and already includes the instance.
+layout( location = 9 ) in uint iDrawRecord;
 
-out vec2 v2fTexCoord;
+#ifndef VERTEX_PULLING
+// Tangent (xyz) and bitangent sign (w), only used with normal maps
+layout( location = 14 ) in vec4 iTangent;
 
-out vec3 v2fNormal;
+// Baked ambient occlusion, 1 where nothing was baked, see ao_bake.hpp
+layout( location = 15 ) in float iOcclusion;
+#endif
 
-out vec3 v2fAmbient;
-out vec3 v2fDiffuse;
-out vec3 v2fSpecular;
-out float v2fShininess;
-out vec3 v2fEmissive;
-out float v2fIllum;
+// The cameras, see uniform_blocks.hpp. With more than one view, each draw
+// is instanced once more per view, see multi_view.hpp.
+#define MAX_VIEWS 2
 
-out vec3 v2fWorldPos;    // Pass position in 'view' space
+layout( std140, row_major ) uniform ViewBlock
+{
+    mat4 uProjCamera[MAX_VIEWS];        // World -> clip
+    vec4 uWorldCameraPos[MAX_VIEWS];    // xyz
+    vec4 uWorldCameraRight[MAX_VIEWS];  // xyz, for billboards
+    vec4 uWorldCameraUp[MAX_VIEWS];
+    uint uViewCount;
+    uint uFirstView;
+};
+
+// Per-draw transforms and switches
+#define DRAW_TEXTURED   1u
+#define DRAW_PALETTE    2u
+#define DRAW_NORMAL_MAP 4u
+#define DRAW_LIGHTMAP   8u
+#define DRAW_PACKED_VERTICES 16u
+
+struct DrawRecord
+{
+    mat4 model2world;
+    mat4 normalMatrix;          // Only the upper 3x3 is used
+    uint flags;
+    int normalMapLayer;
+    uint vertexOffset;          // VERTEX_PULLING only
+    uint paletteIndex;          // DRAW_PALETTE only, into uParts
+};
+
+#ifdef DRAW_BUFFER
+layout( std430, row_major, binding = 3 ) readonly buffer DrawBuffer
+{
+    DrawRecord uDraws[];
+};
+#else
+#define MAX_DRAW_RECORDS 64
+
+layout( std140, row_major ) uniform DrawBlock
+{
+    DrawRecord uDraws[MAX_DRAW_RECORDS];
+};
+#endif
+
+#ifdef VERTEX_PULLING
+// The vertices and their materials, see vertex_format.hpp. pull_vertex()
+// fills in the same inputs that the attributes would otherwise.
+layout( std430, binding = 4 ) readonly buffer VertexBuffer
+{
+    uint uVertexWords[];
+};
+
+struct Material
+{
+    vec4 ambientShininess;
+    vec4 diffuseIllum;
+    vec4 specular;
+    vec4 emissive;
+};
+
+layout( std430, binding = 5 ) readonly buffer MaterialBuffer
+{
+    Material uMaterials[];
+};
+
+vec3 iPosition;
+vec3 iNormal;
+vec2 iTexCoord;
+
+vec3 iAmbient;
+vec3 iDiffuse;
+vec3 iSpecular;
+float iShininess;
+vec3 iEmissive;
+float iIllum;
+
+vec4 iTangent;
+float iOcclusion;
+
+float word_float( uint aWord )
+{
+    return uintBitsToFloat( uVertexWords[aWord] );
+}
+
+vec3 octahedral_decode( uint aWord )
+{
+    vec2 e = unpackSnorm2x16( aWord );
+    vec3 v = vec3( e, 1.0 - abs(e.x) - abs(e.y) );
+
+    // Unfold the lower half
+    float t = max( -v.z, 0.0 );
+    v.x += v.x >= 0.0 ? -t : t;
+    v.y += v.y >= 0.0 ? -t : t;
+
+    return normalize( v );
+}
+
+void pull_vertex( DrawRecord aDraw )
+{
+    // Meshes have a base vertex of 0, so gl_VertexID is the mesh's own
+    uint material;
+
+    if ((aDraw.flags & DRAW_PACKED_VERTICES) != 0u) {
+        uint v = aDraw.vertexOffset + uint(gl_VertexID) * 7u;
+        uint extra = uVertexWords[v + 6u];
+
+        iPosition = vec3( word_float(v), word_float(v + 1u), word_float(v + 2u) );
+        iNormal = octahedral_decode( uVertexWords[v + 3u] );
+        iTangent = vec4( octahedral_decode( uVertexWords[v + 4u] ), (extra & 0x100u) != 0u ? -1.0 : 1.0 );
+        iTexCoord = unpackHalf2x16( uVertexWords[v + 5u] );
+        iOcclusion = float(extra & 0xffu) / 255.0;
+        material = extra >> 16;
+    }
+    else {
+        uint v = aDraw.vertexOffset + uint(gl_VertexID) * 14u;
+
+        iPosition = vec3( word_float(v), word_float(v + 1u), word_float(v + 2u) );
+        iNormal = vec3( word_float(v + 3u), word_float(v + 4u), word_float(v + 5u) );
+        iTexCoord = vec2( word_float(v + 6u), word_float(v + 7u) );
+        iTangent = vec4( word_float(v + 8u), word_float(v + 9u), word_float(v + 10u), word_float(v + 11u) );
+        iOcclusion = word_float(v + 12u);
+        material = uVertexWords[v + 13u];
+    }
+
+    Material m = uMaterials[material];
+    iAmbient = m.ambientShininess.xyz;
+    iShininess = m.ambientShininess.w;
+    iDiffuse = m.diffuseIllum.xyz;
+    iIllum = m.diffuseIllum.w;
+    iSpecular = m.specular.xyz;
+    iEmissive = m.emissive.xyz;
+}
+#endif
+
+#define MAX_PARTS 128
+
+struct PartPaletteEntry
+{
+    mat4 transform;
+    mat4 normal;
+};
+
+layout( std140, row_major ) uniform PartPalette
+{
+    PartPaletteEntry uParts[MAX_PARTS];
+};
+
+// The depth pre-pass draws with this shader as well, and the shading pass
+// then only keeps fragments at exactly the same depth (GL_EQUAL). Without
+// invariance the two programs could compute the position differently.
+invariant gl_Position;
+
+// A block, so that default.geom can pass it through as a whole
+out VertexData
+{
+    vec2 v2fTexCoord;
+
+    vec3 v2fNormal;
+    vec4 v2fTangent;
+
+    vec3 v2fAmbient;
+    vec3 v2fDiffuse;
+    vec3 v2fSpecular;
+    float v2fShininess;
+    vec3 v2fEmissive;
+    float v2fIllum;
+
+    float v2fOcclusion;
+
+    flat uint v2fDrawFlags;
+    flat int v2fNormalMapLayer;
+    flat uint v2fView;
+
+    vec3 v2fWorldPos;    // Pass position in 'view' space
+};
 
 void main()
 {
+    // With DRAW_BUFFER the record attribute's divisor is the view count, so
+    // it only moves on with the object instance
+    uint view = uint(gl_InstanceID) % uViewCount;
+    v2fView = view;
+
+#ifdef DRAW_BUFFER
+    DrawRecord draw = uDraws[iDrawRecord];
+#else
+    DrawRecord draw = uDraws[iDrawRecord + uint(gl_InstanceID) / uViewCount];
+#endif
+
+#ifdef VERTEX_PULLING
+    pull_vertex( draw );
+#endif
+
+    v2fDrawFlags = draw.flags;
+    v2fNormalMapLayer = draw.normalMapLayer;
+
     v2fTexCoord = iTexCoord;
 
     // Pass material attributes to the fragment shader
@@ -39,12 +231,28 @@ void main()
     v2fShininess = iShininess;
     v2fEmissive = iEmissive;
     v2fIllum = iIllum;
+    v2fOcclusion = iOcclusion;
 
-    v2fNormal = normalize(uNormalMatrix * iNormal);
+    // Palette-driven parts are first moved into model space. Each instance
+    // of a part's primitive has its own record, and so its own entry.
+    vec4 position = vec4( iPosition, 1.0 );
+    vec3 normal = iNormal;
+
+    if ((draw.flags & DRAW_PALETTE) != 0u) {
+        position = uParts[draw.paletteIndex].transform * position;
+        normal = mat3(uParts[draw.paletteIndex].normal) * normal;
+    }
+
+    v2fNormal = normalize(mat3(draw.normalMatrix) * normal);
+    v2fTangent = vec4( mat3(draw.model2world) * iTangent.xyz, iTangent.w );
 
     // Vertex position in world space
-    vec4 worldPosition = uModel2World * vec4(iPosition, 1.0);
+    vec4 worldPosition = draw.model2world * position;
     v2fWorldPos = worldPosition.xyz;
 
-    gl_Position = uProjCameraWorld * vec4( iPosition, 1.0 );
+    gl_Position = uProjCamera[view] * worldPosition;
+
+#ifdef VIEW_ROUTING_VERTEX
+    gl_ViewportIndex = int(view);
+#endif
 }
@@ -0,0 +1,9 @@
+#version 410
+
+// Depth pre-pass: default.vert (and default.geom) place the triangles, and
+// only the depth is kept. Colour writes are masked off while it draws, so
+// there is nothing to do here. See the depth pre-pass in main.cpp.
+
+void main()
+{
+}
@@ -1,8 +1,8 @@
+#version 410
+
 // Particle fragment shader
 // https://learnopengl.com/index.php?p=In-Practice/2D-Game/Particles
 
-#version 410
-
 in vec2 v2fTexCoord;
 in vec4 v2fParticleColor;
 
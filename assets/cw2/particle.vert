@@ -1,34 +1,50 @@
+#version 410
+
 // Particle vertex shader
 // https://learnopengl.com/index.php?p=In-Practice/2D-Game/Particles
-//
-#version 410
 
 layout( location = 0 ) in vec3 iPosition;  // Input particle position (e.g., from squareVertices)
 layout( location = 1 ) in vec2 iTexCoord;  // Texture coordinates
 
+// Per particle, one instance per particle and view. The divisor is the
+// view count.
+layout( location = 2 ) in vec4 iCenterSize; // World-space center, billboard size
+layout( location = 3 ) in vec4 iColor;      // Particle color
+
 out vec2 v2fTexCoord;
 out vec4 v2fParticleColor;
 
-uniform mat4 uProjCameraWorld;  // Projection and camera matrix
-uniform vec4 uColor;            // Particle color
+// Same block as in default.vert. The billboards face each view's camera.
+#define MAX_VIEWS 2
 
-uniform vec3 uParticleCenterWorldSpace;  // The center of the particle (world-space position)
-uniform vec3 uCameraRightWorldSpace;    // Right vector (from camera view matrix)
-uniform vec3 uCameraUpWorldSpace;       // Up vector (from camera view matrix)
-uniform vec2 uBillboardSize;            // Size of the billboard (scale factor)
+layout( std140, row_major ) uniform ViewBlock
+{
+    mat4 uProjCamera[MAX_VIEWS];        // World -> clip
+    vec4 uWorldCameraPos[MAX_VIEWS];
+    vec4 uWorldCameraRight[MAX_VIEWS];  // Right vector (from camera view matrix)
+    vec4 uWorldCameraUp[MAX_VIEWS];     // Up vector (from camera view matrix)
+    uint uViewCount;
+    uint uFirstView;
+};
 
 void main() {
+    uint view = uint(gl_InstanceID) % uViewCount;
+
     // Calculate the world-space position for each vertex of the particle
     // https://www.opengl-tutorial.org/intermediate-tutorials/billboards-particles/billboards/#solution-2--the-3d-way
     vec3 vertexPositionWorldSpace = 
-        uParticleCenterWorldSpace
-        + uCameraRightWorldSpace * iPosition.x * uBillboardSize.x
-        + uCameraUpWorldSpace * iPosition.y * uBillboardSize.y;
+        iCenterSize.xyz
+        + uWorldCameraRight[view].xyz * iPosition.x * iCenterSize.w
+        + uWorldCameraUp[view].xyz * iPosition.y * iCenterSize.w;
 
     // Pass the texture coordinates and color to the fragment shader
     v2fTexCoord = iTexCoord;
-    v2fParticleColor = uColor;
+    v2fParticleColor = iColor;
 
     // Compute the final clip-space position
-    gl_Position = uProjCameraWorld * vec4(vertexPositionWorldSpace, 1.0);
+    gl_Position = uProjCamera[view] * vec4(vertexPositionWorldSpace, 1.0);
+
+#ifdef VIEW_ROUTING_VERTEX
+    gl_ViewportIndex = int(view);
+#endif
 }
@@ -0,0 +1,406 @@
+#include <catch2/catch_amalgamated.hpp>
+
+#include "../main/bvh.hpp"
+
+#include "grid-fixture.hpp"
+
+#include <limits>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include <cmath>
+
+using namespace Catch::Matchers;
+
+namespace
+{
+    // A bumpy grid (many small, connected triangles) with a soup of larger
+    // random triangles floating above it
+    GridMesh make_scene_( std::uint32_t aSeed )
+    {
+        auto ret = make_grid(24, 0.2f, aSeed, [] (float x, float z) { return std::sin(x) * std::cos(z); });
+
+        std::mt19937 rng( aSeed + 1 );
+        std::uniform_real_distribution<float> unit( -1.f, 1.f );
+
+        for (int i = 0; i < 300; ++i) {
+            Vec3f const center{ unit(rng) * 10.f, 4.f + unit(rng) * 2.f, unit(rng) * 10.f };
+            for (int j = 0; j < 3; ++j) {
+                ret.indices.push_back(std::uint32_t(ret.positions.size()));
+                ret.positions.push_back(center + Vec3f{ unit(rng), unit(rng), unit(rng) } * 1.5f);
+            }
+        }
+
+        return ret;
+    }
+
+    struct BruteHit_
+    {
+        bool hit = false;
+        std::uint32_t triangle = 0;
+        float t = std::numeric_limits<float>::infinity();
+
+        // Something came within a hair of an edge or of the ends of the ray,
+        // where rounding may go either way
+        bool ambiguous = false;
+    };
+
+    // Möller-Trumbore against every triangle, both sides
+    BruteHit_ brute_raycast_( GridMesh const& aScene, Vec3f aOrigin, Vec3f aDir, float aMaxT )
+    {
+        static constexpr float eps = 1e-4f;
+
+        BruteHit_ ret;
+        for (std::size_t i = 0; i < aScene.indices.size(); i += 3) {
+            Vec3f const v0 = aScene.positions[aScene.indices[i]];
+            Vec3f const e1 = aScene.positions[aScene.indices[i + 1]] - v0;
+            Vec3f const e2 = aScene.positions[aScene.indices[i + 2]] - v0;
+
+            Vec3f const p = cross(aDir, e2);
+            float const det = dot(e1, p);
+            if (std::abs(det) <= 1e-12f)
+                continue;
+
+            Vec3f const s = aOrigin - v0;
+            Vec3f const q = cross(s, e1);
+
+            float const u = dot(s, p) / det;
+            float const v = dot(aDir, q) / det;
+            float const t = dot(e2, q) / det;
+
+            float const inside = std::min({ u, v, 1.f - u - v });
+            if (std::abs(inside) < eps && t > -eps && t < aMaxT + eps)
+                ret.ambiguous = true;
+            if (inside >= 0.f && (std::abs(t) < eps || std::abs(t - aMaxT) < eps))
+                ret.ambiguous = true;
+
+            if (inside >= 0.f && t >= 0.f && t <= aMaxT && t < ret.t) {
+                ret.hit = true;
+                ret.triangle = std::uint32_t(i / 3);
+                ret.t = t;
+            }
+        }
+
+        return ret;
+    }
+
+    struct Ray_
+    {
+        Vec3f origin, dir;
+    };
+
+    std::vector<Ray_> make_rays_( std::size_t aCount, std::uint32_t aSeed )
+    {
+        std::mt19937 rng( aSeed );
+        std::uniform_real_distribution<float> unit( -1.f, 1.f );
+
+        std::vector<Ray_> ret;
+        while (ret.size() < aCount) {
+            Vec3f const origin{ unit(rng) * 12.f, unit(rng) * 6.f + 3.f, unit(rng) * 12.f };
+            Vec3f const dir{ unit(rng), unit(rng), unit(rng) };
+            if (length(dir) < 0.1f)
+                continue;
+
+            // Not normalized on purpose, raycast() doesn't need it
+            ret.push_back({ origin, dir * (0.75f + unit(rng) * 0.25f) });
+        }
+
+        return ret;
+    }
+
+    Vec3f closest_on_segment_( Vec3f aP, Vec3f aA, Vec3f aB )
+    {
+        Vec3f const ab = aB - aA;
+        float const t = std::clamp(dot(aP - aA, ab) / dot(ab, ab), 0.f, 1.f);
+        return aA + t * ab;
+    }
+
+    // Distance from aP to triangle aTriangle: to the plane if aP projects
+    // inside the triangle, otherwise to the nearest of the three edges
+    float triangle_distance_( GridMesh const& aScene, std::size_t aTriangle, Vec3f aP )
+    {
+        Vec3f const a = aScene.positions[aScene.indices[aTriangle * 3 + 0]];
+        Vec3f const b = aScene.positions[aScene.indices[aTriangle * 3 + 1]];
+        Vec3f const c = aScene.positions[aScene.indices[aTriangle * 3 + 2]];
+
+        Vec3f const n = normalize(cross(b - a, c - a));
+        Vec3f const q = aP - dot(aP - a, n) * n;
+
+        bool const inside = dot(cross(b - a, q - a), n) >= 0.f
+            && dot(cross(c - b, q - b), n) >= 0.f
+            && dot(cross(a - c, q - c), n) >= 0.f;
+
+        if (inside)
+            return length(aP - q);
+
+        return std::min({
+            length(aP - closest_on_segment_(aP, a, b)),
+            length(aP - closest_on_segment_(aP, b, c)),
+            length(aP - closest_on_segment_(aP, c, a))
+        });
+    }
+
+    std::vector<Vec3f> make_points_( std::size_t aCount, std::uint32_t aSeed )
+    {
+        std::mt19937 rng( aSeed );
+        std::uniform_real_distribution<float> unit( -1.f, 1.f );
+
+        std::vector<Vec3f> ret;
+        for (std::size_t i = 0; i < aCount; ++i)
+            ret.push_back({ unit(rng) * 12.f, unit(rng) * 4.f + 2.f, unit(rng) * 12.f });
+
+        return ret;
+    }
+}
+
+
+TEST_CASE("Triangle BVH", "[bvh]") {
+
+    static constexpr float tolerance = 1e-3f;
+
+    auto const scene = make_scene_(1);
+    auto const rays = make_rays_(3000, 2);
+
+    // Single threaded and threaded builds must agree with the brute force
+    std::size_t const threads = GENERATE(1, 0);
+    TriangleBvh const bvh( scene.positions, scene.indices.data(), scene.indices.size(), threads );
+
+    SECTION( "Bounds hold every vertex" ) {
+
+        REQUIRE_FALSE(bvh.empty());
+
+        for (auto const& p : scene.positions) {
+            REQUIRE(p.x >= bvh.bounds_min().x);
+            REQUIRE(p.y >= bvh.bounds_min().y);
+            REQUIRE(p.z >= bvh.bounds_min().z);
+            REQUIRE(p.x <= bvh.bounds_max().x);
+            REQUIRE(p.y <= bvh.bounds_max().y);
+            REQUIRE(p.z <= bvh.bounds_max().z);
+        }
+    }
+
+    SECTION( "raycast() finds the same first hit as testing every triangle" ) {
+
+        std::size_t hits = 0, compared = 0;
+        for (auto const& ray : rays) {
+            float const maxT = 40.f;
+            auto const expected = brute_raycast_(scene, ray.origin, ray.dir, maxT);
+            if (expected.ambiguous)
+                continue;
+
+            ++compared;
+
+            RayHit hit{};
+            bool const found = bvh.raycast(ray.origin, ray.dir, maxT, hit);
+            REQUIRE(found == expected.hit);
+
+            if (!found)
+                continue;
+
+            ++hits;
+            REQUIRE_THAT(hit.t, WithinAbs(expected.t, tolerance));
+            REQUIRE(hit.triangle == expected.triangle);
+
+            Vec3f const p = ray.origin + hit.t * ray.dir;
+            REQUIRE_THAT(hit.position.x, WithinAbs(p.x, tolerance));
+            REQUIRE_THAT(hit.position.y, WithinAbs(p.y, tolerance));
+            REQUIRE_THAT(hit.position.z, WithinAbs(p.z, tolerance));
+
+            REQUIRE_THAT(length(hit.normal), WithinAbs(1.f, tolerance));
+            REQUIRE(dot(hit.normal, ray.dir) <= 0.f);
+        }
+
+        // Make sure the rays actually test something either way
+        REQUIRE(compared > rays.size() * 9 / 10);
+        REQUIRE(hits > compared / 4);
+        REQUIRE(hits < compared);
+    }
+
+    SECTION( "raycast() respects the maximum distance" ) {
+
+        for (auto const& ray : rays) {
+            float const maxT = 3.f;
+            auto const expected = brute_raycast_(scene, ray.origin, ray.dir, maxT);
+            if (expected.ambiguous)
+                continue;
+
+            RayHit hit{};
+            REQUIRE(bvh.raycast(ray.origin, ray.dir, maxT, hit) == expected.hit);
+        }
+    }
+
+    SECTION( "occluded4() agrees with testing every triangle" ) {
+
+        for (std::size_t i = 0; i + 4 <= rays.size(); i += 4) {
+            // Packets from one origin (like occlusion rays) and scattered ones
+            bool const shared = (i / 4) % 2 == 0;
+
+            Vec3f origins[4], dirs[4];
+            for (std::size_t j = 0; j < 4; ++j) {
+                origins[j] = shared ? rays[i].origin : rays[i + j].origin;
+                dirs[j] = rays[i + j].dir;
+            }
+
+            float const maxT = 8.f;
+
+            unsigned expected = 0;
+            bool ambiguous = false;
+            for (std::size_t j = 0; j < 4; ++j) {
+                auto const brute = brute_raycast_(scene, origins[j], dirs[j], maxT);
+                ambiguous = ambiguous || brute.ambiguous;
+                if (brute.hit)
+                    expected |= 1u << j;
+            }
+
+            if (ambiguous)
+                continue;
+
+            REQUIRE(bvh.occluded4(origins, dirs, maxT) == expected);
+        }
+    }
+
+    SECTION( "closest_point() finds the same distance as testing every triangle" ) {
+
+        auto const points = make_points_(500, 3);
+        std::size_t const triangleCount = scene.indices.size() / 3;
+
+        std::size_t found = 0;
+        for (auto const& p : points) {
+            float expected = std::numeric_limits<float>::infinity();
+            for (std::size_t t = 0; t < triangleCount; ++t)
+                expected = std::min(expected, triangle_distance_(scene, t, p));
+
+            // Far enough from the limit that rounding can't decide
+            float const maxDistance = 2.f;
+            if (std::abs(expected - maxDistance) < tolerance)
+                continue;
+
+            SurfacePoint surface{};
+            bool const hit = bvh.closest_point(p, maxDistance, surface);
+            REQUIRE(hit == (expected <= maxDistance));
+
+            if (!hit)
+                continue;
+
+            ++found;
+
+            // Ties between neighbouring triangles are common, so only the
+            // distance has to match; the point has to be on the triangle
+            REQUIRE_THAT(surface.distance, WithinAbs(expected, tolerance));
+            REQUIRE_THAT(length(surface.position - p), WithinAbs(surface.distance, tolerance));
+            REQUIRE_THAT(triangle_distance_(scene, surface.triangle, surface.position), WithinAbs(0.f, tolerance));
+        }
+
+        REQUIRE(found > points.size() / 4);
+        REQUIRE(found < points.size());
+    }
+
+    SECTION( "overlap_sphere() finds the same triangles as testing every triangle" ) {
+
+        auto const points = make_points_(300, 4);
+        std::size_t const triangleCount = scene.indices.size() / 3;
+
+        std::size_t total = 0;
+        for (auto const& p : points) {
+            float const radius = 1.5f;
+
+            std::vector<std::uint32_t> result{ 0xdeadbeef };
+            std::size_t const added = bvh.overlap_sphere(p, radius, result);
+
+            // Appended, not replaced
+            REQUIRE(result.size() == added + 1);
+            REQUIRE(result.front() == 0xdeadbeef);
+            result.erase(result.begin());
+
+            std::sort(result.begin(), result.end());
+            REQUIRE(std::adjacent_find(result.begin(), result.end()) == result.end());
+
+            for (std::size_t t = 0; t < triangleCount; ++t) {
+                float const distance = triangle_distance_(scene, t, p);
+                bool const listed = std::binary_search(result.begin(), result.end(), std::uint32_t(t));
+
+                // Triangles that just touch the sphere may go either way
+                if (distance < radius - tolerance)
+                    REQUIRE(listed);
+                else if (distance > radius + tolerance)
+                    REQUIRE_FALSE(listed);
+            }
+
+            total += added;
+        }
+
+        REQUIRE(total > 0);
+    }
+}
+
+TEST_CASE("Triangle BVH corner cases", "[bvh]") {
+
+    SECTION( "An empty BVH hits nothing" ) {
+
+        TriangleBvh const bvh;
+        REQUIRE(bvh.empty());
+
+        RayHit hit{};
+        REQUIRE_FALSE(bvh.raycast({ 0.f, 0.f, 0.f }, { 0.f, 0.f, 1.f }, 10.f, hit));
+
+        Vec3f const origins[4] = {};
+        Vec3f const dirs[4] = { { 1.f, 0.f, 0.f }, { 0.f, 1.f, 0.f }, { 0.f, 0.f, 1.f }, { 1.f, 1.f, 1.f } };
+        REQUIRE(bvh.occluded4(origins, dirs, 10.f) == 0);
+
+        SurfacePoint surface{};
+        REQUIRE_FALSE(bvh.closest_point({ 0.f, 0.f, 0.f }, 10.f, surface));
+
+        std::vector<std::uint32_t> overlaps;
+        REQUIRE(bvh.overlap_sphere({ 0.f, 0.f, 0.f }, 10.f, overlaps) == 0);
+        REQUIRE(overlaps.empty());
+    }
+
+    SECTION( "A single triangle is hit from both sides" ) {
+
+        std::vector<Vec3f> const positions{ { -1.f, 0.f, -1.f }, { 1.f, 0.f, -1.f }, { 0.f, 0.f, 1.f } };
+        std::uint32_t const indices[] = { 0, 1, 2 };
+
+        TriangleBvh const bvh( positions, indices, 3, 1 );
+
+        RayHit hit{};
+        REQUIRE(bvh.raycast({ 0.f, 2.f, 0.f }, { 0.f, -1.f, 0.f }, 10.f, hit));
+        REQUIRE(hit.triangle == 0);
+        REQUIRE_THAT(hit.t, WithinAbs(2.f, 1e-5f));
+        REQUIRE_THAT(hit.normal.y, WithinAbs(1.f, 1e-5f));
+
+        REQUIRE(bvh.raycast({ 0.f, -2.f, 0.f }, { 0.f, 2.f, 0.f }, 10.f, hit));
+        REQUIRE_THAT(hit.t, WithinAbs(1.f, 1e-5f));
+        REQUIRE_THAT(hit.normal.y, WithinAbs(-1.f, 1e-5f));
+
+        // Too short, and past the edge
+        REQUIRE_FALSE(bvh.raycast({ 0.f, 2.f, 0.f }, { 0.f, -1.f, 0.f }, 1.5f, hit));
+        REQUIRE_FALSE(bvh.raycast({ 2.f, 2.f, 0.f }, { 0.f, -1.f, 0.f }, 10.f, hit));
+    }
+
+    SECTION( "Closest points and overlaps of a single triangle" ) {
+
+        std::vector<Vec3f> const positions{ { -1.f, 0.f, -1.f }, { 1.f, 0.f, -1.f }, { 0.f, 0.f, 1.f } };
+        std::uint32_t const indices[] = { 0, 1, 2 };
+
+        TriangleBvh const bvh( positions, indices, 3, 1 );
+
+        // Above the inside, and past a corner
+        SurfacePoint surface{};
+        REQUIRE(bvh.closest_point({ 0.f, 2.f, 0.f }, 10.f, surface));
+        REQUIRE_THAT(surface.distance, WithinAbs(2.f, 1e-5f));
+        REQUIRE_THAT(surface.position.y, WithinAbs(0.f, 1e-5f));
+
+        REQUIRE(bvh.closest_point({ 3.f, 0.f, -1.f }, 10.f, surface));
+        REQUIRE_THAT(surface.distance, WithinAbs(2.f, 1e-5f));
+        REQUIRE_THAT(surface.position.x, WithinAbs(1.f, 1e-5f));
+        REQUIRE_THAT(surface.position.z, WithinAbs(-1.f, 1e-5f));
+
+        REQUIRE_FALSE(bvh.closest_point({ 0.f, 2.f, 0.f }, 1.9f, surface));
+
+        std::vector<std::uint32_t> overlaps;
+        REQUIRE(bvh.overlap_sphere({ 0.f, 2.f, 0.f }, 1.9f, overlaps) == 0);
+        REQUIRE(bvh.overlap_sphere({ 0.f, 2.f, 0.f }, 2.1f, overlaps) == 1);
+        REQUIRE(overlaps == std::vector<std::uint32_t>{ 0 });
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef GRID_FIXTURE_HPP_5E0B8D27_A941_4C63_8F1A_3D72C6B09E54
+#define GRID_FIXTURE_HPP_5E0B8D27_A941_4C63_8F1A_3D72C6B09E54
+
+#include <random>
+#include <vector>
+
+#include <cstdint>
+
+#include "../vmlib/vec3.hpp"
+
+// Test meshes shared by the main-test suites: a regular grid over
+// [-kGridExtent, kGridExtent]^2 in the xz plane, with aCells cells per side
+// and two triangles per cell, wound counter-clockwise seen from above.
+//
+// Vertex (x, z) is at index z * (aCells + 1) + x. Its height is aShape(x, z)
+// plus noise in [-aBump, aBump], drawn from an mt19937 seeded with aSeed, so
+// the same arguments always give the same mesh.
+
+constexpr float kGridExtent = 10.f;
+
+struct GridMesh
+{
+    std::vector<Vec3f> positions;
+    std::vector<std::uint32_t> indices;
+};
+
+template< typename tShape >
+GridMesh make_grid( std::uint32_t aCells, float aBump, std::uint32_t aSeed, tShape&& aShape )
+{
+    std::mt19937 rng( aSeed );
+    std::uniform_real_distribution<float> unit( -1.f, 1.f );
+
+    GridMesh ret;
+
+    std::uint32_t const n = aCells;
+    for (std::uint32_t z = 0; z <= n; ++z) {
+        for (std::uint32_t x = 0; x <= n; ++x) {
+            float const fx = (float(x) / float(n) * 2.f - 1.f) * kGridExtent;
+            float const fz = (float(z) / float(n) * 2.f - 1.f) * kGridExtent;
+            ret.positions.push_back({ fx, aShape(fx, fz) + aBump * unit(rng), fz });
+        }
+    }
+
+    for (std::uint32_t z = 0; z < n; ++z) {
+        for (std::uint32_t x = 0; x < n; ++x) {
+            std::uint32_t const i = z * (n + 1) + x;
+            ret.indices.insert(ret.indices.end(), { i, i + n + 1, i + 1 });
+            ret.indices.insert(ret.indices.end(), { i + 1, i + n + 1, i + n + 2 });
+        }
+    }
+
+    return ret;
+}
+
+// Flat, apart from the noise
+inline GridMesh make_grid( std::uint32_t aCells, float aBump, std::uint32_t aSeed )
+{
+    return make_grid(aCells, aBump, aSeed, [] (float, float) { return 0.f; });
+}
+
+#endif // GRID_FIXTURE_HPP_5E0B8D27_A941_4C63_8F1A_3D72C6B09E54
@@ -0,0 +1,218 @@
+#include <catch2/catch_amalgamated.hpp>
+
+#include "../main/heightfield.hpp"
+
+#include "grid-fixture.hpp"
+
+#include <limits>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include <cmath>
+
+using namespace Catch::Matchers;
+
+namespace
+{
+    // Rolling hills. make_heightfield() with aCells + 1 samples puts a
+    // sample on each vertex.
+    GridMesh make_terrain_( std::uint32_t aCells, std::uint32_t aSeed )
+    {
+        return make_grid(aCells, 0.3f, aSeed, [] (float x, float z) {
+            return 2.f * std::sin(0.5f * x) * std::cos(0.4f * z);
+        });
+    }
+
+    struct BruteHit_
+    {
+        bool hit = false;
+        float t = 0.f;
+
+        // The ray skims the surface somewhere before its hit, where a tiny
+        // difference decides between hit and miss
+        bool ambiguous = false;
+    };
+
+    // Walks the ray in small steps over the part of it above the grid, and
+    // bisects the first step that ends up at or below height_at()
+    BruteHit_ brute_raycast_( Heightfield const& aField, Vec3f aOrigin, Vec3f aDir, float aMaxT )
+    {
+        static constexpr std::size_t steps = 20000;
+        static constexpr float skim = 1e-2f;
+
+        BruteHit_ ret;
+
+        float const lo[2] = { aField.originX, aField.originZ };
+        float const hi[2] = {
+            aField.originX + float(aField.width - 1) * aField.spacingX,
+            aField.originZ + float(aField.depth - 1) * aField.spacingZ
+        };
+        float const o[2] = { aOrigin.x, aOrigin.z };
+        float const d[2] = { aDir.x, aDir.z };
+
+        float t0 = 0.f, t1 = aMaxT;
+        for (int k = 0; k < 2; ++k) {
+            if (0.f == d[k]) {
+                if (o[k] < lo[k] || o[k] > hi[k])
+                    return ret;
+                continue;
+            }
+
+            float a = (lo[k] - o[k]) / d[k], b = (hi[k] - o[k]) / d[k];
+            if (a > b)
+                std::swap(a, b);
+
+            t0 = std::max(t0, a);
+            t1 = std::min(t1, b);
+        }
+
+        if (t0 > t1)
+            return ret;
+
+        auto const f = [&] (float t) {
+            Vec3f const p = aOrigin + t * aDir;
+            return p.y - height_at(aField, p.x, p.z);
+        };
+
+        if (f(t0) <= 0.f) {
+            ret.hit = true;
+            ret.t = t0;
+            return ret;
+        }
+
+        float prev = t0;
+        float fPrev = f(t0), fPrevPrev = std::numeric_limits<float>::max();
+        for (std::size_t s = 1; s <= steps; ++s) {
+            float const t = t0 + (t1 - t0) * float(s) / float(steps);
+            float const ft = f(t);
+
+            if (ft <= 0.f) {
+                float a = prev, b = t;
+                for (int i = 0; i < 40; ++i) {
+                    float const m = 0.5f * (a + b);
+                    (f(m) <= 0.f ? b : a) = m;
+                }
+
+                ret.hit = true;
+                ret.t = b;
+                return ret;
+            }
+
+            // Came close, and is moving away again
+            if (fPrev < skim && fPrev <= fPrevPrev && fPrev <= ft)
+                ret.ambiguous = true;
+
+            prev = t;
+            fPrevPrev = fPrev;
+            fPrev = ft;
+        }
+
+        return ret;
+    }
+}
+
+
+TEST_CASE("Heightfield", "[heightfield]") {
+
+    auto const terrain = make_terrain_(32, 3);
+    auto const field = make_heightfield(terrain.positions, terrain.indices.data(), terrain.indices.size(), 33);
+
+    SECTION( "Samples land on the vertices of a matching grid" ) {
+
+        REQUIRE(field.width == 33);
+        REQUIRE(field.depth == 33);
+
+        for (auto const& p : terrain.positions)
+            REQUIRE_THAT(height_at(field, p.x, p.z), WithinAbs(p.y, 1e-4f));
+    }
+
+    SECTION( "Outside of the grid the edge continues" ) {
+
+        REQUIRE_THAT(height_at(field, -50.f, -50.f), WithinAbs(height_at(field, -10.f, -10.f), 1e-6f));
+        REQUIRE_THAT(height_at(field, 50.f, 3.f), WithinAbs(height_at(field, 10.f, 3.f), 1e-6f));
+    }
+
+    SECTION( "Every pyramid level bounds the heights below it" ) {
+
+        REQUIRE(field.levels.size() > 1);
+        REQUIRE(field.levels.front().width == field.width - 1);
+        REQUIRE(field.levels.front().depth == field.depth - 1);
+        REQUIRE(field.levels.back().width == 1);
+        REQUIRE(field.levels.back().depth == 1);
+
+        auto const [lowest, highest] = std::minmax_element(field.heights.begin(), field.heights.end());
+        REQUIRE(field.levels.back().minHeights[0] == *lowest);
+        REQUIRE(field.levels.back().maxHeights[0] == *highest);
+
+        for (std::size_t l = 1; l < field.levels.size(); ++l) {
+            auto const& level = field.levels[l];
+            auto const& below = field.levels[l - 1];
+
+            for (std::size_t j = 0; j < below.depth; ++j) {
+                for (std::size_t i = 0; i < below.width; ++i) {
+                    std::size_t const b = (j / 2) * level.width + i / 2;
+                    REQUIRE(level.minHeights[b] <= below.minHeights[j * below.width + i]);
+                    REQUIRE(level.maxHeights[b] >= below.maxHeights[j * below.width + i]);
+                }
+            }
+        }
+    }
+
+    SECTION( "raycast_heightfield() finds the same first hit as marching the ray" ) {
+
+        std::mt19937 rng( 4 );
+        std::uniform_real_distribution<float> unit( -1.f, 1.f );
+
+        std::size_t hits = 0, compared = 0;
+        for (int r = 0; r < 1500; ++r) {
+            Vec3f const origin{ unit(rng) * 14.f, 4.f + unit(rng) * 2.f, unit(rng) * 14.f };
+
+            // Steep and shallow rays both, mostly going down
+            Vec3f const dir{ unit(rng), -0.5f + unit(rng) * 0.6f, unit(rng) };
+            float const maxT = 40.f;
+
+            auto const expected = brute_raycast_(field, origin, dir, maxT);
+            if (expected.ambiguous)
+                continue;
+
+            ++compared;
+
+            float t = -1.f;
+            bool const found = raycast_heightfield(field, origin, dir, maxT, t);
+            REQUIRE(found == expected.hit);
+
+            if (found) {
+                ++hits;
+                REQUIRE_THAT(t, WithinAbs(expected.t, 2e-3f));
+            }
+        }
+
+        REQUIRE(compared > 1000);
+        REQUIRE(hits > compared / 4);
+        REQUIRE(hits < compared);
+    }
+
+    SECTION( "Rays that start below the ground hit right away" ) {
+
+        float t = -1.f;
+        REQUIRE(raycast_heightfield(field, { 1.f, -5.f, 1.f }, { 0.f, 1.f, 0.f }, 10.f, t));
+        REQUIRE(t == 0.f);
+    }
+
+    SECTION( "Only the area covered by the grid counts" ) {
+
+        float t = -1.f;
+        REQUIRE_FALSE(raycast_heightfield(field, { 20.f, 5.f, 0.f }, { 0.f, -1.f, 0.f }, 100.f, t));
+        REQUIRE_FALSE(raycast_heightfield(field, { 0.f, 5.f, 20.f }, { 0.f, -1.f, 1.f }, 100.f, t));
+    }
+
+    SECTION( "An empty heightfield hits nothing" ) {
+
+        Heightfield const empty;
+
+        float t = -1.f;
+        REQUIRE_FALSE(raycast_heightfield(empty, { 0.f, 5.f, 0.f }, { 0.f, -1.f, 0.f }, 100.f, t));
+        REQUIRE(make_heightfield({}, nullptr, 0, 16).levels.empty());
+    }
+}
@@ -0,0 +1,264 @@
+#include <catch2/catch_amalgamated.hpp>
+
+#include "../main/mesh_lod.hpp"
+
+#include "grid-fixture.hpp"
+
+#include <limits>
+#include <vector>
+#include <algorithm>
+
+#include <cmath>
+
+using namespace Catch::Matchers;
+
+namespace
+{
+    SimpleMeshData make_mesh_( std::uint32_t aCells, float aBump, std::uint32_t aSeed )
+    {
+        auto grid = make_grid(aCells, aBump, aSeed);
+
+        SimpleMeshData ret;
+        ret.positions = std::move(grid.positions);
+        ret.indices = std::move(grid.indices);
+        return ret;
+    }
+
+    Vec3f face_normal_( SimpleMeshData const& aMesh, std::vector<std::uint32_t> const& aIndices, std::size_t aFirst )
+    {
+        Vec3f const& a = aMesh.positions[aIndices[aFirst + 0]];
+        Vec3f const& b = aMesh.positions[aIndices[aFirst + 1]];
+        Vec3f const& c = aMesh.positions[aIndices[aFirst + 2]];
+        return cross(b - a, c - a);
+    }
+
+    float area_( SimpleMeshData const& aMesh, std::vector<std::uint32_t> const& aIndices )
+    {
+        float ret = 0.f;
+        for (std::size_t i = 0; i < aIndices.size(); i += 3)
+            ret += 0.5f * length(face_normal_(aMesh, aIndices, i));
+        return ret;
+    }
+
+    // Valid indices, and no triangle that collapsed into a line or a point
+    void require_valid_( SimpleMeshData const& aMesh, std::vector<std::uint32_t> const& aIndices )
+    {
+        REQUIRE(aIndices.size() % 3 == 0);
+
+        for (std::size_t i = 0; i < aIndices.size(); i += 3) {
+            std::uint32_t const a = aIndices[i], b = aIndices[i + 1], c = aIndices[i + 2];
+            REQUIRE(a < aMesh.positions.size());
+            REQUIRE(b < aMesh.positions.size());
+            REQUIRE(c < aMesh.positions.size());
+            REQUIRE(a != b);
+            REQUIRE(b != c);
+            REQUIRE(a != c);
+        }
+    }
+
+    bool referenced_( std::vector<std::uint32_t> const& aIndices, std::uint32_t aVertex )
+    {
+        return std::find(aIndices.begin(), aIndices.end(), aVertex) != aIndices.end();
+    }
+}
+
+
+TEST_CASE("Vertex welding", "[mesh_lod]") {
+
+    auto const grid = make_mesh_(8, 0.5f, 1);
+
+    // The same grid as a triangle soup, one vertex per corner
+    SimpleMeshData soup;
+    for (auto const idx : grid.indices)
+        soup.positions.push_back(grid.positions[idx]);
+
+    SECTION( "Vertices with the same attributes are merged" ) {
+
+        auto const welded = weld_vertices(soup);
+
+        REQUIRE(welded.positions.size() == grid.positions.size());
+        REQUIRE(welded.indices.size() == soup.positions.size());
+
+        for (std::size_t i = 0; i < welded.indices.size(); ++i) {
+            Vec3f const& p = welded.positions[welded.indices[i]];
+            REQUIRE(p.x == soup.positions[i].x);
+            REQUIRE(p.y == soup.positions[i].y);
+            REQUIRE(p.z == soup.positions[i].z);
+        }
+    }
+
+    SECTION( "Vertices with different attributes are kept apart" ) {
+
+        // Triangles on the left get other texture coordinates than those on
+        // the right, so the column in the middle is split in two
+        for (std::size_t i = 0; i < soup.positions.size(); i += 3) {
+            float const centerX = soup.positions[i].x + soup.positions[i + 1].x + soup.positions[i + 2].x;
+            for (std::size_t k = 0; k < 3; ++k)
+                soup.texcoords.push_back({ centerX < 0.f ? 0.f : 1.f, 0.f });
+        }
+
+        auto const welded = weld_vertices(soup);
+
+        REQUIRE(welded.positions.size() == grid.positions.size() + 9);
+        REQUIRE(welded.texcoords.size() == welded.positions.size());
+
+        for (std::size_t i = 0; i < welded.indices.size(); ++i)
+            REQUIRE(welded.texcoords[welded.indices[i]].x == soup.texcoords[i].x);
+    }
+}
+
+TEST_CASE("QEM simplification", "[mesh_lod]") {
+
+    SECTION( "A flat grid keeps its outline and its area" ) {
+
+        auto const grid = make_mesh_(16, 0.f, 2);
+
+        float error = -1.f;
+        auto const result = simplify(grid, grid.indices, grid.indices.size() / 4, 1e-3f, &error);
+
+        require_valid_(grid, result);
+        REQUIRE(result.size() < grid.indices.size() / 2);
+        REQUIRE(error >= 0.f);
+        REQUIRE(error <= 1e-3f);
+
+        REQUIRE_THAT(area_(grid, result), WithinAbs(400.f, 1e-2f));
+        for (std::size_t i = 0; i < result.size(); i += 3)
+            REQUIRE(face_normal_(grid, result, i).y > 0.f);
+
+        // The corners can't go anywhere without changing the outline
+        for (std::uint32_t corner : { 0u, 16u, 17u * 16u, 17u * 17u - 1u })
+            REQUIRE(referenced_(result, corner));
+    }
+
+    SECTION( "The target and the error bound are respected" ) {
+
+        auto const grid = make_mesh_(16, 0.3f, 3);
+        std::size_t const target = grid.indices.size() / 8;
+
+        float error = -1.f;
+        auto const coarse = simplify(grid, grid.indices, target, std::numeric_limits<float>::max(), &error);
+
+        require_valid_(grid, coarse);
+        REQUIRE(coarse.size() <= target);
+        REQUIRE(error > 0.f);
+
+        // A fraction of the error of the unbounded run stops early
+        float boundedError = -1.f;
+        auto const bounded = simplify(grid, grid.indices, target, 0.1f * error, &boundedError);
+
+        require_valid_(grid, bounded);
+        REQUIRE(bounded.size() > coarse.size());
+        REQUIRE(boundedError <= 0.1f * error);
+
+        // No error allowed, no change on a mesh without flat parts
+        auto const untouched = simplify(grid, grid.indices, target, 0.f);
+        REQUIRE(untouched == grid.indices);
+    }
+
+    SECTION( "Locked borders don't move" ) {
+
+        auto const grid = make_mesh_(16, 0.3f, 4);
+
+        auto const result = simplify(grid, grid.indices, grid.indices.size() / 4, std::numeric_limits<float>::max(), nullptr, true);
+
+        require_valid_(grid, result);
+        REQUIRE(result.size() < grid.indices.size());
+
+        for (std::uint32_t i = 0; i <= 16; ++i) {
+            REQUIRE(referenced_(result, i));
+            REQUIRE(referenced_(result, 16 * 17 + i));
+            REQUIRE(referenced_(result, i * 17));
+            REQUIRE(referenced_(result, i * 17 + 16));
+        }
+    }
+
+    SECTION( "Vertices on an attribute seam don't move" ) {
+
+        // Split the grid along x = 0, with a copy of the middle column for
+        // the right half
+        auto grid = make_mesh_(16, 0.f, 5);
+        std::uint32_t const original = std::uint32_t(grid.positions.size());
+
+        std::vector<std::uint32_t> copies( original, 0 );
+        for (std::uint32_t z = 0; z <= 16; ++z) {
+            std::uint32_t const v = z * 17 + 8;
+            copies[v] = std::uint32_t(grid.positions.size());
+            grid.positions.push_back(grid.positions[v]);
+        }
+
+        for (std::size_t i = 0; i < grid.indices.size(); i += 3) {
+            Vec3f const center = (grid.positions[grid.indices[i]] + grid.positions[grid.indices[i + 1]] + grid.positions[grid.indices[i + 2]]) / 3.f;
+            if (center.x < 0.f)
+                continue;
+
+            for (std::size_t k = 0; k < 3; ++k) {
+                std::uint32_t& idx = grid.indices[i + k];
+                if (idx < original && idx % 17 == 8)
+                    idx = copies[idx];
+            }
+        }
+
+        auto const result = simplify(grid, grid.indices, grid.indices.size() / 4, 1e-3f);
+
+        require_valid_(grid, result);
+        REQUIRE(result.size() < grid.indices.size() / 2);
+
+        for (std::uint32_t z = 0; z <= 16; ++z) {
+            REQUIRE(referenced_(result, z * 17 + 8));
+            REQUIRE(referenced_(result, copies[z * 17 + 8]));
+        }
+    }
+}
+
+TEST_CASE("LOD chains", "[mesh_lod]") {
+
+    auto mesh = make_mesh_(32, 0.2f, 6);
+    std::size_t const fullCount = mesh.indices.size();
+
+    auto const chain = make_lod_chain(mesh, kMaxLodLevels, 0.5f);
+
+    SECTION( "Levels get coarser, and their errors only grow" ) {
+
+        REQUIRE(chain.levels.size() > 2);
+        REQUIRE(chain.levels.size() <= kMaxLodLevels);
+
+        REQUIRE(chain.levels[0].firstIndex == 0);
+        REQUIRE(std::size_t(chain.levels[0].indexCount) == fullCount);
+        REQUIRE(chain.levels[0].error == 0.f);
+
+        std::size_t total = 0;
+        for (std::size_t i = 0; i < chain.levels.size(); ++i) {
+            auto const& level = chain.levels[i];
+            REQUIRE(level.firstIndex == total);
+            total += std::size_t(level.indexCount);
+
+            if (i > 0) {
+                REQUIRE(level.indexCount < chain.levels[i - 1].indexCount);
+                REQUIRE(level.error >= chain.levels[i - 1].error);
+            }
+
+            std::vector<std::uint32_t> const indices(
+                mesh.indices.begin() + level.firstIndex,
+                mesh.indices.begin() + level.firstIndex + level.indexCount
+            );
+            require_valid_(mesh, indices);
+        }
+
+        REQUIRE(mesh.indices.size() == total);
+    }
+
+    SECTION( "Bounds hold the full resolution mesh" ) {
+
+        for (auto const& p : mesh.positions) {
+            REQUIRE(p.x >= chain.boundsMin.x);
+            REQUIRE(p.y >= chain.boundsMin.y);
+            REQUIRE(p.z >= chain.boundsMin.z);
+            REQUIRE(p.x <= chain.boundsMax.x);
+            REQUIRE(p.y <= chain.boundsMax.y);
+            REQUIRE(p.z <= chain.boundsMax.z);
+        }
+
+        REQUIRE_THAT(chain.boundsMin.x, WithinAbs(-10.f, 1e-5f));
+        REQUIRE_THAT(chain.boundsMax.z, WithinAbs(10.f, 1e-5f));
+    }
+}
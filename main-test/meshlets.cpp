@@ -0,0 +1,248 @@
+#include <catch2/catch_amalgamated.hpp>
+
+#include "../main/meshlets.hpp"
+
+#include "../vmlib/mat44.hpp"
+
+#include "grid-fixture.hpp"
+
+#include <array>
+#include <random>
+#include <vector>
+#include <numbers>
+#include <algorithm>
+
+using namespace Catch::Matchers;
+
+namespace
+{
+    // The index buffer starts with a few triangles that aren't part of the
+    // grid, so the meshlets' range doesn't start at 0
+    struct Grid_
+    {
+        std::vector<Vec3f> positions;
+        std::vector<std::uint32_t> indices;
+
+        GLuint first;
+        GLsizei count;
+    };
+
+    Grid_ make_grid_( std::uint32_t aCells, float aBump, std::uint32_t aSeed )
+    {
+        auto grid = make_grid(aCells, aBump, aSeed);
+
+        Grid_ ret;
+        ret.positions = std::move(grid.positions);
+
+        ret.indices = { 0, 1, 2, 2, 1, 0 };
+        ret.first = GLuint(ret.indices.size());
+        ret.count = GLsizei(grid.indices.size());
+
+        ret.indices.insert(ret.indices.end(), grid.indices.begin(), grid.indices.end());
+        return ret;
+    }
+
+    using Triangle_ = std::array<std::uint32_t, 3>;
+
+    // Rotated so that the smallest index comes first, which keeps the winding
+    std::vector<Triangle_> triangles_( std::vector<std::uint32_t> const& aIndices, std::size_t aFirst, std::size_t aCount )
+    {
+        std::vector<Triangle_> ret;
+        for (std::size_t i = aFirst; i < aFirst + aCount; i += 3) {
+            Triangle_ t{ aIndices[i], aIndices[i + 1], aIndices[i + 2] };
+            std::rotate(t.begin(), std::min_element(t.begin(), t.end()), t.end());
+            ret.push_back(t);
+        }
+
+        std::sort(ret.begin(), ret.end());
+        return ret;
+    }
+
+    Frustum make_view_( Vec3f aPos, Vec3f aTarget, Vec3f aUp )
+    {
+        Mat44f const proj = make_perspective_projection(60.f * std::numbers::pi_v<float> / 180.f, 1.f, 0.1f, 100.f);
+        return make_frustum(proj * look_at(aPos, aTarget, aUp));
+    }
+}
+
+
+TEST_CASE("Meshlet building", "[meshlets]") {
+
+    auto grid = make_grid_(40, 0.3f, 1);
+    auto const original = grid.indices;
+
+    MeshletSet set;
+    auto const range = build_meshlets(grid.positions, grid.indices, grid.first, grid.count, set);
+
+    SECTION( "Meshlets cover the range back to back" ) {
+
+        REQUIRE(range.first == 0);
+        REQUIRE(range.count == set.size());
+        REQUIRE(set.size() > 1);
+
+        GLuint next = grid.first;
+        for (std::size_t i = 0; i < set.size(); ++i) {
+            REQUIRE(set.firstIndex[i] == next);
+            REQUIRE(set.indexCount[i] % 3 == 0);
+            next += GLuint(set.indexCount[i]);
+        }
+
+        REQUIRE(next == grid.first + GLuint(grid.count));
+    }
+
+    SECTION( "The triangles are the same, and nothing outside of the range moved" ) {
+
+        REQUIRE(grid.indices.size() == original.size());
+        REQUIRE(std::equal(original.begin(), original.begin() + grid.first, grid.indices.begin()));
+
+        REQUIRE(triangles_(grid.indices, grid.first, std::size_t(grid.count)) == triangles_(original, grid.first, std::size_t(grid.count)));
+    }
+
+    SECTION( "Meshlets stay within the limits" ) {
+
+        for (std::size_t i = 0; i < set.size(); ++i) {
+            REQUIRE(std::size_t(set.indexCount[i]) <= kMeshletMaxTriangles * 3);
+
+            std::vector<std::uint32_t> vertices(
+                grid.indices.begin() + set.firstIndex[i],
+                grid.indices.begin() + set.firstIndex[i] + set.indexCount[i]
+            );
+            std::sort(vertices.begin(), vertices.end());
+            vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+
+            REQUIRE(vertices.size() <= kMeshletMaxVertices);
+        }
+    }
+
+    SECTION( "Bounding spheres hold every vertex" ) {
+
+        for (std::size_t i = 0; i < set.size(); ++i) {
+            Vec3f const center{ set.centerX[i], set.centerY[i], set.centerZ[i] };
+
+            for (GLsizei j = 0; j < set.indexCount[i]; ++j) {
+                Vec3f const& p = grid.positions[grid.indices[set.firstIndex[i] + j]];
+                REQUIRE(length(p - center) <= set.radius[i] + 1e-5f);
+            }
+        }
+    }
+
+    SECTION( "Back-facing meshlets only hold back-facing triangles" ) {
+
+        std::mt19937 rng( 2 );
+        std::uniform_real_distribution<float> unit( -1.f, 1.f );
+
+        std::size_t backfacing = 0;
+        for (int c = 0; c < 200; ++c) {
+            Vec3f const camera{ unit(rng) * 30.f, unit(rng) * 30.f, unit(rng) * 30.f };
+
+            for (std::size_t i = 0; i < set.size(); ++i) {
+                Vec3f const center{ set.centerX[i], set.centerY[i], set.centerZ[i] };
+                Vec3f const axis{ set.axisX[i], set.axisY[i], set.axisZ[i] };
+                Vec3f const v = center - camera;
+
+                if (dot(v, axis) < set.cutoff[i] * length(v) + set.radius[i])
+                    continue;
+
+                ++backfacing;
+
+                for (GLsizei j = 0; j < set.indexCount[i]; j += 3) {
+                    std::size_t const t = set.firstIndex[i] + std::size_t(j);
+                    Vec3f const& a = grid.positions[grid.indices[t]];
+                    Vec3f const n = cross(grid.positions[grid.indices[t + 1]] - a, grid.positions[grid.indices[t + 2]] - a);
+                    REQUIRE(dot(n, a - camera) >= 0.f);
+                }
+            }
+        }
+
+        REQUIRE(backfacing > 0);
+    }
+}
+
+TEST_CASE("Meshlet culling", "[meshlets]") {
+
+    auto grid = make_grid_(40, 0.f, 3);
+
+    MeshletSet set;
+    auto const range = build_meshlets(grid.positions, grid.indices, grid.first, grid.count, set);
+
+    Vec3f const above{ 0.f, 30.f, 0.f };
+    Vec3f const below{ 0.f, -30.f, 0.f };
+    Vec3f const north{ 0.f, 0.f, -1.f };
+
+    Frustum const fromAbove = make_view_(above, { 0.f, 0.f, 0.f }, north);
+    Frustum const fromBelow = make_view_(below, { 0.f, 0.f, 0.f }, north);
+    Frustum const awayFromAbove = make_view_(above, { 0.f, 60.f, 0.f }, north);
+
+    SECTION( "Everything in view and facing the camera is one draw" ) {
+
+        MultiDrawList draws;
+        MeshletCullStats stats;
+        cull_meshlets(set, range, fromAbove, above, draws, &stats);
+
+        REQUIRE(stats.visible == set.size());
+        REQUIRE(stats.frustumCulled == 0);
+        REQUIRE(stats.backfaceCulled == 0);
+
+        REQUIRE(draws.size() == 1);
+        REQUIRE(draws.counts[0] == grid.count);
+        REQUIRE(draws.offsets[0] == reinterpret_cast<void const*>(std::uintptr_t(grid.first) * sizeof(std::uint32_t)));
+    }
+
+    SECTION( "The back of a flat grid is culled" ) {
+
+        MultiDrawList draws;
+        MeshletCullStats stats;
+        cull_meshlets(set, range, fromBelow, below, draws, &stats);
+
+        REQUIRE(stats.visible == 0);
+        REQUIRE(stats.backfaceCulled == set.size());
+        REQUIRE(draws.size() == 0);
+    }
+
+    SECTION( "Nothing behind the camera is drawn" ) {
+
+        MultiDrawList draws;
+        MeshletCullStats stats;
+        cull_meshlets(set, range, awayFromAbove, above, draws, &stats);
+
+        REQUIRE(stats.visible == 0);
+        REQUIRE(stats.frustumCulled == set.size());
+        REQUIRE(draws.size() == 0);
+    }
+
+    SECTION( "With several views, meshlets that any one view sees are kept" ) {
+
+        Frustum const frusta[] = { awayFromAbove, fromBelow, fromAbove };
+        Vec3f const cameras[] = { above, below, above };
+
+        MultiDrawList draws;
+        MeshletCullStats stats;
+        cull_meshlets(set, range, frusta, cameras, 2, draws, &stats);
+        REQUIRE(stats.visible == 0);
+
+        draws.clear();
+        stats = MeshletCullStats{};
+        cull_meshlets(set, range, frusta, cameras, 3, draws, &stats);
+        REQUIRE(stats.visible == set.size());
+        REQUIRE(draws.size() == 1);
+    }
+
+    SECTION( "Only part of the grid in view" ) {
+
+        // Looking down at one corner from close by
+        Vec3f const camera{ -8.f, 4.f, -8.f };
+
+        MultiDrawList draws;
+        MeshletCullStats stats;
+        cull_meshlets(set, range, make_view_(camera, { -8.f, 0.f, -8.f }, north), camera, draws, &stats);
+
+        REQUIRE(stats.visible > 0);
+        REQUIRE(stats.frustumCulled > 0);
+        REQUIRE(stats.visible + stats.frustumCulled + stats.backfaceCulled == set.size());
+
+        GLsizei total = 0;
+        for (auto const count : draws.counts)
+            total += count;
+        REQUIRE(total < grid.count);
+    }
+}
@@ -0,0 +1,165 @@
+#include <catch2/catch_amalgamated.hpp>
+
+#include "../main/range_allocator.hpp"
+
+#include <random>
+#include <vector>
+
+using namespace Catch::Matchers;
+
+
+TEST_CASE("Range allocator", "[range_allocator]") {
+
+    SECTION( "Allocations split the front off the free range" ) {
+
+        RangeAllocator alloc( 100 );
+
+        std::size_t a = 0, b = 0, c = 0;
+        REQUIRE(alloc.allocate(10, a));
+        REQUIRE(alloc.allocate(20, b));
+        REQUIRE(alloc.allocate(30, c));
+
+        REQUIRE(a == 0);
+        REQUIRE(b == 10);
+        REQUIRE(c == 30);
+
+        auto const stats = alloc.stats();
+        REQUIRE(stats.used == 60);
+        REQUIRE(stats.allocations == 3);
+        REQUIRE(stats.freeRanges == 1);
+        REQUIRE(stats.largestFree == 40);
+        REQUIRE_THAT(stats.fragmentation(), WithinAbs(0.f, 1e-6f));
+        REQUIRE_THAT(stats.occupancy(), WithinAbs(0.6f, 1e-6f));
+    }
+
+    SECTION( "Failed allocations leave the offset alone" ) {
+
+        RangeAllocator alloc( 16 );
+
+        std::size_t offset = 1234;
+        REQUIRE_FALSE(alloc.allocate(17, offset));
+        REQUIRE_FALSE(alloc.allocate(0, offset));
+        REQUIRE(offset == 1234);
+
+        REQUIRE(alloc.allocate(16, offset));
+        REQUIRE(offset == 0);
+
+        offset = 1234;
+        REQUIRE_FALSE(alloc.allocate(1, offset));
+        REQUIRE(offset == 1234);
+        REQUIRE(alloc.stats().freeRanges == 0);
+    }
+
+    SECTION( "Best fit picks the smallest free range that is large enough" ) {
+
+        RangeAllocator alloc( 60 );
+
+        std::size_t r[6];
+        for (auto& offset : r)
+            REQUIRE(alloc.allocate(10, offset));
+
+        // Free: 20 at 0 and 10 at 30
+        alloc.free(r[0], 10);
+        alloc.free(r[1], 10);
+        alloc.free(r[3], 10);
+        REQUIRE(alloc.stats().freeRanges == 2);
+
+        // First fit would take the front of the 20
+        std::size_t offset = 0;
+        REQUIRE(alloc.allocate(10, offset));
+        REQUIRE(offset == 30);
+
+        REQUIRE(alloc.allocate(15, offset));
+        REQUIRE(offset == 0);
+
+        REQUIRE(alloc.allocate(5, offset));
+        REQUIRE(offset == 15);
+
+        REQUIRE(alloc.stats().used == 60);
+        REQUIRE(alloc.stats().freeRanges == 0);
+    }
+
+    SECTION( "Freed ranges coalesce with both neighbours" ) {
+
+        RangeAllocator alloc( 30 );
+
+        std::size_t a = 0, b = 0, c = 0;
+        REQUIRE(alloc.allocate(10, a));
+        REQUIRE(alloc.allocate(10, b));
+        REQUIRE(alloc.allocate(10, c));
+
+        alloc.free(a, 10);
+        alloc.free(c, 10);
+
+        auto stats = alloc.stats();
+        REQUIRE(stats.freeRanges == 2);
+        REQUIRE(stats.largestFree == 10);
+        REQUIRE_THAT(stats.fragmentation(), WithinAbs(0.5f, 1e-6f));
+
+        // A 20 doesn't fit into two separate holes of 10
+        std::size_t offset = 0;
+        REQUIRE_FALSE(alloc.allocate(20, offset));
+
+        // Freeing the middle merges all three
+        alloc.free(b, 10);
+
+        stats = alloc.stats();
+        REQUIRE(stats.used == 0);
+        REQUIRE(stats.allocations == 0);
+        REQUIRE(stats.freeRanges == 1);
+        REQUIRE(stats.largestFree == 30);
+
+        REQUIRE(alloc.allocate(30, offset));
+        REQUIRE(offset == 0);
+    }
+
+    SECTION( "Random allocations never overlap, and everything merges back" ) {
+
+        static constexpr std::size_t capacity = 4096;
+
+        RangeAllocator alloc( capacity );
+
+        std::mt19937 rng( 42 );
+        std::uniform_int_distribution<std::size_t> sizes( 1, 64 );
+
+        struct Range { std::size_t offset, size; };
+        std::vector<Range> live;
+        std::vector<int> owner( capacity, -1 );
+
+        for (int i = 0; i < 2000; ++i) {
+            if (!live.empty() && (rng() % 3 == 0 || live.size() > 100)) {
+                std::size_t const pick = rng() % live.size();
+                auto const range = live[pick];
+
+                alloc.free(range.offset, range.size);
+                for (std::size_t j = 0; j < range.size; ++j)
+                    owner[range.offset + j] = -1;
+
+                live[pick] = live.back();
+                live.pop_back();
+            }
+            else {
+                std::size_t const size = sizes(rng);
+                std::size_t offset = 0;
+                if (!alloc.allocate(size, offset))
+                    continue;
+
+                REQUIRE(offset + size <= capacity);
+                for (std::size_t j = 0; j < size; ++j) {
+                    REQUIRE(owner[offset + j] == -1);
+                    owner[offset + j] = i;
+                }
+
+                live.push_back({ offset, size });
+            }
+        }
+
+        for (auto const& range : live)
+            alloc.free(range.offset, range.size);
+
+        auto const stats = alloc.stats();
+        REQUIRE(stats.used == 0);
+        REQUIRE(stats.freeRanges == 1);
+        REQUIRE(stats.largestFree == capacity);
+    }
+}
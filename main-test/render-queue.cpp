@@ -0,0 +1,129 @@
+#include <catch2/catch_amalgamated.hpp>
+
+#include "../main/render_queue.hpp"
+
+#include <random>
+#include <vector>
+#include <algorithm>
+
+using namespace Catch::Matchers;
+
+
+TEST_CASE("Render queue sort keys", "[render_queue]") {
+
+    SECTION( "Opaque draws sort before transparent ones" ) {
+
+        auto const opaque = make_sort_key(kRenderPassOpaque, 255, 4095, 255, 1e30f);
+        auto const transparent = make_sort_key(kRenderPassTransparent, 0, 0, 0, 0.f);
+
+        REQUIRE(opaque < transparent);
+    }
+
+    SECTION( "State sorts before depth" ) {
+
+        REQUIRE(make_sort_key(kRenderPassOpaque, 1, 0, 0, 0.f) > make_sort_key(kRenderPassOpaque, 0, 4095, 255, 1e30f));
+        REQUIRE(make_sort_key(kRenderPassOpaque, 0, 1, 0, 0.f) > make_sort_key(kRenderPassOpaque, 0, 0, 255, 1e30f));
+        REQUIRE(make_sort_key(kRenderPassOpaque, 0, 0, 1, 0.f) > make_sort_key(kRenderPassOpaque, 0, 0, 0, 1e30f));
+    }
+
+    SECTION( "Opaque goes front to back, transparent back to front" ) {
+
+        REQUIRE(make_sort_key(kRenderPassOpaque, 0, 0, 0, 1.f) < make_sort_key(kRenderPassOpaque, 0, 0, 0, 2.f));
+        REQUIRE(make_sort_key(kRenderPassTransparent, 0, 0, 0, 1.f) > make_sort_key(kRenderPassTransparent, 0, 0, 0, 2.f));
+
+        // Just behind the camera counts as 0
+        REQUIRE(make_sort_key(kRenderPassOpaque, 0, 0, 0, -1.f) == make_sort_key(kRenderPassOpaque, 0, 0, 0, 0.f));
+    }
+}
+
+TEST_CASE("Render queue radix sort", "[render_queue]") {
+
+    SECTION( "Random keys end up in the same order as std::stable_sort" ) {
+
+        std::mt19937 rng( 7 );
+        std::uniform_int_distribution<std::uint32_t> small( 0, 3 );
+        std::uniform_real_distribution<float> depth( -1.f, 500.f );
+
+        RenderQueue queue;
+        std::vector<RenderQueue::Entry> expected;
+
+        for (std::uint32_t i = 0; i < 5000; ++i) {
+            auto const pass = small(rng) == 0 ? kRenderPassTransparent : kRenderPassOpaque;
+            auto const key = make_sort_key(pass, small(rng), small(rng) * 100, small(rng), depth(rng));
+
+            queue.push(key, i);
+            expected.push_back({ key, i });
+        }
+
+        std::stable_sort(expected.begin(), expected.end(), [] (auto const& a, auto const& b) {
+            return a.key < b.key;
+        });
+
+        queue.sort();
+
+        auto const& sorted = queue.entries();
+        REQUIRE(sorted.size() == expected.size());
+        for (std::size_t i = 0; i < sorted.size(); ++i) {
+            REQUIRE(sorted[i].key == expected[i].key);
+            REQUIRE(sorted[i].item == expected[i].item);
+        }
+    }
+
+    SECTION( "Equal keys keep the order they were pushed in" ) {
+
+        // Few distinct keys, that differ in the high bytes only, so most
+        // passes are skipped and the rest have to keep ties in order
+        std::uint64_t const keys[] = {
+            make_sort_key(kRenderPassTransparent, 3, 0, 0, 0.f),
+            make_sort_key(kRenderPassOpaque, 9, 0, 0, 0.f),
+            make_sort_key(kRenderPassOpaque, 2, 7, 0, 0.f),
+            make_sort_key(kRenderPassOpaque, 2, 0, 0, 0.f)
+        };
+
+        RenderQueue queue;
+        for (std::uint32_t i = 0; i < 400; ++i)
+            queue.push(keys[(i * 7) % 4], i);
+
+        queue.sort();
+
+        auto const& sorted = queue.entries();
+        REQUIRE(sorted.size() == 400);
+        for (std::size_t i = 1; i < sorted.size(); ++i) {
+            REQUIRE(sorted[i - 1].key <= sorted[i].key);
+            if (sorted[i - 1].key == sorted[i].key)
+                REQUIRE(sorted[i - 1].item < sorted[i].item);
+        }
+    }
+
+    SECTION( "Stats count the state changes before and after sorting" ) {
+
+        RenderQueue queue;
+        queue.push(make_sort_key(kRenderPassOpaque, 1, 0, 0, 3.f), 0);
+        queue.push(make_sort_key(kRenderPassOpaque, 0, 0, 0, 2.f), 1);
+        queue.push(make_sort_key(kRenderPassOpaque, 1, 0, 0, 1.f), 2);
+        queue.push(make_sort_key(kRenderPassOpaque, 0, 0, 0, 0.f), 3);
+
+        queue.sort();
+
+        auto const& sorted = queue.entries();
+        REQUIRE(sorted[0].item == 3);
+        REQUIRE(sorted[1].item == 1);
+        REQUIRE(sorted[2].item == 2);
+        REQUIRE(sorted[3].item == 0);
+
+        auto const& stats = queue.stats();
+        REQUIRE(stats.items == 4);
+        REQUIRE(stats.unsortedChanges == 3);
+        REQUIRE(stats.programChanges == 1);
+        REQUIRE(stats.state_changes() == 1);
+    }
+
+    SECTION( "Sorting an empty queue does nothing" ) {
+
+        RenderQueue queue;
+        queue.sort();
+
+        REQUIRE(queue.size() == 0);
+        REQUIRE(queue.stats().items == 0);
+    }
+}
@@ -0,0 +1,121 @@
+#include <catch2/catch_amalgamated.hpp>
+
+#include "../main/thread_pool.hpp"
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+using namespace Catch::Matchers;
+
+namespace
+{
+    // Distinct threads that ran the items of a loop
+    struct Threads_
+    {
+        std::mutex mutex;
+        std::vector<std::thread::id> ids;
+
+        void add()
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            if (std::find(ids.begin(), ids.end(), std::this_thread::get_id()) == ids.end())
+                ids.push_back(std::this_thread::get_id());
+        }
+    };
+}
+
+
+TEST_CASE("Thread pool", "[thread_pool]") {
+
+    ThreadPool pool( 4 );
+    REQUIRE(pool.size() == 4);
+
+    SECTION( "Every item runs exactly once" ) {
+
+        for (std::size_t count : { 1, 3, 4, 1000, 100000 }) {
+            std::vector<std::atomic<int>> runs( count );
+
+            pool.parallel_for(count, 0, [&] (std::size_t i) {
+                ++runs[i];
+            });
+
+            for (auto const& r : runs)
+                REQUIRE(r == 1);
+        }
+    }
+
+    SECTION( "An empty loop does nothing" ) {
+
+        bool called = false;
+        pool.parallel_for(0, 0, [&] (std::size_t) { called = true; });
+
+        REQUIRE_FALSE(called);
+    }
+
+    SECTION( "Loops run on at most the threads they ask for" ) {
+
+        // Long enough items that every thread gets some
+        auto const item = [] (Threads_& aThreads) {
+            aThreads.add();
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        };
+
+        Threads_ one;
+        pool.parallel_for(64, 1, [&] (std::size_t) { item(one); });
+        REQUIRE(one.ids.size() == 1);
+        REQUIRE(one.ids.front() == std::this_thread::get_id());
+
+        Threads_ two;
+        pool.parallel_for(64, 2, [&] (std::size_t) { item(two); });
+        REQUIRE(two.ids.size() <= 2);
+
+        Threads_ all;
+        pool.parallel_for(64, 0, [&] (std::size_t) { item(all); });
+        REQUIRE(all.ids.size() <= 4);
+        REQUIRE(all.ids.size() > 1);
+    }
+
+    SECTION( "Nested loops run on the thread that calls them" ) {
+
+        std::atomic<int> total{ 0 };
+        std::atomic<bool> sameThread{ true };
+
+        pool.parallel_for(16, 0, [&] (std::size_t) {
+            auto const outer = std::this_thread::get_id();
+
+            pool.parallel_for(16, 0, [&] (std::size_t) {
+                if (std::this_thread::get_id() != outer)
+                    sameThread = false;
+                ++total;
+            });
+        });
+
+        REQUIRE(total == 16 * 16);
+        REQUIRE(sameThread);
+    }
+
+    SECTION( "Many small loops in a row" ) {
+
+        std::atomic<std::size_t> total{ 0 };
+        for (int loop = 0; loop < 2000; ++loop)
+            pool.parallel_for(5, 0, [&] (std::size_t i) { total += i + 1; });
+
+        REQUIRE(total == 2000 * 15);
+    }
+}
+
+TEST_CASE("Shared thread pool", "[thread_pool]") {
+
+    REQUIRE(&shared_thread_pool() == &shared_thread_pool());
+    REQUIRE(shared_thread_pool().size() == thread_count(0));
+    REQUIRE(thread_count(3) == 3);
+
+    std::vector<int> squares( 500, 0 );
+    parallel_for(squares.size(), 0, [&] (std::size_t i) { squares[i] = int(i * i); });
+
+    for (std::size_t i = 0; i < squares.size(); ++i)
+        REQUIRE(squares[i] == int(i * i));
+}
@@ -0,0 +1,103 @@
+#include <catch2/catch_amalgamated.hpp>
+
+#include "../main/vehicle.hpp"
+
+#include <vector>
+
+using namespace Catch::Matchers;
+
+namespace
+{
+    // A part's joint -> model transform in the rest pose, where every
+    // articulation is the identity
+    Mat44f rest_joint_( std::vector<VehiclePart> const& aParts, int aPart )
+    {
+        Mat44f ret = kIdentity44f;
+        for (int i = aPart; i >= 0; i = aParts[i].parent)
+            ret = aParts[i].joint * ret;
+        return ret;
+    }
+
+    Vec3f transform_point_( Mat44f const& aM, Vec3f const& aP )
+    {
+        Vec4f const p = aM * Vec4f{ aP.x, aP.y, aP.z, 1.f };
+        return Vec3f{ p.x, p.y, p.z } / p.w;
+    }
+}
+
+TEST_CASE("Vehicle model", "[vehicle]") {
+
+    auto const parts = make_vehicle_rig();
+    auto const model = make_vehicle_model(parts);
+
+    SECTION( "Every part is an instance of exactly one primitive" ) {
+
+        REQUIRE(model.instances.size() == model.primitives.size());
+
+        std::vector<int> seen(parts.size(), 0);
+        for (std::size_t p = 0; p < model.primitives.size(); ++p) {
+            REQUIRE_FALSE(model.instances[p].empty());
+
+            for (auto const part : model.instances[p]) {
+                REQUIRE(part < parts.size());
+                REQUIRE(parts[part].geometry.primitive == model.primitives[p]);
+                ++seen[part];
+            }
+        }
+
+        for (auto const count : seen)
+            REQUIRE(count == 1);
+
+        // The legs and the boosters share theirs
+        REQUIRE(model.primitives.size() < parts.size());
+        REQUIRE(parts.size() <= kMaxVehicleParts);
+    }
+
+    SECTION( "Primitives are unique" ) {
+
+        for (std::size_t a = 0; a < model.primitives.size(); ++a) {
+            for (std::size_t b = a + 1; b < model.primitives.size(); ++b)
+                REQUIRE_FALSE(model.primitives[a] == model.primitives[b]);
+        }
+    }
+
+    SECTION( "The palette puts the shared meshes where each part's own copy would be" ) {
+
+        std::vector<PartPaletteEntry> palette;
+        pose_vehicle(parts, VehicleCtrl_{}, palette);
+        REQUIRE(palette.size() == parts.size());
+
+        for (std::size_t p = 0; p < model.primitives.size(); ++p) {
+            auto const shared = make_primitive(model.primitives[p]);
+
+            for (auto const part : model.instances[p]) {
+                auto const own = make_primitive(model.primitives[p], rest_joint_(parts, int(part)) * parts[part].geometry.transform);
+                REQUIRE(own.positions.size() == shared.positions.size());
+
+                for (std::size_t v = 0; v < shared.positions.size(); ++v) {
+                    Vec3f const placed = transform_point_(palette[part].transform, shared.positions[v]);
+                    REQUIRE(length(placed - own.positions[v]) < 1e-5f);
+                }
+            }
+        }
+    }
+
+    SECTION( "Normal matrices stay the inverse transpose when articulated" ) {
+
+        VehicleCtrl_ ctrl;
+        ctrl.legFold = 0.7f;
+        ctrl.gimbal = 0.2f;
+
+        std::vector<PartPaletteEntry> palette;
+        pose_vehicle(parts, ctrl, palette);
+
+        for (auto const& entry : palette) {
+            Mat44f const product = transpose(entry.normal) * entry.transform;
+
+            for (std::size_t r = 0; r < 4; ++r) {
+                for (std::size_t c = 0; c < 4; ++c)
+                    REQUIRE_THAT(product(r, c), WithinAbs(r == c ? 1.f : 0.f, 1e-3f));
+            }
+        }
+    }
+}
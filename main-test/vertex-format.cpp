@@ -0,0 +1,355 @@
+#include <catch2/catch_amalgamated.hpp>
+
+#include "../main/vertex_format.hpp"
+
+#include <bit>
+#include <cmath>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include "../vmlib/vec2.hpp"
+#include "../vmlib/vec3.hpp"
+
+using namespace Catch::Matchers;
+
+
+namespace
+{
+    // What pull_vertex() in default.vert gets out of a vertex. The decoding
+    // below follows it and the GLSL unpack functions step by step.
+    struct PulledVertex_
+    {
+        Vec3f position;
+        Vec3f normal;
+        Vec2f texcoord;
+        Vec4f tangent;
+        float occlusion;
+        std::uint32_t material;
+    };
+
+    float word_float_( std::uint32_t aWord )
+    {
+        return std::bit_cast<float>( aWord );
+    }
+
+    // unpackSnorm2x16()
+    Vec2f unpack_snorm2x16_( std::uint32_t aWord )
+    {
+        auto const snorm = [] (std::uint32_t aBits) {
+            return std::clamp( float(std::int16_t(std::uint16_t(aBits))) / 32767.f, -1.f, 1.f );
+        };
+
+        return { snorm( aWord & 0xffffu ), snorm( aWord >> 16 ) };
+    }
+
+    // unpackHalf2x16()
+    Vec2f unpack_half2x16_( std::uint32_t aWord )
+    {
+        auto const half = [] (std::uint32_t aBits) {
+            float const sign = (aBits & 0x8000u) ? -1.f : 1.f;
+            int const exponent = int((aBits >> 10) & 0x1fu);
+            float const mantissa = float(aBits & 0x3ffu);
+
+            if (0 == exponent)
+                return sign * std::ldexp( mantissa, -24 );
+            if (31 == exponent)
+                return mantissa ? std::numeric_limits<float>::quiet_NaN() : sign * std::numeric_limits<float>::infinity();
+            return sign * std::ldexp( 1024.f + mantissa, exponent - 25 );
+        };
+
+        return { half( aWord & 0xffffu ), half( aWord >> 16 ) };
+    }
+
+    // octahedral_decode()
+    Vec3f octahedral_decode_( std::uint32_t aWord )
+    {
+        Vec2f const e = unpack_snorm2x16_( aWord );
+        Vec3f v{ e.x, e.y, 1.f - std::abs( e.x ) - std::abs( e.y ) };
+
+        float const t = std::max( -v.z, 0.f );
+        v.x += v.x >= 0.f ? -t : t;
+        v.y += v.y >= 0.f ? -t : t;
+
+        return normalize( v );
+    }
+
+    // pull_vertex(), for vertex aIndex of a mesh packed from word 0
+    PulledVertex_ pull_vertex_( std::vector<std::uint32_t> const& aWords, VertexFormat aFormat, std::size_t aIndex )
+    {
+        PulledVertex_ ret;
+
+        if (kVertexPacked == aFormat) {
+            std::size_t const v = aIndex * 7;
+            std::uint32_t const extra = aWords[v + 6];
+
+            ret.position = { word_float_( aWords[v] ), word_float_( aWords[v + 1] ), word_float_( aWords[v + 2] ) };
+            ret.normal = octahedral_decode_( aWords[v + 3] );
+
+            Vec3f const tangent = octahedral_decode_( aWords[v + 4] );
+            ret.tangent = { tangent.x, tangent.y, tangent.z, (extra & 0x100u) ? -1.f : 1.f };
+
+            ret.texcoord = unpack_half2x16_( aWords[v + 5] );
+            ret.occlusion = float(extra & 0xffu) / 255.f;
+            ret.material = extra >> 16;
+        }
+        else {
+            std::size_t const v = aIndex * 14;
+            auto const f = [&] (std::size_t aWord) { return word_float_( aWords[v + aWord] ); };
+
+            ret.position = { f( 0 ), f( 1 ), f( 2 ) };
+            ret.normal = { f( 3 ), f( 4 ), f( 5 ) };
+            ret.texcoord = { f( 6 ), f( 7 ) };
+            ret.tangent = { f( 8 ), f( 9 ), f( 10 ), f( 11 ) };
+            ret.occlusion = f( 12 );
+            ret.material = aWords[v + 13];
+        }
+
+        return ret;
+    }
+
+    Vec3f random_direction_( std::mt19937& aRng )
+    {
+        std::normal_distribution<float> gauss( 0.f, 1.f );
+        for (;;) {
+            Vec3f const v{ gauss( aRng ), gauss( aRng ), gauss( aRng ) };
+            if (length( v ) > 1e-3f)
+                return normalize( v );
+        }
+    }
+
+    // Degrees between two unit vectors. acos() of the dot product would
+    // lose the small angles in float precision.
+    float angle_between_( Vec3f const& aA, Vec3f const& aB )
+    {
+        return std::atan2( length( cross( aA, aB ) ), dot( aA, aB ) ) * 180.f / 3.14159265f;
+    }
+
+    // Every stream filled in, with directions all around the sphere and
+    // texture coordinates over several tiles
+    SimpleMeshData make_mesh_( std::size_t aCount, std::uint32_t aSeed )
+    {
+        std::mt19937 rng( aSeed );
+        std::uniform_real_distribution<float> coord( -50.f, 50.f );
+        std::uniform_real_distribution<float> uv( -4.f, 4.f );
+        std::uniform_real_distribution<float> unit( 0.f, 1.f );
+        std::uniform_int_distribution<int> material( 0, 3 );
+
+        SimpleMeshData ret;
+        for (std::size_t i = 0; i < aCount; ++i) {
+            Vec3f const t = random_direction_( rng );
+
+            ret.positions.emplace_back( Vec3f{ coord( rng ), coord( rng ), coord( rng ) } );
+            ret.normals.emplace_back( random_direction_( rng ) );
+            ret.texcoords.emplace_back( Vec2f{ uv( rng ), uv( rng ) } );
+            ret.tangents.emplace_back( Vec4f{ t.x, t.y, t.z, unit( rng ) < 0.5f ? -1.f : 1.f } );
+            ret.occlusion.emplace_back( unit( rng ) );
+            ret.material_ids.emplace_back( material( rng ) );
+        }
+
+        return ret;
+    }
+}
+
+TEST_CASE("Vertex formats", "[vertex_format]") {
+
+    SECTION( "Strides match pull_vertex()" ) {
+
+        REQUIRE(vertex_stride(kVertexFloat) == 14);
+        REQUIRE(vertex_stride(kVertexPacked) == 7);
+
+        auto const mesh = make_mesh_(10, 1);
+        for (auto format : { kVertexFloat, kVertexPacked }) {
+            std::vector<std::uint32_t> words = { 42u };
+            pack_vertices(mesh, format, 0, words);
+
+            // Appended behind what was already there
+            REQUIRE(words.size() == 1 + 10 * vertex_stride(format));
+            REQUIRE(words.front() == 42u);
+        }
+    }
+
+    SECTION( "Float vertices come back exactly" ) {
+
+        auto const mesh = make_mesh_(500, 2);
+
+        std::vector<std::uint32_t> words;
+        pack_vertices(mesh, kVertexFloat, 7, words);
+
+        for (std::size_t i = 0; i < mesh.positions.size(); ++i) {
+            auto const v = pull_vertex_(words, kVertexFloat, i);
+
+            REQUIRE(v.position.x == mesh.positions[i].x);
+            REQUIRE(v.position.y == mesh.positions[i].y);
+            REQUIRE(v.position.z == mesh.positions[i].z);
+            REQUIRE(v.normal.x == mesh.normals[i].x);
+            REQUIRE(v.normal.y == mesh.normals[i].y);
+            REQUIRE(v.normal.z == mesh.normals[i].z);
+            REQUIRE(v.texcoord.x == mesh.texcoords[i].x);
+            REQUIRE(v.texcoord.y == mesh.texcoords[i].y);
+            REQUIRE(v.tangent.x == mesh.tangents[i].x);
+            REQUIRE(v.tangent.w == mesh.tangents[i].w);
+            REQUIRE(v.occlusion == mesh.occlusion[i]);
+            REQUIRE(v.material == 7u + std::uint32_t(mesh.material_ids[i]));
+        }
+    }
+
+    SECTION( "Packed vertices come back within their precision" ) {
+
+        auto const mesh = make_mesh_(5000, 3);
+
+        std::vector<std::uint32_t> words;
+        pack_vertices(mesh, kVertexPacked, 1000, words);
+
+        float maxNormalError = 0.f, maxTangentError = 0.f;
+
+        for (std::size_t i = 0; i < mesh.positions.size(); ++i) {
+            auto const v = pull_vertex_(words, kVertexPacked, i);
+
+            // Positions stay full floats
+            REQUIRE(v.position.x == mesh.positions[i].x);
+            REQUIRE(v.position.y == mesh.positions[i].y);
+            REQUIRE(v.position.z == mesh.positions[i].z);
+
+            Vec4f const& t = mesh.tangents[i];
+            maxNormalError = std::max(maxNormalError, angle_between_(v.normal, mesh.normals[i]));
+            maxTangentError = std::max(maxTangentError, angle_between_(Vec3f{ v.tangent.x, v.tangent.y, v.tangent.z }, Vec3f{ t.x, t.y, t.z }));
+            REQUIRE(v.tangent.w == t.w);
+
+            // Half floats have 11 significant bits, so up to 4 is within 2^-9
+            REQUIRE_THAT(v.texcoord.x, WithinAbs(mesh.texcoords[i].x, 1.f / 512.f));
+            REQUIRE_THAT(v.texcoord.y, WithinAbs(mesh.texcoords[i].y, 1.f / 512.f));
+
+            REQUIRE_THAT(v.occlusion, WithinAbs(mesh.occlusion[i], 0.5f / 255.f + 1e-6f));
+            REQUIRE(v.material == 1000u + std::uint32_t(mesh.material_ids[i]));
+        }
+
+        // 16 bits per component is a few thousandths of a degree
+        REQUIRE(maxNormalError < 0.01f);
+        REQUIRE(maxTangentError < 0.01f);
+    }
+
+    SECTION( "Octahedral directions along the axes and the folds" ) {
+
+        SimpleMeshData mesh;
+        std::vector<Vec3f> const directions = {
+            { 1.f, 0.f, 0.f }, { -1.f, 0.f, 0.f },
+            { 0.f, 1.f, 0.f }, { 0.f, -1.f, 0.f },
+            { 0.f, 0.f, 1.f }, { 0.f, 0.f, -1.f },
+            normalize(Vec3f{ 1.f, 1.f, -1.f }), normalize(Vec3f{ -1.f, 1.f, -1.f }),
+            normalize(Vec3f{ 1.f, -1.f, -1.f }), normalize(Vec3f{ -1.f, -1.f, -1.f }),
+            normalize(Vec3f{ 1.f, 0.f, -1e-4f }), normalize(Vec3f{ 0.f, -1.f, -1e-4f })
+        };
+
+        for (auto const& d : directions) {
+            mesh.positions.emplace_back(Vec3f{ 0.f, 0.f, 0.f });
+            mesh.normals.emplace_back(d);
+        }
+
+        std::vector<std::uint32_t> words;
+        pack_vertices(mesh, kVertexPacked, 0, words);
+
+        for (std::size_t i = 0; i < directions.size(); ++i)
+            REQUIRE(angle_between_(pull_vertex_(words, kVertexPacked, i).normal, directions[i]) < 0.01f);
+    }
+
+    SECTION( "Half floats round like packHalf2x16()" ) {
+
+        SimpleMeshData mesh;
+        std::vector<Vec2f> const texcoords = {
+            { 0.f, 1.f }, { 0.5f, -0.25f }, { 1000.5f, -2048.f },
+            { 2047.9f, 1.f + 1.f / 2048.f },        // Rounds up, over a power of two; a tie
+            { 1e-6f, 70000.f },                      // Too small, too large
+        };
+
+        for (auto const& uv : texcoords) {
+            mesh.positions.emplace_back(Vec3f{ 0.f, 0.f, 0.f });
+            mesh.texcoords.emplace_back(uv);
+        }
+
+        std::vector<std::uint32_t> words;
+        pack_vertices(mesh, kVertexPacked, 0, words);
+
+        auto const uv = [&] (std::size_t aIndex) { return pull_vertex_(words, kVertexPacked, aIndex).texcoord; };
+
+        REQUIRE(uv(0).x == 0.f);
+        REQUIRE(uv(0).y == 1.f);
+        REQUIRE(uv(1).x == 0.5f);
+        REQUIRE(uv(1).y == -0.25f);
+        REQUIRE(uv(2).x == 1000.5f);
+        REQUIRE(uv(2).y == -2048.f);
+        REQUIRE(uv(3).x == 2048.f);
+        REQUIRE(uv(3).y == 1.f + 1.f / 1024.f);
+        REQUIRE(uv(4).x == 0.f);
+        REQUIRE(std::isinf(uv(4).y));
+    }
+
+    SECTION( "Missing streams get the defaults" ) {
+
+        SimpleMeshData mesh;
+        mesh.positions = { { 1.f, 2.f, 3.f }, { 4.f, 5.f, 6.f } };
+
+        for (auto format : { kVertexFloat, kVertexPacked }) {
+            std::vector<std::uint32_t> words;
+            pack_vertices(mesh, format, 3, words);
+
+            for (std::size_t i = 0; i < 2; ++i) {
+                auto const v = pull_vertex_(words, format, i);
+
+                REQUIRE(v.position.x == mesh.positions[i].x);
+                REQUIRE(v.texcoord.x == 0.f);
+                REQUIRE(v.texcoord.y == 0.f);
+                REQUIRE(v.tangent.w == 1.f);
+                REQUIRE(v.occlusion == 1.f);
+                REQUIRE(v.material == 3u);
+            }
+
+            // No normal, packed it decodes as +z
+            if (kVertexPacked == format)
+                REQUIRE(pull_vertex_(words, format, 0).normal.z == 1.f);
+        }
+    }
+
+    SECTION( "The largest material index keeps its bits apart" ) {
+
+        SimpleMeshData mesh;
+        mesh.positions = { { 0.f, 0.f, 0.f } };
+        mesh.tangents = { { 1.f, 0.f, 0.f, -1.f } };
+        mesh.occlusion = { 1.f };
+        mesh.material_ids = { 5 };
+
+        std::vector<std::uint32_t> words;
+        pack_vertices(mesh, kVertexPacked, 65530, words);
+
+        auto const v = pull_vertex_(words, kVertexPacked, 0);
+        REQUIRE(v.occlusion == 1.f);
+        REQUIRE(v.tangent.w == -1.f);
+        REQUIRE(v.material == 65535u);
+    }
+}
+
+TEST_CASE("Packed materials", "[vertex_format]") {
+
+    SECTION( "Laid out like Material in default.vert" ) {
+
+        REQUIRE(sizeof(PackedMaterial) == 64);
+
+        Material material;
+        material.ambient = { 0.1f, 0.2f, 0.3f };
+        material.diffuse = { 0.4f, 0.5f, 0.6f };
+        material.specular = { 0.7f, 0.8f, 0.9f };
+        material.shininess = 32.f;
+        material.emissive = { 1.f, 2.f, 3.f };
+        material.illum = 2.f;
+
+        auto const packed = pack_material(material);
+
+        REQUIRE(packed.ambientShininess.x == 0.1f);
+        REQUIRE(packed.ambientShininess.w == 32.f);
+        REQUIRE(packed.diffuseIllum.y == 0.5f);
+        REQUIRE(packed.diffuseIllum.w == 2.f);
+        REQUIRE(packed.specular.z == 0.9f);
+        REQUIRE(packed.emissive.x == 1.f);
+        REQUIRE(packed.emissive.z == 3.f);
+    }
+}
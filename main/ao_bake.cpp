@@ -0,0 +1,193 @@
+#include "ao_bake.hpp"
+
+#include <bit>
+#include <random>
+#include <numbers>
+#include <algorithm>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "thread_pool.hpp"
+
+namespace
+{
+    constexpr std::uint32_t kCacheMagic_ = 0x4f415856;     // "VXAO"
+    constexpr std::uint32_t kCacheVersion_ = 1;
+
+    // Vertices handed to a thread at a time
+    constexpr std::size_t kBatchSize_ = 256;
+
+    // Rays start this far (relative to their length) off the surface, so
+    // they don't hit the triangles around their own vertex
+    constexpr float kRayOffset_ = 1e-3f;
+
+    // Cosine weighted direction around aN
+    // Duff et al., "Building an Orthonormal Basis, Revisited"
+    Vec3f cosine_direction_( Vec3f const& aN, float aR1, float aR2 ) noexcept
+    {
+        float const sign = std::copysign( 1.f, aN.z );
+        float const a = -1.f / (sign + aN.z);
+        float const b = aN.x * aN.y * a;
+
+        Vec3f const t{ 1.f + sign * aN.x * aN.x * a, sign * b, -sign * aN.x };
+        Vec3f const s{ b, sign + aN.y * aN.y * a, -aN.y };
+
+        float const r = std::sqrt( aR1 );
+        float const phi = 2.f * std::numbers::pi_v<float> * aR2;
+
+        return r * std::cos( phi ) * t + r * std::sin( phi ) * s + std::sqrt( std::max( 0.f, 1.f - aR1 ) ) * aN;
+    }
+
+    // Seeds the jitter from the vertex itself. OBJ meshes repeat a vertex
+    // for every triangle around it; this way all copies get the same value.
+    std::uint32_t vertex_seed_( Vec3f const& aP, Vec3f const& aN ) noexcept
+    {
+        std::uint32_t bits[6];
+        std::memcpy( bits, &aP, sizeof(Vec3f) );
+        std::memcpy( bits + 3, &aN, sizeof(Vec3f) );
+
+        std::uint32_t hash = 2166136261u;
+        for (auto const b : bits)
+            hash = (hash ^ b) * 16777619u;
+        return hash;
+    }
+}
+
+std::vector<float> bake_vertex_ao(
+    SimpleMeshData const& aMesh,
+    TriangleBvh const& aOccluders,
+    std::size_t aSamples,
+    float aDistance,
+    std::size_t aThreadCount
+)
+{
+    std::size_t const count = aMesh.positions.size();
+    std::vector<float> ret( count, 1.f );
+
+    if (aOccluders.empty() || aMesh.normals.size() != count || 0 == aSamples)
+        return ret;
+
+    // Strata per side of the grid, even so that it splits into 2x2 packets
+    std::size_t side = 2;
+    while (side * side < aSamples)
+        side += 2;
+
+    float const strata = float(side);
+    float const offset = kRayOffset_ * aDistance;
+
+    std::size_t const batches = (count + kBatchSize_ - 1) / kBatchSize_;
+
+    parallel_for( batches, aThreadCount, [&] (std::size_t batch) {
+        std::uniform_real_distribution<float> uniform( 0.f, 1.f );
+
+        std::size_t const end = std::min( count, (batch + 1) * kBatchSize_ );
+
+        for (std::size_t v = batch * kBatchSize_; v < end; ++v) {
+            Vec3f const& p = aMesh.positions[v];
+            Vec3f const& n = aMesh.normals[v];
+
+            if (dot( n, n ) < 1e-12f)
+                continue;
+
+            Vec3f const normal = normalize( n );
+            std::minstd_rand rng( vertex_seed_( p, n ) );
+
+            std::size_t blocked = 0;
+            for (std::size_t y = 0; y < side; y += 2) {
+                for (std::size_t x = 0; x < side; x += 2) {
+                    Vec3f origins[4], dirs[4];
+
+                    for (std::size_t i = 0; i < 4; ++i) {
+                        float const r1 = (float(y + i / 2) + uniform( rng )) / strata;
+                        float const r2 = (float(x + i % 2) + uniform( rng )) / strata;
+
+                        dirs[i] = cosine_direction_( normal, r1, r2 );
+                        origins[i] = p + offset * (normal + dirs[i]);
+                    }
+
+                    blocked += std::popcount( aOccluders.occluded4( origins, dirs, aDistance ) );
+                }
+            }
+
+            ret[v] = 1.f - float(blocked) / float(side * side);
+        }
+    } );
+
+    return ret;
+}
+
+std::uint64_t vertex_ao_key(
+    SimpleMeshData const& aMesh,
+    std::vector<Vec3f> const& aOccluderPositions,
+    std::vector<std::uint32_t> const& aOccluderIndices,
+    std::size_t aSamples,
+    float aDistance
+)
+{
+    // FNV-1a over everything that goes into the bake
+    std::uint64_t hash = 0xcbf29ce484222325ull;
+
+    auto const add = [&] (void const* aData, std::size_t aSize) {
+        auto const* bytes = static_cast<std::uint8_t const*>( aData );
+        for (std::size_t i = 0; i < aSize; ++i)
+            hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    };
+
+    std::uint64_t const params[] = { kCacheVersion_, aSamples };
+    add( params, sizeof(params) );
+    add( &aDistance, sizeof(aDistance) );
+
+    add( aMesh.positions.data(), aMesh.positions.size() * sizeof(Vec3f) );
+    add( aMesh.normals.data(), aMesh.normals.size() * sizeof(Vec3f) );
+    add( aOccluderPositions.data(), aOccluderPositions.size() * sizeof(Vec3f) );
+    add( aOccluderIndices.data(), aOccluderIndices.size() * sizeof(std::uint32_t) );
+
+    return hash;
+}
+
+bool load_vertex_ao( char const* aPath, std::uint64_t aKey, std::size_t aVertexCount, std::vector<float>& aOut )
+{
+    std::FILE* file = std::fopen( aPath, "rb" );
+    if (!file)
+        return false;
+
+    std::uint32_t header[2] = {};
+    std::uint64_t key = 0;
+    std::uint32_t count = 0;
+    std::vector<float> ret;
+
+    bool ok = 1 == std::fread( header, sizeof(header), 1, file )
+        && kCacheMagic_ == header[0] && kCacheVersion_ == header[1]
+        && 1 == std::fread( &key, sizeof(key), 1, file ) && aKey == key
+        && 1 == std::fread( &count, sizeof(count), 1, file ) && aVertexCount == count;
+
+    if (ok) {
+        ret.resize( count );
+        ok = ret.empty() || 1 == std::fread( ret.data(), ret.size() * sizeof(float), 1, file );
+    }
+
+    std::fclose( file );
+
+    if (ok)
+        aOut = std::move(ret);
+    return ok;
+}
+
+bool save_vertex_ao( char const* aPath, std::uint64_t aKey, std::vector<float> const& aOcclusion )
+{
+    std::FILE* file = std::fopen( aPath, "wb" );
+    if (!file)
+        return false;
+
+    std::uint32_t const header[2] = { kCacheMagic_, kCacheVersion_ };
+    std::uint32_t const count = std::uint32_t(aOcclusion.size());
+
+    bool const ok = 1 == std::fwrite( header, sizeof(header), 1, file )
+        && 1 == std::fwrite( &aKey, sizeof(aKey), 1, file )
+        && 1 == std::fwrite( &count, sizeof(count), 1, file )
+        && (aOcclusion.empty() || 1 == std::fwrite( aOcclusion.data(), aOcclusion.size() * sizeof(float), 1, file ));
+
+    return 0 == std::fclose( file ) && ok;
+}
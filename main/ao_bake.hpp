@@ -0,0 +1,61 @@
+#ifndef AO_BAKE_HPP_5B1E7C29_84D3_4F6A_9E02_C37A6D18B4F5
+#define AO_BAKE_HPP_5B1E7C29_84D3_4F6A_9E02_C37A6D18B4F5
+
+#include <vector>
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "bvh.hpp"
+#include "simple_mesh.hpp"
+
+/*
+ *  === Ambient occlusion ===
+ *  https://developer.nvidia.com/gpugems/gpugems/part-iii-materials/chapter-17-ambient-occlusion
+ *  https://www.scratchapixel.com/lessons/3d-basic-rendering/global-illumination-path-tracing/ambient-occlusion.html
+ *
+ *  How much of the sky above each vertex is open: rays go out over the
+ *  hemisphere around the vertex normal (cosine weighted), and the ones that
+ *  hit something within a short distance count as blocked. This darkens
+ *  creases, crater floors and the ground right next to the landing pads.
+ *
+ *  Only static meshes are baked, so this happens once (and is then cached
+ *  on disk) instead of with a screen-space pass every frame. The result is
+ *  a per-vertex attribute that scales the ambient light in default.frag.
+ *
+ *  The hemisphere is split into a grid of strata with one ray each. Rays
+ *  are traced four at a time (TriangleBvh::occluded4), each packet covering
+ *  a 2x2 block of neighbouring strata, so the four rays start at the same
+ *  point and point roughly the same way.
+ */
+
+// Ambient occlusion of every vertex of aMesh, 1 = nothing in the way.
+// aOccluders holds everything that casts occlusion, which can be more than
+// the mesh itself. About aSamples rays are cast per vertex (rounded up to
+// an even grid), each at most aDistance long. aThreadCount = 0 uses all
+// hardware threads.
+std::vector<float> bake_vertex_ao(
+    SimpleMeshData const&,
+    TriangleBvh const& aOccluders,
+    std::size_t aSamples,
+    float aDistance,
+    std::size_t aThreadCount = 0
+);
+
+// Identifies what the occlusion was baked from, so stale caches are
+// ignored. aOccluderPositions/aOccluderIndices are what aOccluders was built
+// from.
+std::uint64_t vertex_ao_key(
+    SimpleMeshData const&,
+    std::vector<Vec3f> const& aOccluderPositions,
+    std::vector<std::uint32_t> const& aOccluderIndices,
+    std::size_t aSamples,
+    float aDistance
+);
+
+// Returns false if the file is missing, was baked from something else or
+// doesn't have aVertexCount values
+bool load_vertex_ao( char const* aPath, std::uint64_t aKey, std::size_t aVertexCount, std::vector<float>& );
+bool save_vertex_ao( char const* aPath, std::uint64_t aKey, std::vector<float> const& );
+
+#endif // AO_BAKE_HPP_5B1E7C29_84D3_4F6A_9E02_C37A6D18B4F5
@@ -0,0 +1,1022 @@
+#include "bvh.hpp"
+
+#include <bit>
+#include <limits>
+#include <algorithm>
+
+#include <cmath>
+
+#include "thread_pool.hpp"
+
+#if defined(__SSE__) || defined(_M_X64)
+#	include <xmmintrin.h>
+#	define BVH_USE_SSE 1
+#endif
+
+namespace
+{
+    constexpr std::size_t kLeafSize_ = 4;       // One triangle packet
+    constexpr std::size_t kBins_ = 16;
+
+    // Below this depth the build falls back to median splits, which bounds
+    // the depth of the tree (and so the traversal stacks).
+    constexpr std::size_t kMaxSahDepth_ = 48;
+    constexpr std::size_t kStackSize_ = 256;
+
+    struct Box_
+    {
+        Vec3f lo{ std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+        Vec3f hi{ -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max() };
+
+        void grow( Vec3f const& aP ) noexcept
+        {
+            lo = Vec3f{ std::min( lo.x, aP.x ), std::min( lo.y, aP.y ), std::min( lo.z, aP.z ) };
+            hi = Vec3f{ std::max( hi.x, aP.x ), std::max( hi.y, aP.y ), std::max( hi.z, aP.z ) };
+        }
+        void grow( Box_ const& aB ) noexcept
+        {
+            grow( aB.lo );
+            grow( aB.hi );
+        }
+
+        float area() const noexcept
+        {
+            Vec3f const e = hi - lo;
+            return (e.x < 0.f) ? 0.f : 2.f * (e.x * e.y + e.y * e.z + e.z * e.x);
+        }
+    };
+
+    // Binary tree, as it comes out of the SAH build. Leaves have count > 0
+    // and cover ids[first, first + count).
+    struct BinaryNode_
+    {
+        Box_ box;
+        std::uint32_t first = 0, count = 0;
+        std::uint32_t left = 0, right = 0;
+    };
+
+    // Subtree that is built in parallel, and replaces node `node` of the top
+    // of the tree afterwards
+    struct BuildTask_
+    {
+        std::uint32_t first, count;
+        std::uint32_t node;
+        std::size_t depth;
+        std::vector<BinaryNode_> nodes;
+    };
+
+    class BinaryBuilder_
+    {
+    public:
+        BinaryBuilder_( std::vector<Box_> const& aBoxes, std::vector<Vec3f> const& aCentroids, std::vector<std::uint32_t>& aIds )
+            : mBoxes( aBoxes )
+            , mCentroids( aCentroids )
+            , mIds( aIds )
+        {}
+
+        // Builds the subtree over ids[aFirst, aFirst + aCount) into aNodes and
+        // returns its root. With aTasks, ranges of at most aTaskSize triangles
+        // are not built, but queued in aTasks instead.
+        std::uint32_t build(
+            std::vector<BinaryNode_>& aNodes,
+            std::uint32_t aFirst, std::uint32_t aCount,
+            std::size_t aDepth,
+            std::vector<BuildTask_>* aTasks = nullptr, std::size_t aTaskSize = 0
+        ) const
+        {
+            std::uint32_t const idx = std::uint32_t(aNodes.size());
+            aNodes.emplace_back();
+
+            Box_ box, centroids;
+            for (std::uint32_t i = aFirst; i < aFirst + aCount; ++i) {
+                box.grow( mBoxes[mIds[i]] );
+                centroids.grow( mCentroids[mIds[i]] );
+            }
+
+            aNodes[idx].box = box;
+
+            if (aCount <= kLeafSize_) {
+                aNodes[idx].first = aFirst;
+                aNodes[idx].count = aCount;
+                return idx;
+            }
+
+            if (aTasks && aCount <= aTaskSize) {
+                aTasks->emplace_back( BuildTask_{ aFirst, aCount, idx, aDepth, {} } );
+                return idx;
+            }
+
+            std::uint32_t const mid = split_( aFirst, aCount, centroids, aDepth );
+
+            std::uint32_t const left = build( aNodes, aFirst, mid - aFirst, aDepth + 1, aTasks, aTaskSize );
+            std::uint32_t const right = build( aNodes, mid, aFirst + aCount - mid, aDepth + 1, aTasks, aTaskSize );
+
+            aNodes[idx].left = left;
+            aNodes[idx].right = right;
+            return idx;
+        }
+
+    private:
+        // Binned SAH over all three axes. Returns the first id of the right
+        // half; the ids are partitioned accordingly.
+        std::uint32_t split_( std::uint32_t aFirst, std::uint32_t aCount, Box_ const& aCentroids, std::size_t aDepth ) const
+        {
+            std::uint32_t const end = aFirst + aCount;
+
+            float bestCost = std::numeric_limits<float>::max();
+            int bestAxis = -1;
+            std::size_t bestBin = 0;
+
+            for (int axis = 0; axis < 3 && aDepth < kMaxSahDepth_; ++axis) {
+                float const lo = aCentroids.lo[axis];
+                float const extent = aCentroids.hi[axis] - lo;
+                if (extent <= 0.f)
+                    continue;
+
+                float const scale = float(kBins_) / extent;
+
+                Box_ bins[kBins_];
+                std::uint32_t counts[kBins_] = {};
+
+                for (std::uint32_t i = aFirst; i < end; ++i) {
+                    std::uint32_t const id = mIds[i];
+                    std::size_t const b = std::min( kBins_ - 1, std::size_t((mCentroids[id][axis] - lo) * scale) );
+                    bins[b].grow( mBoxes[id] );
+                    ++counts[b];
+                }
+
+                // Sweep from the right, then from the left
+                float rightArea[kBins_];
+                std::uint32_t rightCount[kBins_];
+
+                Box_ acc;
+                std::uint32_t n = 0;
+                for (std::size_t b = kBins_ - 1; b > 0; --b) {
+                    acc.grow( bins[b] );
+                    n += counts[b];
+                    rightArea[b] = acc.area();
+                    rightCount[b] = n;
+                }
+
+                acc = Box_{};
+                n = 0;
+                for (std::size_t b = 1; b < kBins_; ++b) {
+                    acc.grow( bins[b - 1] );
+                    n += counts[b - 1];
+
+                    if (0 == n || 0 == rightCount[b])
+                        continue;
+
+                    float const cost = acc.area() * float(n) + rightArea[b] * float(rightCount[b]);
+                    if (cost < bestCost) {
+                        bestCost = cost;
+                        bestAxis = axis;
+                        bestBin = b;
+                    }
+                }
+            }
+
+            if (bestAxis < 0) {
+                // All centroids in one spot (or too deep): split in the middle
+                std::uint32_t const mid = aFirst + aCount / 2;
+                if (aDepth >= kMaxSahDepth_) {
+                    int const axis = largest_axis_( aCentroids );
+                    std::nth_element( mIds.begin() + aFirst, mIds.begin() + mid, mIds.begin() + end, [&] (std::uint32_t a, std::uint32_t b) {
+                        return mCentroids[a][axis] < mCentroids[b][axis];
+                    } );
+                }
+                return mid;
+            }
+
+            float const lo = aCentroids.lo[bestAxis];
+            float const scale = float(kBins_) / (aCentroids.hi[bestAxis] - lo);
+
+            auto const it = std::partition( mIds.begin() + aFirst, mIds.begin() + end, [&] (std::uint32_t id) {
+                return std::min( kBins_ - 1, std::size_t((mCentroids[id][bestAxis] - lo) * scale) ) < bestBin;
+            } );
+
+            return std::uint32_t(it - mIds.begin());
+        }
+
+        static int largest_axis_( Box_ const& aBox ) noexcept
+        {
+            Vec3f const e = aBox.hi - aBox.lo;
+            return (e.x >= e.y && e.x >= e.z) ? 0 : (e.y >= e.z ? 1 : 2);
+        }
+
+        std::vector<Box_> const& mBoxes;
+        std::vector<Vec3f> const& mCentroids;
+        std::vector<std::uint32_t>& mIds;
+    };
+
+    struct Ray_
+    {
+        Vec3f origin, dir, inv;
+    };
+
+    Ray_ make_ray_( Vec3f const& aOrigin, Vec3f const& aDir ) noexcept
+    {
+        // Keep the reciprocals finite, 0 * inf in the slab test would be NaN
+        auto const safeInv = [] (float d) {
+            return 1.f / (std::abs( d ) > 1e-20f ? d : std::copysign( 1e-20f, d ));
+        };
+
+        return Ray_{ aOrigin, aDir, Vec3f{ safeInv( aDir.x ), safeInv( aDir.y ), safeInv( aDir.z ) } };
+    }
+
+    // Slab test of a ray against four boxes. aBounds are minX[4], minY[4],
+    // minZ[4], maxX[4], maxY[4], maxZ[4]. Returns a bit mask of the boxes that
+    // are hit within [0, aMaxT]; aNear receives the entry distances.
+    int hit_boxes_( float const* aBounds, std::uint32_t aCount, Ray_ const& aRay, float aMaxT, float aNear[4] ) noexcept
+    {
+#		if defined(BVH_USE_SSE)
+        __m128 const ox = _mm_set1_ps( aRay.origin.x ), ix = _mm_set1_ps( aRay.inv.x );
+        __m128 const oy = _mm_set1_ps( aRay.origin.y ), iy = _mm_set1_ps( aRay.inv.y );
+        __m128 const oz = _mm_set1_ps( aRay.origin.z ), iz = _mm_set1_ps( aRay.inv.z );
+
+        __m128 const t0x = _mm_mul_ps( _mm_sub_ps( _mm_load_ps( aBounds + 0 ), ox ), ix );
+        __m128 const t0y = _mm_mul_ps( _mm_sub_ps( _mm_load_ps( aBounds + 4 ), oy ), iy );
+        __m128 const t0z = _mm_mul_ps( _mm_sub_ps( _mm_load_ps( aBounds + 8 ), oz ), iz );
+        __m128 const t1x = _mm_mul_ps( _mm_sub_ps( _mm_load_ps( aBounds + 12 ), ox ), ix );
+        __m128 const t1y = _mm_mul_ps( _mm_sub_ps( _mm_load_ps( aBounds + 16 ), oy ), iy );
+        __m128 const t1z = _mm_mul_ps( _mm_sub_ps( _mm_load_ps( aBounds + 20 ), oz ), iz );
+
+        __m128 const tNear = _mm_max_ps(
+            _mm_max_ps( _mm_min_ps( t0x, t1x ), _mm_min_ps( t0y, t1y ) ),
+            _mm_max_ps( _mm_min_ps( t0z, t1z ), _mm_setzero_ps() )
+        );
+        __m128 const tFar = _mm_min_ps(
+            _mm_min_ps( _mm_max_ps( t0x, t1x ), _mm_max_ps( t0y, t1y ) ),
+            _mm_min_ps( _mm_max_ps( t0z, t1z ), _mm_set1_ps( aMaxT ) )
+        );
+
+        _mm_storeu_ps( aNear, tNear );
+        return _mm_movemask_ps( _mm_cmple_ps( tNear, tFar ) ) & ((1 << aCount) - 1);
+#		else // !BVH_USE_SSE
+        int mask = 0;
+        for (std::uint32_t i = 0; i < aCount; ++i) {
+            float const t0x = (aBounds[i +  0] - aRay.origin.x) * aRay.inv.x;
+            float const t0y = (aBounds[i +  4] - aRay.origin.y) * aRay.inv.y;
+            float const t0z = (aBounds[i +  8] - aRay.origin.z) * aRay.inv.z;
+            float const t1x = (aBounds[i + 12] - aRay.origin.x) * aRay.inv.x;
+            float const t1y = (aBounds[i + 16] - aRay.origin.y) * aRay.inv.y;
+            float const t1z = (aBounds[i + 20] - aRay.origin.z) * aRay.inv.z;
+
+            float const tNear = std::max( { std::min( t0x, t1x ), std::min( t0y, t1y ), std::min( t0z, t1z ), 0.f } );
+            float const tFar = std::min( { std::max( t0x, t1x ), std::max( t0y, t1y ), std::max( t0z, t1z ), aMaxT } );
+
+            aNear[i] = tNear;
+            if (tNear <= tFar)
+                mask |= 1 << i;
+        }
+        return mask;
+#		endif // ~ BVH_USE_SSE
+    }
+
+    // Squared distances from a point to four boxes (same layout as above)
+    void box_distances_( float const* aBounds, Vec3f const& aP, float aOut[4] ) noexcept
+    {
+#		if defined(BVH_USE_SSE)
+        __m128 const zero = _mm_setzero_ps();
+        __m128 const px = _mm_set1_ps( aP.x ), py = _mm_set1_ps( aP.y ), pz = _mm_set1_ps( aP.z );
+
+        __m128 const dx = _mm_max_ps( _mm_max_ps( _mm_sub_ps( _mm_load_ps( aBounds + 0 ), px ), _mm_sub_ps( px, _mm_load_ps( aBounds + 12 ) ) ), zero );
+        __m128 const dy = _mm_max_ps( _mm_max_ps( _mm_sub_ps( _mm_load_ps( aBounds + 4 ), py ), _mm_sub_ps( py, _mm_load_ps( aBounds + 16 ) ) ), zero );
+        __m128 const dz = _mm_max_ps( _mm_max_ps( _mm_sub_ps( _mm_load_ps( aBounds + 8 ), pz ), _mm_sub_ps( pz, _mm_load_ps( aBounds + 20 ) ) ), zero );
+
+        _mm_storeu_ps( aOut, _mm_add_ps( _mm_add_ps( _mm_mul_ps( dx, dx ), _mm_mul_ps( dy, dy ) ), _mm_mul_ps( dz, dz ) ) );
+#		else // !BVH_USE_SSE
+        for (std::size_t i = 0; i < 4; ++i) {
+            float const dx = std::max( { aBounds[i +  0] - aP.x, aP.x - aBounds[i + 12], 0.f } );
+            float const dy = std::max( { aBounds[i +  4] - aP.y, aP.y - aBounds[i + 16], 0.f } );
+            float const dz = std::max( { aBounds[i +  8] - aP.z, aP.z - aBounds[i + 20], 0.f } );
+            aOut[i] = dx * dx + dy * dy + dz * dz;
+        }
+#		endif // ~ BVH_USE_SSE
+    }
+
+    // Möller-Trumbore against four triangles. aTris are v0X[4] .. v0Z[4],
+    // e1X[4] .. e1Z[4], e2X[4] .. e2Z[4]. Returns the lane of the closest hit
+    // with t in [0, aMaxT], or -1.
+    int hit_triangles_( float const* aTris, Ray_ const& aRay, float aMaxT, float& aT, float& aU, float& aV ) noexcept
+    {
+        float t[4], u[4], v[4];
+        int mask = 0;
+
+#		if defined(BVH_USE_SSE)
+        auto const ld = [&] (std::size_t aOffset) { return _mm_load_ps( aTris + aOffset ); };
+
+        __m128 const dx = _mm_set1_ps( aRay.dir.x ), dy = _mm_set1_ps( aRay.dir.y ), dz = _mm_set1_ps( aRay.dir.z );
+        __m128 const e1x = ld( 12 ), e1y = ld( 16 ), e1z = ld( 20 );
+        __m128 const e2x = ld( 24 ), e2y = ld( 28 ), e2z = ld( 32 );
+
+        // p = dir x e2
+        __m128 const px = _mm_sub_ps( _mm_mul_ps( dy, e2z ), _mm_mul_ps( dz, e2y ) );
+        __m128 const py = _mm_sub_ps( _mm_mul_ps( dz, e2x ), _mm_mul_ps( dx, e2z ) );
+        __m128 const pz = _mm_sub_ps( _mm_mul_ps( dx, e2y ), _mm_mul_ps( dy, e2x ) );
+
+        __m128 const det = _mm_add_ps( _mm_add_ps( _mm_mul_ps( e1x, px ), _mm_mul_ps( e1y, py ) ), _mm_mul_ps( e1z, pz ) );
+        __m128 const absDet = _mm_andnot_ps( _mm_set1_ps( -0.f ), det );
+        __m128 const inv = _mm_div_ps( _mm_set1_ps( 1.f ), det );
+
+        // s = origin - v0
+        __m128 const sx = _mm_sub_ps( _mm_set1_ps( aRay.origin.x ), ld( 0 ) );
+        __m128 const sy = _mm_sub_ps( _mm_set1_ps( aRay.origin.y ), ld( 4 ) );
+        __m128 const sz = _mm_sub_ps( _mm_set1_ps( aRay.origin.z ), ld( 8 ) );
+
+        __m128 const uu = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( sx, px ), _mm_mul_ps( sy, py ) ), _mm_mul_ps( sz, pz ) ), inv );
+
+        // q = s x e1
+        __m128 const qx = _mm_sub_ps( _mm_mul_ps( sy, e1z ), _mm_mul_ps( sz, e1y ) );
+        __m128 const qy = _mm_sub_ps( _mm_mul_ps( sz, e1x ), _mm_mul_ps( sx, e1z ) );
+        __m128 const qz = _mm_sub_ps( _mm_mul_ps( sx, e1y ), _mm_mul_ps( sy, e1x ) );
+
+        __m128 const vv = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( dx, qx ), _mm_mul_ps( dy, qy ) ), _mm_mul_ps( dz, qz ) ), inv );
+        __m128 const tt = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( e2x, qx ), _mm_mul_ps( e2y, qy ) ), _mm_mul_ps( e2z, qz ) ), inv );
+
+        __m128 const zero = _mm_setzero_ps();
+        __m128 ok = _mm_cmpgt_ps( absDet, _mm_set1_ps( 1e-12f ) );
+        ok = _mm_and_ps( ok, _mm_cmpge_ps( uu, zero ) );
+        ok = _mm_and_ps( ok, _mm_cmpge_ps( vv, zero ) );
+        ok = _mm_and_ps( ok, _mm_cmple_ps( _mm_add_ps( uu, vv ), _mm_set1_ps( 1.f ) ) );
+        ok = _mm_and_ps( ok, _mm_cmpge_ps( tt, zero ) );
+        ok = _mm_and_ps( ok, _mm_cmple_ps( tt, _mm_set1_ps( aMaxT ) ) );
+
+        mask = _mm_movemask_ps( ok );
+        if (0 == mask)
+            return -1;
+
+        _mm_storeu_ps( t, tt );
+        _mm_storeu_ps( u, uu );
+        _mm_storeu_ps( v, vv );
+#		else // !BVH_USE_SSE
+        for (std::size_t i = 0; i < 4; ++i) {
+            Vec3f const v0{ aTris[i], aTris[i + 4], aTris[i + 8] };
+            Vec3f const e1{ aTris[i + 12], aTris[i + 16], aTris[i + 20] };
+            Vec3f const e2{ aTris[i + 24], aTris[i + 28], aTris[i + 32] };
+
+            Vec3f const p = cross( aRay.dir, e2 );
+            float const det = dot( e1, p );
+            if (std::abs( det ) <= 1e-12f)
+                continue;
+
+            float const inv = 1.f / det;
+            Vec3f const s = aRay.origin - v0;
+            Vec3f const q = cross( s, e1 );
+
+            u[i] = dot( s, p ) * inv;
+            v[i] = dot( aRay.dir, q ) * inv;
+            t[i] = dot( e2, q ) * inv;
+
+            if (u[i] >= 0.f && v[i] >= 0.f && u[i] + v[i] <= 1.f && t[i] >= 0.f && t[i] <= aMaxT)
+                mask |= 1 << i;
+        }
+#		endif // ~ BVH_USE_SSE
+
+        int best = -1;
+        for (int i = 0; i < 4; ++i) {
+            if ((mask & (1 << i)) && (best < 0 || t[i] < t[best]))
+                best = i;
+        }
+
+        if (best >= 0) {
+            aT = t[best];
+            aU = u[best];
+            aV = v[best];
+        }
+        return best;
+    }
+
+    // Four rays, SoA
+    struct alignas(16) RayPacket_
+    {
+        float ox[4], oy[4], oz[4];
+        float dx[4], dy[4], dz[4];
+        float ix[4], iy[4], iz[4];
+    };
+
+    RayPacket_ make_packet_( Vec3f const aOrigins[4], Vec3f const aDirs[4] ) noexcept
+    {
+        RayPacket_ ret;
+        for (std::size_t i = 0; i < 4; ++i) {
+            Ray_ const ray = make_ray_( aOrigins[i], aDirs[i] );
+
+            ret.ox[i] = ray.origin.x; ret.oy[i] = ray.origin.y; ret.oz[i] = ray.origin.z;
+            ret.dx[i] = ray.dir.x; ret.dy[i] = ray.dir.y; ret.dz[i] = ray.dir.z;
+            ret.ix[i] = ray.inv.x; ret.iy[i] = ray.inv.y; ret.iz[i] = ray.inv.z;
+        }
+        return ret;
+    }
+
+    // Slab test of four rays against box aBox of a node (layout as in
+    // hit_boxes_). Returns a bit mask of the rays that hit it within
+    // [0, aMaxT]; aNear receives each ray's entry distance.
+    int packet_hits_box_( float const* aBounds, std::uint32_t aBox, RayPacket_ const& aRays, float aMaxT, float aNear[4] ) noexcept
+    {
+#		if defined(BVH_USE_SSE)
+        auto const ld = [&] (float const* aLanes) { return _mm_load_ps( aLanes ); };
+        auto const bound = [&] (std::size_t aOffset) { return _mm_set1_ps( aBounds[aOffset + aBox] ); };
+
+        __m128 const ox = ld( aRays.ox ), oy = ld( aRays.oy ), oz = ld( aRays.oz );
+        __m128 const ix = ld( aRays.ix ), iy = ld( aRays.iy ), iz = ld( aRays.iz );
+
+        __m128 const t0x = _mm_mul_ps( _mm_sub_ps( bound( 0 ), ox ), ix );
+        __m128 const t0y = _mm_mul_ps( _mm_sub_ps( bound( 4 ), oy ), iy );
+        __m128 const t0z = _mm_mul_ps( _mm_sub_ps( bound( 8 ), oz ), iz );
+        __m128 const t1x = _mm_mul_ps( _mm_sub_ps( bound( 12 ), ox ), ix );
+        __m128 const t1y = _mm_mul_ps( _mm_sub_ps( bound( 16 ), oy ), iy );
+        __m128 const t1z = _mm_mul_ps( _mm_sub_ps( bound( 20 ), oz ), iz );
+
+        __m128 const tNear = _mm_max_ps(
+            _mm_max_ps( _mm_min_ps( t0x, t1x ), _mm_min_ps( t0y, t1y ) ),
+            _mm_max_ps( _mm_min_ps( t0z, t1z ), _mm_setzero_ps() )
+        );
+        __m128 const tFar = _mm_min_ps(
+            _mm_min_ps( _mm_max_ps( t0x, t1x ), _mm_max_ps( t0y, t1y ) ),
+            _mm_min_ps( _mm_max_ps( t0z, t1z ), _mm_set1_ps( aMaxT ) )
+        );
+
+        _mm_storeu_ps( aNear, tNear );
+        return _mm_movemask_ps( _mm_cmple_ps( tNear, tFar ) );
+#		else // !BVH_USE_SSE
+        int mask = 0;
+        for (std::size_t i = 0; i < 4; ++i) {
+            float const t0x = (aBounds[aBox +  0] - aRays.ox[i]) * aRays.ix[i];
+            float const t0y = (aBounds[aBox +  4] - aRays.oy[i]) * aRays.iy[i];
+            float const t0z = (aBounds[aBox +  8] - aRays.oz[i]) * aRays.iz[i];
+            float const t1x = (aBounds[aBox + 12] - aRays.ox[i]) * aRays.ix[i];
+            float const t1y = (aBounds[aBox + 16] - aRays.oy[i]) * aRays.iy[i];
+            float const t1z = (aBounds[aBox + 20] - aRays.oz[i]) * aRays.iz[i];
+
+            float const tNear = std::max( { std::min( t0x, t1x ), std::min( t0y, t1y ), std::min( t0z, t1z ), 0.f } );
+            float const tFar = std::min( { std::max( t0x, t1x ), std::max( t0y, t1y ), std::max( t0z, t1z ), aMaxT } );
+
+            aNear[i] = tNear;
+            if (tNear <= tFar)
+                mask |= 1 << i;
+        }
+        return mask;
+#		endif // ~ BVH_USE_SSE
+    }
+
+    // Möller-Trumbore of four rays against triangle aTri of a packet (layout
+    // as in hit_triangles_). Returns a bit mask of the rays that hit it with
+    // t in [0, aMaxT].
+    int packet_hits_triangle_( float const* aTris, std::uint32_t aTri, RayPacket_ const& aRays, float aMaxT ) noexcept
+    {
+#		if defined(BVH_USE_SSE)
+        auto const ld = [&] (float const* aLanes) { return _mm_load_ps( aLanes ); };
+        auto const tri = [&] (std::size_t aOffset) { return _mm_set1_ps( aTris[aOffset + aTri] ); };
+
+        __m128 const dx = ld( aRays.dx ), dy = ld( aRays.dy ), dz = ld( aRays.dz );
+        __m128 const e1x = tri( 12 ), e1y = tri( 16 ), e1z = tri( 20 );
+        __m128 const e2x = tri( 24 ), e2y = tri( 28 ), e2z = tri( 32 );
+
+        // p = dir x e2
+        __m128 const px = _mm_sub_ps( _mm_mul_ps( dy, e2z ), _mm_mul_ps( dz, e2y ) );
+        __m128 const py = _mm_sub_ps( _mm_mul_ps( dz, e2x ), _mm_mul_ps( dx, e2z ) );
+        __m128 const pz = _mm_sub_ps( _mm_mul_ps( dx, e2y ), _mm_mul_ps( dy, e2x ) );
+
+        __m128 const det = _mm_add_ps( _mm_add_ps( _mm_mul_ps( e1x, px ), _mm_mul_ps( e1y, py ) ), _mm_mul_ps( e1z, pz ) );
+        __m128 const absDet = _mm_andnot_ps( _mm_set1_ps( -0.f ), det );
+        __m128 const inv = _mm_div_ps( _mm_set1_ps( 1.f ), det );
+
+        // s = origin - v0
+        __m128 const sx = _mm_sub_ps( ld( aRays.ox ), tri( 0 ) );
+        __m128 const sy = _mm_sub_ps( ld( aRays.oy ), tri( 4 ) );
+        __m128 const sz = _mm_sub_ps( ld( aRays.oz ), tri( 8 ) );
+
+        __m128 const uu = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( sx, px ), _mm_mul_ps( sy, py ) ), _mm_mul_ps( sz, pz ) ), inv );
+
+        // q = s x e1
+        __m128 const qx = _mm_sub_ps( _mm_mul_ps( sy, e1z ), _mm_mul_ps( sz, e1y ) );
+        __m128 const qy = _mm_sub_ps( _mm_mul_ps( sz, e1x ), _mm_mul_ps( sx, e1z ) );
+        __m128 const qz = _mm_sub_ps( _mm_mul_ps( sx, e1y ), _mm_mul_ps( sy, e1x ) );
+
+        __m128 const vv = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( dx, qx ), _mm_mul_ps( dy, qy ) ), _mm_mul_ps( dz, qz ) ), inv );
+        __m128 const tt = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( e2x, qx ), _mm_mul_ps( e2y, qy ) ), _mm_mul_ps( e2z, qz ) ), inv );
+
+        __m128 const zero = _mm_setzero_ps();
+        __m128 ok = _mm_cmpgt_ps( absDet, _mm_set1_ps( 1e-12f ) );
+        ok = _mm_and_ps( ok, _mm_cmpge_ps( uu, zero ) );
+        ok = _mm_and_ps( ok, _mm_cmpge_ps( vv, zero ) );
+        ok = _mm_and_ps( ok, _mm_cmple_ps( _mm_add_ps( uu, vv ), _mm_set1_ps( 1.f ) ) );
+        ok = _mm_and_ps( ok, _mm_cmpge_ps( tt, zero ) );
+        ok = _mm_and_ps( ok, _mm_cmple_ps( tt, _mm_set1_ps( aMaxT ) ) );
+
+        return _mm_movemask_ps( ok );
+#		else // !BVH_USE_SSE
+        Vec3f const v0{ aTris[aTri], aTris[aTri + 4], aTris[aTri + 8] };
+        Vec3f const e1{ aTris[aTri + 12], aTris[aTri + 16], aTris[aTri + 20] };
+        Vec3f const e2{ aTris[aTri + 24], aTris[aTri + 28], aTris[aTri + 32] };
+
+        int mask = 0;
+        for (std::size_t i = 0; i < 4; ++i) {
+            Vec3f const dir{ aRays.dx[i], aRays.dy[i], aRays.dz[i] };
+
+            Vec3f const p = cross( dir, e2 );
+            float const det = dot( e1, p );
+            if (std::abs( det ) <= 1e-12f)
+                continue;
+
+            float const inv = 1.f / det;
+            Vec3f const s = Vec3f{ aRays.ox[i], aRays.oy[i], aRays.oz[i] } - v0;
+            Vec3f const q = cross( s, e1 );
+
+            float const u = dot( s, p ) * inv;
+            float const v = dot( dir, q ) * inv;
+            float const t = dot( e2, q ) * inv;
+
+            if (u >= 0.f && v >= 0.f && u + v <= 1.f && t >= 0.f && t <= aMaxT)
+                mask |= 1 << i;
+        }
+        return mask;
+#		endif // ~ BVH_USE_SSE
+    }
+
+    // Closest point on triangle a, a + e1, a + e2 to p
+    // Ericson, "Real-Time Collision Detection", 5.1.5
+    Vec3f closest_on_triangle_( Vec3f const& aP, Vec3f const& aA, Vec3f const& aE1, Vec3f const& aE2 ) noexcept
+    {
+        Vec3f const ap = aP - aA;
+        float const d1 = dot( aE1, ap );
+        float const d2 = dot( aE2, ap );
+        if (d1 <= 0.f && d2 <= 0.f)
+            return aA;
+
+        Vec3f const bp = ap - aE1;
+        float const d3 = dot( aE1, bp );
+        float const d4 = dot( aE2, bp );
+        if (d3 >= 0.f && d4 <= d3)
+            return aA + aE1;
+
+        float const vc = d1 * d4 - d3 * d2;
+        if (vc <= 0.f && d1 >= 0.f && d3 <= 0.f)
+            return aA + (d1 / (d1 - d3)) * aE1;
+
+        Vec3f const cp = ap - aE2;
+        float const d5 = dot( aE1, cp );
+        float const d6 = dot( aE2, cp );
+        if (d6 >= 0.f && d5 <= d6)
+            return aA + aE2;
+
+        float const vb = d5 * d2 - d1 * d6;
+        if (vb <= 0.f && d2 >= 0.f && d6 <= 0.f)
+            return aA + (d2 / (d2 - d6)) * aE2;
+
+        float const va = d3 * d6 - d5 * d4;
+        if (va <= 0.f && (d4 - d3) >= 0.f && (d5 - d6) >= 0.f) {
+            float const w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+            return aA + aE1 + w * (aE2 - aE1);
+        }
+
+        float const denom = 1.f / (va + vb + vc);
+        return aA + (vb * denom) * aE1 + (vc * denom) * aE2;
+    }
+}
+
+TriangleBvh::TriangleBvh(
+    std::vector<Vec3f> const& aPositions,
+    std::uint32_t const* aIndices,
+    std::size_t aIndexCount,
+    std::size_t aThreadCount
+)
+{
+    std::size_t const triangleCount = aIndexCount / 3;
+    if (0 == triangleCount)
+        return;
+
+    std::vector<Box_> boxes( triangleCount );
+    std::vector<Vec3f> centroids( triangleCount );
+    std::vector<std::uint32_t> ids( triangleCount );
+
+    for (std::size_t t = 0; t < triangleCount; ++t) {
+        for (std::size_t k = 0; k < 3; ++k)
+            boxes[t].grow( aPositions[aIndices[t * 3 + k]] );
+
+        centroids[t] = 0.5f * (boxes[t].lo + boxes[t].hi);
+        ids[t] = std::uint32_t(t);
+    }
+
+    // The top of the tree is split on this thread, until there are enough
+    // subtrees to keep every thread busy
+    aThreadCount = std::min( thread_count( aThreadCount ), shared_thread_pool().size() );
+
+    BinaryBuilder_ const builder( boxes, centroids, ids );
+
+    std::vector<BinaryNode_> nodes;
+    std::vector<BuildTask_> tasks;
+
+    std::size_t const taskSize = std::max<std::size_t>( 1024, triangleCount / (aThreadCount * 8) );
+    builder.build( nodes, 0, std::uint32_t(triangleCount), 0, &tasks, taskSize );
+
+    // Biggest subtrees first
+    std::sort( tasks.begin(), tasks.end(), [] (BuildTask_ const& a, BuildTask_ const& b) {
+        return a.count > b.count;
+    } );
+
+    parallel_for( tasks.size(), aThreadCount, [&] (std::size_t i) {
+        builder.build( tasks[i].nodes, tasks[i].first, tasks[i].count, tasks[i].depth );
+    } );
+
+    // Stitch the subtrees in. Their root replaces the placeholder node, the
+    // rest is appended.
+    for (auto& task : tasks) {
+        std::uint32_t const offset = std::uint32_t(nodes.size()) - 1;
+        auto const remap = [&] (std::uint32_t aIdx) { return 0 == aIdx ? task.node : aIdx + offset; };
+
+        for (std::size_t i = 0; i < task.nodes.size(); ++i) {
+            BinaryNode_ n = task.nodes[i];
+            if (0 == n.count) {
+                n.left = remap( n.left );
+                n.right = remap( n.right );
+            }
+
+            if (0 == i)
+                nodes[task.node] = n;
+            else
+                nodes.emplace_back( n );
+        }
+    }
+
+    mMin = nodes[0].box.lo;
+    mMax = nodes[0].box.hi;
+
+    // Collapse into the 4-wide tree. Each node takes its binary children and
+    // keeps opening the largest inner one until it has four.
+    auto const makePacket = [&] (BinaryNode_ const& aLeaf) {
+        Packet_ p{};
+        for (std::size_t i = 0; i < 4; ++i)
+            p.id[i] = kNoTriangle_;
+
+        for (std::uint32_t i = 0; i < aLeaf.count; ++i) {
+            std::uint32_t const t = ids[aLeaf.first + i];
+            Vec3f const& a = aPositions[aIndices[t * 3 + 0]];
+            Vec3f const e1 = aPositions[aIndices[t * 3 + 1]] - a;
+            Vec3f const e2 = aPositions[aIndices[t * 3 + 2]] - a;
+
+            p.v0X[i] = a.x;  p.v0Y[i] = a.y;  p.v0Z[i] = a.z;
+            p.e1X[i] = e1.x; p.e1Y[i] = e1.y; p.e1Z[i] = e1.z;
+            p.e2X[i] = e2.x; p.e2Y[i] = e2.y; p.e2Z[i] = e2.z;
+            p.id[i] = t;
+        }
+
+        mPackets.emplace_back( p );
+        return std::uint32_t(mPackets.size() - 1) | kLeafBit_;
+    };
+
+    mNodes.reserve( nodes.size() / 2 + 1 );
+    mPackets.reserve( triangleCount / 2 + 1 );
+
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> pending;     // Binary node, wide node
+    mNodes.emplace_back();
+    pending.emplace_back( 0, 0 );
+
+    while (!pending.empty()) {
+        auto const [bin, wide] = pending.back();
+        pending.pop_back();
+
+        std::uint32_t children[4];
+        std::uint32_t count = 0;
+
+        if (nodes[bin].count > 0) {
+            children[count++] = bin;    // Tiny mesh, the root is a leaf
+        }
+        else {
+            children[count++] = nodes[bin].left;
+            children[count++] = nodes[bin].right;
+
+            while (count < 4) {
+                int open = -1;
+                for (std::uint32_t i = 0; i < count; ++i) {
+                    if (0 == nodes[children[i]].count &&
+                        (open < 0 || nodes[children[i]].box.area() > nodes[children[open]].box.area()))
+                        open = int(i);
+                }
+
+                if (open < 0)
+                    break;
+
+                BinaryNode_ const& n = nodes[children[open]];
+                children[open] = n.left;
+                children[count++] = n.right;
+            }
+        }
+
+        Node_ node{};
+        node.childCount = count;
+
+        for (std::uint32_t i = 0; i < 4; ++i) {
+            // Unused slots are never looked at, but keep them tidy
+            Box_ const& box = i < count ? nodes[children[i]].box : nodes[0].box;
+            node.minX[i] = box.lo.x; node.minY[i] = box.lo.y; node.minZ[i] = box.lo.z;
+            node.maxX[i] = box.hi.x; node.maxY[i] = box.hi.y; node.maxZ[i] = box.hi.z;
+        }
+
+        for (std::uint32_t i = 0; i < count; ++i) {
+            if (nodes[children[i]].count > 0) {
+                node.child[i] = makePacket( nodes[children[i]] );
+            }
+            else {
+                node.child[i] = std::uint32_t(mNodes.size());
+                mNodes.emplace_back();
+                pending.emplace_back( children[i], node.child[i] );
+            }
+        }
+
+        mNodes[wide] = node;
+    }
+}
+
+bool TriangleBvh::raycast( Vec3f const& aOrigin, Vec3f const& aDir, float aMaxT, RayHit& aHit ) const
+{
+    if (mNodes.empty())
+        return false;
+
+    Ray_ const ray = make_ray_( aOrigin, aDir );
+
+    float best = aMaxT;
+    std::uint32_t bestPacket = 0;
+    int bestLane = -1;
+    float bestU = 0.f, bestV = 0.f;
+
+    // Entries remember how far away their box was, so that ones behind the
+    // current hit are dropped without looking at them again
+    struct Entry { std::uint32_t child; float near; };
+    Entry stack[kStackSize_];
+    std::size_t top = 0;
+
+    stack[top++] = Entry{ 0, 0.f };
+
+    while (top > 0) {
+        Entry const e = stack[--top];
+        if (e.near > best)
+            continue;
+
+        if (e.child & kLeafBit_) {
+            std::uint32_t const packet = e.child & ~kLeafBit_;
+
+            float t, u, v;
+            int const lane = hit_triangles_( mPackets[packet].v0X, ray, best, t, u, v );
+            if (lane >= 0) {
+                best = t;
+                bestPacket = packet;
+                bestLane = lane;
+                bestU = u;
+                bestV = v;
+            }
+            continue;
+        }
+
+        Node_ const& node = mNodes[e.child];
+
+        float near[4];
+        int const mask = hit_boxes_( node.minX, node.childCount, ray, best, near );
+
+        // Push far to near, so the nearest child is visited first
+        Entry hits[4];
+        std::size_t count = 0;
+
+        for (std::uint32_t i = 0; i < node.childCount; ++i) {
+            if (mask & (1 << i))
+                hits[count++] = Entry{ node.child[i], near[i] };
+        }
+
+        for (std::size_t i = 1; i < count; ++i) {
+            for (std::size_t j = i; j > 0 && hits[j - 1].near < hits[j].near; --j)
+                std::swap( hits[j - 1], hits[j] );
+        }
+
+        for (std::size_t i = 0; i < count; ++i)
+            stack[top++] = hits[i];
+    }
+
+    if (bestLane < 0)
+        return false;
+
+    Packet_ const& p = mPackets[bestPacket];
+    Vec3f const e1{ p.e1X[bestLane], p.e1Y[bestLane], p.e1Z[bestLane] };
+    Vec3f const e2{ p.e2X[bestLane], p.e2Y[bestLane], p.e2Z[bestLane] };
+
+    Vec3f n = normalize( cross( e1, e2 ) );
+    if (dot( n, aDir ) > 0.f)
+        n = -n;
+
+    aHit = RayHit{ p.id[bestLane], best, bestU, bestV, aOrigin + best * aDir, n };
+    return true;
+}
+
+unsigned TriangleBvh::occluded4( Vec3f const aOrigins[4], Vec3f const aDirs[4], float aMaxT ) const
+{
+    if (mNodes.empty())
+        return 0;
+
+    RayPacket_ const rays = make_packet_( aOrigins, aDirs );
+
+    // Entries remember which rays made it into their box. Rays that have hit
+    // something are dropped from everything still on the stack.
+    struct Entry { std::uint32_t child; int rays; };
+    Entry stack[kStackSize_];
+    std::size_t top = 0;
+
+    stack[top++] = Entry{ 0, 0xf };
+
+    int hit = 0;
+    while (top > 0 && 0xf != hit) {
+        Entry const e = stack[--top];
+
+        int const active = e.rays & ~hit;
+        if (0 == active)
+            continue;
+
+        // Once the rays have gone their separate ways, a ray on its own is
+        // better off testing four boxes or triangles at a time
+        int const single = 0 == (active & (active - 1)) ? std::countr_zero( unsigned(active) ) : -1;
+        Ray_ const ray = single < 0 ? Ray_{} : Ray_{
+            Vec3f{ rays.ox[single], rays.oy[single], rays.oz[single] },
+            Vec3f{ rays.dx[single], rays.dy[single], rays.dz[single] },
+            Vec3f{ rays.ix[single], rays.iy[single], rays.iz[single] }
+        };
+
+        if (e.child & kLeafBit_) {
+            Packet_ const& p = mPackets[e.child & ~kLeafBit_];
+
+            if (single >= 0) {
+                float t, u, v;
+                if (hit_triangles_( p.v0X, ray, aMaxT, t, u, v ) >= 0)
+                    hit |= active;
+                continue;
+            }
+
+            for (std::uint32_t i = 0; i < 4 && kNoTriangle_ != p.id[i]; ++i) {
+                hit |= packet_hits_triangle_( p.v0X, i, rays, aMaxT ) & active;
+                if (active == (hit & active))
+                    break;
+            }
+            continue;
+        }
+
+        Node_ const& node = mNodes[e.child];
+
+        // Visit the children in the order the rays reach them, which finds
+        // the (any) hits sooner
+        Entry hits[4];
+        float nearest[4];
+        std::size_t count = 0;
+
+        auto const insert = [&] (Entry const& aEntry, float aNear) {
+            std::size_t j = count++;
+            for (; j > 0 && nearest[j - 1] < aNear; --j) {
+                hits[j] = hits[j - 1];
+                nearest[j] = nearest[j - 1];
+            }
+            hits[j] = aEntry;
+            nearest[j] = aNear;
+        };
+
+        if (single >= 0) {
+            float near[4];
+            int const mask = hit_boxes_( node.minX, node.childCount, ray, aMaxT, near );
+
+            for (std::uint32_t i = 0; i < node.childCount; ++i) {
+                if (mask & (1 << i))
+                    insert( Entry{ node.child[i], active }, near[i] );
+            }
+        }
+        else {
+            for (std::uint32_t i = 0; i < node.childCount; ++i) {
+                float near[4];
+                int const inside = packet_hits_box_( node.minX, i, rays, aMaxT, near ) & active;
+                if (!inside)
+                    continue;
+
+                // Any one of the rays will do for the order
+                insert( Entry{ node.child[i], inside }, near[std::countr_zero( unsigned(inside) )] );
+            }
+        }
+
+        for (std::size_t i = 0; i < count; ++i)
+            stack[top++] = hits[i];
+    }
+
+    return unsigned(hit);
+}
+
+bool TriangleBvh::closest_point( Vec3f const& aPoint, float aMaxDistance, SurfacePoint& aOut ) const
+{
+    if (mNodes.empty())
+        return false;
+
+    float best2 = aMaxDistance * aMaxDistance;
+    bool found = false;
+
+    struct Entry { std::uint32_t child; float dist2; };
+    Entry stack[kStackSize_];
+    std::size_t top = 0;
+
+    stack[top++] = Entry{ 0, 0.f };
+
+    while (top > 0) {
+        Entry const e = stack[--top];
+        if (e.dist2 > best2)
+            continue;
+
+        if (e.child & kLeafBit_) {
+            Packet_ const& p = mPackets[e.child & ~kLeafBit_];
+
+            for (std::size_t i = 0; i < 4 && kNoTriangle_ != p.id[i]; ++i) {
+                Vec3f const q = closest_on_triangle_(
+                    aPoint,
+                    Vec3f{ p.v0X[i], p.v0Y[i], p.v0Z[i] },
+                    Vec3f{ p.e1X[i], p.e1Y[i], p.e1Z[i] },
+                    Vec3f{ p.e2X[i], p.e2Y[i], p.e2Z[i] }
+                );
+
+                Vec3f const d = q - aPoint;
+                float const dist2 = dot( d, d );
+
+                if (dist2 <= best2) {
+                    best2 = dist2;
+                    aOut.triangle = p.id[i];
+                    aOut.position = q;
+                    found = true;
+                }
+            }
+            continue;
+        }
+
+        Node_ const& node = mNodes[e.child];
+
+        float dist2[4];
+        box_distances_( node.minX, aPoint, dist2 );
+
+        Entry hits[4];
+        std::size_t count = 0;
+
+        for (std::uint32_t i = 0; i < node.childCount; ++i) {
+            if (dist2[i] <= best2)
+                hits[count++] = Entry{ node.child[i], dist2[i] };
+        }
+
+        for (std::size_t i = 1; i < count; ++i) {
+            for (std::size_t j = i; j > 0 && hits[j - 1].dist2 < hits[j].dist2; --j)
+                std::swap( hits[j - 1], hits[j] );
+        }
+
+        for (std::size_t i = 0; i < count; ++i)
+            stack[top++] = hits[i];
+    }
+
+    if (found)
+        aOut.distance = std::sqrt( best2 );
+
+    return found;
+}
+
+std::size_t TriangleBvh::overlap_sphere( Vec3f const& aCenter, float aRadius, std::vector<std::uint32_t>& aOut ) const
+{
+    if (mNodes.empty())
+        return 0;
+
+    float const r2 = aRadius * aRadius;
+    std::size_t const before = aOut.size();
+
+    std::uint32_t stack[kStackSize_];
+    std::size_t top = 0;
+
+    stack[top++] = 0;
+
+    while (top > 0) {
+        std::uint32_t const child = stack[--top];
+
+        if (child & kLeafBit_) {
+            Packet_ const& p = mPackets[child & ~kLeafBit_];
+
+            for (std::size_t i = 0; i < 4 && kNoTriangle_ != p.id[i]; ++i) {
+                Vec3f const q = closest_on_triangle_(
+                    aCenter,
+                    Vec3f{ p.v0X[i], p.v0Y[i], p.v0Z[i] },
+                    Vec3f{ p.e1X[i], p.e1Y[i], p.e1Z[i] },
+                    Vec3f{ p.e2X[i], p.e2Y[i], p.e2Z[i] }
+                );
+
+                Vec3f const d = q - aCenter;
+                if (dot( d, d ) <= r2)
+                    aOut.emplace_back( p.id[i] );
+            }
+            continue;
+        }
+
+        Node_ const& node = mNodes[child];
+
+        float dist2[4];
+        box_distances_( node.minX, aCenter, dist2 );
+
+        for (std::uint32_t i = 0; i < node.childCount; ++i) {
+            if (dist2[i] <= r2)
+                stack[top++] = node.child[i];
+        }
+    }
+
+    return aOut.size() - before;
+}
@@ -0,0 +1,122 @@
+#ifndef BVH_HPP_6C1F48A2_D93E_4B07_8A5C_2E97B0F3D418
+#define BVH_HPP_6C1F48A2_D93E_4B07_8A5C_2E97B0F3D418
+
+#include <vector>
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "../vmlib/vec3.hpp"
+
+/*
+ *  === Triangle BVH ===
+ *  https://jacco.ompf2.com/2022/04/13/how-to-build-a-bvh-part-1-basics/
+ *  Wald, "On fast Construction of SAH-based Bounding Volume Hierarchies"
+ *  https://www.sci.utah.edu/~wald/Publications/2007/ParallelBVHBuild/fastbuild.pdf
+ *
+ *  A bounding volume hierarchy over a triangle mesh, for the queries that
+ *  would otherwise need a scan over every triangle: ray casts (picking),
+ *  occlusion rays (baking), closest points and sphere overlaps (collision
+ *  and proximity tests).
+ *
+ *  The tree is first built as a binary tree with binned SAH. The top few
+ *  levels are split on one thread, the subtrees below them are built in
+ *  parallel. The binary tree is then collapsed into a 4-wide tree, so that a
+ *  node's four child boxes can be tested with one set of SSE instructions.
+ *  Occlusion queries go the other way around and test packets of four rays
+ *  against one box or triangle at a time.
+ *  Leaves hold up to four triangles, stored pre-transformed (one vertex and
+ *  two edges) and interleaved so that they can be intersected together too.
+ *  Without SSE the same layout is walked with plain loops.
+ *
+ *  The BVH keeps its own copy of the triangles; the mesh it was built from
+ *  can go away afterwards. Triangle ids are the triangle's position in the
+ *  index range that was passed in (index / 3).
+ */
+
+struct RayHit
+{
+    std::uint32_t triangle;
+    float t;            // Distance along the ray, in units of the direction
+    float u, v;         // Barycentrics of the triangle's 2nd and 3rd vertex
+    Vec3f position;
+    Vec3f normal;       // Geometric normal, unit length, facing the ray
+};
+
+struct SurfacePoint
+{
+    std::uint32_t triangle;
+    Vec3f position;
+    float distance;
+};
+
+class TriangleBvh
+{
+public:
+    TriangleBvh() = default;
+
+    // aThreadCount = 0 uses all hardware threads.
+    TriangleBvh(
+        std::vector<Vec3f> const& aPositions,
+        std::uint32_t const* aIndices,
+        std::size_t aIndexCount,
+        std::size_t aThreadCount = 0
+    );
+
+    bool empty() const noexcept { return mNodes.empty(); }
+    std::size_t node_count() const noexcept { return mNodes.size(); }
+
+    Vec3f const& bounds_min() const noexcept { return mMin; }
+    Vec3f const& bounds_max() const noexcept { return mMax; }
+
+    // First hit along aOrigin + t * aDir, 0 <= t <= aMaxT. aDir doesn't need
+    // to be normalized. Both sides of the triangles count.
+    bool raycast( Vec3f const& aOrigin, Vec3f const& aDir, float aMaxT, RayHit& aHit ) const;
+
+    // Whether anything is hit along aOrigins[i] + t * aDirs[i], 0 <= t <=
+    // aMaxT, for four rays at once. Returns a bit mask of the rays that hit.
+    // The rays go down the tree together and stop at their first hit, which
+    // is a lot cheaper than four raycast()s when they start close together
+    // (shadow and occlusion rays).
+    unsigned occluded4( Vec3f const aOrigins[4], Vec3f const aDirs[4], float aMaxT ) const;
+
+    // Closest point on the mesh that is at most aMaxDistance away.
+    bool closest_point( Vec3f const& aPoint, float aMaxDistance, SurfacePoint& aOut ) const;
+
+    // Appends every triangle that touches the sphere to aOut and returns how
+    // many were added.
+    std::size_t overlap_sphere( Vec3f const& aCenter, float aRadius, std::vector<std::uint32_t>& aOut ) const;
+
+private:
+    // Four child boxes, SoA. Children at or above mChildCount are unused.
+    struct alignas(16) Node_
+    {
+        float minX[4], minY[4], minZ[4];
+        float maxX[4], maxY[4], maxZ[4];
+
+        std::uint32_t child[4];     // Node index, or packet index | kLeafBit_
+        std::uint32_t childCount;
+    };
+
+    // Up to four triangles, SoA. Unused slots have id kNoTriangle_ and zero
+    // edges, so they never report a hit.
+    struct alignas(16) Packet_
+    {
+        float v0X[4], v0Y[4], v0Z[4];
+        float e1X[4], e1Y[4], e1Z[4];
+        float e2X[4], e2Y[4], e2Z[4];
+
+        std::uint32_t id[4];
+    };
+
+    static constexpr std::uint32_t kLeafBit_ = 0x80000000u;
+    static constexpr std::uint32_t kNoTriangle_ = 0xffffffffu;
+
+    std::vector<Node_> mNodes;      // mNodes[0] is the root
+    std::vector<Packet_> mPackets;
+
+    Vec3f mMin{ 0.f, 0.f, 0.f };
+    Vec3f mMax{ 0.f, 0.f, 0.f };
+};
+
+#endif // BVH_HPP_6C1F48A2_D93E_4B07_8A5C_2E97B0F3D418
@@ -0,0 +1,245 @@
+#include "draw_batch.hpp"
+
+#include <bit>
+#include <numeric>
+#include <utility>
+#include <algorithm>
+
+#include <cassert>
+#include <cstring>
+
+#include "../support/gl_state.hpp"
+#include "../support/gl_resources.hpp"
+
+static_assert( sizeof(DrawRecord) == 144, "DrawRecord must match the std140/std430 layout" );
+
+DrawRecord make_draw_record( Mat44f const& aModel2World, Mat44f const& aNormalMatrix, std::uint32_t aFlags, std::int32_t aNormalMapLayer, MeshRange const& aMesh )
+{
+    DrawRecord ret;
+    ret.model2world = aModel2World;
+    ret.normalMatrix = aNormalMatrix;
+    ret.flags = aFlags;
+    ret.normalMapLayer = aNormalMapLayer;
+    ret.vertexOffset = aMesh.vertexOffset;
+    ret.paletteIndex = 0;
+
+    if (kVertexPacked == aMesh.format)
+        ret.flags |= kDrawPackedVertices;
+
+    return ret;
+}
+
+DrawBatch::DrawBatch( GLuint aVao, bool aIndirect )
+    : mVao( aVao )
+    , mIndirect( aIndirect )
+{
+    // The records and commands go into the frame's stream buffer, and the
+    // record id buffer is created once there are draws, see
+    // reserve_record_ids_()
+}
+
+DrawBatch::~DrawBatch()
+{
+    if (mRecordIdBuffer)
+        glDeleteBuffers( 1, &mRecordIdBuffer );
+}
+
+DrawBatch::DrawBatch( DrawBatch&& aOther ) noexcept
+    : mVao( std::exchange( aOther.mVao, 0 ) )
+    , mIndirect( aOther.mIndirect )
+    , mRecordIdBuffer( std::exchange( aOther.mRecordIdBuffer, 0 ) )
+    , mRecordIdCapacity( std::exchange( aOther.mRecordIdCapacity, 0 ) )
+    , mRecordIdDivisor( std::exchange( aOther.mRecordIdDivisor, 1 ) )
+    , mRecords( std::move(aOther.mRecords) )
+    , mCommands( std::move(aOther.mCommands) )
+    , mUploaded( std::exchange( aOther.mUploaded, 0 ) )
+    , mViewCount( aOther.mViewCount )
+    , mStream( aOther.mStream )
+    , mRecordOffset( aOther.mRecordOffset )
+    , mRecordSize( aOther.mRecordSize )
+    , mCommandOffset( aOther.mCommandOffset )
+{}
+
+DrawBatch& DrawBatch::operator=( DrawBatch&& aOther ) noexcept
+{
+    std::swap( mVao, aOther.mVao );
+    std::swap( mIndirect, aOther.mIndirect );
+    std::swap( mRecordIdBuffer, aOther.mRecordIdBuffer );
+    std::swap( mRecordIdCapacity, aOther.mRecordIdCapacity );
+    std::swap( mRecordIdDivisor, aOther.mRecordIdDivisor );
+    std::swap( mRecords, aOther.mRecords );
+    std::swap( mCommands, aOther.mCommands );
+    std::swap( mUploaded, aOther.mUploaded );
+    std::swap( mViewCount, aOther.mViewCount );
+    std::swap( mStream, aOther.mStream );
+    std::swap( mRecordOffset, aOther.mRecordOffset );
+    std::swap( mRecordSize, aOther.mRecordSize );
+    std::swap( mCommandOffset, aOther.mCommandOffset );
+    return *this;
+}
+
+void DrawBatch::clear() noexcept
+{
+    mRecords.clear();
+    mCommands.clear();
+    mUploaded = 0;
+}
+
+GLuint DrawBatch::add_records( DrawRecord const* aRecords, std::size_t aCount )
+{
+    GLuint const first = GLuint(mRecords.size());
+    mRecords.insert( mRecords.end(), aRecords, aRecords + aCount );
+    return first;
+}
+
+void DrawBatch::add_draw( GLuint aFirstIndex, GLsizei aIndexCount, GLint aBaseVertex, GLuint aRecord, GLsizei aInstances )
+{
+    assert( aRecord + GLuint(aInstances) <= mRecords.size() );
+
+    if (0 == aIndexCount || 0 == aInstances)
+        return;
+
+    mCommands.emplace_back( Command_{ GLuint(aIndexCount), GLuint(aInstances), aFirstIndex, aBaseVertex, aRecord } );
+}
+
+void DrawBatch::add_draw( MeshRange const& aRange, GLuint aRecord, GLsizei aInstances )
+{
+    add_draw( aRange.firstIndex, aRange.indexCount, aRange.baseVertex, aRecord, aInstances );
+}
+
+void DrawBatch::upload( StreamBuffer& aStream, GLuint aViewCount )
+{
+    mUploaded = mCommands.size();
+    mViewCount = aViewCount;
+    mStream = aStream.buffer();
+
+    if (mCommands.empty())
+        return;
+
+    if (mIndirect) {
+        reserve_record_ids_( mRecords.size() );
+
+        // Every view gets its own copy of each instance. The record index
+        // only moves on with the object instance.
+        if (aViewCount != mRecordIdDivisor) {
+            set_vertex_divisor( mVao, kDrawRecordLocation, aViewCount );
+            mRecordIdDivisor = aViewCount;
+        }
+
+        auto const records = stream_( aStream, mRecords.data(), mRecords.size() * sizeof(DrawRecord) );
+        auto const commands = aStream.allocate( GLsizeiptr(mCommands.size() * sizeof(Command_)) );
+
+        auto* out = static_cast<Command_*>( commands.data );
+        for (auto const& cmd : mCommands) {
+            *out = cmd;
+            out->instanceCount *= aViewCount;
+            ++out;
+        }
+        aStream.flush( commands );
+
+        mRecordOffset = records.offset;
+        mRecordSize = records.size;
+        mCommandOffset = commands.offset;
+        return;
+    }
+
+    assert( mRecords.size() <= kMaxFallbackDrawRecords );
+    std::size_t const records = std::min( mRecords.size(), kMaxFallbackDrawRecords );
+
+    // The uniform block is always bound in full
+    auto const block = aStream.allocate( kMaxFallbackDrawRecords * sizeof(DrawRecord) );
+    std::memcpy( block.data, mRecords.data(), records * sizeof(DrawRecord) );
+    aStream.flush( block );
+
+    mRecordOffset = block.offset;
+    mRecordSize = block.size;
+}
+
+std::size_t DrawBatch::draw()
+{
+    if (0 == mUploaded)
+        return 0;
+
+    gl_state().bind_vertex_array( mVao );
+
+    if (mIndirect) {
+        glBindBufferRange( GL_SHADER_STORAGE_BUFFER, kDrawRecordBinding, mStream, mRecordOffset, mRecordSize );
+
+        glBindBuffer( GL_DRAW_INDIRECT_BUFFER, mStream );
+        glMultiDrawElementsIndirect( GL_TRIANGLES, GL_UNSIGNED_INT, (void const*)mCommandOffset, GLsizei(mUploaded), 0 );
+        glBindBuffer( GL_DRAW_INDIRECT_BUFFER, 0 );
+        return 1;
+    }
+
+    glBindBufferRange( GL_UNIFORM_BUFFER, kDrawRecordBinding, mStream, mRecordOffset, mRecordSize );
+
+    std::size_t calls = 0;
+    for (std::size_t i = 0; i < mUploaded; ) {
+        Command_ const& cmd = mCommands[i];
+        glVertexAttribI1ui( kDrawRecordLocation, cmd.baseInstance );
+
+        // With several views, every draw is instanced
+        if (cmd.instanceCount * mViewCount > 1) {
+            glDrawElementsInstancedBaseVertex(
+                GL_TRIANGLES, GLsizei(cmd.count), GL_UNSIGNED_INT,
+                (void const*)(cmd.firstIndex * sizeof(std::uint32_t)),
+                GLsizei(cmd.instanceCount * mViewCount), cmd.baseVertex
+            );
+            ++i;
+        }
+        else {
+            // Everything up to the next record change goes in one call
+            mCounts.clear();
+            mOffsets.clear();
+            mBaseVertices.clear();
+
+            for (; i < mUploaded && 1 == mCommands[i].instanceCount && cmd.baseInstance == mCommands[i].baseInstance; ++i) {
+                mCounts.emplace_back( GLsizei(mCommands[i].count) );
+                mOffsets.emplace_back( (void const*)(mCommands[i].firstIndex * sizeof(std::uint32_t)) );
+                mBaseVertices.emplace_back( mCommands[i].baseVertex );
+            }
+
+            glMultiDrawElementsBaseVertex(
+                GL_TRIANGLES, mCounts.data(), GL_UNSIGNED_INT,
+                mOffsets.data(), GLsizei(mCounts.size()), mBaseVertices.data()
+            );
+        }
+
+        ++calls;
+    }
+
+    return calls;
+}
+
+std::size_t DrawBatch::submit( StreamBuffer& aStream, GLuint aViewCount )
+{
+    upload( aStream, aViewCount );
+    return draw();
+}
+
+StreamBuffer::Allocation DrawBatch::stream_( StreamBuffer& aStream, void const* aData, std::size_t aBytes )
+{
+    auto const ret = aStream.allocate( GLsizeiptr(aBytes) );
+    std::memcpy( ret.data, aData, aBytes );
+    aStream.flush( ret );
+    return ret;
+}
+
+void DrawBatch::reserve_record_ids_( std::size_t aCount )
+{
+    if (aCount <= mRecordIdCapacity)
+        return;
+
+    mRecordIdCapacity = std::bit_ceil( std::max<std::size_t>( aCount, 64 ) );
+
+    std::vector<std::uint32_t> ids( mRecordIdCapacity );
+    std::iota( ids.begin(), ids.end(), 0u );
+
+    // Immutable, so growing means a new buffer that the attribute moves to
+    if (mRecordIdBuffer)
+        glDeleteBuffers( 1, &mRecordIdBuffer );
+    mRecordIdBuffer = create_buffer( GLsizeiptr(ids.size() * sizeof(std::uint32_t)), ids.data() );
+
+    set_vertex_attribute_integer( mVao, kDrawRecordLocation, mRecordIdBuffer, 0, 0, 1, GL_UNSIGNED_INT );
+    set_vertex_divisor( mVao, kDrawRecordLocation, mRecordIdDivisor );
+}
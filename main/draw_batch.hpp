@@ -0,0 +1,185 @@
+#ifndef DRAW_BATCH_HPP_6F1C9A3E_2D84_4B57_8E06_C93A5D7B1E42
+#define DRAW_BATCH_HPP_6F1C9A3E_2D84_4B57_8E06_C93A5D7B1E42
+
+#include <glad/glad.h>
+
+#include <vector>
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "shared_geometry.hpp"
+
+#include "../support/stream_buffer.hpp"
+
+#include "../vmlib/mat44.hpp"
+
+/*
+ *  === Draw batches / multi-draw indirect ===
+ *  https://www.khronos.org/opengl/wiki/Vertex_Rendering#Indirect_rendering
+ *  https://www.khronos.org/opengl/wiki/Shader_Storage_Buffer_Object
+ *
+ *  All static meshes live in one SharedGeometry (see shared_geometry.hpp):
+ *  one set of vertex buffers and one index buffer behind a single VAO, with
+ *  each mesh at its own index range and base vertex.
+ *
+ *  A frame's opaque draws are collected into a DrawBatch. Each draw is an
+ *  indirect command (an index range plus an instance count) and points at a
+ *  DrawRecord with its transforms and per-draw switches. Draws may share a
+ *  record, e.g. all terrain meshlets of one LOD do.
+ *
+ *  With GL 4.3 the records go into a shader storage buffer and the whole
+ *  batch is one glMultiDrawElementsIndirect(). gl_DrawID needs GL 4.6, so
+ *  the record index comes in through the command's baseInstance instead:
+ *  attribute kDrawRecordLocation reads an identity buffer with a divisor of
+ *  1, so instance i of a command sees record baseInstance + i. Instanced
+ *  draws thus use consecutive records, one per instance. Drawing several
+ *  views in one pass multiplies the instances by the view count, and the
+ *  divisor along with them.
+ *
+ *  4.1 contexts (macOS) have neither storage buffers nor baseInstance. There
+ *  the records go into a uniform block instead, and the batch is a loop of
+ *  glMultiDrawElementsBaseVertex() calls, one per run of draws that share a
+ *  record. The attribute is disabled and set with glVertexAttribI1ui(); the
+ *  shader adds gl_InstanceID itself.
+ *
+ *  Either way the records and commands are rewritten every frame, so they
+ *  go into the frame's region of a StreamBuffer (see stream_buffer.hpp)
+ *  and are bound from there with glBindBufferRange().
+ *
+ *  A batch is a recorded command list: index ranges and record offsets,
+ *  nothing that depends on the camera. upload() writes it out once per
+ *  frame, and draw() replays it as often as needed. Each view of the frame
+ *  replays the same batch with only its ViewBlock changed.
+ */
+
+// Where the records go. A shader storage buffer binding with GL 4.3, a
+// uniform buffer binding otherwise (see uniform_blocks.hpp for the others).
+constexpr GLuint kDrawRecordBinding = 3;
+
+// Attribute that carries the record index. It used to hold per-instance
+// transforms, which are now part of the records.
+constexpr GLuint kDrawRecordLocation = 9;
+
+// Room in the uniform block fallback. Must match MAX_DRAW_RECORDS in
+// default.vert.
+constexpr std::size_t kMaxFallbackDrawRecords = 64;
+
+// DrawRecord::flags
+enum DrawFlags : std::uint32_t
+{
+    kDrawTextured       = 1u << 0,      // uTexture
+    kDrawPalette        = 1u << 1,      // PartPalette, see vehicle.hpp
+    kDrawNormalMap      = 1u << 2,      // uNormalMap, layer normalMapLayer
+    kDrawLightmap       = 1u << 3,      // uLightmap
+    kDrawPackedVertices = 1u << 4       // kVertexPacked, with vertex pulling
+};
+
+// Laid out like DrawRecord in default.vert. std140 and std430 agree on this
+// one, so the same bytes work for both the storage buffer and the uniform
+// block.
+struct DrawRecord
+{
+    Mat44f model2world;
+    Mat44f normalMatrix;            // Only the upper 3x3 is used
+    std::uint32_t flags;            // DrawFlags
+    std::int32_t normalMapLayer;
+    std::uint32_t vertexOffset;     // Vertex pulling only, see MeshRange
+    std::uint32_t paletteIndex;     // kDrawPalette only, see vehicle.hpp
+};
+
+// A record for drawing aMesh. Fills in where its vertices are, for vertex
+// pulling.
+DrawRecord make_draw_record(
+    Mat44f const& aModel2World,
+    Mat44f const& aNormalMatrix,
+    std::uint32_t aFlags,
+    std::int32_t aNormalMapLayer,
+    MeshRange const& aMesh
+);
+
+class DrawBatch
+{
+public:
+    DrawBatch() = default;
+
+    // aIndirect selects the GL 4.3 path. The VAO is the one all draws use.
+    DrawBatch( GLuint aVao, bool aIndirect );
+    ~DrawBatch();
+
+    DrawBatch( DrawBatch const& ) = delete;
+    DrawBatch& operator=( DrawBatch const& ) = delete;
+
+    DrawBatch( DrawBatch&& ) noexcept;
+    DrawBatch& operator=( DrawBatch&& ) noexcept;
+
+    bool indirect() const noexcept { return mIndirect; }
+
+    void clear() noexcept;
+
+    // Adds aCount consecutive records and returns the index of the first
+    GLuint add_records( DrawRecord const*, std::size_t aCount = 1 );
+
+    // Draws aInstances instances of the index range; instance i uses record
+    // aRecord + i
+    void add_draw( GLuint aFirstIndex, GLsizei aIndexCount, GLint aBaseVertex, GLuint aRecord, GLsizei aInstances = 1 );
+    void add_draw( MeshRange const&, GLuint aRecord, GLsizei aInstances = 1 );
+
+    std::size_t record_count() const noexcept { return mRecords.size(); }
+    std::size_t draw_count() const noexcept { return mCommands.size(); }
+
+    // Writes the records (and commands) to aStream, with every draw once
+    // for each of the aViewCount views in the bound ViewBlock (see
+    // multi_view.hpp). Once per frame, after the last add_draw().
+    void upload( StreamBuffer& aStream, GLuint aViewCount = 1 );
+
+    // Draws what was uploaded. May be called any number of times, e.g. once
+    // per view with that view's ViewBlock bound; nothing is rewritten.
+    // Expects the shader program to be bound. Returns the number of GL draw
+    // calls it took.
+    std::size_t draw();
+
+    // upload() and draw()
+    std::size_t submit( StreamBuffer& aStream, GLuint aViewCount = 1 );
+
+private:
+    // Laid out like DrawElementsIndirectCommand
+    struct Command_
+    {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+
+    // Copies aData into a new allocation of aStream
+    static StreamBuffer::Allocation stream_( StreamBuffer&, void const* aData, std::size_t aBytes );
+
+    void reserve_record_ids_( std::size_t );
+
+    GLuint mVao = 0;
+    bool mIndirect = false;
+
+    GLuint mRecordIdBuffer = 0;         // GL 4.3 only, 0, 1, 2, ...
+    std::size_t mRecordIdCapacity = 0;
+    GLuint mRecordIdDivisor = 1;        // The view count
+
+    std::vector<DrawRecord> mRecords;
+    std::vector<Command_> mCommands;
+
+    // Where upload() put things
+    std::size_t mUploaded = 0;          // Commands
+    GLuint mViewCount = 1;
+    GLuint mStream = 0;
+    GLintptr mRecordOffset = 0;
+    GLsizeiptr mRecordSize = 0;
+    GLintptr mCommandOffset = 0;        // GL 4.3 only
+
+    // Scratch space for the fallback's multi-draws
+    std::vector<GLsizei> mCounts;
+    std::vector<void const*> mOffsets;
+    std::vector<GLint> mBaseVertices;
+};
+
+#endif // DRAW_BATCH_HPP_6F1C9A3E_2D84_4B57_8E06_C93A5D7B1E42
@@ -0,0 +1,54 @@
+#include "frustum.hpp"
+
+Frustum make_frustum( Mat44f const& aProjCameraWorld ) noexcept
+{
+    auto const row = [&] (std::size_t i) {
+        return Vec4f{ aProjCameraWorld(i, 0), aProjCameraWorld(i, 1), aProjCameraWorld(i, 2), aProjCameraWorld(i, 3) };
+    };
+
+    Vec4f const r0 = row( 0 ), r1 = row( 1 ), r2 = row( 2 ), r3 = row( 3 );
+
+    Frustum ret{ {
+        r3 + r0, r3 - r0,   // Left, right
+        r3 + r1, r3 - r1,   // Bottom, top
+        r3 + r2, r3 - r2    // Near, far
+    } };
+
+    // Normalize, so that the plane equation gives real distances (needed for
+    // the sphere test)
+    for (auto& p : ret.planes) {
+        float const len = length( Vec3f{ p.x, p.y, p.z } );
+        if (len > 0.f)
+            p /= len;
+    }
+
+    return ret;
+}
+
+bool intersects_sphere( Frustum const& aFrustum, Vec3f const& aCenter, float aRadius ) noexcept
+{
+    for (auto const& p : aFrustum.planes) {
+        if (p.x * aCenter.x + p.y * aCenter.y + p.z * aCenter.z + p.w < -aRadius)
+            return false;
+    }
+
+    return true;
+}
+
+bool intersects_box( Frustum const& aFrustum, Vec3f const& aMin, Vec3f const& aMax ) noexcept
+{
+    for (auto const& p : aFrustum.planes) {
+        // The corner furthest along the plane normal; if even that one is
+        // behind the plane, the whole box is.
+        Vec3f const v{
+            p.x >= 0.f ? aMax.x : aMin.x,
+            p.y >= 0.f ? aMax.y : aMin.y,
+            p.z >= 0.f ? aMax.z : aMin.z
+        };
+
+        if (p.x * v.x + p.y * v.y + p.z * v.z + p.w < 0.f)
+            return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,30 @@
+#ifndef FRUSTUM_HPP_64C2F0B9_1E7D_4A38_9B56_D3A08E5C217F
+#define FRUSTUM_HPP_64C2F0B9_1E7D_4A38_9B56_D3A08E5C217F
+
+#include "../vmlib/vec3.hpp"
+#include "../vmlib/vec4.hpp"
+#include "../vmlib/mat44.hpp"
+
+/*
+ *  === View frustum culling ===
+ *  Gribb & Hartmann, "Fast Extraction of Viewing Frustum Planes from the
+ *  World-View-Projection Matrix"
+ *  https://www.gamedevs.org/uploads/fast-extraction-viewing-frustum-planes-from-world-view-projection-matrix.pdf
+ *
+ *  The planes come straight out of the rows of projection * world2camera (or
+ *  projection * world2camera * model2world, to cull in model space). Points
+ *  with dot( plane.xyz, p ) + plane.w >= 0 for all six planes are inside.
+ */
+
+struct Frustum
+{
+    Vec4f planes[6];    // Left, right, bottom, top, near, far; normalized
+};
+
+Frustum make_frustum( Mat44f const& aProjCameraWorld ) noexcept;
+
+// Conservative tests: false means definitely outside.
+bool intersects_sphere( Frustum const&, Vec3f const& aCenter, float aRadius ) noexcept;
+bool intersects_box( Frustum const&, Vec3f const& aMin, Vec3f const& aMax ) noexcept;
+
+#endif // FRUSTUM_HPP_64C2F0B9_1E7D_4A38_9B56_D3A08E5C217F
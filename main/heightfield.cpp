@@ -0,0 +1,331 @@
+#include "heightfield.hpp"
+
+#include <limits>
+#include <algorithm>
+
+#include <cmath>
+
+namespace
+{
+    constexpr std::size_t kStackSize_ = 128;
+
+    // Bilinear height inside cell (aI, aJ), aU and aV in [0, 1]
+    float cell_height_( Heightfield const& aField, std::size_t aI, std::size_t aJ, float aU, float aV ) noexcept
+    {
+        float const* row0 = aField.heights.data() + aJ * aField.width + aI;
+        float const* row1 = row0 + aField.width;
+
+        float const h0 = row0[0] + (row0[1] - row0[0]) * aU;
+        float const h1 = row1[0] + (row1[1] - row1[0]) * aU;
+        return h0 + (h1 - h0) * aV;
+    }
+
+    // Slab test against [aLo, aHi], clipped to [aNear, aFar]
+    bool hit_box_( Vec3f const& aOrigin, Vec3f const& aInv, Vec3f const& aLo, Vec3f const& aHi, float& aNear, float& aFar ) noexcept
+    {
+        for (std::size_t k = 0; k < 3; ++k) {
+            float t0 = (aLo[k] - aOrigin[k]) * aInv[k];
+            float t1 = (aHi[k] - aOrigin[k]) * aInv[k];
+            if (t0 > t1)
+                std::swap( t0, t1 );
+
+            aNear = std::max( aNear, t0 );
+            aFar = std::min( aFar, t1 );
+        }
+
+        return aNear <= aFar;
+    }
+
+    // The ray inside one cell. Along the ray the bilinear surface is a
+    // quadratic, so the height difference is fitted through three samples
+    // and its first root is solved for.
+    bool hit_cell_( Heightfield const& aField, std::size_t aI, std::size_t aJ, Vec3f const& aOrigin, Vec3f const& aDir, float aT0, float aT1, float& aT ) noexcept
+    {
+        float const x0 = aField.originX + float(aI) * aField.spacingX;
+        float const z0 = aField.originZ + float(aJ) * aField.spacingZ;
+
+        auto const f = [&] (float t) {
+            Vec3f const p = aOrigin + t * aDir;
+            float const u = std::clamp( (p.x - x0) / aField.spacingX, 0.f, 1.f );
+            float const v = std::clamp( (p.z - z0) / aField.spacingZ, 0.f, 1.f );
+            return p.y - cell_height_( aField, aI, aJ, u, v );
+        };
+
+        float const f0 = f( aT0 );
+        if (f0 <= 0.f) {
+            aT = aT0;
+            return true;
+        }
+
+        float const fm = f( 0.5f * (aT0 + aT1) );
+        float const f1 = f( aT1 );
+
+        // f(s) = a s^2 + b s + c, s in [0, 1]
+        float const a = 2.f * f1 + 2.f * f0 - 4.f * fm;
+        float const b = f1 - f0 - a;
+        float const c = f0;
+
+        float s = -1.f;
+        if (std::abs( a ) < 1e-12f) {
+            if (b < 0.f)
+                s = -c / b;
+        }
+        else {
+            float const disc = b * b - 4.f * a * c;
+            if (disc >= 0.f) {
+                float const root = std::sqrt( disc );
+                float const s0 = (-b - root) / (2.f * a);
+                float const s1 = (-b + root) / (2.f * a);
+
+                float const lo = std::min( s0, s1 ), hi = std::max( s0, s1 );
+                s = (lo >= 0.f) ? lo : hi;
+            }
+        }
+
+        if (s < 0.f || s > 1.f)
+            return false;
+
+        aT = aT0 + s * (aT1 - aT0);
+        return true;
+    }
+}
+
+Heightfield make_heightfield(
+    std::vector<Vec3f> const& aPositions,
+    std::uint32_t const* aIndices,
+    std::size_t aIndexCount,
+    std::size_t aResolution
+)
+{
+    Heightfield ret;
+    if (aIndexCount < 3 || aResolution < 2)
+        return ret;
+
+    float minX = std::numeric_limits<float>::max(), maxX = -minX;
+    float minZ = minX, maxZ = -minX;
+    float minY = minX;
+
+    for (std::size_t i = 0; i < aIndexCount; ++i) {
+        Vec3f const& p = aPositions[aIndices[i]];
+        minX = std::min( minX, p.x ); maxX = std::max( maxX, p.x );
+        minZ = std::min( minZ, p.z ); maxZ = std::max( maxZ, p.z );
+        minY = std::min( minY, p.y );
+    }
+
+    float const spacing = std::max( std::max( maxX - minX, maxZ - minZ ) / float(aResolution - 1), 1e-6f );
+
+    ret.width = std::max<std::size_t>( 2, std::size_t(std::ceil( (maxX - minX) / spacing )) + 1 );
+    ret.depth = std::max<std::size_t>( 2, std::size_t(std::ceil( (maxZ - minZ) / spacing )) + 1 );
+    ret.originX = minX;
+    ret.originZ = minZ;
+    ret.spacingX = spacing;
+    ret.spacingZ = spacing;
+
+    // Rasterize the triangles from above, keeping the highest surface
+    float const kUncovered = -std::numeric_limits<float>::max();
+    ret.heights.assign( ret.width * ret.depth, kUncovered );
+
+    for (std::size_t t = 0; t + 2 < aIndexCount; t += 3) {
+        Vec3f const& a = aPositions[aIndices[t + 0]];
+        Vec3f const& b = aPositions[aIndices[t + 1]];
+        Vec3f const& c = aPositions[aIndices[t + 2]];
+
+        float const area = (b.x - a.x) * (c.z - a.z) - (c.x - a.x) * (b.z - a.z);
+        if (0.f == area)
+            continue;   // Vertical, the neighbours cover it
+
+        auto const toSample = [&] (float aCoord, float aOrigin, std::size_t aCount, bool aUp) {
+            float const s = (aCoord - aOrigin) / spacing;
+            long const i = long(aUp ? std::floor( s ) : std::ceil( s ));
+            return std::size_t(std::clamp<long>( i, 0, long(aCount) - 1 ));
+        };
+
+        std::size_t const i0 = toSample( std::min( { a.x, b.x, c.x } ), minX, ret.width, false );
+        std::size_t const i1 = toSample( std::max( { a.x, b.x, c.x } ), minX, ret.width, true );
+        std::size_t const j0 = toSample( std::min( { a.z, b.z, c.z } ), minZ, ret.depth, false );
+        std::size_t const j1 = toSample( std::max( { a.z, b.z, c.z } ), minZ, ret.depth, true );
+
+        float const eps = -1e-5f;
+
+        for (std::size_t j = j0; j <= j1; ++j) {
+            float const z = minZ + float(j) * spacing;
+
+            for (std::size_t i = i0; i <= i1; ++i) {
+                float const x = minX + float(i) * spacing;
+
+                float const wa = ((b.x - x) * (c.z - z) - (c.x - x) * (b.z - z)) / area;
+                float const wb = ((c.x - x) * (a.z - z) - (a.x - x) * (c.z - z)) / area;
+                float const wc = 1.f - wa - wb;
+
+                if (wa < eps || wb < eps || wc < eps)
+                    continue;
+
+                float& h = ret.heights[j * ret.width + i];
+                h = std::max( h, wa * a.y + wb * b.y + wc * c.y );
+            }
+        }
+    }
+
+    // Holes are filled from the nearest covered sample (breadth first)
+    std::vector<std::size_t> queue;
+    queue.reserve( ret.heights.size() );
+
+    for (std::size_t s = 0; s < ret.heights.size(); ++s) {
+        if (kUncovered != ret.heights[s])
+            queue.emplace_back( s );
+    }
+
+    for (std::size_t q = 0; q < queue.size(); ++q) {
+        std::size_t const s = queue[q];
+        std::size_t const i = s % ret.width, j = s / ret.width;
+
+        std::size_t const neighbours[4] = {
+            i > 0 ? s - 1 : s,
+            i + 1 < ret.width ? s + 1 : s,
+            j > 0 ? s - ret.width : s,
+            j + 1 < ret.depth ? s + ret.width : s
+        };
+
+        for (auto const n : neighbours) {
+            if (kUncovered == ret.heights[n]) {
+                ret.heights[n] = ret.heights[s];
+                queue.emplace_back( n );
+            }
+        }
+    }
+
+    for (auto& h : ret.heights) {
+        if (kUncovered == h)
+            h = minY;
+    }
+
+    // Min/max pyramid, from the cells up to a single block
+    Heightfield::Level cells{ ret.width - 1, ret.depth - 1, {}, {} };
+    cells.minHeights.resize( cells.width * cells.depth );
+    cells.maxHeights.resize( cells.width * cells.depth );
+
+    for (std::size_t j = 0; j < cells.depth; ++j) {
+        for (std::size_t i = 0; i < cells.width; ++i) {
+            float const* row0 = ret.heights.data() + j * ret.width + i;
+            float const* row1 = row0 + ret.width;
+
+            cells.minHeights[j * cells.width + i] = std::min( { row0[0], row0[1], row1[0], row1[1] } );
+            cells.maxHeights[j * cells.width + i] = std::max( { row0[0], row0[1], row1[0], row1[1] } );
+        }
+    }
+
+    ret.levels.emplace_back( std::move(cells) );
+
+    while (ret.levels.back().width > 1 || ret.levels.back().depth > 1) {
+        Heightfield::Level const& prev = ret.levels.back();
+        Heightfield::Level next{ (prev.width + 1) / 2, (prev.depth + 1) / 2, {}, {} };
+
+        next.minHeights.assign( next.width * next.depth, std::numeric_limits<float>::max() );
+        next.maxHeights.assign( next.width * next.depth, -std::numeric_limits<float>::max() );
+
+        for (std::size_t j = 0; j < prev.depth; ++j) {
+            for (std::size_t i = 0; i < prev.width; ++i) {
+                std::size_t const dst = (j / 2) * next.width + i / 2;
+                next.minHeights[dst] = std::min( next.minHeights[dst], prev.minHeights[j * prev.width + i] );
+                next.maxHeights[dst] = std::max( next.maxHeights[dst], prev.maxHeights[j * prev.width + i] );
+            }
+        }
+
+        ret.levels.emplace_back( std::move(next) );
+    }
+
+    return ret;
+}
+
+float height_at( Heightfield const& aField, float aX, float aZ ) noexcept
+{
+    if (aField.width < 2 || aField.depth < 2)
+        return 0.f;
+
+    float const fx = std::clamp( (aX - aField.originX) / aField.spacingX, 0.f, float(aField.width - 1) );
+    float const fz = std::clamp( (aZ - aField.originZ) / aField.spacingZ, 0.f, float(aField.depth - 1) );
+
+    std::size_t const i = std::min( std::size_t(fx), aField.width - 2 );
+    std::size_t const j = std::min( std::size_t(fz), aField.depth - 2 );
+
+    return cell_height_( aField, i, j, fx - float(i), fz - float(j) );
+}
+
+bool raycast_heightfield( Heightfield const& aField, Vec3f const& aOrigin, Vec3f const& aDir, float aMaxT, float& aT )
+{
+    if (aField.levels.empty())
+        return false;
+
+    auto const safeInv = [] (float d) {
+        return 1.f / (std::abs( d ) > 1e-20f ? d : std::copysign( 1e-20f, d ));
+    };
+    Vec3f const inv{ safeInv( aDir.x ), safeInv( aDir.y ), safeInv( aDir.z ) };
+
+    // Blocks are visited front to back, so the first cell that is hit is
+    // the answer
+    struct Entry { std::size_t level, i, j; float near, far; };
+    Entry stack[kStackSize_];
+    std::size_t top = 0;
+
+    auto const push = [&] (std::size_t aLevel, std::size_t aI, std::size_t aJ, Entry* aOut, std::size_t& aCount) {
+        Heightfield::Level const& level = aField.levels[aLevel];
+        if (aI >= level.width || aJ >= level.depth)
+            return;
+
+        // Cells covered by the block
+        std::size_t const cellsX = aField.levels[0].width, cellsZ = aField.levels[0].depth;
+        std::size_t const c0 = aI << aLevel, c1 = std::min( cellsX, (aI + 1) << aLevel );
+        std::size_t const r0 = aJ << aLevel, r1 = std::min( cellsZ, (aJ + 1) << aLevel );
+
+        std::size_t const b = aJ * level.width + aI;
+        Vec3f const lo{ aField.originX + float(c0) * aField.spacingX, level.minHeights[b], aField.originZ + float(r0) * aField.spacingZ };
+        Vec3f const hi{ aField.originX + float(c1) * aField.spacingX, level.maxHeights[b], aField.originZ + float(r1) * aField.spacingZ };
+
+        // Everything below the block's top counts as inside, so that rays
+        // starting under the ground are caught as well
+        Vec3f const solidLo{ lo.x, -std::numeric_limits<float>::max(), lo.z };
+
+        float near = 0.f, far = aMaxT;
+        if (hit_box_( aOrigin, inv, solidLo, hi, near, far ))
+            aOut[aCount++] = Entry{ aLevel, aI, aJ, near, far };
+    };
+
+    std::size_t count = 0;
+    push( aField.levels.size() - 1, 0, 0, stack, count );
+    top = count;
+
+    while (top > 0) {
+        Entry const e = stack[--top];
+
+        // Entering below the lowest point of the block means we're in the
+        // ground already
+        Heightfield::Level const& level = aField.levels[e.level];
+        if (aOrigin.y + e.near * aDir.y <= level.minHeights[e.j * level.width + e.i]) {
+            aT = e.near;
+            return true;
+        }
+
+        if (0 == e.level) {
+            if (hit_cell_( aField, e.i, e.j, aOrigin, aDir, e.near, e.far, aT ))
+                return true;
+            continue;
+        }
+
+        Entry children[4];
+        std::size_t n = 0;
+
+        for (std::size_t k = 0; k < 4; ++k)
+            push( e.level - 1, e.i * 2 + (k & 1), e.j * 2 + (k >> 1), children, n );
+
+        // Push far to near
+        for (std::size_t i = 1; i < n; ++i) {
+            for (std::size_t j = i; j > 0 && children[j - 1].near < children[j].near; --j)
+                std::swap( children[j - 1], children[j] );
+        }
+
+        for (std::size_t i = 0; i < n; ++i)
+            stack[top++] = children[i];
+    }
+
+    return false;
+}
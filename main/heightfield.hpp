@@ -0,0 +1,68 @@
+#ifndef HEIGHTFIELD_HPP_0E93C6B1_7A25_4D18_B6F4_9C21D85E3A07
+#define HEIGHTFIELD_HPP_0E93C6B1_7A25_4D18_B6F4_9C21D85E3A07
+
+#include <vector>
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "../vmlib/vec3.hpp"
+
+/*
+ *  === Heightfields ===
+ *  Tevs et al., "Maximum Mipmaps for Fast, Accurate, and Scalable Dynamic
+ *  Height Field Rendering"
+ *  https://www.researchgate.net/publication/220792095
+ *
+ *  Most ground queries are vertical ("how high is the terrain here?"). For
+ *  those the terrain is resampled once into a regular grid of heights, the
+ *  topmost surface at every sample. A lookup is then a bilinear blend of four
+ *  samples, without looking at any triangles.
+ *
+ *  For rays there is a min/max pyramid over the grid cells (the quads
+ *  between four samples). Each level halves the previous one, up to a single
+ *  cell, so a ray can skip every block whose height range it passes over.
+ *  Inside a cell the surface is bilinear, which is a quadratic along the ray
+ *  and is solved exactly.
+ */
+
+struct Heightfield
+{
+    std::size_t width = 0;      // Samples along x
+    std::size_t depth = 0;      // Samples along z
+
+    // World position of sample (0, 0) and the distance between samples
+    float originX = 0.f, originZ = 0.f;
+    float spacingX = 1.f, spacingZ = 1.f;
+
+    std::vector<float> heights;     // width * depth, rows along x
+
+    // Level 0 has a block per cell, (width-1) x (depth-1) of them. Each
+    // following level has a block per 2x2 blocks of the previous one.
+    struct Level
+    {
+        std::size_t width, depth;
+        std::vector<float> minHeights, maxHeights;
+    };
+
+    std::vector<Level> levels;
+};
+
+// Resamples the triangles so that the longer side of their xz footprint has
+// aResolution samples. Samples that no triangle covers take the height of a
+// neighbour, or the lowest height if there is none.
+Heightfield make_heightfield(
+    std::vector<Vec3f> const& aPositions,
+    std::uint32_t const* aIndices,
+    std::size_t aIndexCount,
+    std::size_t aResolution
+);
+
+// Bilinear height at (aX, aZ). Outside of the grid the edge continues.
+float height_at( Heightfield const&, float aX, float aZ ) noexcept;
+
+// First point where aOrigin + t * aDir, 0 <= t <= aMaxT, is at or below the
+// surface. Only the area covered by the grid counts.
+bool raycast_heightfield( Heightfield const&, Vec3f const& aOrigin, Vec3f const& aDir, float aMaxT, float& aT );
+
+#endif // HEIGHTFIELD_HPP_0E93C6B1_7A25_4D18_B6F4_9C21D85E3A07
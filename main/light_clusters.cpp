@@ -0,0 +1,314 @@
+#include "light_clusters.hpp"
+
+#include <limits>
+#include <utility>
+#include <algorithm>
+
+#include <cmath>
+#include <cstring>
+
+#include "../support/gl_state.hpp"
+
+static_assert( sizeof(PointLight) == 48, "PointLight must match the std430 layout" );
+
+namespace
+{
+    std::uint32_t tile_of_( float aNdc, std::uint32_t aTiles ) noexcept
+    {
+        float t = std::floor( (aNdc * 0.5f + 0.5f) * float(aTiles) );
+        return std::uint32_t(std::clamp( t, 0.f, float(aTiles - 1) ));
+    }
+
+    // Empty allocations can't be bound, so there's always something
+    StreamBuffer::Allocation stream_( StreamBuffer& aStream, void const* aData, std::size_t aBytes )
+    {
+        auto const ret = aStream.allocate( GLsizeiptr(std::max<std::size_t>( aBytes, 16 )) );
+        if (aBytes)
+            std::memcpy( ret.data, aData, aBytes );
+        aStream.flush( ret );
+        return ret;
+    }
+}
+
+float light_range( Vec3f const& aDiffuse, Vec3f const& aSpecular, float aCutoff ) noexcept
+{
+    float brightest = 0.f;
+    for (std::size_t i = 0; i < 3; ++i)
+        brightest = std::max( { brightest, aDiffuse[i], aSpecular[i] } );
+
+    return std::sqrt( brightest / aCutoff );
+}
+
+PointLight make_point_light( Vec3f const& aPosition, Vec3f const& aDiffuse, Vec3f const& aSpecular, float aCutoff )
+{
+    PointLight ret;
+    ret.position = { aPosition.x, aPosition.y, aPosition.z, light_range( aDiffuse, aSpecular, aCutoff ) };
+    ret.diffuse = { aDiffuse.x, aDiffuse.y, aDiffuse.z, 0.f };
+    ret.specular = { aSpecular.x, aSpecular.y, aSpecular.z, 0.f };
+    return ret;
+}
+
+LightClusters::LightClusters( ClusterGrid const& aGrid, bool aStorageBuffers )
+    : mGrid( aGrid )
+    , mStorageBuffers( aStorageBuffers )
+{
+    if (mStorageBuffers)
+        return;
+
+    // Three texels per light, one per entry
+    GLint texels = 0;
+    glGetIntegerv( GL_MAX_TEXTURE_BUFFER_SIZE, &texels );
+    mGrid.maxLights = std::min( mGrid.maxLights, std::size_t(texels) / 3 );
+    mGrid.maxIndices = std::min( mGrid.maxIndices, std::size_t(texels) );
+
+    glGenTextures( 3, mTextures );
+
+    mTextureRanges = GLAD_GL_VERSION_4_3;
+    if (mTextureRanges)
+        return;
+
+    // The textures stay attached to their buffers, which upload() refills
+    GLenum const formats[] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+    GLuint const units[] = { kLightTextureUnit, kLightClusterTextureUnit, kLightIndexTextureUnit };
+
+    glGenBuffers( 3, mBuffers );
+    for (std::size_t i = 0; i < 3; ++i) {
+        glBindBuffer( GL_TEXTURE_BUFFER, mBuffers[i] );
+        glBufferData( GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW );
+
+        gl_state().bind_texture( units[i], GL_TEXTURE_BUFFER, mTextures[i] );
+        glTexBuffer( GL_TEXTURE_BUFFER, formats[i], mBuffers[i] );
+    }
+    glBindBuffer( GL_TEXTURE_BUFFER, 0 );
+}
+
+LightClusters::~LightClusters()
+{
+    if (mTextures[0]) {
+        for (GLuint texture : mTextures)
+            gl_state().forget_texture( texture );
+        glDeleteTextures( 3, mTextures );
+    }
+
+    if (mBuffers[0])
+        glDeleteBuffers( 3, mBuffers );
+}
+
+LightClusters::LightClusters( LightClusters&& aOther ) noexcept
+    : mGrid( aOther.mGrid )
+    , mStorageBuffers( aOther.mStorageBuffers )
+    , mLights( std::move(aOther.mLights) )
+    , mClusters( std::move(aOther.mClusters) )
+    , mIndices( std::move(aOther.mIndices) )
+    , mPairs( std::move(aOther.mPairs) )
+    , mColumnGaps( std::move(aOther.mColumnGaps) )
+    , mTextureRanges( aOther.mTextureRanges )
+    , mStats( aOther.mStats )
+{
+    for (std::size_t i = 0; i < 3; ++i) {
+        mTextures[i] = std::exchange( aOther.mTextures[i], 0 );
+        mBuffers[i] = std::exchange( aOther.mBuffers[i], 0 );
+    }
+}
+
+LightClusters& LightClusters::operator=( LightClusters&& aOther ) noexcept
+{
+    std::swap( mGrid, aOther.mGrid );
+    std::swap( mStorageBuffers, aOther.mStorageBuffers );
+    std::swap( mLights, aOther.mLights );
+    std::swap( mClusters, aOther.mClusters );
+    std::swap( mIndices, aOther.mIndices );
+    std::swap( mPairs, aOther.mPairs );
+    std::swap( mColumnGaps, aOther.mColumnGaps );
+    std::swap( mTextures, aOther.mTextures );
+    std::swap( mBuffers, aOther.mBuffers );
+    std::swap( mTextureRanges, aOther.mTextureRanges );
+    std::swap( mStats, aOther.mStats );
+    return *this;
+}
+
+void LightClusters::build( PointLight const* aLights, std::size_t aLightCount, Mat44f const* aWorld2Cameras, Mat44f const* aProjections, std::size_t aViewCount )
+{
+    std::size_t const lightCount = std::min( aLightCount, mGrid.maxLights );
+    mLights.assign( aLights, aLights + lightCount );
+
+    std::size_t const perView = mGrid.cluster_count();
+    std::uint32_t const tilesX = mGrid.tilesX, tilesY = mGrid.tilesY, slices = mGrid.slices;
+
+    mStats = Stats{};
+    mStats.lights = aLightCount;
+    mStats.droppedLights = aLightCount - lightCount;
+    mPairs.clear();
+
+    // Slice s covers view depths near * (far / near)^(s / slices) up to
+    // that of s+1
+    float const sliceScale = float(slices) / std::log( mGrid.zFar / mGrid.zNear );
+    float const sliceBias = -std::log( mGrid.zNear ) * sliceScale;
+
+    auto slice_of = [&](float aDepth) {
+        float s = std::floor( std::log( aDepth ) * sliceScale + sliceBias );
+        return std::uint32_t(std::clamp( s, 0.f, float(slices - 1) ));
+    };
+
+    std::vector<float> sliceDepths( slices + 1 );
+    for (std::uint32_t s = 0; s <= slices; ++s)
+        sliceDepths[s] = mGrid.zNear * std::pow( mGrid.zFar / mGrid.zNear, float(s) / float(slices) );
+
+    // Distance along x (or y) from aCenter to a cluster's view space box.
+    // The tile's edges fan out with depth, so each side of the box is the
+    // further out of its two ends.
+    auto gap = [](float aNdc0, float aNdc1, float aD0, float aD1, float aScale, float aCenter) {
+        float const lo = std::min( aNdc0 * aD0, aNdc0 * aD1 ) / aScale;
+        float const hi = std::max( aNdc1 * aD0, aNdc1 * aD1 ) / aScale;
+        return std::max( { lo - aCenter, 0.f, aCenter - hi } );
+    };
+
+    std::vector<std::uint8_t> seen( lightCount, 0 );
+
+    for (std::size_t v = 0; v < aViewCount; ++v) {
+        Mat44f const& world2camera = aWorld2Cameras[v];
+
+        // NDC x = sx * x / depth, likewise for y
+        float const sx = aProjections[v](0, 0);
+        float const sy = aProjections[v](1, 1);
+
+        for (std::size_t i = 0; i < lightCount; ++i) {
+            Vec4f const& p = aLights[i].position;
+            Vec4f const c = world2camera * Vec4f{ p.x, p.y, p.z, 1.f };
+
+            float const depth = -c.z, r = p.w;
+            if (depth + r < mGrid.zNear || depth - r > mGrid.zFar)
+                continue;
+
+            float const zMin = std::max( depth - r, mGrid.zNear );
+            float const zMax = std::min( depth + r, mGrid.zFar );
+
+            // The sphere's box spans x in [c.x - r, c.x + r] and depth in
+            // [zMin, zMax]. Its corners bound how far out on screen it gets.
+            float const xs[] = { sx * (c.x - r) / zMin, sx * (c.x - r) / zMax, sx * (c.x + r) / zMin, sx * (c.x + r) / zMax };
+            float const ys[] = { sy * (c.y - r) / zMin, sy * (c.y - r) / zMax, sy * (c.y + r) / zMin, sy * (c.y + r) / zMax };
+
+            auto const [xLo, xHi] = std::minmax_element( std::begin(xs), std::end(xs) );
+            auto const [yLo, yHi] = std::minmax_element( std::begin(ys), std::end(ys) );
+            if (*xHi < -1.f || *xLo > 1.f || *yHi < -1.f || *yLo > 1.f)
+                continue;
+
+            std::uint32_t const x0 = tile_of_( *xLo, tilesX ), x1 = tile_of_( *xHi, tilesX );
+            std::uint32_t const y0 = tile_of_( *yLo, tilesY ), y1 = tile_of_( *yHi, tilesY );
+            std::uint32_t const s0 = slice_of( zMin ), s1 = slice_of( zMax );
+
+            for (std::uint32_t s = s0; s <= s1; ++s) {
+                float const d0 = sliceDepths[s], d1 = sliceDepths[s + 1];
+                float const dz = std::max( { d0 - depth, 0.f, depth - d1 } );
+
+                // Same for every row of the slice
+                mColumnGaps.clear();
+                for (std::uint32_t x = x0; x <= x1; ++x) {
+                    float const dx = gap( 2.f * float(x) / float(tilesX) - 1.f, 2.f * float(x + 1) / float(tilesX) - 1.f, d0, d1, sx, c.x );
+                    mColumnGaps.emplace_back( dx * dx );
+                }
+
+                for (std::uint32_t y = y0; y <= y1; ++y) {
+                    float const dy = gap( 2.f * float(y) / float(tilesY) - 1.f, 2.f * float(y + 1) / float(tilesY) - 1.f, d0, d1, sy, c.y );
+                    float const dyz = dy * dy + dz * dz;
+
+                    for (std::uint32_t x = x0; x <= x1; ++x) {
+                        if (mColumnGaps[x - x0] + dyz > r * r)
+                            continue;
+
+                        if (mPairs.size() / 2 >= mGrid.maxIndices) {
+                            ++mStats.dropped;
+                            continue;
+                        }
+
+                        std::size_t const cluster = v * perView + (std::size_t(s) * tilesY + y) * tilesX + x;
+                        mPairs.emplace_back( std::uint32_t(cluster) );
+                        mPairs.emplace_back( std::uint32_t(i) );
+                        seen[i] = 1;
+                    }
+                }
+            }
+        }
+    }
+
+    // Counting sort by cluster: counts, then first indices, then the lists
+    std::size_t const clusters = aViewCount * perView;
+    mClusters.assign( clusters * 2, 0 );
+
+    for (std::size_t e = 0; e < mPairs.size(); e += 2)
+        ++mClusters[mPairs[e] * 2 + 1];
+
+    std::uint32_t first = 0;
+    for (std::size_t c = 0; c < clusters; ++c) {
+        std::uint32_t const count = mClusters[c * 2 + 1];
+        mClusters[c * 2] = first;
+        first += count;
+
+        mStats.litClusters += count ? 1 : 0;
+        mStats.maxPerCluster = std::max( mStats.maxPerCluster, std::size_t(count) );
+    }
+
+    // The counts go back up as the lists fill in
+    mIndices.resize( first );
+    for (std::size_t c = 0; c < clusters; ++c)
+        mClusters[c * 2 + 1] = 0;
+
+    for (std::size_t e = 0; e < mPairs.size(); e += 2) {
+        std::uint32_t* cluster = &mClusters[mPairs[e] * 2];
+        mIndices[cluster[0] + cluster[1]++] = mPairs[e + 1];
+    }
+
+    mStats.indices = mIndices.size();
+    for (auto s : seen)
+        mStats.visible += s;
+}
+
+void LightClusters::upload( StreamBuffer& aStream, FrameUniforms& aFrame )
+{
+    aFrame.lightGrid[0] = mGrid.tilesX;
+    aFrame.lightGrid[1] = mGrid.tilesY;
+    aFrame.lightGrid[2] = mGrid.slices;
+    aFrame.lightGrid[3] = std::uint32_t(mLights.size());
+
+    float const sliceScale = float(mGrid.slices) / std::log( mGrid.zFar / mGrid.zNear );
+    aFrame.lightSlices = { sliceScale, -std::log( mGrid.zNear ) * sliceScale, mGrid.zNear, mGrid.zFar };
+
+    void const* const data[] = { mLights.data(), mClusters.data(), mIndices.data() };
+    std::size_t const bytes[] = {
+        mLights.size() * sizeof(PointLight),
+        mClusters.size() * sizeof(std::uint32_t),
+        mIndices.size() * sizeof(std::uint32_t)
+    };
+
+    if (mStorageBuffers) {
+        GLuint const bindings[] = { kLightBufferBinding, kLightClusterBinding, kLightIndexBinding };
+        for (std::size_t i = 0; i < 3; ++i) {
+            auto const range = stream_( aStream, data[i], bytes[i] );
+            glBindBufferRange( GL_SHADER_STORAGE_BUFFER, bindings[i], aStream.buffer(), range.offset, range.size );
+        }
+        return;
+    }
+
+    // Each texture sees only this frame's data, and is indexed from zero
+    GLenum const formats[] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+    GLuint const units[] = { kLightTextureUnit, kLightClusterTextureUnit, kLightIndexTextureUnit };
+
+    for (std::size_t i = 0; i < 3; ++i) {
+        gl_state().bind_texture( units[i], GL_TEXTURE_BUFFER, mTextures[i] );
+
+        if (mTextureRanges) {
+            auto const range = stream_( aStream, data[i], bytes[i] );
+            glTexBufferRange( GL_TEXTURE_BUFFER, formats[i], aStream.buffer(), range.offset, range.size );
+        }
+        else {
+            // Orphans last frame's data, which the GPU may still be reading
+            glBindBuffer( GL_TEXTURE_BUFFER, mBuffers[i] );
+            glBufferData( GL_TEXTURE_BUFFER, GLsizeiptr(std::max<std::size_t>( bytes[i], 16 )), nullptr, GL_STREAM_DRAW );
+            if (bytes[i])
+                glBufferSubData( GL_TEXTURE_BUFFER, 0, GLsizeiptr(bytes[i]), data[i] );
+        }
+    }
+
+    if (!mTextureRanges)
+        glBindBuffer( GL_TEXTURE_BUFFER, 0 );
+}
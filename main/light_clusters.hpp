@@ -0,0 +1,165 @@
+#ifndef LIGHT_CLUSTERS_HPP_5E2A9C47_B13D_4F6E_8A70_D94C1B3E2F68
+#define LIGHT_CLUSTERS_HPP_5E2A9C47_B13D_4F6E_8A70_D94C1B3E2F68
+
+#include <glad/glad.h>
+
+#include <vector>
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "uniform_blocks.hpp"
+
+#include "../support/stream_buffer.hpp"
+
+#include "../vmlib/vec3.hpp"
+#include "../vmlib/vec4.hpp"
+#include "../vmlib/mat44.hpp"
+
+/*
+ *  === Clustered forward lighting ===
+ *  Olsson, Billeter and Assarsson, "Clustered Deferred and Forward Shading", HPG 2012
+ *
+ *  Every point light has a range, past which its 1/d^2 falloff is too dim
+ *  to matter (see light_range()). default.frag fades the falloff out to
+ *  zero at the range, so cutting a light off there leaves no seams.
+ *
+ *  Each view's frustum is cut into clusters: a grid of screen tiles, and
+ *  slices along the view depth that grow exponentially, so clusters near
+ *  and far are roughly cube shaped. Once per frame the CPU finds which
+ *  lights reach which clusters, and writes a light list per cluster. A
+ *  fragment looks up its cluster from its position in the view and only
+ *  loops over that cluster's lights, so a frame can hold hundreds or
+ *  thousands of lights as long as only a few reach each place.
+ *
+ *  Lights are assigned in two steps: the light's sphere gives a range of
+ *  tiles and slices that it may touch, and each cluster in that range is
+ *  then tested against the sphere with the cluster's view space box.
+ *
+ *  The lights, the clusters (first index and count into the light lists)
+ *  and the light lists go into the frame's region of the StreamBuffer. With
+ *  GL 4.3 they are shader storage buffers. 4.1 contexts (macOS) have none,
+ *  so there they are texture buffers instead. Those can be as small as
+ *  65536 texels (GL_MAX_TEXTURE_BUFFER_SIZE), so the light and index
+ *  capacities are clamped to it. 4.1 has no glTexBufferRange() either, so
+ *  each texture gets a buffer of its own, filled again every frame.
+ *
+ *  Every view has its own clusters, one after the other. The ViewBlock's
+ *  uFirstView says which view its first camera is, see uniform_blocks.hpp.
+ */
+
+// Shader storage buffer bindings, GL 4.3 only. Storage buffers have their
+// own set of binding points, apart from the uniform buffers'.
+constexpr GLuint kLightBufferBinding = 0;
+constexpr GLuint kLightClusterBinding = 1;
+constexpr GLuint kLightIndexBinding = 2;
+
+// Texture units of the texture buffers, GL 4.1 only
+constexpr GLuint kLightTextureUnit = 3;
+constexpr GLuint kLightClusterTextureUnit = 4;
+constexpr GLuint kLightIndexTextureUnit = 5;
+
+// Laid out like PointLight in default.frag (std430), and three RGBA32F
+// texels in the texture buffer
+struct PointLight
+{
+    Vec4f position;         // xyz, world space; w: range
+    Vec4f diffuse;          // rgb
+    Vec4f specular;         // rgb
+};
+
+// Distance at which the light's 1/d^2 falloff drops below aCutoff, for the
+// brightest of its colours
+float light_range( Vec3f const& aDiffuse, Vec3f const& aSpecular, float aCutoff ) noexcept;
+
+PointLight make_point_light( Vec3f const& aPosition, Vec3f const& aDiffuse, Vec3f const& aSpecular, float aCutoff );
+
+struct ClusterGrid
+{
+    std::uint32_t tilesX = 16;
+    std::uint32_t tilesY = 9;
+    std::uint32_t slices = 24;
+
+    // The views' near and far planes
+    float zNear = 0.1f;
+    float zFar = 100.f;
+
+    // Lights past maxLights are left out. Light list entries, all views;
+    // lights past it are left out of the clusters that ran out of room.
+    std::size_t maxLights = 1 << 14;
+    std::size_t maxIndices = 1 << 18;
+
+    std::size_t cluster_count() const noexcept { return std::size_t(tilesX) * tilesY * slices; }
+};
+
+class LightClusters
+{
+public:
+    struct Stats
+    {
+        std::size_t lights = 0;
+        std::size_t visible = 0;        // Reach at least one cluster
+        std::size_t indices = 0;        // Light list entries, all views
+        std::size_t litClusters = 0;    // Have any lights at all
+        std::size_t maxPerCluster = 0;
+        std::size_t dropped = 0;        // Didn't fit, see maxIndices
+        std::size_t droppedLights = 0;  // See maxLights
+    };
+
+public:
+    LightClusters() = default;
+
+    // aStorageBuffers selects the GL 4.3 path. Without it, the grid's
+    // capacities are clamped to what a texture buffer holds.
+    LightClusters( ClusterGrid const&, bool aStorageBuffers );
+    ~LightClusters();
+
+    LightClusters( LightClusters const& ) = delete;
+    LightClusters& operator=( LightClusters const& ) = delete;
+
+    LightClusters( LightClusters&& ) noexcept;
+    LightClusters& operator=( LightClusters&& ) noexcept;
+
+    ClusterGrid const& grid() const noexcept { return mGrid; }
+    Stats const& stats() const noexcept { return mStats; }
+
+    // Sorts aLights into the clusters of each view. The projections must be
+    // symmetric perspective ones (see make_perspective_projection()) with
+    // the grid's near and far planes.
+    void build(
+        PointLight const* aLights,
+        std::size_t aLightCount,
+        Mat44f const* aWorld2Cameras,
+        Mat44f const* aProjections,
+        std::size_t aViewCount
+    );
+
+    // Writes what build() made to aStream (or, with 4.1, to the texture
+    // buffers' own buffers) and binds it, and fills in the point light
+    // fields of aFrame except for the ambient
+    void upload( StreamBuffer& aStream, FrameUniforms& aFrame );
+
+private:
+    ClusterGrid mGrid;
+    bool mStorageBuffers = false;
+
+    std::vector<PointLight> mLights;
+    std::vector<std::uint32_t> mClusters;       // First index and count, per cluster
+    std::vector<std::uint32_t> mIndices;
+
+    // Cluster and light of each light list entry, before they are sorted
+    // by cluster
+    std::vector<std::uint32_t> mPairs;
+    std::vector<float> mColumnGaps;
+
+    // Texture buffers, without storage buffers only. Their buffers are
+    // ranges of the stream buffer with glTexBufferRange() (GL 4.3), and
+    // otherwise mBuffers.
+    GLuint mTextures[3] = {};
+    GLuint mBuffers[3] = {};
+    bool mTextureRanges = false;
+
+    Stats mStats;
+};
+
+#endif // LIGHT_CLUSTERS_HPP_5E2A9C47_B13D_4F6E_8A70_D94C1B3E2F68
@@ -0,0 +1,354 @@
+#include "lightmap.hpp"
+
+#include <limits>
+#include <random>
+#include <numbers>
+#include <algorithm>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "../support/gl_resources.hpp"
+
+#include "thread_pool.hpp"
+
+namespace
+{
+    // Fraction of the light that the terrain reflects. One value is close
+    // enough for the reddish rock of the Mars terrain.
+    constexpr float kTerrainAlbedo_ = 0.4f;
+
+    // Direct light is supersampled (2x2) per texel, for smoother shadow edges
+    constexpr float kSubsamples_[4][2] = { { 0.25f, 0.25f }, { 0.75f, 0.25f }, { 0.25f, 0.75f }, { 0.75f, 0.75f } };
+
+    constexpr std::uint32_t kCacheMagic_ = 0x50414d4c;     // "LMAP"
+    constexpr std::uint32_t kCacheVersion_ = 1;
+
+    struct Surface_
+    {
+        bool covered = false;
+        Vec3f position;
+        Vec3f normal;
+    };
+
+    // Bilinear lookup in a width x height grid of texel centres
+    float bilinear_( std::vector<float> const& aValues, std::size_t aWidth, std::size_t aHeight, float aU, float aV ) noexcept
+    {
+        float const fx = std::clamp( aU * float(aWidth) - 0.5f, 0.f, float(aWidth - 1) );
+        float const fy = std::clamp( aV * float(aHeight) - 0.5f, 0.f, float(aHeight - 1) );
+
+        std::size_t const x0 = std::size_t(fx), y0 = std::size_t(fy);
+        std::size_t const x1 = std::min( x0 + 1, aWidth - 1 ), y1 = std::min( y0 + 1, aHeight - 1 );
+        float const tx = fx - float(x0), ty = fy - float(y0);
+
+        float const a = aValues[y0 * aWidth + x0] + (aValues[y0 * aWidth + x1] - aValues[y0 * aWidth + x0]) * tx;
+        float const b = aValues[y1 * aWidth + x0] + (aValues[y1 * aWidth + x1] - aValues[y1 * aWidth + x0]) * tx;
+        return a + (b - a) * ty;
+    }
+
+    // Cosine weighted direction around aN
+    // Duff et al., "Building an Orthonormal Basis, Revisited"
+    Vec3f cosine_direction_( Vec3f const& aN, float aR1, float aR2 ) noexcept
+    {
+        float const sign = std::copysign( 1.f, aN.z );
+        float const a = -1.f / (sign + aN.z);
+        float const b = aN.x * aN.y * a;
+
+        Vec3f const t{ 1.f + sign * aN.x * aN.x * a, sign * b, -sign * aN.x };
+        Vec3f const s{ b, sign + aN.y * aN.y * a, -aN.y };
+
+        float const r = std::sqrt( aR1 );
+        float const phi = 2.f * std::numbers::pi_v<float> * aR2;
+
+        return r * std::cos( phi ) * t + r * std::sin( phi ) * s + std::sqrt( std::max( 0.f, 1.f - aR1 ) ) * aN;
+    }
+
+    // Spreads the covered texels into the uncovered ones (breadth first)
+    void fill_uncovered_( std::vector<float>& aValues, std::vector<std::uint8_t> aCovered, std::size_t aWidth, std::size_t aHeight )
+    {
+        std::vector<std::size_t> queue;
+        queue.reserve( aValues.size() );
+
+        for (std::size_t i = 0; i < aValues.size(); ++i) {
+            if (aCovered[i])
+                queue.emplace_back( i );
+        }
+
+        for (std::size_t q = 0; q < queue.size(); ++q) {
+            std::size_t const t = queue[q];
+            std::size_t const x = t % aWidth, y = t / aWidth;
+
+            std::size_t const neighbours[4] = {
+                x > 0 ? t - 1 : t,
+                x + 1 < aWidth ? t + 1 : t,
+                y > 0 ? t - aWidth : t,
+                y + 1 < aHeight ? t + aWidth : t
+            };
+
+            for (auto const n : neighbours) {
+                if (!aCovered[n]) {
+                    aValues[n] = aValues[t];
+                    aCovered[n] = 1;
+                    queue.emplace_back( n );
+                }
+            }
+        }
+    }
+}
+
+Lightmap bake_lightmap(
+    SimpleMeshData const& aMesh,
+    MeshLod const& aLevel,
+    TriangleBvh const& aBvh,
+    Vec3f const& aLightDir,
+    std::size_t aResolution,
+    std::size_t aBounceSamples,
+    std::size_t aThreadCount
+)
+{
+    Lightmap ret;
+    if (aBvh.empty() || aMesh.normals.size() != aMesh.positions.size() || aResolution < 2)
+        return ret;
+
+    Vec3f const lo = aBvh.bounds_min(), hi = aBvh.bounds_max();
+    float const extentX = std::max( hi.x - lo.x, 1e-6f );
+    float const extentZ = std::max( hi.z - lo.z, 1e-6f );
+    float const longest = std::max( extentX, extentZ );
+
+    ret.width = std::max<std::size_t>( 2, std::size_t(std::round( float(aResolution) * extentX / longest )) );
+    ret.height = std::max<std::size_t>( 2, std::size_t(std::round( float(aResolution) * extentZ / longest )) );
+    ret.transform = Vec4f{ 1.f / extentX, 1.f / extentZ, -lo.x / extentX, -lo.z / extentZ };
+
+    std::size_t const texelCount = ret.width * ret.height;
+
+    Vec3f const light = normalize( aLightDir );
+    float const diagonal = length( hi - lo );
+    float const bias = 1e-4f * diagonal;
+    float const top = hi.y + 1.f;
+
+    std::uint32_t const* indices = aMesh.indices.data() + aLevel.firstIndex;
+
+    // Where the terrain is, seen from above
+    auto const surface = [&] (float aX, float aZ, Surface_& aOut) {
+        RayHit hit;
+        if (!aBvh.raycast( Vec3f{ aX, top, aZ }, Vec3f{ 0.f, -1.f, 0.f }, top - lo.y + 1.f, hit ))
+            return false;
+
+        std::uint32_t const* tri = indices + hit.triangle * 3;
+        Vec3f n = (1.f - hit.u - hit.v) * aMesh.normals[tri[0]] + hit.u * aMesh.normals[tri[1]] + hit.v * aMesh.normals[tri[2]];
+
+        float const len = length( n );
+        aOut.covered = true;
+        aOut.position = hit.position;
+        aOut.normal = len > 0.f ? n / len : hit.normal;
+        return true;
+    };
+
+    // Direct light, with shadows
+    std::vector<Surface_> surfaces( texelCount );
+    std::vector<float> direct( texelCount, 0.f );
+
+    parallel_for( ret.height, aThreadCount, [&] (std::size_t aRow) {
+        for (std::size_t x = 0; x < ret.width; ++x) {
+            std::size_t const texel = aRow * ret.width + x;
+
+            float sum = 0.f;
+            std::size_t covered = 0;
+
+            for (auto const& sub : kSubsamples_) {
+                Surface_ s;
+                if (!surface( lo.x + (float(x) + sub[0]) / float(ret.width) * extentX, lo.z + (float(aRow) + sub[1]) / float(ret.height) * extentZ, s ))
+                    continue;
+
+                if (!surfaces[texel].covered)
+                    surfaces[texel] = s;
+                ++covered;
+
+                float const nDotL = dot( s.normal, light );
+                if (nDotL <= 0.f)
+                    continue;
+
+                RayHit blocker;
+                if (!aBvh.raycast( s.position + bias * s.normal, light, diagonal, blocker ))
+                    sum += nDotL;
+            }
+
+            if (covered > 0)
+                direct[texel] = sum / float(covered);
+        }
+    } );
+
+    // One bounce. Light leaving the terrain where a ray lands is looked up
+    // in the direct light we just traced.
+    std::vector<float> bounce( texelCount, 0.f );
+
+    parallel_for( ret.height, aThreadCount, [&] (std::size_t aRow) {
+        std::minstd_rand rng( std::uint32_t(aRow) + 1 );
+        std::uniform_real_distribution<float> uniform( 0.f, 1.f );
+
+        for (std::size_t x = 0; x < ret.width; ++x) {
+            Surface_ const& s = surfaces[aRow * ret.width + x];
+            if (!s.covered || 0 == aBounceSamples)
+                continue;
+
+            float sum = 0.f;
+            for (std::size_t i = 0; i < aBounceSamples; ++i) {
+                // Stratified along one axis
+                float const r1 = (float(i) + uniform( rng )) / float(aBounceSamples);
+                Vec3f const dir = cosine_direction_( s.normal, r1, uniform( rng ) );
+
+                RayHit hit;
+                if (!aBvh.raycast( s.position + bias * s.normal, dir, diagonal, hit ))
+                    continue;
+
+                sum += bilinear_( direct, ret.width, ret.height,
+                    hit.position.x * ret.transform.x + ret.transform.z,
+                    hit.position.z * ret.transform.y + ret.transform.w
+                );
+            }
+
+            bounce[aRow * ret.width + x] = kTerrainAlbedo_ * sum / float(aBounceSamples);
+        }
+    } );
+
+    // The bounce is noisy but smooth, a small blur takes care of that
+    {
+        std::vector<float> blurred( texelCount, 0.f );
+
+        for (std::size_t y = 0; y < ret.height; ++y) {
+            for (std::size_t x = 0; x < ret.width; ++x) {
+                float sum = 0.f;
+                float weight = 0.f;
+
+                for (std::size_t ny = (y > 0 ? y - 1 : 0); ny <= std::min( y + 1, ret.height - 1 ); ++ny) {
+                    for (std::size_t nx = (x > 0 ? x - 1 : 0); nx <= std::min( x + 1, ret.width - 1 ); ++nx) {
+                        if (!surfaces[ny * ret.width + nx].covered)
+                            continue;
+
+                        sum += bounce[ny * ret.width + nx];
+                        weight += 1.f;
+                    }
+                }
+
+                blurred[y * ret.width + x] = weight > 0.f ? sum / weight : 0.f;
+            }
+        }
+
+        bounce = std::move(blurred);
+    }
+
+    // Texels outside the terrain take their neighbours' values, so that
+    // filtering at the edges doesn't darken them
+    std::vector<std::uint8_t> covered( texelCount );
+    for (std::size_t i = 0; i < texelCount; ++i)
+        covered[i] = surfaces[i].covered;
+
+    fill_uncovered_( direct, covered, ret.width, ret.height );
+    fill_uncovered_( bounce, covered, ret.width, ret.height );
+
+    ret.texels.resize( texelCount * 2 );
+    for (std::size_t i = 0; i < texelCount; ++i) {
+        ret.texels[i * 2 + 0] = std::uint8_t(std::clamp( direct[i], 0.f, 1.f ) * 255.f + 0.5f);
+        ret.texels[i * 2 + 1] = std::uint8_t(std::clamp( bounce[i], 0.f, 1.f ) * 255.f + 0.5f);
+    }
+
+    return ret;
+}
+
+std::uint64_t lightmap_key( SimpleMeshData const& aMesh, MeshLod const& aLevel, Vec3f const& aLightDir, std::size_t aResolution, std::size_t aBounceSamples )
+{
+    // FNV-1a over everything that goes into the bake
+    std::uint64_t hash = 0xcbf29ce484222325ull;
+
+    auto const add = [&] (void const* aData, std::size_t aSize) {
+        auto const* bytes = static_cast<std::uint8_t const*>( aData );
+        for (std::size_t i = 0; i < aSize; ++i)
+            hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    };
+
+    std::uint64_t const params[] = { kCacheVersion_, aResolution, aBounceSamples };
+    add( params, sizeof(params) );
+    add( &aLightDir, sizeof(aLightDir) );
+
+    for (GLsizei i = 0; i < aLevel.indexCount; ++i) {
+        std::uint32_t const idx = aMesh.indices[aLevel.firstIndex + i];
+        add( &aMesh.positions[idx], sizeof(Vec3f) );
+        add( &aMesh.normals[idx], sizeof(Vec3f) );
+    }
+
+    return hash;
+}
+
+bool load_lightmap( char const* aPath, std::uint64_t aKey, Lightmap& aOut )
+{
+    std::FILE* file = std::fopen( aPath, "rb" );
+    if (!file)
+        return false;
+
+    std::uint32_t header[2] = {};
+    std::uint64_t key = 0;
+    std::uint32_t size[2] = {};
+    Lightmap ret;
+
+    bool ok = 1 == std::fread( header, sizeof(header), 1, file )
+        && kCacheMagic_ == header[0] && kCacheVersion_ == header[1]
+        && 1 == std::fread( &key, sizeof(key), 1, file ) && aKey == key
+        && 1 == std::fread( size, sizeof(size), 1, file )
+        && 1 == std::fread( &ret.transform, sizeof(ret.transform), 1, file );
+
+    if (ok) {
+        ret.width = size[0];
+        ret.height = size[1];
+        ret.texels.resize( ret.width * ret.height * 2 );
+        ok = ret.texels.empty() || 1 == std::fread( ret.texels.data(), ret.texels.size(), 1, file );
+    }
+
+    std::fclose( file );
+
+    if (ok)
+        aOut = std::move(ret);
+    return ok;
+}
+
+bool save_lightmap( char const* aPath, std::uint64_t aKey, Lightmap const& aLightmap )
+{
+    std::FILE* file = std::fopen( aPath, "wb" );
+    if (!file)
+        return false;
+
+    std::uint32_t const header[2] = { kCacheMagic_, kCacheVersion_ };
+    std::uint32_t const size[2] = { std::uint32_t(aLightmap.width), std::uint32_t(aLightmap.height) };
+
+    bool const ok = 1 == std::fwrite( header, sizeof(header), 1, file )
+        && 1 == std::fwrite( &aKey, sizeof(aKey), 1, file )
+        && 1 == std::fwrite( size, sizeof(size), 1, file )
+        && 1 == std::fwrite( &aLightmap.transform, sizeof(aLightmap.transform), 1, file )
+        && (aLightmap.texels.empty() || 1 == std::fwrite( aLightmap.texels.data(), aLightmap.texels.size(), 1, file ));
+
+    return 0 == std::fclose( file ) && ok;
+}
+
+GLuint create_lightmap_texture( Lightmap const& aLightmap )
+{
+    if (aLightmap.texels.empty())
+        return 0;
+
+    GLsizei const w = GLsizei(aLightmap.width), h = GLsizei(aLightmap.height);
+    GLuint tex = create_texture( GL_TEXTURE_2D, GL_RG8, w, h, 1, mip_levels( w, h ) );
+
+    // Rows of two-byte texels aren't necessarily 4-byte aligned
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+    upload_texture( tex, GL_TEXTURE_2D, w, h, 1, GL_RG, GL_UNSIGNED_BYTE, aLightmap.texels.data() );
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+
+    generate_texture_mipmaps( tex, GL_TEXTURE_2D );
+
+    set_texture_parameter( tex, GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+    set_texture_parameter( tex, GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+
+    set_texture_parameter( tex, GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+    set_texture_parameter( tex, GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+
+    return tex;
+}
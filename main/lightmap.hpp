@@ -0,0 +1,74 @@
+#ifndef LIGHTMAP_HPP_93B4E6D1_2F07_4C8A_A5D3_71E0C94B628F
+#define LIGHTMAP_HPP_93B4E6D1_2F07_4C8A_A5D3_71E0C94B628F
+
+#include <glad/glad.h>
+
+#include <vector>
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "bvh.hpp"
+#include "mesh_lod.hpp"
+#include "simple_mesh.hpp"
+
+#include "../vmlib/vec3.hpp"
+#include "../vmlib/vec4.hpp"
+
+/*
+ *  === Lightmaps ===
+ *  https://www.flipcode.com/archives/Light_Mapping_Theory_and_Implementation.shtml
+ *  https://ndotl.wordpress.com/2018/08/29/baking-artifact-free-lightmaps/
+ *
+ *  The terrain and the directional light never move, so the light's
+ *  contribution is traced once on the CPU instead of being evaluated for
+ *  every fragment: shadows against the BVH, plus one bounce of light off the
+ *  surrounding terrain.
+ *
+ *  The terrain is a heightfield seen from above (see heightfield.hpp), so its
+ *  xz footprint is a parametrization without overlaps. Lightmap UVs are
+ *  generated from that, the shader computes them from the world position
+ *  with uLightmapTransform, and no extra vertex attribute is needed.
+ *
+ *  Texels are RG8: R is the direct light (N.L, zero in shadow), G the
+ *  bounced light, both relative to the light's diffuse colour. Baking takes
+ *  a while, so results are cached on disk.
+ */
+
+struct Lightmap
+{
+    std::size_t width = 0;
+    std::size_t height = 0;
+
+    // uv = xz * transform.xy + transform.zw
+    Vec4f transform{ 0.f, 0.f, 0.f, 0.f };
+
+    // RG8, rows bottom to top (like OpenGL)
+    std::vector<std::uint8_t> texels;
+};
+
+// Bakes the light arriving from direction aLightDir (towards the light) over
+// the terrain. aBvh must have been built over aLevel of aMesh; the mesh
+// provides the normals. The longer side of the footprint gets aResolution
+// texels. aThreadCount = 0 uses all hardware threads.
+Lightmap bake_lightmap(
+    SimpleMeshData const&,
+    MeshLod const& aLevel,
+    TriangleBvh const& aBvh,
+    Vec3f const& aLightDir,
+    std::size_t aResolution,
+    std::size_t aBounceSamples = 16,
+    std::size_t aThreadCount = 0
+);
+
+// Identifies what a lightmap was baked from, so stale caches are ignored
+std::uint64_t lightmap_key( SimpleMeshData const&, MeshLod const&, Vec3f const& aLightDir, std::size_t aResolution, std::size_t aBounceSamples );
+
+// Returns false if the file is missing or was baked from something else
+bool load_lightmap( char const* aPath, std::uint64_t aKey, Lightmap& );
+bool save_lightmap( char const* aPath, std::uint64_t aKey, Lightmap const& );
+
+// Uploads the lightmap as a GL_TEXTURE_2D with mipmaps.
+GLuint create_lightmap_texture( Lightmap const& );
+
+#endif // LIGHTMAP_HPP_93B4E6D1_2F07_4C8A_A5D3_71E0C94B628F
@@ -5,7 +5,7 @@
 
 #include "../support/error.hpp"
 
-SimpleMeshData load_wavefront_obj( char const* aPath )
+SimpleMeshData load_wavefront_obj( char const* aPath, float aCreaseAngle )
 {
 	auto result = rapidobj::ParseFile( aPath );
 
@@ -32,7 +32,10 @@ SimpleMeshData load_wavefront_obj( char const* aPath )
         });
     }
 
-    // Geometry
+    // Geometry. Normals and texture coordinates are optional in OBJ files
+    // (index -1); missing normals are left zero and generated below.
+    bool missingNormals = false;
+
     for (auto const& shape : result.shapes) {
         for (std::size_t i = 0; i < shape.mesh.indices.size(); ++i) {
             auto const& idx = shape.mesh.indices[i];
@@ -44,17 +47,27 @@ SimpleMeshData load_wavefront_obj( char const* aPath )
             } );
 
             // Extract texture coordinate (vt)
-            ret.texcoords.emplace_back(Vec2f {
-                result.attributes.texcoords[idx.texcoord_index * 2 + 0], // `u`
-                result.attributes.texcoords[idx.texcoord_index * 2 + 1]  // `v`
-            });
-
+            if (idx.texcoord_index >= 0) {
+                ret.texcoords.emplace_back(Vec2f {
+                    result.attributes.texcoords[idx.texcoord_index * 2 + 0], // `u`
+                    result.attributes.texcoords[idx.texcoord_index * 2 + 1]  // `v`
+                });
+            }
+            else {
+                ret.texcoords.emplace_back( Vec2f{ 0.f, 0.f } );
+            }
 
-            ret.normals.emplace_back( Vec3f {
-                result.attributes.normals[idx.normal_index*3+0],    // Use normal index 
-                result.attributes.normals[idx.normal_index*3+1],
-                result.attributes.normals[idx.normal_index*3+2]
-            });
+            if (idx.normal_index >= 0) {
+                ret.normals.emplace_back( Vec3f {
+                    result.attributes.normals[idx.normal_index*3+0],    // Use normal index 
+                    result.attributes.normals[idx.normal_index*3+1],
+                    result.attributes.normals[idx.normal_index*3+2]
+                });
+            }
+            else {
+                ret.normals.emplace_back( Vec3f{ 0.f, 0.f, 0.f } );
+                missingNormals = true;
+            }
 
             // Each shape has a material ID
             std::size_t material_id = shape.mesh.material_ids[i / 3];
@@ -62,6 +75,12 @@ SimpleMeshData load_wavefront_obj( char const* aPath )
         }
     }
 
+    // Only where the file has none, see mesh_normals.hpp
+    if (missingNormals)
+        fill_missing_normals( ret, aCreaseAngle );
+
+    if (!result.attributes.texcoords.empty())
+        generate_tangents( ret );
+
     return ret;
 }
-
@@ -2,7 +2,11 @@
 #define LOADOBJ_HPP_2CF735BE_6624_413E_B6DC_B5BBA337F96F
 
 #include "simple_mesh.hpp"
+#include "mesh_normals.hpp"
 
-SimpleMeshData load_wavefront_obj( char const* aPath );
+// Loads the OBJ as a triangle soup. Normals the file doesn't have are
+// generated, keeping edges sharper than aCreaseAngle (radians); tangents are
+// generated if it has texture coordinates. See mesh_normals.hpp.
+SimpleMeshData load_wavefront_obj( char const* aPath, float aCreaseAngle = kDefaultCreaseAngle );
 
 #endif // LOADOBJ_HPP_2CF735BE_6624_413E_B6DC_B5BBA337F96F
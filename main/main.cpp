@@ -1,14 +1,24 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
+#include <string>
+#include <limits>
+#include <random>
+#include <optional>
+#include <numeric>
 #include <typeinfo>
+#include <filesystem>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 #include "../support/error.hpp"
 #include "../support/program.hpp"
 #include "../support/checkpoint.hpp"
 #include "../support/debug_output.hpp"
+#include "../support/gl_state.hpp"
+#include "../support/stream_buffer.hpp"
+#include "../support/gpu_timer.hpp"
 
 #include "../vmlib/mat44.hpp"
 #include "../vmlib/mat33.hpp"
@@ -18,6 +28,21 @@
 #include "texture.hpp"
 #include "vehicle.hpp"
 #include "particle.hpp"
+#include "mesh_lod.hpp"
+#include "mesh_chunks.hpp"
+#include "meshlets.hpp"
+#include "frustum.hpp"
+#include "normal_bake.hpp"
+#include "bvh.hpp"
+#include "heightfield.hpp"
+#include "lightmap.hpp"
+#include "ao_bake.hpp"
+#include "uniform_blocks.hpp"
+#include "draw_batch.hpp"
+#include "render_queue.hpp"
+#include "world_bounds.hpp"
+#include "multi_view.hpp"
+#include "light_clusters.hpp"
 
 #include <fontstash.h>
 #include <stb_truetype.h>
@@ -25,8 +50,6 @@
 
 #define FONTSTASH_IMPLEMENTATION
 
-#define NUM_LIGHTS 3
-
 // Camera Views
 #define FREE_ROAM 0
 #define FIXED_DISTANCE 1
@@ -46,6 +69,61 @@ namespace
     constexpr float kMovementPerSecond_ = 3.f; // units per second
     constexpr float kMouseSensitivity_ = 0.05f; // radians per pixel
 
+    // Terrain LODs are picked by how many pixels their error covers. With the
+    // baked normal maps the shading survives simplification, so only the
+    // silhouette gives a LOD away and we can afford a few pixels.
+    constexpr float kTerrainLodPixelError_ = 4.f;
+    constexpr std::size_t kTerrainNormalMapSize_ = 1024;
+
+    // The terrain is split into this many chunks along x and z
+    constexpr std::size_t kTerrainChunks_ = 8;
+
+    // The sun. It never moves, so its light on the terrain is baked.
+    constexpr Vec3f kDirectLightDir_ = { 0.f, 1.f, -1.f };
+
+    constexpr std::size_t kTerrainLightmapSize_ = 1024;
+    constexpr std::size_t kTerrainLightmapBounces_ = 16;    // Bounce rays per texel
+    constexpr char const* kTerrainLightmapCache_ = "cache/langerso.lightmap";
+
+    // Baked data goes here, away from the assets. It's in .gitignore.
+    constexpr char const* kBakeCacheDir_ = "cache";
+
+    // Point lights are cut off where they fall below this, see
+    // light_clusters.hpp
+    constexpr float kLightCutoff_ = 1.f / 256.f;
+
+    // The views' near and far planes, the light clusters' as well
+    constexpr float kNearPlane_ = 0.1f;
+    constexpr float kFarPlane_ = 100.f;
+
+    // Dim lights scattered over the terrain, toggled with L. Enough that
+    // looping over all of them in every fragment would show.
+    constexpr std::size_t kLightFieldCount_ = 1024;
+    constexpr float kLightFieldIntensity_ = 0.02f;
+
+    // Ambient occlusion, see ao_bake.hpp. Rays per vertex, and how far away
+    // something still blocks the sky.
+    constexpr std::size_t kAoSamples_ = 64;
+    constexpr float kTerrainAoDistance_ = 2.f;
+    constexpr float kLandingPadAoDistance_ = 0.5f;
+
+    // Room for one frame's streamed data: draw records and commands for all
+    // views, the part palette and particle instances. Far more than a frame
+    // needs, see the stream buffer stats.
+    constexpr GLsizeiptr kFrameStreamSize_ = 4 << 20;
+
+    // Next to the lightmap, see kBakeCacheDir_. The meshes themselves are
+    // loaded from the OBJ files every run, so there's no mesh cache to put
+    // the occlusion in.
+    constexpr char const* kTerrainAoCache_ = "cache/langerso.ao";
+    constexpr char const* kLandingPadAoCache_ = "cache/landingpad.ao";
+
+    // Samples along the longer side of the terrain's height grid
+    constexpr std::size_t kTerrainHeightfieldSize_ = 1024;
+
+    // The free roam camera stays at least this far above the terrain
+    constexpr float kCameraGroundClearance_ = 0.2f;
+
     int fbwidth = 0;
     int fbheight = 0;
 
@@ -60,18 +138,81 @@ namespace
     };
 
 
+    // A draw waiting in the render queue
+    struct SceneDraw_ {
+        GLuint firstIndex;
+        GLsizei indexCount;
+        GLint baseVertex;
+        GLuint record;          // First DrawRecord, one per instance
+        GLsizei instances;
+    };
+
+    // How the cameras share the window, V cycles through them
+    enum class ViewLayout_ {
+        kSingle,            // The first camera only
+        kSplitScreen,       // Side by side
+        kPictureInPicture   // The second camera in a corner of the first
+    };
+
+    // Parts of the frame that the GpuTimer measures
+    enum GpuSection_ : std::size_t {
+        kGpuDepthPrepass_,
+        kGpuScene_,         // Shading, all views, without the particles
+        kGpuUI_,
+        kGpuSectionCount_
+    };
+
+    // The scene's programs for one way of getting at the vertices
+    struct ScenePrograms_ {
+        ShaderProgram* prog;
+        ShaderProgram* multiViewProg;   // Draws all views at once, may be prog
+        ShaderProgram* depthProg;       // Depth only, for the pre-pass
+        ShaderProgram* depthMultiViewProg;
+    };
+
+    // One camera's view of the frame, see layout_views()
+    struct SceneView_ {
+        Mat44f world2camera;
+        Mat44f projection;
+        ViewRect rect;
+    };
+
     // This will contain the state of our program
     struct State_ {
-        ShaderProgram* prog;
+        // [0] reads vertex attributes, [1] pulls the vertices from a storage
+        // buffer (GL 4.3 only), see vertex_format.hpp
+        ScenePrograms_ scenePrograms[2] = {};
         ShaderProgram* UI_prog;
 
         double deltaTime;
 
-        bool isSplitScreen = false;
+        ViewLayout_ viewLayout = ViewLayout_::kSingle;
+
+        // Split screen draws both views in one pass, see multi_view.hpp.
+        // Otherwise (and always for overlapping views) the views are drawn
+        // one after the other.
+        bool isSinglePassViews = true;
+        ViewRouting viewRouting = ViewRouting::kVertexShader;
+
+        // Lay down the scene's depth first, so that default.frag only runs
+        // once per pixel, see draw_scene_pass()
+        bool isDepthPrepass = false;
+
+        // Which of the scene's programs and geometry draw, G switches. The
+        // packed vertices are less to read but more to decode.
+        bool canPullVertices = false;
+        bool isVertexPulling = false;
 
         ParticleSystem *particleSystem;
         VehicleCtrl_ vehicleControl;
 
+        bool isLightFieldOn = false;
+
+        // Full resolution terrain, for picking. Vertical ground queries go
+        // to the height grid instead.
+        TriangleBvh terrainBvh;
+        Heightfield terrainHeights;
+
         /*
         *  === Camera Controls ===
         *  https://learnopengl.com/Getting-started/Camera
@@ -131,57 +272,114 @@ namespace
 
         // This will hold all data required for rendering
         struct RenderData_ {
-            GLuint langersoVertexCount;
-            GLuint landingPadVertexCount;
-            GLuint vehicleVertexCount;
+            ChunkedMesh langersoChunks;    // Index ranges, the terrain is indexed
+            MultiDrawList langersoDraws[kMaxLodLevels];    // Visible meshlets, per LOD, reused every frame
 
             // Uniform locations
-            GLuint uDirectLightDirLocation;
-            GLuint uDirectLightDiffuseLocation;
-            GLuint uDirectLightAmbientLocation;
-
-            GLuint uLightPosLocations[NUM_LIGHTS] = {};
-            GLuint uLightDiffuseLocations[NUM_LIGHTS] = {};
-            GLuint uLightSpecularLocations[NUM_LIGHTS] = {};
-            GLuint uSceneAmbientLocations[NUM_LIGHTS] = {};
-
-            GLuint uProjCameraWorldLocation;
-            GLuint uUseTextureLocation;
-            GLuint uNormalMatrixLocation;
-            GLuint uModel2WorldLocation;
-
             GLuint uButtonActiveColorLocation;
             GLuint uButtonOutlineLocation;
 
-            // Matrices
-            Mat44f world2camera;
-            Mat44f projection;
+            // This frame's views
+            SceneView_ views[kMaxViews];
+            std::size_t viewCount = 1;
+
+            // Uniform blocks, see uniform_blocks.hpp
+            UniformBlockBuffer frameBlock;
+            UniformBlockBuffer viewBlocks;      // One per view, then all views
 
             // Point Lights
             std::vector<Light> lights = {};
             std::vector<Vec3f> lightOrigins = {};
-
-            // VAO's
-            GLuint langersoVao;
-            GLuint landingPadVao;
-            GLuint vehicleVao;
+            std::vector<Light> lightField = {};
+
+            // This frame's point lights, and their clusters, see
+            // light_clusters.hpp
+            std::vector<PointLight> pointLights;
+            LightClusters lightClusters;
+
+            // All static meshes, and the draws that go out each view. See
+            // shared_geometry.hpp and draw_batch.hpp. Indexed like
+            // scenePrograms; both hold the same meshes under the same ids.
+            SharedGeometry sceneGeometry[2];
+            std::size_t langersoMeshId;
+            std::vector<std::size_t> vehicleMeshIds;    // Per unique primitive
+            std::size_t landingPadMeshId;
+            DrawBatch sceneBatch[2];
+
+            // Everything that is rewritten every frame, see stream_buffer.hpp
+            StreamBuffer frameStream;
+
+            // The scene's draws, in the order they are produced, and the
+            // queue that puts them in draw order. See render_queue.hpp.
+            std::vector<SceneDraw_> sceneDraws;
+            RenderQueue sceneQueue;
+
+            // Both pads share one mesh; a draw with an instance per pad
+            std::vector<Mat44f> landingPadTransforms;
+
+            // World bounds of every renderable, see world_bounds.hpp. The
+            // terrain chunks and the pads are consecutive ids.
+            WorldBounds sceneBounds;
+            std::size_t chunkBoundsFirst;
+            std::size_t padBoundsFirst;
+            std::size_t vehicleBoundsId;
+            std::size_t particleBoundsId;
+
+            // Vehicle parts' boxes in their primitive's space, moved by the
+            // palette
+            std::vector<Vec3f> vehiclePartMin, vehiclePartMax;
+            Mat44f vehicleModel2World;
+
+            // Per view, what survived its frustum this frame
+            std::vector<std::uint8_t> visible[kMaxViews];
+
+            // Vehicle part hierarchy, its primitives and its matrix palette
+            std::vector<VehiclePart> vehicleParts;
+            VehicleModel vehicleModel;
+            std::vector<PartPaletteEntry> vehiclePalette;
 
             GLuint UI_vao;
 
             // Texture ID
             GLuint textureObjectId;
+            GLuint langersoNormalMapId;     // 2D array, layer i-1 for LOD i
+            GLuint langersoLightmapId;
 
         } renderData;
 
-        #ifdef ENABLE_TIMING
-        GLuint queries[12];
-        size_t qCount = 0;
+        // Per frame statistics, printed once a second when enabled
+        struct FrameStats_ {
+            bool enabled = false;
+            double sinceLastPrint = 0.0;
 
-        std::chrono::_V2::system_clock::time_point startF2F;
-        #endif
+            std::size_t lodTriangles[kMaxLodLevels] = {};
+
+            std::size_t visibleChunks = 0;
+            std::size_t culledChunks = 0;
+
+            std::size_t renderablesVisible = 0;     // All views
+            std::size_t renderablesCulled = 0;
+
+            MeshletCullStats meshlets;
 
+            std::size_t sceneDraws = 0;     // Indirect commands, recorded once
+            std::size_t sceneCalls = 0;     // GL draw calls they took, all views
+            std::size_t sceneReplays = 0;   // Times the recorded scene was drawn
 
+            // Render queue, all views. Changes between consecutive draws, in
+            // sorted and in submission order.
+            std::size_t queueItems = 0;
+            std::size_t queueChanges = 0;
+            std::size_t queueChangesUnsorted = 0;
+        } stats;
 
+        // GPU time per part of the frame, see gpu_timer.hpp. The averages
+        // go out with the stats.
+        GpuTimer gpuTimer;
+
+        #ifdef ENABLE_TIMING
+        std::chrono::high_resolution_clock::time_point startF2F;
+        #endif
     };
 
     void glfw_callback_error_( int, char const* );
@@ -192,9 +390,16 @@ namespace
 
     // Forward declarations
     void update_camera_pos( State_& );
-    void renderScene( State_& );
+    void layout_views( State_& );
+    void renderScene( State_&, GLuint );
+    void bind_scene_state( State_&, ShaderProgram const& );
+    std::size_t draw_scene_pass( State_&, ShaderProgram const&, ShaderProgram const& );
     void initialisePointLights( State_& );
+    void scatter_light_field( State_& );
     void configureCamera( State_& );
+    void pick_terrain( State_&, double, double );
+    std::vector<float> load_or_bake_ao( char const*, SimpleMeshData const&, std::vector<Vec3f> const&, std::vector<std::uint32_t> const&, float );
+    void print_geometry_stats( SharedGeometry const& );
 
     struct GLFWCleanupHelper
     {
@@ -328,11 +533,83 @@ int main() try
 
     glViewport( 0, 0, iwidth, iheight );
 
-    // Load shader program
-    ShaderProgram prog( {
-        { GL_VERTEX_SHADER, "assets/cw2/default.vert" },
-        { GL_FRAGMENT_SHADER, "assets/cw2/default.frag" }
-    } );
+    // Multi-draw indirect and storage buffers need GL 4.3. Without them the
+    // scene is drawn in a loop, see draw_batch.hpp.
+    bool const multiDrawIndirect = GLAD_GL_VERSION_4_3;
+    std::printf( "Scene draws: %s\n", multiDrawIndirect ? "multi-draw indirect" : "draw loop" );
+
+    // Pulling the vertices from a storage buffer needs GL 4.3 as well. Both
+    // ways are set up then, and G switches between them.
+    state.canPullVertices = multiDrawIndirect;
+    std::printf( "Scene vertices: vertex attributes%s\n", state.canPullVertices ? ", or pulled from a storage buffer (G)" : "" );
+
+    // Split screen draws both views in one pass. The vertex shader picks
+    // the viewport if it can, a geometry shader otherwise.
+    state.viewRouting = select_view_routing();
+    std::printf( "Split screen: one pass, viewports picked by the %s\n", view_routing_name( state.viewRouting ) );
+
+    bool const vertexRouting = ViewRouting::kVertexShader == state.viewRouting;
+
+    // Load shader programs, a set for each way of getting at the vertices.
+    // Like scenePrograms in State_, the second set pulls them.
+    std::string const preambles[2] = {
+        multiDrawIndirect ? "#version 430\n#define DRAW_BUFFER 1\n" : "",
+        "#version 430\n#define DRAW_BUFFER 1\n#define VERTEX_PULLING 1\n"
+    };
+
+    struct {
+        std::optional<ShaderProgram> prog, multiViewProg, depthProg, depthMultiViewProg;
+    } sceneShaders[2];
+
+    std::vector<ShaderProgram*> scenePrograms, depthPrograms;
+
+    for (std::size_t v = 0; v < (state.canPullVertices ? 2 : 1); ++v) {
+        std::string const& preamble = preambles[v];
+        std::string const routedPreamble = preamble + view_routing_preamble( state.viewRouting );
+        auto& shaders = sceneShaders[v];
+
+        shaders.prog.emplace( std::vector<ShaderProgram::ShaderSource>{
+            { GL_VERTEX_SHADER, "assets/cw2/default.vert" },
+            { GL_FRAGMENT_SHADER, "assets/cw2/default.frag" }
+        }, vertexRouting ? routedPreamble : preamble );
+
+        // The depth pre-pass places the triangles with the same vertex (and
+        // geometry) shader, but writes no colour
+        shaders.depthProg.emplace( std::vector<ShaderProgram::ShaderSource>{
+            { GL_VERTEX_SHADER, "assets/cw2/default.vert" },
+            { GL_FRAGMENT_SHADER, "assets/cw2/depth.frag" }
+        }, vertexRouting ? routedPreamble : preamble );
+
+        // Only the programs that draw several views at once get the geometry
+        // shader
+        if (!vertexRouting) {
+            shaders.multiViewProg.emplace( std::vector<ShaderProgram::ShaderSource>{
+                { GL_VERTEX_SHADER, "assets/cw2/default.vert" },
+                { GL_GEOMETRY_SHADER, "assets/cw2/default.geom" },
+                { GL_FRAGMENT_SHADER, "assets/cw2/default.frag" }
+            }, routedPreamble );
+
+            shaders.depthMultiViewProg.emplace( std::vector<ShaderProgram::ShaderSource>{
+                { GL_VERTEX_SHADER, "assets/cw2/default.vert" },
+                { GL_GEOMETRY_SHADER, "assets/cw2/default.geom" },
+                { GL_FRAGMENT_SHADER, "assets/cw2/depth.frag" }
+            }, routedPreamble );
+        }
+
+        auto& programs = state.scenePrograms[v];
+        programs.prog = &*shaders.prog;
+        programs.multiViewProg = shaders.multiViewProg ? &*shaders.multiViewProg : programs.prog;
+        programs.depthProg = &*shaders.depthProg;
+        programs.depthMultiViewProg = shaders.depthMultiViewProg ? &*shaders.depthMultiViewProg : programs.depthProg;
+
+        scenePrograms.emplace_back( programs.prog );
+        if (shaders.multiViewProg)
+            scenePrograms.emplace_back( programs.multiViewProg );
+
+        depthPrograms.emplace_back( programs.depthProg );
+        if (shaders.depthMultiViewProg)
+            depthPrograms.emplace_back( programs.depthMultiViewProg );
+    }
 
     // Load UI shader program
     ShaderProgram UI_prog( {
@@ -340,79 +617,79 @@ int main() try
         { GL_FRAGMENT_SHADER, "assets/cw2/UI.frag" }
     } );
 
-    // Load particles shader program
+    // Load particles shader program. It doesn't get a geometry shader;
+    // without vertex routing the particles are drawn view by view.
     ShaderProgram particle_prog( {
         { GL_VERTEX_SHADER, "assets/cw2/particle.vert" },
         { GL_FRAGMENT_SHADER, "assets/cw2/particle.frag" }
-    } );
+    }, vertexRouting ? view_routing_preamble( state.viewRouting ) : "" );
 
 
     UI.add_button("Launch", { -0.5f, -0.6f }, { -0.1f, -1.f }, { 0.5f, 0.5f, 0.5f, 1.f });
     UI.add_button("Reset", { 0.1f, -0.6f }, { 0.5f, -1.f }, { 0.5f, 0.5f, 0.5f, 1.f });
 
 
-    // FIX FOR 4.1
-    state.renderData.uDirectLightDirLocation     = glGetUniformLocation(prog.programId(), "uDirectLightDir");
-    state.renderData.uDirectLightAmbientLocation = glGetUniformLocation(prog.programId(), "uDirectLightAmbient");
-    state.renderData.uDirectLightDiffuseLocation = glGetUniformLocation(prog.programId(), "uDirectLightDiffuse");
+    // The transforms and lights come from uniform blocks, see
+    // uniform_blocks.hpp
+    struct { char const* name; GLuint binding; } const uniformBlocks[] = {
+        { "PartPalette", kPartPaletteBinding },
+        { "FrameBlock", kFrameBlockBinding },
+        { "ViewBlock", kViewBlockBinding },
+        { "DrawBlock", kDrawRecordBinding },    // Without DRAW_BUFFER only
+    };
+
+    for (auto* program : scenePrograms) {
+        // The normal map lives on texture unit 1. It must not share unit 0
+        // with uTexture, since the two samplers have different types. The
+        // lightmap gets unit 2.
+        glUseProgram(program->programId());
+        glUniform1i(glGetUniformLocation(program->programId(), "uNormalMap"), 1);
+        glUniform1i(glGetUniformLocation(program->programId(), "uLightmap"), 2);
+
+        // The light clusters' texture buffers, without storage buffers only
+        glUniform1i(glGetUniformLocation(program->programId(), "uLightData"), GLint(kLightTextureUnit));
+        glUniform1i(glGetUniformLocation(program->programId(), "uLightClusterData"), GLint(kLightClusterTextureUnit));
+        glUniform1i(glGetUniformLocation(program->programId(), "uLightIndexData"), GLint(kLightIndexTextureUnit));
+        glUseProgram(0);
+
+        for (auto const& block : uniformBlocks) {
+            if (multiDrawIndirect && kDrawRecordBinding == block.binding)
+                continue;
+            if (!bind_uniform_block(program->programId(), block.name, block.binding))
+                std::fprintf(stderr, "Error: Uniform block '%s' not found\n", block.name);
+        }
+    }
+
+    // The depth programs only have default.vert's blocks
+    for (auto* program : depthPrograms) {
+        for (auto const& block : uniformBlocks) {
+            if (kFrameBlockBinding == block.binding)
+                continue;
+            if (multiDrawIndirect && kDrawRecordBinding == block.binding)
+                continue;
+            if (!bind_uniform_block(program->programId(), block.name, block.binding))
+                std::fprintf(stderr, "Error: Uniform block '%s' not found\n", block.name);
+        }
+    }
 
-    state.renderData.uProjCameraWorldLocation = glGetUniformLocation(prog.programId(), "uProjCameraWorld");
-    state.renderData.uNormalMatrixLocation    = glGetUniformLocation(prog.programId(), "uNormalMatrix");
-    state.renderData.uUseTextureLocation      = glGetUniformLocation(prog.programId(), "uUseTexture");
-    state.renderData.uModel2WorldLocation     = glGetUniformLocation(prog.programId(), "uModel2World");
+    // The particles' cameras, too
+    if (!bind_uniform_block(particle_prog.programId(), "ViewBlock", kViewBlockBinding))
+        std::fprintf(stderr, "Error: Uniform block 'ViewBlock' not found\n");
 
-    GLuint uWorldCameraPosLocation = glGetUniformLocation(prog.programId(), "uWorldCameraPos");
+    state.renderData.frameBlock = UniformBlockBuffer(sizeof(FrameUniforms), 1);
+    state.renderData.viewBlocks = UniformBlockBuffer(sizeof(ViewUniforms), kMaxViews + 1);
 
     state.renderData.uButtonActiveColorLocation  = glGetUniformLocation(UI_prog.programId(), "uButtonActiveColor");
     state.renderData.uButtonOutlineLocation  = glGetUniformLocation(UI_prog.programId(), "uButtonOutline");
 
-    // Generate locations for lights
-    for (int i = 0; i < NUM_LIGHTS; ++i) {
-        // Light Position
-        std::string lightPosUniform = "uLightPos[" + std::to_string(i) + "]";
-        state.renderData.uLightPosLocations[i] = glGetUniformLocation(prog.programId(), lightPosUniform.c_str());
-
-        // Light Diffuse
-        std::string lightDiffuseUniform = "uLightDiffuse[" + std::to_string(i) + "]";
-        state.renderData.uLightDiffuseLocations[i] = glGetUniformLocation(prog.programId(), lightDiffuseUniform.c_str());
-
-        // Light Specular
-        std::string lightSpecularUniform = "uLightSpecular[" + std::to_string(i) + "]";
-        state.renderData.uLightSpecularLocations[i] = glGetUniformLocation(prog.programId(), lightSpecularUniform.c_str());
-
-        // Scene Ambient
-        std::string sceneAmbientUniform = "uSceneAmbient[" + std::to_string(i) + "]";
-        state.renderData.uSceneAmbientLocations[i] = glGetUniformLocation(prog.programId(), sceneAmbientUniform.c_str());
-        
-        // Check Uniform Locations
-        if (state.renderData.uLightPosLocations[i] == static_cast<GLuint>(-1))
-            fprintf(stderr, "Error: Uniform location for %s not found!\n", lightPosUniform.c_str());
-        if (state.renderData.uLightDiffuseLocations[i] == static_cast<GLuint>(-1))
-            fprintf(stderr, "Error: Uniform location for %s not found!\n", lightDiffuseUniform.c_str());
-        if (state.renderData.uLightSpecularLocations[i] == static_cast<GLuint>(-1))
-            fprintf(stderr, "Error: Uniform location for %s not found!\n", lightSpecularUniform.c_str());
-        if (state.renderData.uSceneAmbientLocations[i] == static_cast<GLuint>(-1))
-            fprintf(stderr, "Error: Uniform location for %s not found!\n", sceneAmbientUniform.c_str());
-    }
-
-    // Ensure the locations are valid
-    if ( 
-        state.renderData.uProjCameraWorldLocation == static_cast<GLuint>(-1) ||
-         state.renderData.uNormalMatrixLocation == static_cast<GLuint>(-1)    ||
-         state.renderData.uDirectLightDirLocation == static_cast<GLuint>(-1)  ||
-         state.renderData.uModel2WorldLocation == static_cast<GLuint>(-1)     ||
-         uWorldCameraPosLocation == static_cast<GLuint>(-1)                   ||
-         state.renderData.uUseTextureLocation == static_cast<GLuint>(-1) 
-    ) {
-        std::fprintf(stderr, "Error: Uniform location not found\n");
-    }
 
 
 
     // Assign shader programs
-    state.prog = &prog;
 	state.UI_prog = &UI_prog;
 
+    state.gpuTimer = GpuTimer( kGpuSectionCount_ );
+
     glfwGetFramebufferSize(window, &fbwidth, &fbheight);
 
     // Init particle system
@@ -423,41 +700,244 @@ int main() try
     OGL_CHECKPOINT_ALWAYS();
 
     // Load the terrain and add to VAO
+    // The terrain is split into chunks with their own LODs. Everything shares
+    // the vertices; each chunk and LOD is a range in the index buffer.
     auto langersoMesh = load_wavefront_obj("assets/cw2/langerso.obj");
-    state.renderData.langersoVao = create_vao(langersoMesh);
-    state.renderData.langersoVertexCount = langersoMesh.positions.size();
+    state.renderData.langersoChunks = make_chunked_lods(langersoMesh, kTerrainChunks_, kTerrainChunks_);
 
-    // Load the texture
-    state.renderData.textureObjectId = load_texture_2d("assets/cw2/L3211E-4k.jpg");
+    // Bring back the detail the LODs lose with baked normal maps. The loader
+    // has generated the tangents for them.
+    {
+        auto bakeStart = std::chrono::steady_clock::now();
+        auto normalMaps = bake_lod_normal_maps(langersoMesh, state.renderData.langersoChunks.lods, kTerrainNormalMapSize_);
+        state.renderData.langersoNormalMapId = create_normal_map_texture(normalMaps);
+
+        auto bakeTime = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - bakeStart);
+        std::printf("Baked %zu terrain normal maps in %lld ms\n", normalMaps.layers, (long long)bakeTime.count());
+    }
+
+    // Ground queries go against the full resolution terrain
+    {
+        auto const& full = state.renderData.langersoChunks.lods.levels[0];
+
+        auto bvhStart = std::chrono::steady_clock::now();
+        state.terrainBvh = TriangleBvh(langersoMesh.positions, langersoMesh.indices.data() + full.firstIndex, std::size_t(full.indexCount));
+
+        auto bvhTime = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - bvhStart);
+        std::printf("Built terrain BVH (%zu nodes) in %lld ms\n", state.terrainBvh.node_count(), (long long)bvhTime.count());
+
+        auto heightsStart = std::chrono::steady_clock::now();
+        state.terrainHeights = make_heightfield(langersoMesh.positions, langersoMesh.indices.data() + full.firstIndex, std::size_t(full.indexCount), kTerrainHeightfieldSize_);
+
+        auto heightsTime = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - heightsStart);
+        std::printf("Resampled terrain into a %zux%zu height grid in %lld ms\n", state.terrainHeights.width, state.terrainHeights.depth, (long long)heightsTime.count());
+    }
 
-    // Load the landing pad mesh and create VAO
+    state.particleSystem->setGround( &state.terrainHeights );
+
+    // Bake the sun's light, or load it from the last run
+    {
+        auto const& full = state.renderData.langersoChunks.lods.levels[0];
+        auto key = lightmap_key(langersoMesh, full, kDirectLightDir_, kTerrainLightmapSize_, kTerrainLightmapBounces_);
+
+        Lightmap lightmap;
+        if (load_lightmap(kTerrainLightmapCache_, key, lightmap)) {
+            std::printf("Loaded terrain lightmap from '%s'\n", kTerrainLightmapCache_);
+        }
+        else {
+            auto bakeStart = std::chrono::steady_clock::now();
+            lightmap = bake_lightmap(langersoMesh, full, state.terrainBvh, kDirectLightDir_, kTerrainLightmapSize_, kTerrainLightmapBounces_);
+
+            auto bakeTime = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - bakeStart);
+            std::printf("Baked %zux%zu terrain lightmap in %lld ms\n", lightmap.width, lightmap.height, (long long)bakeTime.count());
+
+            std::error_code ec;
+            std::filesystem::create_directories(kBakeCacheDir_, ec);
+            if (!save_lightmap(kTerrainLightmapCache_, key, lightmap))
+                std::fprintf(stderr, "Warning: unable to write lightmap cache '%s'\n", kTerrainLightmapCache_);
+        }
+
+        state.renderData.langersoLightmapId = create_lightmap_texture(lightmap);
+
+        // The lightmap's transform never changes, so it's set once
+        for (auto* program : scenePrograms) {
+            glUseProgram(program->programId());
+            GLint location = glGetUniformLocation(program->programId(), "uLightmapTransform");
+            if (location < 0)
+                std::fprintf(stderr, "Warning: uniform 'uLightmapTransform' not found\n");
+            else
+                glUniform4fv(location, 1, &lightmap.transform.x);
+            glUseProgram(0);
+        }
+    }
+
+    // Load the landing pad mesh. Both pads share it through instancing.
     auto landingPadMesh = load_wavefront_obj("assets/cw2/landingpad.obj");
-    state.renderData.landingPadVao = create_vao( landingPadMesh );
-    state.renderData.landingPadVertexCount = landingPadMesh.positions.size();
+    state.renderData.landingPadTransforms = {
+        make_translation( Vec3f { 3.f, 0.f, -5.f } ),
+        make_translation( Vec3f { -7.f, 0.f, 7.f } )
+    };
+    auto const& landingPadTransforms = state.renderData.landingPadTransforms;
+
+    // Bake ambient occlusion, or load it from the last run. The pads darken
+    // the terrain around them; on their own mesh they only block themselves.
+    {
+        auto const& full = state.renderData.langersoChunks.lods.levels[0];
+
+        std::vector<Vec3f> occluderPositions = langersoMesh.positions;
+        std::vector<std::uint32_t> occluderIndices(
+            langersoMesh.indices.begin() + full.firstIndex,
+            langersoMesh.indices.begin() + full.firstIndex + full.indexCount
+        );
+
+        for (auto const& transform : landingPadTransforms) {
+            for (auto const& p : landingPadMesh.positions) {
+                Vec4f world = transform * Vec4f{ p.x, p.y, p.z, 1.f };
+                occluderIndices.emplace_back(std::uint32_t(occluderPositions.size()));
+                occluderPositions.emplace_back(Vec3f{ world.x, world.y, world.z });
+            }
+        }
+
+        langersoMesh.occlusion = load_or_bake_ao(kTerrainAoCache_, langersoMesh, occluderPositions, occluderIndices, kTerrainAoDistance_);
+
+        // The pad is a triangle soup
+        std::vector<std::uint32_t> padIndices(landingPadMesh.positions.size());
+        std::iota(padIndices.begin(), padIndices.end(), 0u);
+
+        landingPadMesh.occlusion = load_or_bake_ao(kLandingPadAoCache_, landingPadMesh, landingPadMesh.positions, padIndices, kLandingPadAoDistance_);
+    }
+
+    std::printf("Terrain: %zu chunks, %zu meshlets\n", state.renderData.langersoChunks.chunks.size(), state.renderData.langersoChunks.meshlets.size());
+    for (std::size_t i = 0; i < state.renderData.langersoChunks.lods.levels.size(); ++i) {
+        auto const& lod = state.renderData.langersoChunks.lods.levels[i];
+        std::printf("Terrain LOD %zu: %d triangles, max. error %f\n", i, lod.indexCount / 3, lod.error);
+    }
+
+    // Load the texture
+    state.renderData.textureObjectId = load_texture_2d("assets/cw2/L3211E-4k.jpg");
 
     // Create Vehicle
-    auto vehicle = make_vehicle();
-    state.renderData.vehicleVao = create_vao( vehicle );
-    state.renderData.vehicleVertexCount = vehicle.positions.size();
+    // One mesh per unique primitive, with an instance for every part that
+    // is a copy of it
+    state.renderData.vehicleParts = make_vehicle_rig();
+    state.renderData.vehicleModel = make_vehicle_model( state.renderData.vehicleParts );
+
+    std::vector<SimpleMeshData> vehicleMeshes;
+    for (auto const& primitive : state.renderData.vehicleModel.primitives)
+        vehicleMeshes.emplace_back( make_primitive( primitive ) );
+
+    // Everything goes into one set of buffers, so that the whole scene can
+    // be drawn without switching VAOs. A quarter extra leaves room for
+    // meshes added later. Vertex pulling gets its own set.
+    std::size_t const geometryCount = state.canPullVertices ? 2 : 1;
+    auto* const sceneGeometry = state.renderData.sceneGeometry;
+    {
+        std::size_t vertexCapacity = 0, indexCapacity = 0;
+        std::vector<SimpleMeshData const*> meshes = { &langersoMesh, &landingPadMesh };
+        for (auto const& mesh : vehicleMeshes)
+            meshes.emplace_back( &mesh );
+
+        shared_geometry_capacity( meshes, 0.25f, vertexCapacity, indexCapacity );
+
+        for (std::size_t v = 0; v < geometryCount; ++v)
+            sceneGeometry[v] = SharedGeometry( vertexCapacity, indexCapacity, 1 == v );
+    }
+
+    // Same meshes in the same order, so the same ids
+    auto const add_scene_mesh = [&] (SimpleMeshData const& aMesh, VertexFormat aFormat) {
+        std::size_t const id = sceneGeometry[0].add( aMesh, aFormat );
+        for (std::size_t v = 1; v < geometryCount; ++v) {
+            if (sceneGeometry[v].add( aMesh, aFormat ) != id)
+                throw Error( "Scene geometry ids out of step" );
+        }
+        return id;
+    };
+
+    // With vertex pulling, the terrain is by far the most vertices and gets
+    // the compact format. Its texture coordinates end up within a texel.
+    state.renderData.langersoMeshId = add_scene_mesh( langersoMesh, kVertexPacked );
+    state.renderData.landingPadMeshId = add_scene_mesh( landingPadMesh, kVertexFloat );
+    for (auto const& mesh : vehicleMeshes)
+        state.renderData.vehicleMeshIds.emplace_back( add_scene_mesh( mesh, kVertexFloat ) );
+
+    // World bounds, from the meshes while they are still around. Only the
+    // vehicle and the particles move; they are updated every frame.
+    {
+        auto& bounds = state.renderData.sceneBounds;
+
+        state.renderData.chunkBoundsFirst = bounds.size();
+        for (auto const& chunk : state.renderData.langersoChunks.chunks)
+            bounds.add( chunk.lods.boundsMin, chunk.lods.boundsMax );
+
+        Vec3f padMin, padMax;
+        compute_bounds( landingPadMesh.positions, padMin, padMax );
+
+        state.renderData.padBoundsFirst = bounds.size();
+        for (auto const& transform : landingPadTransforms)
+            bounds.add( padMin, padMax, transform );
+
+        // One box per part, its primitive's
+        auto& partMin = state.renderData.vehiclePartMin;
+        auto& partMax = state.renderData.vehiclePartMax;
+
+        auto const& vehicleModel = state.renderData.vehicleModel;
+        partMin.resize( state.renderData.vehicleParts.size() );
+        partMax.resize( state.renderData.vehicleParts.size() );
+
+        for (std::size_t p = 0; p < vehicleModel.primitives.size(); ++p) {
+            Vec3f primitiveMin, primitiveMax;
+            compute_bounds( vehicleMeshes[p].positions, primitiveMin, primitiveMax );
+
+            for (auto const part : vehicleModel.instances[p]) {
+                partMin[part] = primitiveMin;
+                partMax[part] = primitiveMax;
+            }
+        }
+
+        state.renderData.vehicleBoundsId = bounds.add( partMin.front(), partMax.front() );
+        state.renderData.particleBoundsId = bounds.add( Vec3f{ 0.f, 0.f, 0.f }, Vec3f{ 0.f, 0.f, 0.f } );
+    }
+
+    // The GPU has its own copies now
+    langersoMesh = {};
+    vehicleMeshes = {};
+    landingPadMesh = {};
+
+    // Only the pulled geometry has storage buffers to bind, at bindings of
+    // its own
+    for (std::size_t v = 0; v < geometryCount; ++v) {
+        print_geometry_stats( sceneGeometry[v] );
+        sceneGeometry[v].bind_storage();
+
+        state.renderData.sceneBatch[v] = DrawBatch( sceneGeometry[v].vao(), multiDrawIndirect );
+    }
+
+    state.renderData.frameStream = StreamBuffer( kFrameStreamSize_ );
 
     state.renderData.UI_vao = create_UI_vao(UI);
 
+    ClusterGrid lightGrid;
+    lightGrid.zNear = kNearPlane_;
+    lightGrid.zFar = kFarPlane_;
+    state.renderData.lightClusters = LightClusters( lightGrid, multiDrawIndirect );
+
     initialisePointLights( state );
+    scatter_light_field( state );
 
     double last = glfwGetTime();
 
     // Main loop
+    // Setup bound and unbound things behind the state cache's back. From
+    // here on all per-frame state goes through it, see gl_state.hpp.
+    gl_state().invalidate();
+
     while( !glfwWindowShouldClose( window ) )
     {
 
         #ifdef ENABLE_TIMING
-		glGenQueries(12, state.queries);
-
         state.startF2F = std::chrono::high_resolution_clock::now();
         #endif
 
-
-
         // Let GLFW process events
         glfwPollEvents();
 
@@ -489,6 +969,24 @@ int main() try
         state.deltaTime = currentTime - last;
         last = currentTime;
 
+        std::fill(std::begin(state.stats.lodTriangles), std::end(state.stats.lodTriangles), 0);
+        state.stats.visibleChunks = 0;
+        state.stats.culledChunks = 0;
+        state.stats.renderablesVisible = 0;
+        state.stats.renderablesCulled = 0;
+        state.stats.meshlets = MeshletCullStats{};
+        state.stats.sceneDraws = 0;
+        state.stats.sceneCalls = 0;
+        state.stats.sceneReplays = 0;
+        state.stats.queueItems = 0;
+        state.stats.queueChanges = 0;
+        state.stats.queueChangesUnsorted = 0;
+        gl_state().reset_stats();
+
+        // Waits if the GPU is still working on the frame that used this
+        // region of the stream buffer last
+        state.renderData.frameStream.begin_frame();
+
         if (state.vehicleControl.launch) {
             state.particleSystem->update(
                 state.deltaTime,
@@ -503,19 +1001,12 @@ int main() try
 
         // Draw scene
 
-        glUseProgram(prog.programId());
+        gl_state().use_program(state.scenePrograms[state.isVertexPulling].prog->programId());
 
-        glEnable( GL_DEPTH_TEST );
+        gl_state().set_enabled( GL_DEPTH_TEST, true );
+        gl_state().set_enabled( GL_BLEND, false );
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glDepthFunc(GL_LESS); // Ensure closer fragments overwrite farther ones
-
-        // === Setup Lighting ===
-        // Original directional lighting
-        Vec3f directLightDir = normalize( Vec3f{ 0.f, 1.f, -1.f } );
-
-        glUniform3fv( state.renderData.uDirectLightDirLocation, 1, &directLightDir.x );
-        glUniform3f( state.renderData.uDirectLightDiffuseLocation, 0.8f, 0.8f, 0.3f );
-        glUniform3f( state.renderData.uDirectLightAmbientLocation, 0.1f, 0.1f, 0.1f );
+        gl_state().depth_func(GL_LESS); // Ensure closer fragments overwrite farther ones
 
         // === Update Vehicle ===
         // Space vehicle translations
@@ -541,22 +1032,28 @@ int main() try
             else {
                 // During deceleration phase under gravity
                 velocityY = accelerationUp * maxThrustTime - gravity * decelTime;
-                if (velocityY <= 0.0f) {
-                    // Stop vertical motion when velocity reaches zero
-                    velocityY = 0.0f;
-                }
             }
 
-            state.vehicleControl.position.y += velocityY * state.deltaTime;
-
             // Update velocity in Z (starts at 0 and accelerates)
             float velocityZ = accelerationZ * state.vehicleControl.time;
 
-            // Update position in the z-axis
-            state.vehicleControl.position.z += velocityZ * state.deltaTime;
+            Vec3f step = Vec3f{ 0.f, velocityY, velocityZ } * float(state.deltaTime);
+
+            // On the way down, land where this frame's step would go through
+            // the ground
+            float groundT = 0.f;
+            bool landed = velocityY < 0.f && raycast_heightfield(state.terrainHeights, state.vehicleControl.position, step, 1.f, groundT);
+
+            if (landed) {
+                state.vehicleControl.position += groundT * step;
+                state.vehicleControl.land();
+            }
+            else {
+                state.vehicleControl.position += step;
+            }
 
             // Update lights to follow the ship
-            for (int i = 0; i < NUM_LIGHTS; ++i)
+            for (std::size_t i = 0; i < state.renderData.lights.size(); ++i)
             {
                 // Define a fixed offset for each light relative to the ship's position
                 Vec3f lightOffset = state.renderData.lights[i].offset;
@@ -574,92 +1071,226 @@ int main() try
                 state.renderData.lights[i].position = state.vehicleControl.position + rotatedOffset;
             }
 
-            // Compute rotation angle based on velocity vector
-            state.vehicleControl.theta = std::atan2(velocityZ, velocityY);
+            if (!landed) {
+                // Compute rotation angle based on velocity vector
+                state.vehicleControl.theta = std::atan2(velocityZ, velocityY);
+
+                // Fold the legs away after lift-off, and wiggle the boosters
+                // while they are thrusting
+                state.vehicleControl.legFold = std::min(1.f, state.vehicleControl.time / 1.5f);
+                state.vehicleControl.gimbal = state.vehicleControl.time <= maxThrustTime
+                    ? 0.08f * std::sin(state.vehicleControl.time * 7.f)
+                    : 0.f;
 
-            state.vehicleControl.velocity = { 0.f, velocityY, velocityZ };
+                state.vehicleControl.velocity = { 0.f, velocityY, velocityZ };
+            }
         }
 
-        // Point lights
-        for (int i = 0; i < NUM_LIGHTS; ++i) {
-            glUniform3fv( state.renderData.uLightPosLocations[i], 1, &state.renderData.lights[i].position.x );
-            glUniform3fv( state.renderData.uLightDiffuseLocations[i], 1, &state.renderData.lights[i].diffuse.x );
-            glUniform3fv( state.renderData.uLightSpecularLocations[i], 1, &state.renderData.lights[i].specular.x );
-            glUniform3fv( state.renderData.uSceneAmbientLocations[i], 1, &state.renderData.lights[i].ambient.x );
+        // Vehicle part palette
+        // One small block in the stream buffer animates every part. The
+        // uniform block is always bound in full.
+        pose_vehicle( state.renderData.vehicleParts, state.vehicleControl, state.renderData.vehiclePalette );
+
+        {
+            auto& stream = state.renderData.frameStream;
+            auto const palette = stream.allocate( kMaxVehicleParts * sizeof(PartPaletteEntry) );
+            std::memcpy( palette.data, state.renderData.vehiclePalette.data(), state.renderData.vehiclePalette.size() * sizeof(PartPaletteEntry) );
+            stream.flush( palette );
+
+            glBindBufferRange( GL_UNIFORM_BUFFER, kPartPaletteBinding, stream.buffer(), palette.offset, palette.size );
+        }
+
+        // Moving renderables' world bounds
+        // The vehicle's box is the union of its posed parts' boxes
+        {
+            auto const& palette = state.renderData.vehiclePalette;
+            auto const& partMin = state.renderData.vehiclePartMin;
+            auto const& partMax = state.renderData.vehiclePartMax;
+
+            Vec3f vehicleMin, vehicleMax;
+            transform_box( palette[0].transform, partMin[0], partMax[0], vehicleMin, vehicleMax );
+
+            for (std::size_t i = 1; i < palette.size(); ++i) {
+                Vec3f lo, hi;
+                transform_box( palette[i].transform, partMin[i], partMax[i], lo, hi );
+
+                vehicleMin = Vec3f{ std::min( vehicleMin.x, lo.x ), std::min( vehicleMin.y, lo.y ), std::min( vehicleMin.z, lo.z ) };
+                vehicleMax = Vec3f{ std::max( vehicleMax.x, hi.x ), std::max( vehicleMax.y, hi.y ), std::max( vehicleMax.z, hi.z ) };
+            }
+
+            state.renderData.vehicleModel2World = make_translation(state.vehicleControl.position) * make_rotation_x(state.vehicleControl.theta);
+            state.renderData.sceneBounds.set_box( state.renderData.vehicleBoundsId, vehicleMin, vehicleMax, state.renderData.vehicleModel2World );
+
+            Vec3f particleMin, particleMax;
+            if (state.particleSystem->bounds( particleMin, particleMax ))
+                state.renderData.sceneBounds.set_box( state.renderData.particleBoundsId, particleMin, particleMax, kIdentity44f );
         }
 
         configureCamera( state );
+        layout_views( state );
 
-        if (!state.isSplitScreen) {
+        auto const& views = state.renderData.views;
+        std::size_t const viewCount = state.renderData.viewCount;
 
-            glViewport(0, 0, fbwidth, fbheight);
+        // === Setup Lighting ===
+        // All lights go up in one go
+        FrameUniforms frame{};
 
-            state.renderData.world2camera = state.camControl.getView();
+        // Original directional lighting
+        Vec3f directLightDir = normalize( kDirectLightDir_ );
+        frame.directLightDir = { directLightDir.x, directLightDir.y, directLightDir.z, 0.f };
+        frame.directLightDiffuse = { 0.8f, 0.8f, 0.3f, 0.f };
+        frame.directLightAmbient = { 0.1f, 0.1f, 0.1f, 0.f };
 
-            state.renderData.projection = make_perspective_projection(
-                60.f * std::numbers::pi_v<float> / 180.f,
-                fbwidth / float(fbheight),                  // Aspect ratio
-                0.1f, 100.0f                                // Near / far
-            );
+        // Point lights
+        // Each goes into the clusters of every view that it reaches, see
+        // light_clusters.hpp. The ambient doesn't fall off, so it's summed.
+        {
+            auto& pointLights = state.renderData.pointLights;
+            pointLights.clear();
+
+            Vec3f ambient = { 0.f, 0.f, 0.f };
+            auto add = [&](Light const& aLight) {
+                pointLights.emplace_back(make_point_light(aLight.position, aLight.diffuse, aLight.specular, kLightCutoff_));
+                ambient += aLight.ambient;
+            };
+
+            for (auto const& light : state.renderData.lights)
+                add(light);
+            if (state.isLightFieldOn) {
+                for (auto const& light : state.renderData.lightField)
+                    add(light);
+            }
 
-            glUniform3fv( uWorldCameraPosLocation, 1, &state.camControl.cameraPos.x );
+            // Each of the vehicle's lights used to add the emissive term
+            float const emissiveWeight = float(state.renderData.lights.size());
+            frame.pointLightAmbient = { ambient.x, ambient.y, ambient.z, emissiveWeight };
 
-            renderScene( state );
+            Mat44f world2cameras[kMaxViews], projections[kMaxViews];
+            for (std::size_t i = 0; i < viewCount; ++i) {
+                world2cameras[i] = views[i].world2camera;
+                projections[i] = views[i].projection;
+            }
 
-        } else {
+            state.renderData.lightClusters.build(pointLights.data(), pointLights.size(), world2cameras, projections, viewCount);
+            state.renderData.lightClusters.upload(state.renderData.frameStream, frame);
+        }
 
-            state.renderData.world2camera = state.camControl.getView();
+        state.renderData.frameBlock.update( &frame, 1 );
+        state.renderData.frameBlock.bind( kFrameBlockBinding, 0 );
 
-            state.renderData.projection = make_perspective_projection(
-                60.f * std::numbers::pi_v<float> / 180.f,
-                fbwidth/2.f / float(fbheight),              // Aspect ratio
-                0.1f, 100.0f                                // Near / far
-            );
+        // === Views ===
+        // A block per view with just that view, for drawing view by view,
+        // and one with all of them for drawing in one pass. They all go up
+        // in one go.
+        ViewUniforms viewBlocks[kMaxViews + 1] = {};
+        ViewUniforms& allViews = viewBlocks[kMaxViews];
+        allViews.viewCount = std::uint32_t(viewCount);
 
-            glViewport(0, 0, fbwidth/2, fbheight);
-            renderScene( state );
+        ViewRect rects[kMaxViews];
 
-            // === Right hand side ===
-            state.renderData.world2camera = state.camControl2.getView();
-            glViewport(fbwidth/2, 0, fbwidth/2, fbheight);
-            renderScene( state );
+        // Each view culls every renderable up front, before anything is
+        // recorded or uploaded for it
+        for (std::size_t i = 0; i < viewCount; ++i) {
+            set_view( viewBlocks[i], 0, views[i].projection, views[i].world2camera );
+            viewBlocks[i].viewCount = 1;
+            viewBlocks[i].firstView = std::uint32_t(i);
+            set_view( allViews, i, views[i].projection, views[i].world2camera );
+
+            rects[i] = views[i].rect;
+
+            std::size_t visible = state.renderData.sceneBounds.cull( make_frustum(allViews.projCamera[i]), state.renderData.visible[i] );
+            state.stats.renderablesVisible += visible;
+            state.stats.renderablesCulled += state.renderData.sceneBounds.size() - visible;
         }
 
+        state.renderData.viewBlocks.update( viewBlocks, kMaxViews + 1 );
 
-        if (state.vehicleControl.hasLaunched) {
-            if ( !state.isSplitScreen ) {
-                state.particleSystem->draw(
-                    state.renderData.projection * state.renderData.world2camera,
-                    state.renderData.world2camera
-                );
-            } else {
-                glViewport(0, 0, fbwidth/2, fbheight);
-                state.particleSystem->draw(
-                    state.renderData.projection * state.camControl.getView(),
-                    state.camControl.getView()
-                );
+        // One pass draws every view, with a viewport each, and the draws are
+        // instanced once per view. Views that overlap share pixels, and so
+        // can't share a pass.
+        bool const singlePass = state.isSinglePassViews && viewCount > 1 && !views_overlap( rects, viewCount );
 
-                glViewport(fbwidth/2, 0, fbwidth/2, fbheight);
-                state.particleSystem->draw(
-                    state.renderData.projection * state.camControl2.getView(),
-                    state.camControl2.getView()
-                );
+        // The scene is culled, sorted and recorded once for all views, then
+        // replayed: once in a single pass, otherwise once per view with only
+        // the ViewBlock changed
+        renderScene( state, singlePass ? GLuint(viewCount) : 1 );
+
+        // The particles are sorted and uploaded once, for the first view.
+        // Like the scene, every view replays the same instances, which is
+        // only right because they don't write depth (see particle.hpp).
+        // Without vertex routing they are drawn view by view.
+        bool const hasParticles = state.vehicleControl.hasLaunched;
+        if (hasParticles)
+            state.particleSystem->prepare( allViews.projCamera[0], state.renderData.frameStream );
+
+        auto particlesVisible = [&](std::size_t aView) {
+            return hasParticles && state.renderData.visible[aView][state.renderData.particleBoundsId];
+        };
+
+        if (singlePass) {
+            set_view_viewports( rects, viewCount );
+            state.renderData.viewBlocks.bind( kViewBlockBinding, kMaxViews );
+
+            auto const& programs = state.scenePrograms[state.isVertexPulling];
+            state.stats.sceneCalls += draw_scene_pass( state, *programs.multiViewProg, *programs.depthMultiViewProg );
+
+            bool anyVisible = false;
+            for (std::size_t i = 0; i < viewCount; ++i)
+                anyVisible = anyVisible || particlesVisible(i);
+
+            if (anyVisible && ViewRouting::kVertexShader == state.viewRouting) {
+                state.particleSystem->draw( GLuint(viewCount) );
+            }
+            else if (anyVisible) {
+                for (std::size_t i = 0; i < viewCount; ++i) {
+                    if (!particlesVisible(i))
+                        continue;
+
+                    glViewport( rects[i].x, rects[i].y, rects[i].width, rects[i].height );
+                    state.renderData.viewBlocks.bind( kViewBlockBinding, i );
+                    state.particleSystem->draw( 1 );
+                }
+            }
+        }
+        else {
+            for (std::size_t i = 0; i < viewCount; ++i) {
+                ViewRect const& rect = rects[i];
+                glViewport( rect.x, rect.y, rect.width, rect.height );
+
+                // A view on top of an earlier one starts from a clean slate
+                if (i > 0 && views_overlap( rects, i + 1 )) {
+                    gl_state().set_enabled( GL_SCISSOR_TEST, true );
+                    glScissor( rect.x, rect.y, rect.width, rect.height );
+                    glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+                    gl_state().set_enabled( GL_SCISSOR_TEST, false );
+                }
+
+                state.renderData.viewBlocks.bind( kViewBlockBinding, i );
+
+                auto const& programs = state.scenePrograms[state.isVertexPulling];
+                state.stats.sceneCalls += draw_scene_pass( state, *programs.prog, *programs.depthProg );
+
+                // Before the next view covers it
+                if (particlesVisible(i))
+                    state.particleSystem->draw( 1 );
             }
         }
 
         // === UI ===
+        state.gpuTimer.begin( kGpuUI_ );
         glViewport( 0, 0, fbwidth, fbheight );
 
-        glUseProgram( state.UI_prog->programId() );
-        glDisable( GL_DEPTH_TEST );
+        gl_state().use_program( state.UI_prog->programId() );
+        gl_state().set_enabled( GL_DEPTH_TEST, false );
 
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        gl_state().set_enabled( GL_BLEND, true );
+        gl_state().blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
         glEnable( GL_PROGRAM_POINT_SIZE );
 
 
-        glBindVertexArray(state.renderData.UI_vao);
+        gl_state().bind_vertex_array(state.renderData.UI_vao);
 
         for (size_t i = 0; i < UI.buttons.size(); i++) {
             if (UI.buttons[i].state == MOUSE_OVER) {
@@ -678,82 +1309,81 @@ int main() try
                 glUniform4fv(state.renderData.uButtonActiveColorLocation, 1, baseColor);
             }
 
-            #ifdef ENABLE_TIMING
-            glQueryCounter(state.queries[state.qCount++], GL_TIMESTAMP);
             glDrawArrays(GL_TRIANGLES, i*30, 6);
-            glQueryCounter(state.queries[state.qCount++], GL_TIMESTAMP);
-            #else
-            glDrawArrays(GL_TRIANGLES, i*30, 6);
-            #endif
         }
 
         static float const baseColor[] = {0.f, 0.f, 0.f, 1.f};
         glUniform4fv(state.renderData.uButtonActiveColorLocation, 1, baseColor);
 
         for (size_t i = 0; i < UI.buttons.size(); i++) {
-
-            #ifdef ENABLE_TIMING
-            glQueryCounter(state.queries[state.qCount++], GL_TIMESTAMP);
-            glDrawArrays(GL_TRIANGLES, (i*30)+6, 24);
-            glQueryCounter(state.queries[state.qCount++], GL_TIMESTAMP);
-            #else
             glDrawArrays(GL_TRIANGLES, (i*30)+6, 24);
-            #endif
         }
 
 
-        // Cleanup
-        glBindVertexArray( 0 );
+        // Cleanup. Blending and the VAO stay, the scene sets what it needs.
         glBindBuffer( GL_ARRAY_BUFFER, 0 );
 
-        glDisable(GL_BLEND);
         glDisable( GL_PROGRAM_POINT_SIZE );
+        state.gpuTimer.end( kGpuUI_ );
 
         OGL_CHECKPOINT_DEBUG();
 
-        
-        
-        #ifdef ENABLE_TIMING
-
-        auto totalF2F = std::chrono::high_resolution_clock::now() - state.startF2F;
-        
-        GLuint64 start1_2, end1_2, start1_4_1, end1_4_1, start1_4_2, end1_4_2, start1_5, end1_5, startUI_1, endUI_1, startUI_2, endUI_2;
-        glGetQueryObjectui64v(state.queries[0], GL_QUERY_RESULT, &start1_2);
-        glGetQueryObjectui64v(state.queries[1], GL_QUERY_RESULT, &end1_2);
-        glGetQueryObjectui64v(state.queries[2], GL_QUERY_RESULT, &start1_4_1);
-        glGetQueryObjectui64v(state.queries[3], GL_QUERY_RESULT, &end1_4_1);
-        glGetQueryObjectui64v(state.queries[4], GL_QUERY_RESULT, &start1_4_2);
-        glGetQueryObjectui64v(state.queries[5], GL_QUERY_RESULT, &end1_4_2);
-        glGetQueryObjectui64v(state.queries[6], GL_QUERY_RESULT, &start1_5);
-        glGetQueryObjectui64v(state.queries[7], GL_QUERY_RESULT, &end1_5);
+        // Reads back the frame from GpuTimer::kFrames ago, so this doesn't
+        // wait for the GPU
+        state.gpuTimer.end_frame();
 
-        glGetQueryObjectui64v(state.queries[8], GL_QUERY_RESULT, &startUI_1);
-        glGetQueryObjectui64v(state.queries[9], GL_QUERY_RESULT, &endUI_1);
-        glGetQueryObjectui64v(state.queries[10], GL_QUERY_RESULT, &startUI_2);
-        glGetQueryObjectui64v(state.queries[11], GL_QUERY_RESULT, &endUI_2);
-
-        auto totalGPUtime = (end1_2 - start1_2) +
-                            (end1_4_1 - start1_4_1) +
-                            (end1_4_2 - start1_4_2) +
-                            (end1_5 - start1_5) +
-                            (endUI_1 - startUI_1) +
-                            (endUI_2 - startUI_2);
-
-        auto totalCPUtime = totalF2F - std::chrono::nanoseconds(totalGPUtime);
-
-        printf("Per Frame Total Render Time, GPU: %lu ns\n", totalGPUtime);
-        printf("1.2 Render Time, GPU: %lu ns\n", end1_2 - start1_2);
-        printf("1.4 Render Time, GPU: %lu ns\n", (end1_4_1 - start1_4_1) + (end1_4_2 - start1_4_2));
-        printf("1.5 Render Time, GPU: %lu ns\n", end1_5 - start1_5);
-
-        printf("Frame-to-Frame Time, CPU: %lu ns\n", totalF2F.count());
-        printf("Time to submit Rendering, CPU: %lu ns\n", totalCPUtime.count());
+        #ifdef ENABLE_TIMING
+        auto totalF2F = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - state.startF2F);
 
-        glDeleteQueries(12, state.queries);
+        printf("Depth pre-pass Time, GPU: %.3f ms\n", state.gpuTimer.last(kGpuDepthPrepass_));
+        printf("Scene Render Time, GPU: %.3f ms\n", state.gpuTimer.last(kGpuScene_));
+        printf("UI Render Time, GPU: %.3f ms\n", state.gpuTimer.last(kGpuUI_));
+        printf("Frame-to-Frame Time, CPU: %lld ns\n", (long long)totalF2F.count());
+        #endif
 
-        state.qCount = 0;
+        // === Stats ===
+        state.stats.sinceLastPrint += state.deltaTime;
+
+        if (state.stats.enabled && state.stats.sinceLastPrint >= 1.0) {
+            state.stats.sinceLastPrint = 0.0;
+
+            std::printf("Terrain triangles per LOD:");
+            for (std::size_t i = 0; i < state.renderData.langersoChunks.lods.levels.size(); ++i)
+                std::printf(" [%zu] %zu", i, state.stats.lodTriangles[i]);
+            std::printf("\n");
+
+            std::printf("Renderables: %zu visible, %zu culled, all views\n", state.stats.renderablesVisible, state.stats.renderablesCulled);
+            std::printf("Terrain chunks: %zu visible, %zu culled\n", state.stats.visibleChunks, state.stats.culledChunks);
+            std::printf("Terrain meshlets: %zu visible, %zu outside the view, %zu back-facing\n",
+                state.stats.meshlets.visible, state.stats.meshlets.frustumCulled, state.stats.meshlets.backfaceCulled);
+            std::printf("Scene: %zu draws recorded, replayed %zu times in %zu draw calls\n",
+                state.stats.sceneDraws, state.stats.sceneReplays, state.stats.sceneCalls);
+            auto const& lightStats = state.renderData.lightClusters.stats();
+            std::printf("Point lights: %zu, %zu in view, %zu cluster entries in %zu clusters, at most %zu in one\n",
+                lightStats.lights, lightStats.visible, lightStats.indices, lightStats.litClusters, lightStats.maxPerCluster);
+            if (lightStats.dropped)
+                std::printf("  %zu cluster entries didn't fit\n", lightStats.dropped);
+            if (lightStats.droppedLights)
+                std::printf("  %zu lights didn't fit\n", lightStats.droppedLights);
+            std::printf("Render queue: %zu items, %zu state changes sorted, %zu unsorted\n",
+                state.stats.queueItems, state.stats.queueChanges, state.stats.queueChangesUnsorted);
+            std::printf("GL state: %zu calls, %zu redundant ones skipped\n",
+                gl_state().stats().calls, gl_state().stats().avoided);
+            std::printf("Stream buffer: %zu of %zu KiB per frame used, at most %zu, %zu waits for the GPU\n",
+                state.renderData.frameStream.stats().used / 1024,
+                std::size_t(state.renderData.frameStream.frame_size()) / 1024,
+                state.renderData.frameStream.stats().peak / 1024,
+                state.renderData.frameStream.stats().waits);
+            std::printf("GPU: depth pre-pass %.2f ms, scene %.2f ms, UI %.2f ms (pre-pass %s, vertices %s)\n",
+                state.gpuTimer.average(kGpuDepthPrepass_), state.gpuTimer.average(kGpuScene_),
+                state.gpuTimer.average(kGpuUI_), state.isDepthPrepass ? "on" : "off",
+                state.isVertexPulling ? "pulled" : "attributes");
+            state.gpuTimer.reset_average();
+            print_geometry_stats( state.renderData.sceneGeometry[state.isVertexPulling] );
+        }
 
-        #endif
+        // Everything that reads this frame's streamed data has been issued
+        state.renderData.frameStream.end_frame();
 
         // Display results
         glfwSwapBuffers( window );
@@ -761,9 +1391,10 @@ int main() try
 
     // Cleanup.
     //TODO: additional cleanup
-    glBindVertexArray( 0 );
-    glUseProgram( 0 );
-    state.prog = nullptr;
+    gl_state().bind_vertex_array( 0 );
+    gl_state().use_program( 0 );
+    for (auto& programs : state.scenePrograms)
+        programs = {};
 
     return 0;
 }
@@ -818,6 +1449,29 @@ namespace
         };
     }
 
+    // Random coloured lights just above the terrain, the same every run
+    void scatter_light_field( State_& state ) {
+        auto const& heights = state.terrainHeights;
+
+        float sizeX = float(heights.width - 1) * heights.spacingX;
+        float sizeZ = float(heights.depth - 1) * heights.spacingZ;
+
+        std::mt19937 rng( 3811 );
+        std::uniform_real_distribution<float> uniform( 0.f, 1.f );
+
+        auto& field = state.renderData.lightField;
+        field.clear();
+
+        for (std::size_t i = 0; i < kLightFieldCount_; ++i) {
+            float x = heights.originX + uniform(rng) * sizeX;
+            float z = heights.originZ + uniform(rng) * sizeZ;
+            Vec3f position = { x, height_at(heights, x, z) + 0.2f, z };
+
+            Vec3f color = Vec3f{ uniform(rng), uniform(rng), uniform(rng) } * kLightFieldIntensity_;
+            field.emplace_back(Light{ position, color, color, Vec3f{ 0.f, 0.f, 0.f }, Vec3f{ 0.f, 0.f, 0.f } });
+        }
+    }
+
     void update_camera_pos( State_& state ) {
         if ( state.camControl.camView != FREE_ROAM && state.camControl2.camView != FREE_ROAM )
         	return;
@@ -853,6 +1507,10 @@ namespace
             state.freeRoamCtrls.cameraPos += velocity * cameraRelativeUp;
         if (state.freeRoamCtrls.movingDown)
             state.freeRoamCtrls.cameraPos -= velocity * cameraRelativeUp;
+
+        // Keep out of the ground
+        Vec3f& pos = state.freeRoamCtrls.cameraPos;
+        pos.y = std::max(pos.y, height_at(state.terrainHeights, pos.x, pos.z) + kCameraGroundClearance_);
     
 
         // If update the camera to the free roam view
@@ -891,98 +1549,383 @@ namespace
             update_camera_pos( state );
     }
 
+    // Places the cameras on screen for the current layout. Every view gets
+    // a projection for its own aspect ratio.
+    void layout_views( State_& state ) {
+        auto& views = state.renderData.views;
+
+        GLsizei halfWidth = fbwidth / 2;
+
+        switch (state.viewLayout) {
+            case ViewLayout_::kSingle:
+                views[0].rect = { 0, 0, fbwidth, fbheight };
+                state.renderData.viewCount = 1;
+                break;
+
+            case ViewLayout_::kSplitScreen:
+                views[0].rect = { 0, 0, halfWidth, fbheight };
+                views[1].rect = { halfWidth, 0, fbwidth - halfWidth, fbheight };
+                state.renderData.viewCount = 2;
+                break;
+
+            case ViewLayout_::kPictureInPicture: {
+                // A quarter of the size, in the top right hand corner
+                GLsizei insetWidth = fbwidth / 4, insetHeight = fbheight / 4;
+                GLint margin = fbheight / 32;
+
+                views[0].rect = { 0, 0, fbwidth, fbheight };
+                views[1].rect = { fbwidth - insetWidth - margin, fbheight - insetHeight - margin, insetWidth, insetHeight };
+                state.renderData.viewCount = 2;
+            } break;
+        }
+
+        static_assert( kMaxViews >= 2 );
+        Mat44f const world2cameras[] = { state.camControl.getView(), state.camControl2.getView() };
+
+        for (std::size_t i = 0; i < state.renderData.viewCount; ++i) {
+            ViewRect const& rect = views[i].rect;
+
+            views[i].world2camera = world2cameras[i];
+            views[i].projection = make_perspective_projection(
+                60.f * std::numbers::pi_v<float> / 180.f,
+                float(rect.width) / float(std::max(rect.height, 1)),   // Aspect ratio
+                kNearPlane_, kFarPlane_                                 // Near / far
+            );
+        }
+    }
+
+    // aX and aY are in framebuffer pixels, from the top left
+    void pick_terrain( State_& state, double aX, double aY ) {
+        // Which view the cursor is over. Later views are drawn on top.
+        // Window y points down, the viewports' up.
+        double windowY = double(fbheight) - aY;
+
+        std::size_t view = 0;
+        for (std::size_t i = 0; i < state.renderData.viewCount; ++i) {
+            ViewRect const& r = state.renderData.views[i].rect;
+            if (aX >= r.x && aX < r.x + r.width && windowY >= r.y && windowY < r.y + r.height)
+                view = i;
+        }
+
+        SceneView_ const& sceneView = state.renderData.views[view];
+        ViewRect const& rect = sceneView.rect;
+
+        // Cursor to NDC
+        float ndcX = 2.f * (float(aX) - float(rect.x)) / float(rect.width) - 1.f;
+        float ndcY = 2.f * (float(windowY) - float(rect.y)) / float(rect.height) - 1.f;
+
+        // Unproject onto the near and far planes
+        Mat44f clip2world = invert(sceneView.projection * sceneView.world2camera);
+        Vec4f nearPoint = clip2world * Vec4f{ ndcX, ndcY, -1.f, 1.f };
+        Vec4f farPoint = clip2world * Vec4f{ ndcX, ndcY, 1.f, 1.f };
+
+        Vec3f from = Vec3f{ nearPoint.x, nearPoint.y, nearPoint.z } / nearPoint.w;
+        Vec3f to = Vec3f{ farPoint.x, farPoint.y, farPoint.z } / farPoint.w;
+
+        auto pickStart = std::chrono::steady_clock::now();
+
+        RayHit hit;
+        bool found = state.terrainBvh.raycast(from, to - from, 1.f, hit);
+
+        auto pickTime = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - pickStart);
+
+        if (found)
+            std::printf("Picked terrain triangle %u at (%.2f, %.2f, %.2f) in %.1f us\n", hit.triangle, hit.position.x, hit.position.y, hit.position.z, pickTime.count());
+        else
+            std::printf("Picked nothing in %.1f us\n", pickTime.count());
+    }
+
 
-    void drawMesh(
-        GLuint vao,
-        GLuint vertexCount,
-        const Mat44f &projCameraWorld,
-        const Mat33f &normalMatrix,
-        State_ &state
+    std::vector<float> load_or_bake_ao(
+        char const* aCachePath,
+        SimpleMeshData const& aMesh,
+        std::vector<Vec3f> const& aOccluderPositions,
+        std::vector<std::uint32_t> const& aOccluderIndices,
+        float aDistance
     ) {
-        glUniformMatrix4fv(state.renderData.uProjCameraWorldLocation, 1, GL_TRUE, projCameraWorld.v);
-        glUniformMatrix3fv(state.renderData.uNormalMatrixLocation, 1, GL_TRUE, normalMatrix.v);
+        auto key = vertex_ao_key(aMesh, aOccluderPositions, aOccluderIndices, kAoSamples_, aDistance);
 
-        glBindVertexArray(vao);
+        std::vector<float> occlusion;
+        if (load_vertex_ao(aCachePath, key, aMesh.positions.size(), occlusion)) {
+            std::printf("Loaded ambient occlusion from '%s'\n", aCachePath);
+            return occlusion;
+        }
 
-        #ifdef ENABLE_TIMING
-		glQueryCounter(state.queries[state.qCount++], GL_TIMESTAMP);
-        glDrawArrays(GL_TRIANGLES, 0, vertexCount);
-		glQueryCounter(state.queries[state.qCount++], GL_TIMESTAMP);
-        #else
-        glDrawArrays(GL_TRIANGLES, 0, vertexCount);
-        #endif
+        auto bakeStart = std::chrono::steady_clock::now();
+
+        TriangleBvh occluders(aOccluderPositions, aOccluderIndices.data(), aOccluderIndices.size());
+        occlusion = bake_vertex_ao(aMesh, occluders, kAoSamples_, aDistance);
+
+        auto bakeTime = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - bakeStart);
+        std::printf("Baked ambient occlusion for %zu vertices in %lld ms\n", occlusion.size(), (long long)bakeTime.count());
+
+        std::error_code ec;
+        std::filesystem::create_directories(kBakeCacheDir_, ec);
+        if (!save_vertex_ao(aCachePath, key, occlusion))
+            std::fprintf(stderr, "Warning: unable to write ambient occlusion cache '%s'\n", aCachePath);
+
+        return occlusion;
+    }
+
+    void print_geometry_stats( SharedGeometry const& aGeometry ) {
+        auto stats = aGeometry.stats();
+
+        std::printf("Scene geometry: %zu meshes\n", stats.meshes);
+        std::printf("  %s: %zu / %zu (%.1f%% used), %zu free ranges, %.1f%% fragmented\n",
+            stats.pulled ? "vertex words" : "vertices",
+            stats.vertices.used, stats.vertices.capacity, stats.vertices.occupancy() * 100.f,
+            stats.vertices.freeRanges, stats.vertices.fragmentation() * 100.f);
+        std::printf("  indices: %zu / %zu (%.1f%% used), %zu free ranges, %.1f%% fragmented\n",
+            stats.indices.used, stats.indices.capacity, stats.indices.occupancy() * 100.f,
+            stats.indices.freeRanges, stats.indices.fragmentation() * 100.f);
     }
 
+    // Program, textures and fixed function state for replaying the scene.
+    // The particles share texture unit 0, so this goes before every replay.
+    void bind_scene_state( State_& state, ShaderProgram const& aProgram ) {
+        gl_state().use_program( aProgram.programId() );
+        gl_state().set_enabled( GL_DEPTH_TEST, true );
+        gl_state().set_enabled( GL_BLEND, false );
+
+        gl_state().bind_texture( 0, GL_TEXTURE_2D, state.renderData.textureObjectId );
+        gl_state().bind_texture( 1, GL_TEXTURE_2D_ARRAY, state.renderData.langersoNormalMapId );
+        gl_state().bind_texture( 2, GL_TEXTURE_2D, state.renderData.langersoLightmapId );
+    }
+
+    // Replays the recorded scene with aShading. With the depth pre-pass, the
+    // scene is first replayed with aDepth and colour writes off, and then
+    // shaded with depth writes off, keeping only the fragments that won. So
+    // default.frag runs once per pixel however much of the scene is hidden.
+    // The pre-pass costs a second run over the vertices, so it pays off when
+    // the shading is the expensive part: many lights, steep terrain seen
+    // from the ground. The stats' GPU times show which one it is (P).
+    // Returns the GL draw calls.
+    std::size_t draw_scene_pass( State_& state, ShaderProgram const& aShading, ShaderProgram const& aDepth ) {
+        auto& batch = state.renderData.sceneBatch[state.isVertexPulling];
+        std::size_t calls = 0;
+
+        if (state.isDepthPrepass) {
+            state.gpuTimer.begin( kGpuDepthPrepass_ );
+            bind_scene_state( state, aDepth );
+            gl_state().color_mask( false );
+            calls += batch.draw();
+            ++state.stats.sceneReplays;
+            gl_state().color_mask( true );
+            state.gpuTimer.end( kGpuDepthPrepass_ );
+
+            // Same shaders up to gl_Position, which is invariant, so the
+            // depths match exactly
+            gl_state().depth_func( GL_EQUAL );
+            gl_state().depth_mask( false );
+        }
+
+        state.gpuTimer.begin( kGpuScene_ );
+        bind_scene_state( state, aShading );
+        calls += batch.draw();
+        ++state.stats.sceneReplays;
+        state.gpuTimer.end( kGpuScene_ );
+
+        // The particles and the next view's clear need depth writes
+        gl_state().depth_func( GL_LESS );
+        gl_state().depth_mask( true );
+
+        return calls;
+    }
 
     // Contains main rendering logic
-    void renderScene( State_ &state ) {
+    // Records the scene once for all of this frame's views: whatever any
+    // view sees goes into the batch, which is then uploaded. Nothing is
+    // drawn here; each view replays the batch, see DrawBatch::draw(). With
+    // aViewsPerDraw > 1 every draw is instanced for that many views at once
+    // (see multi_view.hpp).
+    void renderScene( State_ &state, GLuint aViewsPerDraw ) {
 
         // === Setting up models ===
-        // Langerso translations
+        // The cameras are in the ViewBlock and the transforms go in the draw
+        // records. The terrain's meshlet culling needs them here as well.
         Mat44f model2world = kIdentity44f;
-        Mat44f projCameraWorld = state.renderData.projection * state.renderData.world2camera * model2world;
-        Mat33f normalMatrix = mat44_to_mat33(transpose(invert(model2world)));
-
-        // Translations and projection for first launchpad
-        Mat44f model2worldLaunchpad =  make_translation( Vec3f { 3.f, 0.f, -5.f } ) * model2world;
-        Mat44f projCameraWorld_LP1 = state.renderData.projection * state.renderData.world2camera * model2worldLaunchpad;
-        Mat33f normalMatrix_LP1 = mat44_to_mat33(transpose(invert(model2worldLaunchpad)));
-        
-        // Translations and projection for second launchpad
-        Mat44f model2worldLaunchpad2 = make_translation( Vec3f { -7.f, 0.f, 7.f } ) * model2world;
-        Mat44f projCameraWorld_LP2 = state.renderData.projection * state.renderData.world2camera * model2worldLaunchpad2;
-        Mat33f normalMatrix_LP2 = mat44_to_mat33(transpose(invert(model2worldLaunchpad2)));
-
-        // Combine translation and rotation
-        Mat44f model2worldVehicle = make_translation(state.vehicleControl.position) * make_rotation_x(state.vehicleControl.theta);
-        Mat44f projCameraWorld_V = state.renderData.projection * state.renderData.world2camera * model2worldVehicle;
-        Mat33f normalMatrix_V = mat44_to_mat33(transpose(invert(model2worldVehicle)));    
-
-        // === Drawing ===
+
+        Mat44f model2worldVehicle = state.renderData.vehicleModel2World;
+
+        auto const& views = state.renderData.views;
+        std::size_t const viewCount = state.renderData.viewCount;
+
+        Frustum frusta[kMaxViews];
+        Vec3f cameraPositions[kMaxViews];
+
+        for (std::size_t i = 0; i < viewCount; ++i) {
+            Mat44f const& world2camera = views[i].world2camera;
+            frusta[i] = make_frustum(views[i].projection * world2camera * model2world);
+
+            Mat44f camera2world = invert(world2camera);
+            cameraPositions[i] = { camera2world(0, 3), camera2world(1, 3), camera2world(2, 3) };
+        }
+
+        // Anything that survived any one view's frustum, see the views setup
+        auto visible = [&](std::size_t aId) {
+            for (std::size_t i = 0; i < viewCount; ++i) {
+                if (state.renderData.visible[i][aId])
+                    return true;
+            }
+            return false;
+        };
+
+        // === Recording ===
+        // Everything is collected into one batch and goes out in one go
+        auto& geometry = state.renderData.sceneGeometry[state.isVertexPulling];
+        auto& batch = state.renderData.sceneBatch[state.isVertexPulling];
+        batch.clear();
 
         // Langerso mesh
-        glUniformMatrix4fv(
-            state.renderData.uModel2WorldLocation, 1,
-            GL_TRUE, model2world.v
-        );
+        // Chunks were culled against the view frusta with everything else,
+        // and the ones left pick their LOD from the error it would have on
+        // screen. With several views, the view that needs the most detail
+        // decides.
+        Vec3f const& cameraPos = cameraPositions[0];     // Sorts the draws
+
+        float maxPixelError = state.renderData.langersoNormalMapId ? kTerrainLodPixelError_ : 1.f;
+
+        // Every draw goes into the render queue with its sort key first, and
+        // into the batch in key order. There is one program and one VAO, so
+        // the material (which textures, which normal map layer) and the
+        // distance decide. See render_queue.hpp.
+        auto& sceneDraws = state.renderData.sceneDraws;
+        auto& queue = state.renderData.sceneQueue;
+        sceneDraws.clear();
+        queue.clear();
+
+        auto enqueue = [&](DrawRecord const& aRecord, SceneDraw_ const& aDraw, Vec3f const& aCenter) {
+            std::uint32_t material = (aRecord.flags << 6) | std::uint32_t(aRecord.normalMapLayer + 1);
+            Vec3f toCamera = aCenter - cameraPos;
+
+            queue.push(make_sort_key(kRenderPassOpaque, 0, material, 0, length(toCamera)), std::uint32_t(sceneDraws.size()));
+            sceneDraws.emplace_back(aDraw);
+        };
+
+        // One record per LOD, since the normal map layer is per LOD. The
+        // meshlets' offsets are relative to the terrain's own indices.
+        MeshRange const& terrain = geometry.range(state.renderData.langersoMeshId);
+
+        DrawRecord lodRecords[kMaxLodLevels];
+        GLuint lodRecordIds[kMaxLodLevels];
+
+        for (std::size_t lod = 0; lod < kMaxLodLevels; ++lod) {
+            GLint layer = state.renderData.langersoNormalMapId ? GLint(lod) - 1 : -1;
+
+            lodRecords[lod] = make_draw_record(model2world, kIdentity44f, kDrawTextured, layer, terrain);
+            if (layer >= 0)
+                lodRecords[lod].flags |= kDrawNormalMap;
+            if (state.renderData.langersoLightmapId)
+                lodRecords[lod].flags |= kDrawLightmap;
+
+            lodRecordIds[lod] = batch.add_records(&lodRecords[lod]);
+        }
+
+        auto& draws = state.renderData.langersoDraws;
+        for (auto& list : draws)
+            list.clear();
+
+        auto const& chunks = state.renderData.langersoChunks.chunks;
+        for (std::size_t c = 0; c < chunks.size(); ++c) {
+            auto const& chunk = chunks[c];
+
+            if (!visible(state.renderData.chunkBoundsFirst + c)) {
+                ++state.stats.culledChunks;
+                continue;
+            }
+
+            ++state.stats.visibleChunks;
+
+            // By each view's own height on screen
+            std::size_t lod = kMaxLodLevels - 1;
+            for (std::size_t i = 0; i < viewCount; ++i)
+                lod = std::min(lod, select_lod(chunk.lods, model2world, cameraPositions[i], views[i].projection, float(views[i].rect.height), maxPixelError));
 
-        glUniform1i(state.renderData.uUseTextureLocation, GL_TRUE);
+            // Then the chunk's meshlets at that LOD, against the frustum and
+            // their normal cones
+            std::size_t before = draws[lod].size();
+            cull_meshlets(state.renderData.langersoChunks.meshlets, chunk.meshlets[lod], frusta, cameraPositions, viewCount, draws[lod], &state.stats.meshlets);
 
-        glActiveTexture( GL_TEXTURE0 );
-        glBindTexture( GL_TEXTURE_2D, state.renderData.textureObjectId );
+            // The chunk's meshlets sort by the chunk's distance
+            for (std::size_t i = before; i < draws[lod].size(); ++i) {
+                state.stats.lodTriangles[lod] += draws[lod].counts[i] / 3;
 
-        drawMesh(state.renderData.langersoVao, state.renderData.langersoVertexCount, projCameraWorld, normalMatrix, state);
+                GLuint first = terrain.firstIndex + GLuint(std::uintptr_t(draws[lod].offsets[i]) / sizeof(std::uint32_t));
+                enqueue(lodRecords[lod], SceneDraw_{ first, draws[lod].counts[i], terrain.baseVertex, lodRecordIds[lod], 1 }, chunk.sphereCenter);
+            }
+        }
 
         // Draw Vehicle
-        glUniform1i(state.renderData.uUseTextureLocation, GL_FALSE);
+        // One instanced draw per unique primitive. Each instance's record
+        // names its part, which is moved by its entry in the PartPalette
+        // block.
+        if (visible(state.renderData.vehicleBoundsId)) {
+            auto const& model = state.renderData.vehicleModel;
+            Mat44f normalMatrix = transpose(invert(model2worldVehicle));
+
+            std::vector<DrawRecord> records;
+            for (std::size_t p = 0; p < model.primitives.size(); ++p) {
+                MeshRange const& mesh = geometry.range(state.renderData.vehicleMeshIds[p]);
+
+                records.clear();
+                for (auto const part : model.instances[p]) {
+                    records.emplace_back(make_draw_record(model2worldVehicle, normalMatrix, kDrawPalette, -1, mesh));
+                    records.back().paletteIndex = part;
+                }
 
-        glUniformMatrix4fv(
-            state.renderData.uModel2WorldLocation, 1,
-            GL_TRUE, model2worldVehicle.v
-        );
+                GLuint first = batch.add_records(records.data(), records.size());
+                enqueue(records.front(), SceneDraw_{ mesh.firstIndex, mesh.indexCount, mesh.baseVertex, first, GLsizei(records.size()) }, state.vehicleControl.position);
+            }
+        }
+
+        // Draw both launch pads, instanced
+        // One record per visible instance places each pad in the world. They
+        // go out in one draw, at the nearest pad's distance.
+        {
+            MeshRange const& pad = geometry.range(state.renderData.landingPadMeshId);
 
-        drawMesh(state.renderData.vehicleVao, state.renderData.vehicleVertexCount, projCameraWorld_V, normalMatrix_V, state);
+            std::vector<DrawRecord> records;
+            Vec3f nearest = {};
+            float nearestDistance = std::numeric_limits<float>::max();
 
-        // Draw first launch pad
-        glUniformMatrix4fv(
-            state.renderData.uModel2WorldLocation, 1,
-            GL_TRUE, model2worldLaunchpad.v
-        );
+            auto const& transforms = state.renderData.landingPadTransforms;
+            for (std::size_t p = 0; p < transforms.size(); ++p) {
+                if (!visible(state.renderData.padBoundsFirst + p))
+                    continue;
 
-        drawMesh(state.renderData.landingPadVao, state.renderData.landingPadVertexCount, projCameraWorld_LP1, normalMatrix_LP1, state);
+                auto const& transform = transforms[p];
+                records.emplace_back(make_draw_record(transform, transpose(invert(transform)), 0, -1, pad));
 
-        // Draw second launch pad
-        glUniformMatrix4fv(
-            state.renderData.uModel2WorldLocation, 1,
-            GL_TRUE, model2worldLaunchpad2.v
-        );
+                Vec3f center = { transform(0, 3), transform(1, 3), transform(2, 3) };
+                float distance = length(center - cameraPos);
+                if (distance < nearestDistance) {
+                    nearestDistance = distance;
+                    nearest = center;
+                }
+            }
+
+            if (!records.empty()) {
+                GLuint first = batch.add_records(records.data(), records.size());
+                enqueue(records.front(), SceneDraw_{ pad.firstIndex, pad.indexCount, pad.baseVertex, first, GLsizei(records.size()) }, nearest);
+            }
+        }
+
+        queue.sort();
+
+        for (auto const& entry : queue.entries()) {
+            SceneDraw_ const& draw = sceneDraws[entry.item];
+            batch.add_draw(draw.firstIndex, draw.indexCount, draw.baseVertex, draw.record, draw.instances);
+        }
 
-        drawMesh(state.renderData.landingPadVao, state.renderData.landingPadVertexCount, projCameraWorld_LP2, normalMatrix_LP2, state);
+        state.stats.queueItems += queue.stats().items;
+        state.stats.queueChanges += queue.stats().state_changes();
+        state.stats.queueChangesUnsorted += queue.stats().unsortedChanges;
 
+        state.stats.sceneDraws += batch.draw_count();
+        batch.upload( state.renderData.frameStream, aViewsPerDraw );
     }
 }
 
-
 // Callbacks
 namespace
 {
@@ -1030,7 +1973,42 @@ namespace
                 state->particleSystem->reset( state->vehicleControl.origin );
             }
 
-            if (aAction == GLFW_PRESS && aKey == GLFW_KEY_V) { state->isSplitScreen = !state->isSplitScreen; }
+            if (aAction == GLFW_PRESS && aKey == GLFW_KEY_V) {
+                switch (state->viewLayout) {
+                    case ViewLayout_::kSingle: state->viewLayout = ViewLayout_::kSplitScreen; break;
+                    case ViewLayout_::kSplitScreen: state->viewLayout = ViewLayout_::kPictureInPicture; break;
+                    case ViewLayout_::kPictureInPicture: state->viewLayout = ViewLayout_::kSingle; break;
+                }
+            }
+
+            // Split screen in one pass, or view by view
+            if (aAction == GLFW_PRESS && aKey == GLFW_KEY_M) {
+                state->isSinglePassViews = !state->isSinglePassViews;
+                std::printf("Split screen: %s\n", state->isSinglePassViews ? "one pass" : "view by view");
+            }
+
+            if (aAction == GLFW_PRESS && aKey == GLFW_KEY_I) { state->stats.enabled = !state->stats.enabled; }
+
+            if (aAction == GLFW_PRESS && aKey == GLFW_KEY_P) {
+                state->isDepthPrepass = !state->isDepthPrepass;
+                std::printf("Depth pre-pass: %s\n", state->isDepthPrepass ? "on" : "off");
+            }
+
+            // Vertex attributes, or vertices pulled from a storage buffer
+            if (aAction == GLFW_PRESS && aKey == GLFW_KEY_G) {
+                if (state->canPullVertices) {
+                    state->isVertexPulling = !state->isVertexPulling;
+                    std::printf("Scene vertices: %s\n", state->isVertexPulling ? "pulled from a storage buffer" : "vertex attributes");
+                }
+                else {
+                    std::printf("Scene vertices: pulling them needs OpenGL 4.3\n");
+                }
+            }
+
+            if (aAction == GLFW_PRESS && aKey == GLFW_KEY_L) {
+                state->isLightFieldOn = !state->isLightFieldOn;
+                std::printf("Light field: %s\n", state->isLightFieldOn ? "on" : "off");
+            }
 
             if (aAction == GLFW_PRESS || aAction == GLFW_RELEASE)
             {
@@ -1164,9 +2142,12 @@ namespace
             }
             if( GLFW_MOUSE_BUTTON_LEFT == aButton && GLFW_PRESS == aAction ) {
 
+                bool onButton = false;
+
                 for (auto& b : UI.buttons) {
                     if (b.state == MOUSE_OVER) {
 
+                        onButton = true;
                         b.state = PRESSED;
                         if (b.text == "Launch") {
                             // toggle the launch
@@ -1184,6 +2165,23 @@ namespace
 
                     }
                 }
+
+                // Clicks that miss the UI pick the terrain
+                if (!onButton && !state->freeRoamCtrls.cameraActive) {
+                    double x, y;
+                    glfwGetCursorPos( aWindow, &x, &y );
+
+                    // The cursor is in window coordinates, the views in
+                    // framebuffer pixels. They differ on HiDPI displays.
+                    int windowWidth, windowHeight;
+                    glfwGetWindowSize( aWindow, &windowWidth, &windowHeight );
+                    if (windowWidth > 0 && windowHeight > 0) {
+                        x *= double(fbwidth) / double(windowWidth);
+                        y *= double(fbheight) / double(windowHeight);
+                    }
+
+                    pick_terrain( *state, x, y );
+                }
             }
             if( GLFW_MOUSE_BUTTON_LEFT == aButton && GLFW_RELEASE == aAction ) {
 
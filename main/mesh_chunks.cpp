@@ -0,0 +1,222 @@
+#include "mesh_chunks.hpp"
+
+#include <limits>
+#include <algorithm>
+
+#include <cmath>
+
+#include "thread_pool.hpp"
+
+namespace
+{
+    struct ChunkBuild_
+    {
+        std::vector<std::uint32_t> triangles;               // Global index buffer offsets / 3
+        std::vector<std::vector<std::uint32_t>> levels;     // Global indices, per level
+        std::vector<float> errors;
+    };
+
+    void build_chunk_( SimpleMeshData const& aMesh, ChunkBuild_& aChunk, std::size_t aLevelCount, float aRatio )
+    {
+        // Pull the chunk out into its own small mesh, so that the simplifier
+        // only has to look at the vertices this chunk actually uses
+        std::vector<std::uint32_t> vertices;
+        vertices.reserve( aChunk.triangles.size() * 3 );
+
+        for (auto const t : aChunk.triangles)
+            for (std::size_t k = 0; k < 3; ++k)
+                vertices.emplace_back( aMesh.indices[t * 3 + k] );
+
+        std::sort( vertices.begin(), vertices.end() );
+        vertices.erase( std::unique( vertices.begin(), vertices.end() ), vertices.end() );
+
+        auto const local = [&] (std::uint32_t aGlobal) {
+            return std::uint32_t(std::lower_bound( vertices.begin(), vertices.end(), aGlobal ) - vertices.begin());
+        };
+
+        SimpleMeshData part;
+        part.positions.reserve( vertices.size() );
+        for (auto const v : vertices)
+            part.positions.emplace_back( aMesh.positions[v] );
+
+        if (aMesh.normals.size() == aMesh.positions.size()) {
+            part.normals.reserve( vertices.size() );
+            for (auto const v : vertices)
+                part.normals.emplace_back( aMesh.normals[v] );
+        }
+
+        std::vector<std::uint32_t> level;
+        level.reserve( aChunk.triangles.size() * 3 );
+        for (auto const t : aChunk.triangles)
+            for (std::size_t k = 0; k < 3; ++k)
+                level.emplace_back( local( aMesh.indices[t * 3 + k] ) );
+
+        auto const toGlobal = [&] (std::vector<std::uint32_t> const& aLocal) {
+            std::vector<std::uint32_t> ret( aLocal.size() );
+            for (std::size_t i = 0; i < aLocal.size(); ++i)
+                ret[i] = vertices[aLocal[i]];
+            return ret;
+        };
+
+        aChunk.levels.emplace_back( toGlobal( level ) );
+        aChunk.errors.emplace_back( 0.f );
+
+        while (aChunk.levels.size() < aLevelCount) {
+            std::size_t const target = std::size_t(level.size() / 3 * aRatio) * 3;
+
+            float levelError = 0.f;
+            auto next = simplify( part, level, target, std::numeric_limits<float>::max(), &levelError, true );
+
+            if (next.empty() || next.size() > level.size() * 9 / 10)
+                break;
+
+            level = std::move(next);
+
+            aChunk.levels.emplace_back( toGlobal( level ) );
+            aChunk.errors.emplace_back( aChunk.errors.back() + levelError );
+        }
+    }
+}
+
+ChunkedMesh make_chunked_lods(
+    SimpleMeshData& aMesh,
+    std::size_t aChunksX,
+    std::size_t aChunksZ,
+    std::size_t aLevelCount,
+    float aRatio,
+    std::size_t aThreadCount
+)
+{
+    aMesh = weld_vertices( aMesh );
+
+    aChunksX = std::max<std::size_t>( 1, aChunksX );
+    aChunksZ = std::max<std::size_t>( 1, aChunksZ );
+    aLevelCount = std::clamp<std::size_t>( aLevelCount, 1, kMaxLodLevels );
+
+    ChunkedMesh ret;
+
+    auto const fitBounds = [&] (MeshLodChain& aOut, std::vector<std::uint32_t> const& aIndices) {
+        aOut.boundsMin = Vec3f{ std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+        aOut.boundsMax = -aOut.boundsMin;
+
+        for (auto const idx : aIndices) {
+            Vec3f const& p = aMesh.positions[idx];
+            aOut.boundsMin = Vec3f{ std::min( aOut.boundsMin.x, p.x ), std::min( aOut.boundsMin.y, p.y ), std::min( aOut.boundsMin.z, p.z ) };
+            aOut.boundsMax = Vec3f{ std::max( aOut.boundsMax.x, p.x ), std::max( aOut.boundsMax.y, p.y ), std::max( aOut.boundsMax.z, p.z ) };
+        }
+    };
+
+    fitBounds( ret.lods, aMesh.indices );
+
+    // Sort the triangles into the grid by their centroids
+    std::vector<ChunkBuild_> builds( aChunksX * aChunksZ );
+
+    Vec3f const extent = ret.lods.boundsMax - ret.lods.boundsMin;
+
+    for (std::size_t i = 0; i + 2 < aMesh.indices.size(); i += 3) {
+        Vec3f const c = (aMesh.positions[aMesh.indices[i]] + aMesh.positions[aMesh.indices[i+1]] + aMesh.positions[aMesh.indices[i+2]]) / 3.f;
+
+        float const u = extent.x > 0.f ? (c.x - ret.lods.boundsMin.x) / extent.x : 0.f;
+        float const v = extent.z > 0.f ? (c.z - ret.lods.boundsMin.z) / extent.z : 0.f;
+
+        std::size_t const cx = std::min( aChunksX - 1, std::size_t(u * aChunksX) );
+        std::size_t const cz = std::min( aChunksZ - 1, std::size_t(v * aChunksZ) );
+
+        builds[cz * aChunksX + cx].triangles.emplace_back( std::uint32_t(i / 3) );
+    }
+
+    builds.erase( std::remove_if( builds.begin(), builds.end(), [] (ChunkBuild_ const& b) {
+        return b.triangles.empty();
+    } ), builds.end() );
+
+    // Simplify the chunks in parallel
+    parallel_for( builds.size(), aThreadCount, [&] (std::size_t c) {
+        build_chunk_( aMesh, builds[c], aLevelCount, aRatio );
+    } );
+
+    // Chunks that ran out of collapses early repeat their last level, so that
+    // every level exists for every chunk
+    std::size_t levelCount = 0;
+    for (auto const& b : builds)
+        levelCount = std::max( levelCount, b.levels.size() );
+
+    for (auto& b : builds) {
+        while (b.levels.size() < levelCount) {
+            b.levels.emplace_back( b.levels.back() );
+            b.errors.emplace_back( b.errors.back() );
+        }
+    }
+
+    // Build the index buffer, level by level
+    ret.chunks.resize( builds.size() );
+
+    std::vector<std::uint32_t> indices;
+    indices.reserve( aMesh.indices.size() * 2 );
+
+    for (std::size_t level = 0; level < levelCount; ++level) {
+        MeshLod whole{ GLuint(indices.size()), 0, 0.f };
+
+        for (std::size_t c = 0; c < builds.size(); ++c) {
+            auto const& src = builds[c].levels[level];
+
+            ret.chunks[c].lods.levels.emplace_back( MeshLod{
+                GLuint(indices.size()),
+                GLsizei(src.size()),
+                builds[c].errors[level]
+            } );
+
+            indices.insert( indices.end(), src.begin(), src.end() );
+            whole.error = std::max( whole.error, builds[c].errors[level] );
+        }
+
+        whole.indexCount = GLsizei(indices.size() - whole.firstIndex);
+        ret.lods.levels.emplace_back( whole );
+    }
+
+    // Chunk bounds, from the full resolution triangles
+    for (std::size_t c = 0; c < builds.size(); ++c) {
+        MeshChunk& chunk = ret.chunks[c];
+        fitBounds( chunk.lods, builds[c].levels[0] );
+
+        chunk.sphereCenter = 0.5f * (chunk.lods.boundsMin + chunk.lods.boundsMax);
+        chunk.sphereRadius = 0.f;
+
+        for (auto const idx : builds[c].levels[0])
+            chunk.sphereRadius = std::max( chunk.sphereRadius, length( aMesh.positions[idx] - chunk.sphereCenter ) );
+    }
+
+    // Meshlets, for every chunk and level. The chunks don't share any index
+    // ranges, so they can be built in parallel and merged afterwards.
+    std::vector<MeshletSet> chunkMeshlets( ret.chunks.size() );
+
+    parallel_for( ret.chunks.size(), aThreadCount, [&] (std::size_t c) {
+        for (auto const& range : ret.chunks[c].lods.levels)
+            ret.chunks[c].meshlets.emplace_back( build_meshlets( aMesh.positions, indices, range.firstIndex, range.indexCount, chunkMeshlets[c] ) );
+    } );
+
+    for (std::size_t c = 0; c < ret.chunks.size(); ++c) {
+        std::uint32_t const offset = std::uint32_t(ret.meshlets.size());
+        for (auto& range : ret.chunks[c].meshlets)
+            range.first += offset;
+
+        auto const append = [] (auto& aDst, auto const& aSrc) {
+            aDst.insert( aDst.end(), aSrc.begin(), aSrc.end() );
+        };
+
+        MeshletSet const& src = chunkMeshlets[c];
+        append( ret.meshlets.centerX, src.centerX );
+        append( ret.meshlets.centerY, src.centerY );
+        append( ret.meshlets.centerZ, src.centerZ );
+        append( ret.meshlets.radius, src.radius );
+        append( ret.meshlets.axisX, src.axisX );
+        append( ret.meshlets.axisY, src.axisY );
+        append( ret.meshlets.axisZ, src.axisZ );
+        append( ret.meshlets.cutoff, src.cutoff );
+        append( ret.meshlets.firstIndex, src.firstIndex );
+        append( ret.meshlets.indexCount, src.indexCount );
+    }
+
+    aMesh.indices = std::move(indices);
+
+    return ret;
+}
@@ -0,0 +1,64 @@
+#ifndef MESH_CHUNKS_HPP_0F8B3E56_C7A1_4D29_86E4_B92D15F0A3C8
+#define MESH_CHUNKS_HPP_0F8B3E56_C7A1_4D29_86E4_B92D15F0A3C8
+
+#include <vector>
+
+#include <cstdlib>
+
+#include "simple_mesh.hpp"
+#include "mesh_lod.hpp"
+#include "meshlets.hpp"
+
+/*
+ *  === Spatial chunks ===
+ *
+ *  Large meshes (the terrain) are split into a grid of chunks on the xz-plane,
+ *  so that the parts outside the view can be skipped and each part can pick
+ *  its own LOD.
+ *
+ *  Every chunk is simplified on its own, with the chunk borders locked, so
+ *  that neighbouring chunks at different LODs still meet without cracks.
+ *
+ *  The index buffer is ordered by level, then by chunk. Level i of all chunks
+ *  is therefore one contiguous range, which is what the normal map baker
+ *  expects (see ChunkedMesh::lods).
+ *
+ *  Each chunk's range is further split into meshlets for finer culling. The
+ *  meshlets only reorder triangles within their chunk's range.
+ */
+
+struct MeshChunk
+{
+    MeshLodChain lods;      // Index ranges and AABB of this chunk
+
+    Vec3f sphereCenter;
+    float sphereRadius;
+
+    std::vector<MeshletRange> meshlets;     // Per level
+};
+
+struct ChunkedMesh
+{
+    // Level i of the whole mesh, i.e. of all chunks together. The error is
+    // the largest one of any chunk at that level.
+    MeshLodChain lods;
+
+    std::vector<MeshChunk> chunks;
+    MeshletSet meshlets;
+};
+
+// Welds aMesh, splits it into aChunksX * aChunksZ chunks by triangle centroid
+// and builds up to aLevelCount LODs per chunk. Chunks are processed in
+// parallel; aThreadCount = 0 uses all hardware threads. On return aMesh holds
+// the shared vertices and the index buffer of every chunk and level. Empty
+// chunks are dropped.
+ChunkedMesh make_chunked_lods(
+    SimpleMeshData& aMesh,
+    std::size_t aChunksX,
+    std::size_t aChunksZ,
+    std::size_t aLevelCount = kMaxLodLevels,
+    float aRatio = 0.5f,
+    std::size_t aThreadCount = 0
+);
+
+#endif // MESH_CHUNKS_HPP_0F8B3E56_C7A1_4D29_86E4_B92D15F0A3C8
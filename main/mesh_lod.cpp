@@ -0,0 +1,540 @@
+#include "mesh_lod.hpp"
+
+#include <limits>
+#include <numeric>
+#include <tuple>
+#include <algorithm>
+
+#include <cmath>
+
+namespace
+{
+    // Symmetric 4x4 quadric, stored as the upper triangle of A, b and c, so
+    // that Q(p) = p^T A p + 2 b.p + c. The weight w is the total area that
+    // went into the quadric; Q(p)/w is then a squared distance.
+    struct Quadric
+    {
+        double a00, a01, a02, a11, a12, a22;
+        double b0, b1, b2;
+        double c;
+        double w;
+    };
+
+    Quadric make_plane_quadric_( Vec3f const& aN, float aD, double aWeight ) noexcept
+    {
+        double const nx = aN.x, ny = aN.y, nz = aN.z, d = aD;
+
+        return Quadric{
+            nx*nx * aWeight, nx*ny * aWeight, nx*nz * aWeight,
+            ny*ny * aWeight, ny*nz * aWeight, nz*nz * aWeight,
+            nx*d * aWeight, ny*d * aWeight, nz*d * aWeight,
+            d*d * aWeight,
+            aWeight
+        };
+    }
+
+    void accumulate_( Quadric& aQ, Quadric const& aR ) noexcept
+    {
+        aQ.a00 += aR.a00; aQ.a01 += aR.a01; aQ.a02 += aR.a02;
+        aQ.a11 += aR.a11; aQ.a12 += aR.a12; aQ.a22 += aR.a22;
+        aQ.b0 += aR.b0; aQ.b1 += aR.b1; aQ.b2 += aR.b2;
+        aQ.c += aR.c;
+        aQ.w += aR.w;
+    }
+
+    double evaluate_( Quadric const& aQ, Vec3f const& aP ) noexcept
+    {
+        double const x = aP.x, y = aP.y, z = aP.z;
+
+        double const r =
+            aQ.a00*x*x + aQ.a11*y*y + aQ.a22*z*z
+            + 2.0 * (aQ.a01*x*y + aQ.a02*x*z + aQ.a12*y*z)
+            + 2.0 * (aQ.b0*x + aQ.b1*y + aQ.b2*z)
+            + aQ.c;
+
+        return std::abs( r );
+    }
+
+    // Borders get a much stronger quadric than the surface, so they only
+    // move when the rest of the mesh has run out of cheap collapses.
+    constexpr double kBorderWeight_ = 10.0;
+
+    // Penalty for collapsing into a vertex with a different normal, scaled
+    // by the squared edge length so that it is comparable to the quadric.
+    constexpr double kNormalWeight_ = 0.5;
+
+    // Collapses that rotate a triangle's normal by more than ~85 degrees are
+    // rejected.
+    constexpr float kMinNormalCos_ = 0.1f;
+
+    enum class VertexKind : unsigned char
+    {
+        manifold,
+        border,
+        locked
+    };
+
+    struct Collapse
+    {
+        std::uint32_t from, to;
+        float cost;         // Squared error
+    };
+
+    std::uint64_t edge_key_( std::uint32_t aA, std::uint32_t aB ) noexcept
+    {
+        return (std::uint64_t(aA) << 32) | aB;
+    }
+
+    bool degenerate_( std::uint32_t aA, std::uint32_t aB, std::uint32_t aC ) noexcept
+    {
+        return aA == aB || aB == aC || aA == aC;
+    }
+}
+
+SimpleMeshData weld_vertices( SimpleMeshData const& aMesh )
+{
+    std::size_t const count = aMesh.positions.size();
+
+    bool const hasTexcoords = aMesh.texcoords.size() == count;
+    bool const hasNormals = aMesh.normals.size() == count;
+    bool const hasMaterials = aMesh.material_ids.size() == count;
+    bool const hasTangents = aMesh.tangents.size() == count;
+
+    auto const key = [&] (std::size_t i) {
+        Vec3f const& p = aMesh.positions[i];
+        Vec2f const t = hasTexcoords ? aMesh.texcoords[i] : Vec2f{ 0.f, 0.f };
+        Vec3f const n = hasNormals ? aMesh.normals[i] : Vec3f{ 0.f, 0.f, 0.f };
+        int const m = hasMaterials ? aMesh.material_ids[i] : 0;
+        Vec4f const tan = hasTangents ? aMesh.tangents[i] : Vec4f{ 0.f, 0.f, 0.f, 0.f };
+
+        return std::make_tuple( p.x, p.y, p.z, t.x, t.y, n.x, n.y, n.z, m, tan.x, tan.y, tan.z, tan.w );
+    };
+
+    // Sort the vertices so that identical ones end up next to each other
+    std::vector<std::uint32_t> order( count );
+    std::iota( order.begin(), order.end(), 0u );
+
+    std::sort( order.begin(), order.end(), [&] (std::uint32_t a, std::uint32_t b) {
+        return key( a ) < key( b );
+    } );
+
+    SimpleMeshData ret;
+    ret.materials = aMesh.materials;
+
+    std::vector<std::uint32_t> remap( count );
+
+    for (std::size_t i = 0; i < count; ++i) {
+        std::uint32_t const v = order[i];
+
+        if (i > 0 && key( order[i-1] ) == key( v )) {
+            remap[v] = remap[order[i-1]];
+            continue;
+        }
+
+        remap[v] = std::uint32_t(ret.positions.size());
+
+        ret.positions.emplace_back( aMesh.positions[v] );
+        if (hasTexcoords) ret.texcoords.emplace_back( aMesh.texcoords[v] );
+        if (hasNormals) ret.normals.emplace_back( aMesh.normals[v] );
+        if (hasMaterials) ret.material_ids.emplace_back( aMesh.material_ids[v] );
+        if (hasTangents) ret.tangents.emplace_back( aMesh.tangents[v] );
+    }
+
+    if (aMesh.indices.empty()) {
+        ret.indices = std::move(remap);
+    }
+    else {
+        ret.indices.reserve( aMesh.indices.size() );
+        for (auto const idx : aMesh.indices)
+            ret.indices.emplace_back( remap[idx] );
+    }
+
+    return ret;
+}
+
+std::vector<std::uint32_t> simplify(
+    SimpleMeshData const& aMesh,
+    std::vector<std::uint32_t> const& aIndices,
+    std::size_t aTargetIndexCount,
+    float aMaxError,
+    float* aOutError,
+    bool aLockBorders
+)
+{
+    std::size_t const vertexCount = aMesh.positions.size();
+    auto const& pos = aMesh.positions;
+
+    bool const hasNormals = aMesh.normals.size() == vertexCount;
+
+    std::vector<std::uint32_t> indices = aIndices;
+    float error = 0.f;
+
+    // Vertices that share their position with another vertex sit on an
+    // attribute seam. Moving them would tear the seam open, so lock them.
+    std::vector<VertexKind> seam( vertexCount, VertexKind::manifold );
+    {
+        std::vector<std::uint32_t> order( vertexCount );
+        std::iota( order.begin(), order.end(), 0u );
+
+        auto const key = [&] (std::uint32_t i) { return std::make_tuple( pos[i].x, pos[i].y, pos[i].z ); };
+        std::sort( order.begin(), order.end(), [&] (std::uint32_t a, std::uint32_t b) {
+            return key( a ) < key( b );
+        } );
+
+        for (std::size_t i = 1; i < vertexCount; ++i) {
+            if (key( order[i-1] ) == key( order[i] ))
+                seam[order[i-1]] = seam[order[i]] = VertexKind::locked;
+        }
+    }
+
+    // Per-vertex quadrics from the triangles around each vertex
+    std::vector<Quadric> quadrics( vertexCount, Quadric{} );
+
+    for (std::size_t i = 0; i + 2 < indices.size(); i += 3) {
+        Vec3f const& a = pos[indices[i+0]];
+        Vec3f const& b = pos[indices[i+1]];
+        Vec3f const& c = pos[indices[i+2]];
+
+        Vec3f n = cross( b - a, c - a );
+        float const area2 = length( n );
+
+        if (area2 <= 0.f)
+            continue;
+
+        n = n / area2;
+
+        Quadric const q = make_plane_quadric_( n, -dot( n, a ), 0.5 * area2 );
+        for (std::size_t k = 0; k < 3; ++k)
+            accumulate_( quadrics[indices[i+k]], q );
+    }
+
+    std::vector<VertexKind> kind( vertexCount );
+    std::vector<std::uint32_t> borderNext( vertexCount ), borderPrev( vertexCount );
+    std::vector<std::uint32_t> borderEdges( vertexCount );
+
+    std::vector<std::uint32_t> adjOffset( vertexCount + 1 );
+    std::vector<std::uint32_t> adjTriangles;
+
+    std::vector<std::uint64_t> halfEdges;
+    std::vector<Collapse> collapses;
+    std::vector<std::uint32_t> remap( vertexCount );
+    std::vector<bool> touched( vertexCount );
+
+    bool firstPass = true;
+
+    // Each pass collapses a batch of independent edges, cheapest first, then
+    // rebuilds the connectivity.
+    while (indices.size() > aTargetIndexCount) {
+        std::size_t const triangleCount = indices.size() / 3;
+
+        // Directed edges, sorted so the reverse of an edge can be looked up
+        halfEdges.clear();
+        for (std::size_t i = 0; i < indices.size(); i += 3) {
+            for (std::size_t k = 0; k < 3; ++k)
+                halfEdges.emplace_back( edge_key_( indices[i+k], indices[i+(k+1)%3] ) );
+        }
+        std::sort( halfEdges.begin(), halfEdges.end() );
+
+        auto const hasEdge = [&] (std::uint32_t a, std::uint32_t b) {
+            return std::binary_search( halfEdges.begin(), halfEdges.end(), edge_key_( a, b ) );
+        };
+
+        // Classify vertices. An edge without its reverse is on an open border.
+        kind = seam;
+        std::fill( borderEdges.begin(), borderEdges.end(), 0 );
+
+        for (std::size_t i = 0; i < indices.size(); i += 3) {
+            for (std::size_t k = 0; k < 3; ++k) {
+                std::uint32_t const a = indices[i+k];
+                std::uint32_t const b = indices[i+(k+1)%3];
+
+                if (hasEdge( b, a ))
+                    continue;
+
+                borderNext[a] = b;
+                borderPrev[b] = a;
+                ++borderEdges[a];
+                ++borderEdges[b];
+
+                // Keep borders in place with planes perpendicular to the
+                // triangle, through the border edge. Only needed once, the
+                // quadrics are carried along by the collapses.
+                if (firstPass) {
+                    Vec3f const& c = pos[indices[i+(k+2)%3]];
+                    Vec3f const e = pos[b] - pos[a];
+                    Vec3f const tn = cross( e, c - pos[a] );
+                    Vec3f const m = cross( e, tn );
+                    float const ml = length( m );
+
+                    if (ml > 0.f) {
+                        Vec3f const mn = m / ml;
+                        Quadric const q = make_plane_quadric_( mn, -dot( mn, pos[a] ), kBorderWeight_ * dot( e, e ) );
+                        accumulate_( quadrics[a], q );
+                        accumulate_( quadrics[b], q );
+                    }
+                }
+            }
+        }
+
+        for (std::size_t v = 0; v < vertexCount; ++v) {
+            if (VertexKind::locked == kind[v] || 0 == borderEdges[v])
+                continue;
+
+            // A simple border vertex has exactly one edge in and one out.
+            // Anything else is a non-manifold corner that we leave alone.
+            kind[v] = (2 == borderEdges[v] && !aLockBorders) ? VertexKind::border : VertexKind::locked;
+        }
+
+        firstPass = false;
+
+        // Vertex -> triangle adjacency
+        std::fill( adjOffset.begin(), adjOffset.end(), 0 );
+        for (auto const idx : indices)
+            ++adjOffset[idx + 1];
+        std::partial_sum( adjOffset.begin(), adjOffset.end(), adjOffset.begin() );
+
+        adjTriangles.resize( indices.size() );
+        {
+            std::vector<std::uint32_t> fill( adjOffset.begin(), adjOffset.end() - 1 );
+            for (std::size_t i = 0; i < indices.size(); ++i)
+                adjTriangles[fill[indices[i]]++] = std::uint32_t(i / 3);
+        }
+
+        // Candidate collapses
+        auto const cost = [&] (std::uint32_t from, std::uint32_t to) {
+            Quadric q = quadrics[from];
+            accumulate_( q, quadrics[to] );
+
+            double c = q.w > 0.0 ? evaluate_( q, pos[to] ) / q.w : 0.0;
+
+            if (hasNormals) {
+                Vec3f const d = pos[to] - pos[from];
+                double const bend = 1.0 - dot( aMesh.normals[from], aMesh.normals[to] );
+                c += kNormalWeight_ * std::max( 0.0, bend ) * dot( d, d );
+            }
+
+            return float(c);
+        };
+
+        auto const allowed = [&] (std::uint32_t from, std::uint32_t to) {
+            switch (kind[from]) {
+                case VertexKind::manifold:
+                    return true;
+                case VertexKind::border:
+                    return to == borderNext[from] || to == borderPrev[from];
+                case VertexKind::locked:
+                    return false;
+            }
+            return false;
+        };
+
+        collapses.clear();
+        for (std::size_t i = 0; i < indices.size(); i += 3) {
+            for (std::size_t k = 0; k < 3; ++k) {
+                std::uint32_t const a = indices[i+k];
+                std::uint32_t const b = indices[i+(k+1)%3];
+
+                // Interior edges are seen twice, once in each direction.
+                // Border edges only once, so try both directions here.
+                bool const border = !hasEdge( b, a );
+
+                if (allowed( a, b ))
+                    collapses.emplace_back( Collapse{ a, b, cost( a, b ) } );
+                if (border && allowed( b, a ))
+                    collapses.emplace_back( Collapse{ b, a, cost( b, a ) } );
+            }
+        }
+
+        std::sort( collapses.begin(), collapses.end(), [] (Collapse const& x, Collapse const& y) {
+            return x.cost < y.cost;
+        } );
+
+        // Apply as many as possible. Both ends of a collapse are locked for
+        // the rest of the pass, so the adjacency above stays valid.
+        std::iota( remap.begin(), remap.end(), 0u );
+        std::fill( touched.begin(), touched.end(), false );
+
+        float const maxCost = aMaxError * aMaxError;
+        std::size_t remaining = triangleCount;
+        std::size_t applied = 0;
+
+        for (auto const& c : collapses) {
+            if (remaining * 3 <= aTargetIndexCount || c.cost > maxCost)
+                break;
+
+            if (touched[c.from] || touched[c.to])
+                continue;
+
+            // Reject collapses that flip (or squash) a triangle
+            bool ok = true;
+            std::size_t removed = 0;
+
+            for (std::uint32_t j = adjOffset[c.from]; j < adjOffset[c.from + 1] && ok; ++j) {
+                std::size_t const t = adjTriangles[j] * std::size_t(3);
+
+                std::uint32_t const v0 = remap[indices[t+0]];
+                std::uint32_t const v1 = remap[indices[t+1]];
+                std::uint32_t const v2 = remap[indices[t+2]];
+
+                if (degenerate_( v0, v1, v2 ))
+                    continue;
+
+                if (v0 == c.to || v1 == c.to || v2 == c.to) {
+                    ++removed;
+                    continue;
+                }
+
+                auto const at = [&] (std::uint32_t v) { return v == c.from ? pos[c.to] : pos[v]; };
+
+                Vec3f const n0 = cross( pos[v1] - pos[v0], pos[v2] - pos[v0] );
+                Vec3f const n1 = cross( at( v1 ) - at( v0 ), at( v2 ) - at( v0 ) );
+
+                ok = dot( n0, n1 ) > kMinNormalCos_ * length( n0 ) * length( n1 );
+            }
+
+            if (!ok)
+                continue;
+
+            remap[c.from] = c.to;
+            touched[c.from] = touched[c.to] = true;
+
+            accumulate_( quadrics[c.to], quadrics[c.from] );
+            error = std::max( error, std::sqrt( c.cost ) );
+
+            remaining -= std::min( remaining, removed );
+            ++applied;
+        }
+
+        if (0 == applied)
+            break;
+
+        // Rewrite the index buffer, dropping the collapsed triangles
+        std::size_t out = 0;
+        for (std::size_t i = 0; i < indices.size(); i += 3) {
+            std::uint32_t const v0 = remap[indices[i+0]];
+            std::uint32_t const v1 = remap[indices[i+1]];
+            std::uint32_t const v2 = remap[indices[i+2]];
+
+            if (degenerate_( v0, v1, v2 ))
+                continue;
+
+            indices[out++] = v0;
+            indices[out++] = v1;
+            indices[out++] = v2;
+        }
+        indices.resize( out );
+    }
+
+    if (aOutError)
+        *aOutError = error;
+
+    return indices;
+}
+
+MeshLodChain make_lod_chain( SimpleMeshData& aMesh, std::size_t aLevelCount, float aRatio )
+{
+    aMesh = weld_vertices( aMesh );
+
+    MeshLodChain ret;
+
+    ret.boundsMin = Vec3f{ std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+    ret.boundsMax = -ret.boundsMin;
+
+    for (auto const& p : aMesh.positions) {
+        ret.boundsMin = Vec3f{ std::min( ret.boundsMin.x, p.x ), std::min( ret.boundsMin.y, p.y ), std::min( ret.boundsMin.z, p.z ) };
+        ret.boundsMax = Vec3f{ std::max( ret.boundsMax.x, p.x ), std::max( ret.boundsMax.y, p.y ), std::max( ret.boundsMax.z, p.z ) };
+    }
+
+    std::vector<std::uint32_t> chain = aMesh.indices;
+    std::vector<std::uint32_t> level = aMesh.indices;
+
+    ret.levels.emplace_back( MeshLod{ 0, GLsizei(level.size()), 0.f } );
+
+    aLevelCount = std::min( aLevelCount, kMaxLodLevels );
+
+    while (ret.levels.size() < aLevelCount) {
+        std::size_t const target = std::size_t(level.size() / 3 * aRatio) * 3;
+
+        float levelError = 0.f;
+        level = simplify( aMesh, level, target, std::numeric_limits<float>::max(), &levelError );
+
+        // Give up once the simplifier stalls (everything left is locked)
+        if (level.empty() || level.size() > std::size_t(ret.levels.back().indexCount) * 9 / 10)
+            break;
+
+        // Each level is simplified from the previous one, so the errors add
+        // up. The sum is a conservative bound of the deviation from LOD 0.
+        ret.levels.emplace_back( MeshLod{
+            GLuint(chain.size()),
+            GLsizei(level.size()),
+            ret.levels.back().error + levelError
+        } );
+
+        chain.insert( chain.end(), level.begin(), level.end() );
+    }
+
+    aMesh.indices = std::move(chain);
+
+    return ret;
+}
+
+std::size_t select_lod(
+    MeshLodChain const& aChain,
+    Mat44f const& aModel2World,
+    Vec3f const& aCameraPos,
+    Mat44f const& aProjection,
+    float aViewportHeight,
+    float aMaxPixelError
+)
+{
+    if (aChain.levels.empty())
+        return 0;
+
+    // World space bounds, from the eight corners of the model space box
+    Vec3f lo{ std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+    Vec3f hi = -lo;
+
+    for (int i = 0; i < 8; ++i) {
+        Vec4f const c = aModel2World * Vec4f{
+            (i & 1) ? aChain.boundsMax.x : aChain.boundsMin.x,
+            (i & 2) ? aChain.boundsMax.y : aChain.boundsMin.y,
+            (i & 4) ? aChain.boundsMax.z : aChain.boundsMin.z,
+            1.f
+        };
+
+        lo = Vec3f{ std::min( lo.x, c.x ), std::min( lo.y, c.y ), std::min( lo.z, c.z ) };
+        hi = Vec3f{ std::max( hi.x, c.x ), std::max( hi.y, c.y ), std::max( hi.z, c.z ) };
+    }
+
+    // Distance from the camera to the closest point of the bounds
+    Vec3f const closest{
+        std::clamp( aCameraPos.x, lo.x, hi.x ),
+        std::clamp( aCameraPos.y, lo.y, hi.y ),
+        std::clamp( aCameraPos.z, lo.z, hi.z )
+    };
+    float const distance = length( closest - aCameraPos );
+
+    if (distance <= 0.f)
+        return 0;
+
+    // Largest scale factor of the model transform
+    float scale = 0.f;
+    for (std::size_t c = 0; c < 3; ++c) {
+        Vec3f const axis{ aModel2World(0, c), aModel2World(1, c), aModel2World(2, c) };
+        scale = std::max( scale, length( axis ) );
+    }
+
+    // The projection maps y/-z to [-1,1], ie. a world space length l at
+    // distance d covers l * P(1,1) / d * (height/2) pixels.
+    float const pixelsPerUnit = aProjection(1, 1) * 0.5f * aViewportHeight / distance;
+
+    std::size_t lod = 0;
+    for (std::size_t i = 1; i < aChain.levels.size(); ++i) {
+        if (aChain.levels[i].error * scale * pixelsPerUnit > aMaxPixelError)
+            break;
+
+        lod = i;
+    }
+
+    return lod;
+}
@@ -0,0 +1,86 @@
+#ifndef MESH_LOD_HPP_3D71A9C4_60E2_4B8F_9C35_E18B7D24F05A
+#define MESH_LOD_HPP_3D71A9C4_60E2_4B8F_9C35_E18B7D24F05A
+
+#include <glad/glad.h>
+
+#include <vector>
+
+#include <cstdlib>
+
+#include "simple_mesh.hpp"
+
+#include "../vmlib/vec3.hpp"
+#include "../vmlib/mat44.hpp"
+
+/*
+ *  === Mesh LOD chains ===
+ *  Garland & Heckbert, "Surface Simplification Using Quadric Error Metrics"
+ *  https://www.cs.cmu.edu/~./garland/Papers/quadrics.pdf
+ *
+ *  Meshes are simplified with half-edge collapses: a vertex is always merged
+ *  into one of its neighbours, never moved. Every LOD therefore only needs a
+ *  new index buffer, and all levels share the vertex data of the full
+ *  resolution mesh. The chain is stored as one indexed mesh whose index
+ *  buffer holds each level back to back.
+ *
+ *  Attributes and borders are preserved by restricting which collapses are
+ *  allowed:
+ *   - vertices on an attribute seam (same position, different normal, UV or
+ *     material) never move, so seams can't crack open
+ *   - vertices on an open border may only slide along the border
+ *  Collapses that would flip a triangle, or bend normals too much, are
+ *  rejected.
+ */
+
+constexpr std::size_t kMaxLodLevels = 6;
+
+struct MeshLod
+{
+    GLuint firstIndex;
+    GLsizei indexCount;
+    float error;        // Max. geometric deviation from LOD 0, in model units
+};
+
+struct MeshLodChain
+{
+    std::vector<MeshLod> levels;    // Level 0 is the full resolution mesh
+
+    // Bounds of the full resolution mesh, in model space
+    Vec3f boundsMin;
+    Vec3f boundsMax;
+};
+
+// Merges vertices that share all of their attributes. The result is indexed.
+SimpleMeshData weld_vertices( SimpleMeshData const& );
+
+// Simplifies an indexed mesh until it has at most aTargetIndexCount indices,
+// or until the next collapse would exceed aMaxError. Returns the new index
+// buffer; aOutError receives the error of the result. With aLockBorders, open
+// borders don't move at all (e.g. where the mesh meets a neighbouring chunk).
+std::vector<std::uint32_t> simplify(
+    SimpleMeshData const&,
+    std::vector<std::uint32_t> const& aIndices,
+    std::size_t aTargetIndexCount,
+    float aMaxError,
+    float* aOutError = nullptr,
+    bool aLockBorders = false
+);
+
+// Welds aMesh and builds up to aLevelCount LODs, each with roughly aRatio
+// times the triangles of the previous one. On return aMesh holds the shared
+// vertices and the index buffer of the whole chain.
+MeshLodChain make_lod_chain( SimpleMeshData& aMesh, std::size_t aLevelCount = kMaxLodLevels, float aRatio = 0.5f );
+
+// Picks the coarsest level whose error projects to at most aMaxPixelError
+// pixels. aProjection is the one from make_perspective_projection() and
+// aViewportHeight the height of the viewport in pixels.
+std::size_t select_lod(
+    MeshLodChain const&,
+    Mat44f const& aModel2World,
+    Vec3f const& aCameraPos,
+    Mat44f const& aProjection,
+    float aViewportHeight,
+    float aMaxPixelError = 1.f
+);
+
+#endif // MESH_LOD_HPP_3D71A9C4_60E2_4B8F_9C35_E18B7D24F05A
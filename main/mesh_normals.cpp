@@ -0,0 +1,270 @@
+#include "mesh_normals.hpp"
+
+#include <numeric>
+#include <algorithm>
+
+#include <cmath>
+#include <cstdint>
+
+#include "thread_pool.hpp"
+
+namespace
+{
+    // Triangles or groups handed to a thread at a time
+    constexpr std::size_t kBatchSize_ = 1024;
+
+    // Triangles with sin(angle between their edges) below this are slivers
+    constexpr float kSliver_ = 1e-6f;
+
+    // Normals closer than this are the same normal (for tangent sharing)
+    constexpr float kSameNormal_ = 0.9999f;
+
+    // Runs aFunc( first, last ) over [0, aCount) in batches, on aThreadCount
+    // threads
+    template< typename tFunc >
+    void for_each_batch_( std::size_t aCount, std::size_t aThreadCount, tFunc&& aFunc )
+    {
+        std::size_t const batches = (aCount + kBatchSize_ - 1) / kBatchSize_;
+
+        parallel_for( batches, aThreadCount, [&] (std::size_t batch) {
+            aFunc( batch * kBatchSize_, std::min( aCount, (batch + 1) * kBatchSize_ ) );
+        } );
+    }
+
+    bool position_less_( Vec3f const& aA, Vec3f const& aB ) noexcept
+    {
+        if (aA.x != aB.x) return aA.x < aB.x;
+        if (aA.y != aB.y) return aA.y < aB.y;
+        return aA.z < aB.z;
+    }
+
+    bool position_equal_( Vec3f const& aA, Vec3f const& aB ) noexcept
+    {
+        return aA.x == aB.x && aA.y == aB.y && aA.z == aB.z;
+    }
+
+    // Vertices at the same position, as ranges of a sorted vertex list.
+    // Slices are sorted in parallel and then merged pairwise.
+    struct Groups_
+    {
+        std::vector<std::uint32_t> vertices;    // Sorted by position
+        std::vector<std::uint32_t> begin;       // Group g is [begin[g], begin[g+1])
+    };
+
+    Groups_ group_positions_( std::vector<Vec3f> const& aPositions, std::size_t aThreadCount )
+    {
+        Groups_ ret;
+        ret.vertices.resize( aPositions.size() );
+        std::iota( ret.vertices.begin(), ret.vertices.end(), 0u );
+
+        auto const less = [&] (std::uint32_t aA, std::uint32_t aB) {
+            return position_less_( aPositions[aA], aPositions[aB] );
+        };
+
+        std::size_t const count = ret.vertices.size();
+        std::size_t const slices = std::max<std::size_t>( 1, std::min( aThreadCount, count / kBatchSize_ ) );
+
+        std::vector<std::size_t> bounds( slices + 1 );
+        for (std::size_t i = 0; i <= slices; ++i)
+            bounds[i] = count * i / slices;
+
+        parallel_for( slices, aThreadCount, [&] (std::size_t i) {
+            std::sort( ret.vertices.begin() + bounds[i], ret.vertices.begin() + bounds[i + 1], less );
+        } );
+
+        for (std::size_t width = 1; width < slices; width *= 2) {
+            std::size_t const merges = (slices - width + 2 * width - 1) / (2 * width);
+
+            parallel_for( merges, aThreadCount, [&] (std::size_t m) {
+                std::size_t const i = m * 2 * width;
+
+                auto const first = ret.vertices.begin() + bounds[i];
+                auto const middle = ret.vertices.begin() + bounds[i + width];
+                auto const last = ret.vertices.begin() + bounds[std::min( i + 2 * width, slices )];
+
+                std::inplace_merge( first, middle, last, less );
+            } );
+        }
+
+        for (std::size_t i = 0; i < count; ++i) {
+            if (0 == i || !position_equal_( aPositions[ret.vertices[i - 1]], aPositions[ret.vertices[i]] ))
+                ret.begin.emplace_back( std::uint32_t(i) );
+        }
+        ret.begin.emplace_back( std::uint32_t(count) );
+
+        return ret;
+    }
+
+    // Interior angles of triangle v, v+1, v+2 (v = first vertex)
+    void corner_angles_( std::vector<Vec3f> const& aPositions, std::size_t aFirst, float aOut[3] ) noexcept
+    {
+        for (std::size_t k = 0; k < 3; ++k) {
+            Vec3f const& p = aPositions[aFirst + k];
+            Vec3f const a = aPositions[aFirst + (k + 1) % 3] - p;
+            Vec3f const b = aPositions[aFirst + (k + 2) % 3] - p;
+
+            float const la = length( a ), lb = length( b );
+            aOut[k] = (la > 0.f && lb > 0.f) ? std::acos( std::clamp( dot( a, b ) / (la * lb), -1.f, 1.f ) ) : 0.f;
+        }
+    }
+}
+
+void generate_normals( SimpleMeshData& aMesh, float aCreaseAngle, std::size_t aThreadCount )
+{
+    aMesh.normals.assign( aMesh.positions.size(), Vec3f{ 0.f, 0.f, 0.f } );
+    fill_missing_normals( aMesh, aCreaseAngle, aThreadCount );
+}
+
+void fill_missing_normals( SimpleMeshData& aMesh, float aCreaseAngle, std::size_t aThreadCount )
+{
+    std::size_t const count = aMesh.positions.size();
+    std::size_t const triangles = count / 3;
+
+    if (0 != count % 3 || aMesh.normals.size() != count)
+        return;
+
+    aThreadCount = thread_count( aThreadCount );
+
+    // Per triangle: its unit normal and, per vertex, its weighted normal
+    // (twice the area times the angle at that vertex)
+    std::vector<Vec3f> faceNormals( triangles );
+    std::vector<Vec3f> weighted( count );
+
+    for_each_batch_( triangles, aThreadCount, [&] (std::size_t aFirst, std::size_t aLast) {
+        for (std::size_t t = aFirst; t < aLast; ++t) {
+            Vec3f const& p0 = aMesh.positions[t * 3];
+            Vec3f const e1 = aMesh.positions[t * 3 + 1] - p0;
+            Vec3f const e2 = aMesh.positions[t * 3 + 2] - p0;
+            Vec3f const n = cross( e1, e2 );
+
+            // Slivers (e.g. the ones at the poles of a UV sphere) count as
+            // degenerate, their direction is mostly rounding error
+            float const len = length( n );
+            faceNormals[t] = len > kSliver_ * length( e1 ) * length( e2 ) ? n / len : Vec3f{ 0.f, 0.f, 0.f };
+
+            float angles[3];
+            corner_angles_( aMesh.positions, t * 3, angles );
+            for (std::size_t k = 0; k < 3; ++k)
+                weighted[t * 3 + k] = angles[k] * n;
+        }
+    } );
+
+    Groups_ const groups = group_positions_( aMesh.positions, aThreadCount );
+    float const minCos = std::cos( aCreaseAngle );
+
+    for_each_batch_( groups.begin.size() - 1, aThreadCount, [&] (std::size_t aFirst, std::size_t aLast) {
+        for (std::size_t g = aFirst; g < aLast; ++g) {
+            std::uint32_t const* first = groups.vertices.data() + groups.begin[g];
+            std::uint32_t const* last = groups.vertices.data() + groups.begin[g + 1];
+
+            for (auto const* v = first; v != last; ++v) {
+                // Normals that are there already stay. Each vertex is only
+                // read and written by its own group's thread.
+                Vec3f const& given = aMesh.normals[*v];
+                if (0.f != dot( given, given ))
+                    continue;
+
+                // Degenerate triangles have no direction of their own and
+                // take in everything around them
+                Vec3f const& own = faceNormals[*v / 3];
+                bool const degenerate = 0.f == dot( own, own );
+
+                Vec3f sum{ 0.f, 0.f, 0.f };
+                for (auto const* w = first; w != last; ++w) {
+                    if (degenerate || dot( own, faceNormals[*w / 3] ) >= minCos)
+                        sum += weighted[*w];
+                }
+
+                float const len = length( sum );
+                aMesh.normals[*v] = len > 0.f ? sum / len : own;
+            }
+        }
+    } );
+}
+
+void generate_tangents( SimpleMeshData& aMesh, std::size_t aThreadCount )
+{
+    std::size_t const count = aMesh.positions.size();
+    std::size_t const triangles = count / 3;
+
+    if (0 != count % 3 || aMesh.normals.size() != count || aMesh.texcoords.size() != count)
+        return;
+
+    aThreadCount = thread_count( aThreadCount );
+
+    // Per triangle: the direction of increasing u, and whether the texture
+    // is mirrored. Per vertex: the angle at that vertex.
+    std::vector<Vec3f> faceTangents( triangles );
+    std::vector<float> faceSigns( triangles );
+    std::vector<float> angles( count );
+
+    for_each_batch_( triangles, aThreadCount, [&] (std::size_t aFirst, std::size_t aLast) {
+        for (std::size_t t = aFirst; t < aLast; ++t) {
+            std::size_t const v = t * 3;
+
+            Vec3f const e1 = aMesh.positions[v + 1] - aMesh.positions[v];
+            Vec3f const e2 = aMesh.positions[v + 2] - aMesh.positions[v];
+            Vec2f const d1 = aMesh.texcoords[v + 1] - aMesh.texcoords[v];
+            Vec2f const d2 = aMesh.texcoords[v + 2] - aMesh.texcoords[v];
+
+            // Lengyel, see compute_tangents()
+            float const det = d1.x * d2.y - d2.x * d1.y;
+            if (0.f == det) {
+                faceTangents[t] = Vec3f{ 0.f, 0.f, 0.f };
+                faceSigns[t] = 1.f;
+            }
+            else {
+                Vec3f const tangent = (e1 * d2.y - e2 * d1.y) / det;
+                Vec3f const bitangent = (e2 * d1.x - e1 * d2.x) / det;
+
+                faceTangents[t] = tangent;
+                faceSigns[t] = dot( cross( cross( e1, e2 ), tangent ), bitangent ) < 0.f ? -1.f : 1.f;
+            }
+
+            corner_angles_( aMesh.positions, v, &angles[v] );
+        }
+    } );
+
+    Groups_ const groups = group_positions_( aMesh.positions, aThreadCount );
+
+    aMesh.tangents.resize( count );
+
+    for_each_batch_( groups.begin.size() - 1, aThreadCount, [&] (std::size_t aFirst, std::size_t aLast) {
+        for (std::size_t g = aFirst; g < aLast; ++g) {
+            std::uint32_t const* first = groups.vertices.data() + groups.begin[g];
+            std::uint32_t const* last = groups.vertices.data() + groups.begin[g + 1];
+
+            for (auto const* v = first; v != last; ++v) {
+                Vec3f const n = normalize( aMesh.normals[*v] );
+                Vec2f const& uv = aMesh.texcoords[*v];
+                float const sign = faceSigns[*v / 3];
+
+                Vec3f sum{ 0.f, 0.f, 0.f };
+                for (auto const* w = first; w != last; ++w) {
+                    Vec2f const& uvW = aMesh.texcoords[*w];
+                    if (faceSigns[*w / 3] != sign || uvW.x != uv.x || uvW.y != uv.y)
+                        continue;
+                    if (dot( n, normalize( aMesh.normals[*w] ) ) < kSameNormal_)
+                        continue;
+
+                    // Project onto the tangent plane first, so that every
+                    // triangle counts by its angle only
+                    Vec3f const& ft = faceTangents[*w / 3];
+                    Vec3f const t = ft - n * dot( n, ft );
+                    float const len = length( t );
+                    if (len > 0.f)
+                        sum += (angles[*w] / len) * t;
+                }
+
+                // Without usable UVs, any tangent will do
+                if (dot( sum, sum ) < 1e-12f) {
+                    Vec3f const axis = std::abs( n.x ) < 0.9f ? Vec3f{ 1.f, 0.f, 0.f } : Vec3f{ 0.f, 1.f, 0.f };
+                    sum = cross( axis, n );
+                }
+
+                Vec3f const t = normalize( sum );
+                aMesh.tangents[*v] = Vec4f{ t.x, t.y, t.z, sign };
+            }
+        }
+    } );
+}
@@ -0,0 +1,48 @@
+#ifndef MESH_NORMALS_HPP_E2A7F519_36C4_4B8D_9D61_04B8C3E7A952
+#define MESH_NORMALS_HPP_E2A7F519_36C4_4B8D_9D61_04B8C3E7A952
+
+#include <cstdlib>
+
+#include "simple_mesh.hpp"
+
+/*
+ *  === Normal and tangent generation ===
+ *  Thürmer & Wüthrich, "Computing Vertex Normals from Polygonal Facets"
+ *  http://www.bytehazard.com/articles/vertnorm.html
+ *  http://www.mikktspace.com/
+ *
+ *  For OBJ files that come without some or all normals (scanned terrain
+ *  often does), and for the tangents that OBJ files never have.
+ *
+ *  Both work on triangle soups, where every triangle has its own three
+ *  vertices (which is what load_wavefront_obj() returns). Vertices at the
+ *  same position are grouped first. Each vertex then sums up what the
+ *  triangles around its position contribute, so every output is written by
+ *  exactly one thread and nothing needs to be synchronised.
+ *
+ *  Normals are weighted by triangle area and by the triangle's angle at the
+ *  vertex, so that neither long thin triangles nor finely split ones skew
+ *  them. Only triangles that face within aCreaseAngle of the vertex's own
+ *  triangle count, so sharp edges stay sharp.
+ *
+ *  Tangents follow MikkTSpace: per-triangle tangents are projected onto the
+ *  vertex normal and weighted by angle, and vertices only share them across
+ *  triangles with the same normal, texture coordinate and handedness (so
+ *  UV seams and mirrored UVs stay separate).
+ */
+
+// Default for aCreaseAngle, in radians
+constexpr float kDefaultCreaseAngle = 1.0471976f;   // 60 degrees
+
+// Replaces the normals of a triangle soup. aThreadCount = 0 uses all
+// hardware threads.
+void generate_normals( SimpleMeshData&, float aCreaseAngle = kDefaultCreaseAngle, std::size_t aThreadCount = 0 );
+
+// Same, but only for the vertices whose normal is zero (e.g. the ones an OBJ
+// file left out). The others keep theirs, authored hard edges included.
+void fill_missing_normals( SimpleMeshData&, float aCreaseAngle = kDefaultCreaseAngle, std::size_t aThreadCount = 0 );
+
+// Fills in the tangents of a triangle soup. Needs normals and texcoords.
+void generate_tangents( SimpleMeshData&, std::size_t aThreadCount = 0 );
+
+#endif // MESH_NORMALS_HPP_E2A7F519_36C4_4B8D_9D61_04B8C3E7A952
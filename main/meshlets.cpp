@@ -0,0 +1,364 @@
+#include "meshlets.hpp"
+
+#include <limits>
+#include <algorithm>
+
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64)
+#	include <xmmintrin.h>
+#	define MESHLETS_USE_SSE 1
+#endif
+
+namespace
+{
+    void append_bounds_( std::vector<Vec3f> const& aPositions, std::uint32_t const* aIndices, std::size_t aIndexCount, MeshletSet& aOut )
+    {
+        // Sphere around the centre of the AABB
+        Vec3f lo{ std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+        Vec3f hi = -lo;
+
+        for (std::size_t i = 0; i < aIndexCount; ++i) {
+            Vec3f const& p = aPositions[aIndices[i]];
+            lo = Vec3f{ std::min( lo.x, p.x ), std::min( lo.y, p.y ), std::min( lo.z, p.z ) };
+            hi = Vec3f{ std::max( hi.x, p.x ), std::max( hi.y, p.y ), std::max( hi.z, p.z ) };
+        }
+
+        Vec3f const center = 0.5f * (lo + hi);
+        float radius = 0.f;
+
+        for (std::size_t i = 0; i < aIndexCount; ++i)
+            radius = std::max( radius, length( aPositions[aIndices[i]] - center ) );
+
+        // Normal cone: the average normal, and how far the triangles stray
+        // from it
+        Vec3f axis{ 0.f, 0.f, 0.f };
+
+        std::vector<Vec3f> normals;
+        normals.reserve( aIndexCount / 3 );
+
+        for (std::size_t i = 0; i + 2 < aIndexCount; i += 3) {
+            Vec3f const& a = aPositions[aIndices[i+0]];
+            Vec3f n = cross( aPositions[aIndices[i+1]] - a, aPositions[aIndices[i+2]] - a );
+
+            float const len = length( n );
+            if (len <= 0.f)
+                continue;
+
+            n /= len;
+            normals.emplace_back( n );
+            axis += n;
+        }
+
+        float cutoff = 1.f;     // Never back-facing
+        float const axisLength = length( axis );
+
+        if (axisLength > 0.f) {
+            axis /= axisLength;
+
+            float minDot = 1.f;
+            for (auto const& n : normals)
+                minDot = std::min( minDot, dot( n, axis ) );
+
+            // Cones wider than 90 degrees can't be culled
+            if (minDot > 0.f)
+                cutoff = std::sqrt( 1.f - minDot * minDot );
+        }
+
+        aOut.centerX.emplace_back( center.x );
+        aOut.centerY.emplace_back( center.y );
+        aOut.centerZ.emplace_back( center.z );
+        aOut.radius.emplace_back( radius );
+
+        aOut.axisX.emplace_back( axis.x );
+        aOut.axisY.emplace_back( axis.y );
+        aOut.axisZ.emplace_back( axis.z );
+        aOut.cutoff.emplace_back( cutoff );
+    }
+
+    void emit_( MeshletSet const& aSet, std::size_t aMeshlet, MultiDrawList& aOut )
+    {
+        auto const offset = reinterpret_cast<void const*>( std::uintptr_t(aSet.firstIndex[aMeshlet]) * sizeof(std::uint32_t) );
+
+        // Merge with the previous draw if it ends where this one starts
+        if (!aOut.counts.empty()) {
+            auto const end = reinterpret_cast<std::uintptr_t>( aOut.offsets.back() ) + std::uintptr_t(aOut.counts.back()) * sizeof(std::uint32_t);
+
+            if (end == reinterpret_cast<std::uintptr_t>( offset )) {
+                aOut.counts.back() += aSet.indexCount[aMeshlet];
+                return;
+            }
+        }
+
+        aOut.counts.emplace_back( aSet.indexCount[aMeshlet] );
+        aOut.offsets.emplace_back( offset );
+    }
+}
+
+MeshletRange build_meshlets(
+    std::vector<Vec3f> const& aPositions,
+    std::vector<std::uint32_t>& aIndices,
+    GLuint aFirst,
+    GLsizei aCount,
+    MeshletSet& aOut
+)
+{
+    MeshletRange ret{ std::uint32_t(aOut.size()), 0 };
+
+    std::size_t const triangleCount = std::size_t(aCount) / 3;
+    if (0 == triangleCount)
+        return ret;
+
+    std::uint32_t const* tris = aIndices.data() + aFirst;
+
+    // Local vertex ids, so the bookkeeping below can use flat arrays
+    std::vector<std::uint32_t> vertices( tris, tris + triangleCount * 3 );
+    std::sort( vertices.begin(), vertices.end() );
+    vertices.erase( std::unique( vertices.begin(), vertices.end() ), vertices.end() );
+
+    std::vector<std::uint32_t> local( triangleCount * 3 );
+    for (std::size_t i = 0; i < local.size(); ++i)
+        local[i] = std::uint32_t(std::lower_bound( vertices.begin(), vertices.end(), tris[i] ) - vertices.begin());
+
+    // Vertex -> triangle adjacency
+    std::vector<std::uint32_t> adjOffset( vertices.size() + 1, 0 );
+    for (auto const v : local)
+        ++adjOffset[v + 1];
+    for (std::size_t v = 1; v < adjOffset.size(); ++v)
+        adjOffset[v] += adjOffset[v - 1];
+
+    std::vector<std::uint32_t> adjTriangles( local.size() );
+    {
+        std::vector<std::uint32_t> fill( adjOffset.begin(), adjOffset.end() - 1 );
+        for (std::size_t i = 0; i < local.size(); ++i)
+            adjTriangles[fill[local[i]]++] = std::uint32_t(i / 3);
+    }
+
+    constexpr std::uint32_t kNone = std::numeric_limits<std::uint32_t>::max();
+
+    std::vector<bool> emitted( triangleCount, false );
+    std::vector<std::uint32_t> owner( vertices.size(), kNone );    // Meshlet the vertex was last added to
+
+    std::vector<std::uint32_t> reordered;
+    reordered.reserve( triangleCount * 3 );
+
+    std::vector<std::uint32_t> candidates;
+    std::size_t meshletVertices = 0, meshletTriangles = 0;
+    std::uint32_t meshlet = 0;
+    std::size_t cursor = 0;
+
+    auto const newVertices = [&] (std::uint32_t t) {
+        std::size_t n = 0;
+        for (std::size_t k = 0; k < 3; ++k)
+            n += owner[local[t*3+k]] != meshlet;
+        return n;
+    };
+
+    auto const finish = [&] {
+        if (0 == meshletTriangles)
+            return;
+
+        std::size_t const count = meshletTriangles * 3;
+        std::size_t const first = reordered.size() - count;
+
+        aOut.firstIndex.emplace_back( GLuint(aFirst + first) );
+        aOut.indexCount.emplace_back( GLsizei(count) );
+        append_bounds_( aPositions, reordered.data() + first, count, aOut );
+
+        ++ret.count;
+        ++meshlet;
+        meshletVertices = meshletTriangles = 0;
+    };
+
+    auto const add = [&] (std::uint32_t t) {
+        meshletVertices += newVertices( t );
+        ++meshletTriangles;
+        emitted[t] = true;
+
+        for (std::size_t k = 0; k < 3; ++k) {
+            std::uint32_t const v = local[t*3+k];
+            owner[v] = meshlet;
+            reordered.emplace_back( tris[t*3+k] );
+
+            for (std::uint32_t j = adjOffset[v]; j < adjOffset[v + 1]; ++j) {
+                if (!emitted[adjTriangles[j]])
+                    candidates.emplace_back( adjTriangles[j] );
+            }
+        }
+    };
+
+    for (std::size_t done = 0; done < triangleCount; ) {
+        // Grow the current meshlet with the neighbour that adds the fewest
+        // new vertices
+        std::uint32_t best = kNone;
+        std::size_t bestCost = 4;
+
+        std::size_t keep = 0;
+        for (auto const t : candidates) {
+            if (emitted[t])
+                continue;
+
+            candidates[keep++] = t;
+
+            std::size_t const cost = newVertices( t );
+            if (cost < bestCost && meshletVertices + cost <= kMeshletMaxVertices) {
+                best = t;
+                bestCost = cost;
+            }
+        }
+        candidates.resize( keep );
+
+        bool const full = meshletTriangles >= kMeshletMaxTriangles;
+
+        if (kNone == best || full) {
+            finish();
+
+            // Start the next meshlet next to the previous one if possible,
+            // otherwise with the next unused triangle
+            best = kNone;
+            for (auto const t : candidates) {
+                if (!emitted[t]) {
+                    best = t;
+                    break;
+                }
+            }
+
+            if (kNone == best) {
+                while (emitted[cursor])
+                    ++cursor;
+                best = std::uint32_t(cursor);
+            }
+
+            candidates.clear();
+        }
+
+        add( best );
+        ++done;
+    }
+
+    finish();
+
+    std::copy( reordered.begin(), reordered.end(), aIndices.begin() + aFirst );
+
+    return ret;
+}
+
+void cull_meshlets(
+    MeshletSet const& aSet,
+    MeshletRange aRange,
+    Frustum const& aFrustum,
+    Vec3f const& aCameraPos,
+    MultiDrawList& aOut,
+    MeshletCullStats* aStats
+)
+{
+    cull_meshlets( aSet, aRange, &aFrustum, &aCameraPos, 1, aOut, aStats );
+}
+
+void cull_meshlets(
+    MeshletSet const& aSet,
+    MeshletRange aRange,
+    Frustum const* aFrusta,
+    Vec3f const* aCameraPos,
+    std::size_t aViewCount,
+    MultiDrawList& aOut,
+    MeshletCullStats* aStats
+)
+{
+    MeshletCullStats stats;
+
+    std::size_t i = aRange.first;
+    std::size_t const end = std::size_t(aRange.first) + aRange.count;
+
+#	if defined(MESHLETS_USE_SSE)
+    for (; i + 4 <= end; i += 4) {
+        __m128 const cx = _mm_loadu_ps( aSet.centerX.data() + i );
+        __m128 const cy = _mm_loadu_ps( aSet.centerY.data() + i );
+        __m128 const cz = _mm_loadu_ps( aSet.centerZ.data() + i );
+        __m128 const r = _mm_loadu_ps( aSet.radius.data() + i );
+        __m128 const negR = _mm_sub_ps( _mm_setzero_ps(), r );
+
+        __m128 const ax = _mm_loadu_ps( aSet.axisX.data() + i );
+        __m128 const ay = _mm_loadu_ps( aSet.axisY.data() + i );
+        __m128 const az = _mm_loadu_ps( aSet.axisZ.data() + i );
+        __m128 const cutoff = _mm_loadu_ps( aSet.cutoff.data() + i );
+
+        // A meshlet is kept if any one view sees it
+        int insideMask = 0, visibleMask = 0;
+
+        for (std::size_t view = 0; view < aViewCount; ++view) {
+            // Spheres vs. the six planes
+            __m128 inside = _mm_cmpeq_ps( r, r );
+            for (auto const& p : aFrusta[view].planes) {
+                __m128 d = _mm_add_ps(
+                    _mm_add_ps( _mm_mul_ps( _mm_set1_ps( p.x ), cx ), _mm_mul_ps( _mm_set1_ps( p.y ), cy ) ),
+                    _mm_add_ps( _mm_mul_ps( _mm_set1_ps( p.z ), cz ), _mm_set1_ps( p.w ) )
+                );
+                inside = _mm_and_ps( inside, _mm_cmpge_ps( d, negR ) );
+            }
+
+            // Normal cones
+            __m128 const vx = _mm_sub_ps( cx, _mm_set1_ps( aCameraPos[view].x ) );
+            __m128 const vy = _mm_sub_ps( cy, _mm_set1_ps( aCameraPos[view].y ) );
+            __m128 const vz = _mm_sub_ps( cz, _mm_set1_ps( aCameraPos[view].z ) );
+
+            __m128 const along = _mm_add_ps(
+                _mm_add_ps( _mm_mul_ps( vx, ax ), _mm_mul_ps( vy, ay ) ),
+                _mm_mul_ps( vz, az )
+            );
+            __m128 const distance = _mm_sqrt_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( vx, vx ), _mm_mul_ps( vy, vy ) ), _mm_mul_ps( vz, vz ) ) );
+            __m128 const back = _mm_cmpge_ps( along, _mm_add_ps( _mm_mul_ps( cutoff, distance ), r ) );
+
+            int const viewInside = _mm_movemask_ps( inside );
+            insideMask |= viewInside;
+            visibleMask |= viewInside & ~_mm_movemask_ps( back );
+        }
+
+        for (int b = 0; b < 4; ++b) {
+            if (!(insideMask & (1 << b)))
+                ++stats.frustumCulled;
+            else if (!(visibleMask & (1 << b)))
+                ++stats.backfaceCulled;
+            else {
+                ++stats.visible;
+                emit_( aSet, i + b, aOut );
+            }
+        }
+    }
+#	endif // ~ MESHLETS_USE_SSE
+
+    // Whatever is left (or everything, without SSE)
+    for (; i < end; ++i) {
+        Vec3f const c{ aSet.centerX[i], aSet.centerY[i], aSet.centerZ[i] };
+        Vec3f const axis{ aSet.axisX[i], aSet.axisY[i], aSet.axisZ[i] };
+
+        bool inside = false, visible = false;
+        for (std::size_t view = 0; view < aViewCount && !visible; ++view) {
+            if (!intersects_sphere( aFrusta[view], c, aSet.radius[i] ))
+                continue;
+
+            inside = true;
+
+            Vec3f const v = c - aCameraPos[view];
+            visible = dot( v, axis ) < aSet.cutoff[i] * length( v ) + aSet.radius[i];
+        }
+
+        if (!inside) {
+            ++stats.frustumCulled;
+            continue;
+        }
+        if (!visible) {
+            ++stats.backfaceCulled;
+            continue;
+        }
+
+        ++stats.visible;
+        emit_( aSet, i, aOut );
+    }
+
+    if (aStats) {
+        aStats->visible += stats.visible;
+        aStats->frustumCulled += stats.frustumCulled;
+        aStats->backfaceCulled += stats.backfaceCulled;
+    }
+}
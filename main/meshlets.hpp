@@ -0,0 +1,108 @@
+#ifndef MESHLETS_HPP_A27E5D90_3B4C_4F81_9D62_05E8C1B7F3A6
+#define MESHLETS_HPP_A27E5D90_3B4C_4F81_9D62_05E8C1B7F3A6
+
+#include <glad/glad.h>
+
+#include <vector>
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "frustum.hpp"
+
+#include "../vmlib/vec3.hpp"
+
+/*
+ *  === Meshlets ===
+ *  https://developer.nvidia.com/blog/introduction-turing-mesh-shaders/
+ *  https://github.com/zeux/meshoptimizer#mesh-shading
+ *
+ *  Index ranges are split further into small clusters of triangles that
+ *  share their vertices (at most kMeshletMaxVertices / kMeshletMaxTriangles).
+ *  Each meshlet gets a bounding sphere and a normal cone, so whole clusters
+ *  can be skipped when they are outside the view or face away from the
+ *  camera. We don't have mesh shaders, so culling runs on the CPU, and the
+ *  surviving meshlets are drawn with glMultiDrawElements().
+ *
+ *  The per-meshlet data is kept as separate arrays (SoA), so the culling can
+ *  test four meshlets at a time with SSE.
+ */
+
+constexpr std::size_t kMeshletMaxVertices = 64;
+constexpr std::size_t kMeshletMaxTriangles = 124;
+
+struct MeshletRange
+{
+    std::uint32_t first;
+    std::uint32_t count;
+};
+
+struct MeshletSet
+{
+    // Bounding spheres
+    std::vector<float> centerX, centerY, centerZ, radius;
+
+    // Normal cones. A meshlet is back-facing from p if
+    //   dot( center - p, axis ) >= cutoff * length( center - p ) + radius
+    std::vector<float> axisX, axisY, axisZ, cutoff;
+
+    // Triangles, as a range in the index buffer
+    std::vector<GLuint> firstIndex;
+    std::vector<GLsizei> indexCount;
+
+    std::size_t size() const noexcept { return firstIndex.size(); }
+};
+
+// Draw list for glMultiDrawElements()
+struct MultiDrawList
+{
+    std::vector<GLsizei> counts;
+    std::vector<void const*> offsets;
+
+    void clear() noexcept { counts.clear(); offsets.clear(); }
+    std::size_t size() const noexcept { return counts.size(); }
+};
+
+struct MeshletCullStats
+{
+    std::size_t visible = 0;
+    std::size_t frustumCulled = 0;
+    std::size_t backfaceCulled = 0;
+};
+
+// Splits the triangles in aIndices[aFirst, aFirst + aCount) into meshlets.
+// The triangles are reordered in place, so that each meshlet is contiguous;
+// the range as a whole covers the same triangles as before.
+MeshletRange build_meshlets(
+    std::vector<Vec3f> const& aPositions,
+    std::vector<std::uint32_t>& aIndices,
+    GLuint aFirst,
+    GLsizei aCount,
+    MeshletSet& aOut
+);
+
+// Culls the meshlets in aRange and appends the visible ones to aOut. Runs of
+// meshlets that are adjacent in the index buffer become a single draw.
+// aFrustum and aCameraPos must be in the meshlets' (model) space.
+void cull_meshlets(
+    MeshletSet const&,
+    MeshletRange aRange,
+    Frustum const& aFrustum,
+    Vec3f const& aCameraPos,
+    MultiDrawList& aOut,
+    MeshletCullStats* aStats = nullptr
+);
+
+// Same, for a single pass over aViewCount views (see multi_view.hpp): keeps
+// the meshlets that any one view sees
+void cull_meshlets(
+    MeshletSet const&,
+    MeshletRange aRange,
+    Frustum const* aFrusta,
+    Vec3f const* aCameraPos,
+    std::size_t aViewCount,
+    MultiDrawList& aOut,
+    MeshletCullStats* aStats = nullptr
+);
+
+#endif // MESHLETS_HPP_A27E5D90_3B4C_4F81_9D62_05E8C1B7F3A6
@@ -0,0 +1,68 @@
+#include "multi_view.hpp"
+
+#include <cstring>
+
+namespace
+{
+    bool has_extension_( char const* aName )
+    {
+        GLint count = 0;
+        glGetIntegerv( GL_NUM_EXTENSIONS, &count );
+
+        for (GLint i = 0; i < count; ++i) {
+            auto const* name = reinterpret_cast<char const*>( glGetStringi( GL_EXTENSIONS, GLuint(i) ) );
+            if (name && 0 == std::strcmp( name, aName ))
+                return true;
+        }
+
+        return false;
+    }
+}
+
+ViewRouting select_view_routing()
+{
+    if (has_extension_( "GL_ARB_shader_viewport_layer_array" ) || has_extension_( "GL_AMD_vertex_shader_viewport_index" ))
+        return ViewRouting::kVertexShader;
+
+    return ViewRouting::kGeometryShader;
+}
+
+char const* view_routing_preamble( ViewRouting aRouting )
+{
+    // Either extension is enough, only one has to be there
+    if (ViewRouting::kVertexShader == aRouting) {
+        return "#extension GL_ARB_shader_viewport_layer_array : enable\n"
+            "#extension GL_AMD_vertex_shader_viewport_index : enable\n"
+            "#define VIEW_ROUTING_VERTEX 1\n";
+    }
+
+    return "#define VIEW_ROUTING_GEOMETRY 1\n";
+}
+
+char const* view_routing_name( ViewRouting aRouting )
+{
+    return ViewRouting::kVertexShader == aRouting ? "vertex shader" : "geometry shader";
+}
+
+void set_view_viewports( ViewRect const* aRects, std::size_t aViewCount )
+{
+    for (std::size_t i = 0; i < aViewCount; ++i) {
+        ViewRect const& r = aRects[i];
+        glViewportIndexedf( GLuint(i), float(r.x), float(r.y), float(r.width), float(r.height) );
+    }
+}
+
+bool views_overlap( ViewRect const* aRects, std::size_t aViewCount ) noexcept
+{
+    for (std::size_t i = 0; i < aViewCount; ++i) {
+        for (std::size_t j = i + 1; j < aViewCount; ++j) {
+            ViewRect const& a = aRects[i];
+            ViewRect const& b = aRects[j];
+
+            if (a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height && b.y < a.y + a.height)
+                return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,58 @@
+#ifndef MULTI_VIEW_HPP_9B6D107F_D670_45DD_B4FF_E4648C17EC0B
+#define MULTI_VIEW_HPP_9B6D107F_D670_45DD_B4FF_E4648C17EC0B
+
+#include <glad/glad.h>
+
+#include <cstdlib>
+
+/*
+ *  === Single pass multi-view ===
+ *  https://registry.khronos.org/OpenGL/extensions/ARB/ARB_viewport_array.txt
+ *  https://registry.khronos.org/OpenGL/extensions/ARB/ARB_shader_viewport_layer_array.txt
+ *
+ *  Split screen draws both views in one pass. Every view gets its own
+ *  viewport (viewport arrays are core in GL 4.1), and the ViewBlock holds
+ *  all cameras (see uniform_blocks.hpp). Each draw is instanced once more
+ *  per view: instance i is view i % uViewCount, and object instance
+ *  i / uViewCount. The view picks the camera, and gl_ViewportIndex routes
+ *  the triangle to the view's viewport.
+ *
+ *  gl_ViewportIndex is written by the vertex shader where the context has
+ *  ARB_shader_viewport_layer_array (or the older AMD extension). Otherwise
+ *  a pass-through geometry shader (default.geom) writes it. The geometry
+ *  shader only goes into the program that is used for more than one view.
+ *
+ *  The draws are culled, sorted and submitted once for all views, so the
+ *  CPU cost stays that of a single view. Views that overlap, like a
+ *  picture in picture, are drawn one after the other instead.
+ */
+
+// Where a view goes on screen, in framebuffer pixels from the bottom left
+struct ViewRect
+{
+    GLint x, y;
+    GLsizei width, height;
+};
+
+enum class ViewRouting
+{
+    kVertexShader,
+    kGeometryShader
+};
+
+ViewRouting select_view_routing();
+
+// Shader preamble lines for the routing: the extension and a #define
+// (VIEW_ROUTING_VERTEX or VIEW_ROUTING_GEOMETRY), see default.vert
+char const* view_routing_preamble( ViewRouting );
+
+char const* view_routing_name( ViewRouting );
+
+// Viewport i is aRects[i]
+void set_view_viewports( ViewRect const* aRects, std::size_t aViewCount );
+
+// True if any two of the rectangles overlap. Overlapping views can't share
+// a pass, since they'd share the depth buffer.
+bool views_overlap( ViewRect const* aRects, std::size_t aViewCount ) noexcept;
+
+#endif // MULTI_VIEW_HPP_9B6D107F_D670_45DD_B4FF_E4648C17EC0B
@@ -0,0 +1,399 @@
+#include "normal_bake.hpp"
+
+#include <limits>
+#include <algorithm>
+
+#include <cmath>
+
+#include "../support/gl_resources.hpp"
+
+#include "thread_pool.hpp"
+
+namespace
+{
+    // Uniform grid over the triangles of the full resolution mesh. The rays
+    // are short (a few times the LOD error), so a grid is enough to keep the
+    // number of triangle tests per ray small.
+    class TriangleGrid_
+    {
+    public:
+        TriangleGrid_( std::vector<Vec3f> const& aPositions, std::uint32_t const* aIndices, std::size_t aIndexCount )
+            : mPositions( aPositions )
+            , mIndices( aIndices )
+        {
+            std::size_t const triangleCount = aIndexCount / 3;
+
+            mMin = Vec3f{ std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+            Vec3f max = -mMin;
+
+            double edgeSum = 0.0;
+            for (std::size_t i = 0; i < aIndexCount; ++i) {
+                Vec3f const& p = aPositions[aIndices[i]];
+                mMin = Vec3f{ std::min( mMin.x, p.x ), std::min( mMin.y, p.y ), std::min( mMin.z, p.z ) };
+                max = Vec3f{ std::max( max.x, p.x ), std::max( max.y, p.y ), std::max( max.z, p.z ) };
+
+                std::size_t const next = i - i % 3 + (i + 1) % 3;
+                edgeSum += length( aPositions[aIndices[next]] - p );
+            }
+
+            // Cells about twice the size of an average edge, but never more
+            // than a few million of them
+            float cell = std::max( 1e-6f, float(2.0 * edgeSum / std::max<std::size_t>( 1, aIndexCount )) );
+            Vec3f const extent = max - mMin;
+
+            for (;;) {
+                mDims[0] = std::max( 1, int(std::ceil( extent.x / cell )) );
+                mDims[1] = std::max( 1, int(std::ceil( extent.y / cell )) );
+                mDims[2] = std::max( 1, int(std::ceil( extent.z / cell )) );
+
+                if (std::size_t(mDims[0]) * mDims[1] * mDims[2] <= (std::size_t(1) << 22))
+                    break;
+
+                cell *= 1.5f;
+            }
+
+            mInvCell = 1.f / cell;
+
+            // Two passes, counting then filling (CSR layout)
+            mCellStart.assign( std::size_t(mDims[0]) * mDims[1] * mDims[2] + 1, 0 );
+
+            auto const visit = [&] (std::size_t aTriangle, auto&& aFunc) {
+                int lo[3], hi[3];
+                triangle_cells_( aTriangle, lo, hi );
+
+                for (int z = lo[2]; z <= hi[2]; ++z)
+                    for (int y = lo[1]; y <= hi[1]; ++y)
+                        for (int x = lo[0]; x <= hi[0]; ++x)
+                            aFunc( cell_index_( x, y, z ) );
+            };
+
+            for (std::size_t t = 0; t < triangleCount; ++t)
+                visit( t, [&] (std::size_t c) { ++mCellStart[c + 1]; } );
+
+            for (std::size_t c = 1; c < mCellStart.size(); ++c)
+                mCellStart[c] += mCellStart[c - 1];
+
+            mCellTriangles.resize( mCellStart.back() );
+
+            std::vector<std::uint32_t> fill( mCellStart.begin(), mCellStart.end() - 1 );
+            for (std::size_t t = 0; t < triangleCount; ++t)
+                visit( t, [&] (std::size_t c) { mCellTriangles[fill[c]++] = std::uint32_t(t); } );
+        }
+
+        struct Hit
+        {
+            std::uint32_t triangle;
+            float t, u, v;      // Ray parameter and barycentrics of vertex 1, 2
+        };
+
+        // Closest hit (by |t|) on the line aOrigin + t * aDir, |t| <= aMaxT.
+        // Hits on either side of the origin count.
+        bool closest_hit( Vec3f const& aOrigin, Vec3f const& aDir, float aMaxT, Hit& aHit ) const
+        {
+            Vec3f const a = aOrigin - aMaxT * aDir;
+            Vec3f const b = aOrigin + aMaxT * aDir;
+
+            int lo[3], hi[3];
+            box_cells_(
+                Vec3f{ std::min( a.x, b.x ), std::min( a.y, b.y ), std::min( a.z, b.z ) },
+                Vec3f{ std::max( a.x, b.x ), std::max( a.y, b.y ), std::max( a.z, b.z ) },
+                lo, hi
+            );
+
+            bool found = false;
+            float best = aMaxT;
+
+            for (int z = lo[2]; z <= hi[2]; ++z) {
+                for (int y = lo[1]; y <= hi[1]; ++y) {
+                    for (int x = lo[0]; x <= hi[0]; ++x) {
+                        std::size_t const c = cell_index_( x, y, z );
+
+                        for (std::uint32_t i = mCellStart[c]; i < mCellStart[c + 1]; ++i) {
+                            std::uint32_t const tri = mCellTriangles[i];
+
+                            float t, u, v;
+                            if (!intersect_( tri, aOrigin, aDir, t, u, v ) || std::abs( t ) > best)
+                                continue;
+
+                            best = std::abs( t );
+                            aHit = Hit{ tri, t, u, v };
+                            found = true;
+                        }
+                    }
+                }
+            }
+
+            return found;
+        }
+
+    private:
+        // Möller-Trumbore, without culling and without limits on t
+        bool intersect_( std::uint32_t aTriangle, Vec3f const& aOrigin, Vec3f const& aDir, float& aT, float& aU, float& aV ) const
+        {
+            Vec3f const& p0 = mPositions[mIndices[aTriangle * 3 + 0]];
+            Vec3f const& p1 = mPositions[mIndices[aTriangle * 3 + 1]];
+            Vec3f const& p2 = mPositions[mIndices[aTriangle * 3 + 2]];
+
+            Vec3f const e1 = p1 - p0;
+            Vec3f const e2 = p2 - p0;
+            Vec3f const pv = cross( aDir, e2 );
+
+            float const det = dot( e1, pv );
+            if (std::abs( det ) < 1e-12f)
+                return false;
+
+            float const inv = 1.f / det;
+            Vec3f const tv = aOrigin - p0;
+
+            aU = dot( tv, pv ) * inv;
+            if (aU < 0.f || aU > 1.f)
+                return false;
+
+            Vec3f const qv = cross( tv, e1 );
+            aV = dot( aDir, qv ) * inv;
+            if (aV < 0.f || aU + aV > 1.f)
+                return false;
+
+            aT = dot( e2, qv ) * inv;
+            return true;
+        }
+
+        void box_cells_( Vec3f const& aLo, Vec3f const& aHi, int aOutLo[3], int aOutHi[3] ) const
+        {
+            float const lo[3] = { aLo.x - mMin.x, aLo.y - mMin.y, aLo.z - mMin.z };
+            float const hi[3] = { aHi.x - mMin.x, aHi.y - mMin.y, aHi.z - mMin.z };
+
+            for (int k = 0; k < 3; ++k) {
+                aOutLo[k] = std::clamp( int(std::floor( lo[k] * mInvCell )), 0, mDims[k] - 1 );
+                aOutHi[k] = std::clamp( int(std::floor( hi[k] * mInvCell )), 0, mDims[k] - 1 );
+            }
+        }
+
+        void triangle_cells_( std::size_t aTriangle, int aOutLo[3], int aOutHi[3] ) const
+        {
+            Vec3f const& p0 = mPositions[mIndices[aTriangle * 3 + 0]];
+            Vec3f const& p1 = mPositions[mIndices[aTriangle * 3 + 1]];
+            Vec3f const& p2 = mPositions[mIndices[aTriangle * 3 + 2]];
+
+            box_cells_(
+                Vec3f{ std::min( { p0.x, p1.x, p2.x } ), std::min( { p0.y, p1.y, p2.y } ), std::min( { p0.z, p1.z, p2.z } ) },
+                Vec3f{ std::max( { p0.x, p1.x, p2.x } ), std::max( { p0.y, p1.y, p2.y } ), std::max( { p0.z, p1.z, p2.z } ) },
+                aOutLo, aOutHi
+            );
+        }
+
+        std::size_t cell_index_( int aX, int aY, int aZ ) const noexcept
+        {
+            return (std::size_t(aZ) * mDims[1] + aY) * mDims[0] + aX;
+        }
+
+        std::vector<Vec3f> const& mPositions;
+        std::uint32_t const* mIndices;
+
+        Vec3f mMin;
+        float mInvCell;
+        int mDims[3];
+
+        std::vector<std::uint32_t> mCellStart;
+        std::vector<std::uint32_t> mCellTriangles;
+    };
+
+    // Rows per work item. Each band is written by exactly one thread.
+    constexpr std::size_t kBandHeight_ = 16;
+
+    // Texels that no triangle covers are grown from their neighbours this many
+    // times, so that filtering near chart edges doesn't pick up garbage.
+    constexpr int kDilationSteps_ = 2;
+
+    Vec3f lerp3_( Vec3f const& aA, Vec3f const& aB, Vec3f const& aC, float aWa, float aWb, float aWc ) noexcept
+    {
+        return aWa * aA + aWb * aB + aWc * aC;
+    }
+
+    void encode_( std::uint8_t* aTexel, Vec3f const& aN ) noexcept
+    {
+        aTexel[0] = std::uint8_t(std::clamp( aN.x * 0.5f + 0.5f, 0.f, 1.f ) * 255.f + 0.5f);
+        aTexel[1] = std::uint8_t(std::clamp( aN.y * 0.5f + 0.5f, 0.f, 1.f ) * 255.f + 0.5f);
+        aTexel[2] = std::uint8_t(std::clamp( aN.z * 0.5f + 0.5f, 0.f, 1.f ) * 255.f + 0.5f);
+        aTexel[3] = 255;
+    }
+}
+
+NormalMapArray bake_lod_normal_maps(
+    SimpleMeshData const& aMesh,
+    MeshLodChain const& aChain,
+    std::size_t aResolution,
+    std::size_t aThreadCount
+)
+{
+    NormalMapArray ret;
+
+    std::size_t const vertexCount = aMesh.positions.size();
+    if (aChain.levels.size() < 2 || aMesh.normals.size() != vertexCount ||
+        aMesh.texcoords.size() != vertexCount || aMesh.tangents.size() != vertexCount)
+        return ret;
+
+    ret.width = aResolution;
+    ret.height = aResolution;
+    ret.layers = aChain.levels.size() - 1;
+    ret.texels.assign( ret.width * ret.height * ret.layers * 4, 0 );
+
+    auto const& pos = aMesh.positions;
+    auto const& nrm = aMesh.normals;
+    auto const& uv = aMesh.texcoords;
+    auto const& tan = aMesh.tangents;
+
+    MeshLod const& full = aChain.levels[0];
+    TriangleGrid_ const grid( pos, aMesh.indices.data() + full.firstIndex, std::size_t(full.indexCount) );
+
+    std::size_t const bandCount = (ret.height + kBandHeight_ - 1) / kBandHeight_;
+    float const w = float(ret.width), h = float(ret.height);
+
+    for (std::size_t layer = 0; layer < ret.layers; ++layer) {
+        MeshLod const& lod = aChain.levels[layer + 1];
+        std::uint32_t const* lodIndices = aMesh.indices.data() + lod.firstIndex;
+        std::size_t const triangleCount = std::size_t(lod.indexCount) / 3;
+
+        // Rays have to reach from the low-poly surface to the original one.
+        // The LOD error bounds that distance; add some slack.
+        Vec3f const diagonal = aChain.boundsMax - aChain.boundsMin;
+        float const maxDistance = 2.f * lod.error + 1e-3f * length( diagonal );
+
+        // Sort the triangles into bands of rows in texture space
+        std::vector<std::vector<std::uint32_t>> bands( bandCount );
+
+        for (std::size_t t = 0; t < triangleCount; ++t) {
+            float const v0 = uv[lodIndices[t*3+0]].y;
+            float const v1 = uv[lodIndices[t*3+1]].y;
+            float const v2 = uv[lodIndices[t*3+2]].y;
+
+            int const y0 = std::max( 0, int(std::floor( std::min( { v0, v1, v2 } ) * h - 0.5f )) );
+            int const y1 = std::min( int(ret.height) - 1, int(std::ceil( std::max( { v0, v1, v2 } ) * h - 0.5f )) );
+
+            for (int b = y0 / int(kBandHeight_); b <= y1 / int(kBandHeight_) && y0 <= y1; ++b)
+                bands[b].emplace_back( std::uint32_t(t) );
+        }
+
+        std::uint8_t* texels = ret.texels.data() + layer * ret.width * ret.height * 4;
+        std::vector<std::uint8_t> covered( ret.width * ret.height, 0 );
+
+        parallel_for( bandCount, aThreadCount, [&] (std::size_t band) {
+            int const bandLo = int(band * kBandHeight_);
+            int const bandHi = std::min( int(ret.height), bandLo + int(kBandHeight_) ) - 1;
+
+            for (auto const t : bands[band]) {
+                std::uint32_t const i0 = lodIndices[t*3+0];
+                std::uint32_t const i1 = lodIndices[t*3+1];
+                std::uint32_t const i2 = lodIndices[t*3+2];
+
+                Vec2f const a = uv[i0], b = uv[i1], c = uv[i2];
+
+                float const area = (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y);
+                if (0.f == area)
+                    continue;
+
+                int const x0 = std::max( 0, int(std::floor( std::min( { a.x, b.x, c.x } ) * w - 0.5f )) );
+                int const x1 = std::min( int(ret.width) - 1, int(std::ceil( std::max( { a.x, b.x, c.x } ) * w - 0.5f )) );
+                int const y0 = std::max( bandLo, int(std::floor( std::min( { a.y, b.y, c.y } ) * h - 0.5f )) );
+                int const y1 = std::min( bandHi, int(std::ceil( std::max( { a.y, b.y, c.y } ) * h - 0.5f )) );
+
+                for (int y = y0; y <= y1; ++y) {
+                    for (int x = x0; x <= x1; ++x) {
+                        Vec2f const p{ (x + 0.5f) / w, (y + 0.5f) / h };
+
+                        // Barycentrics in texture space
+                        float const wa = ((b.x - p.x) * (c.y - p.y) - (c.x - p.x) * (b.y - p.y)) / area;
+                        float const wb = ((c.x - p.x) * (a.y - p.y) - (a.x - p.x) * (c.y - p.y)) / area;
+                        float const wc = 1.f - wa - wb;
+
+                        if (wa < -1e-4f || wb < -1e-4f || wc < -1e-4f)
+                            continue;
+
+                        // Low-poly surface point and tangent frame, interpolated
+                        // the same way the rasterizer will
+                        Vec3f const lp = lerp3_( pos[i0], pos[i1], pos[i2], wa, wb, wc );
+                        Vec3f const ln = normalize( lerp3_( nrm[i0], nrm[i1], nrm[i2], wa, wb, wc ) );
+
+                        Vec3f lt = lerp3_(
+                            Vec3f{ tan[i0].x, tan[i0].y, tan[i0].z },
+                            Vec3f{ tan[i1].x, tan[i1].y, tan[i1].z },
+                            Vec3f{ tan[i2].x, tan[i2].y, tan[i2].z },
+                            wa, wb, wc
+                        );
+                        lt = normalize( lt - dot( lt, ln ) * ln );
+                        float const lw = wa * tan[i0].w + wb * tan[i1].w + wc * tan[i2].w;
+                        Vec3f const lb = (lw < 0.f ? -1.f : 1.f) * cross( ln, lt );
+
+                        // Trace onto the full resolution surface
+                        Vec3f hn = ln;
+
+                        TriangleGrid_::Hit hit;
+                        if (grid.closest_hit( lp, ln, maxDistance, hit )) {
+                            std::uint32_t const* tri = aMesh.indices.data() + full.firstIndex + hit.triangle * 3;
+                            hn = normalize( lerp3_( nrm[tri[0]], nrm[tri[1]], nrm[tri[2]], 1.f - hit.u - hit.v, hit.u, hit.v ) );
+                        }
+
+                        std::size_t const texel = std::size_t(y) * ret.width + x;
+                        encode_( texels + texel * 4, Vec3f{ dot( hn, lt ), dot( hn, lb ), dot( hn, ln ) } );
+                        covered[texel] = 1;
+                    }
+                }
+            }
+        } );
+
+        // Grow the covered area a little, then fill the rest with "straight up"
+        for (int step = 0; step < kDilationSteps_; ++step) {
+            std::vector<std::uint8_t> next = covered;
+
+            for (std::size_t y = 0; y < ret.height; ++y) {
+                for (std::size_t x = 0; x < ret.width; ++x) {
+                    std::size_t const texel = y * ret.width + x;
+                    if (covered[texel])
+                        continue;
+
+                    static int const offsets[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+                    for (auto const& o : offsets) {
+                        std::size_t const nx = x + o[0], ny = y + o[1];
+                        if (nx >= ret.width || ny >= ret.height || !covered[ny * ret.width + nx])
+                            continue;
+
+                        std::copy_n( texels + (ny * ret.width + nx) * 4, 4, texels + texel * 4 );
+                        next[texel] = 1;
+                        break;
+                    }
+                }
+            }
+
+            covered = std::move(next);
+        }
+
+        for (std::size_t texel = 0; texel < ret.width * ret.height; ++texel) {
+            if (!covered[texel])
+                encode_( texels + texel * 4, Vec3f{ 0.f, 0.f, 1.f } );
+        }
+    }
+
+    return ret;
+}
+
+GLuint create_normal_map_texture( NormalMapArray const& aMaps )
+{
+    if (0 == aMaps.layers)
+        return 0;
+
+    GLsizei const w = GLsizei(aMaps.width), h = GLsizei(aMaps.height), layers = GLsizei(aMaps.layers);
+
+    // Normals are data, not colours, so no sRGB here
+    GLuint tex = create_texture( GL_TEXTURE_2D_ARRAY, GL_RGBA8, w, h, layers, mip_levels( w, h ) );
+    upload_texture( tex, GL_TEXTURE_2D_ARRAY, w, h, layers, GL_RGBA, GL_UNSIGNED_BYTE, aMaps.texels.data() );
+
+    generate_texture_mipmaps( tex, GL_TEXTURE_2D_ARRAY );
+
+    set_texture_parameter( tex, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+    set_texture_parameter( tex, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+
+    set_texture_parameter( tex, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+    set_texture_parameter( tex, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+
+    return tex;
+}
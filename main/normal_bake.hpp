@@ -0,0 +1,54 @@
+#ifndef NORMAL_BAKE_HPP_B51E07C2_94A3_4D6F_A8E0_6C2F3D91B7A4
+#define NORMAL_BAKE_HPP_B51E07C2_94A3_4D6F_A8E0_6C2F3D91B7A4
+
+#include <glad/glad.h>
+
+#include <vector>
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "simple_mesh.hpp"
+#include "mesh_lod.hpp"
+
+/*
+ *  === Normal map baking ===
+ *  https://learnopengl.com/Advanced-Lighting/Normal-Mapping
+ *
+ *  Simplifying a mesh throws away the small bumps that make the lighting
+ *  interesting. To get them back, every texel of each simplified LOD is
+ *  traced back onto the full resolution mesh: a ray is cast from the low-poly
+ *  surface along its (interpolated) normal, and the high-poly normal where it
+ *  lands is stored in the low-poly surface's tangent space.
+ *
+ *  Each LOD gets its own layer in a 2D array texture, since the low-poly
+ *  surface (and so its tangent space) is different for every level. LOD 0
+ *  has no layer; it uses its vertex normals. Layer i-1 belongs to LOD i.
+ *
+ *  The mesh needs texture coordinates without overlaps, normals and tangents
+ *  (see generate_tangents() or compute_tangents()).
+ */
+
+struct NormalMapArray
+{
+    std::size_t width = 0;
+    std::size_t height = 0;
+    std::size_t layers = 0;
+
+    // RGBA8, rows bottom to top (like OpenGL), one layer after the other
+    std::vector<std::uint8_t> texels;
+};
+
+// Bakes one layer per LOD after the first. aThreadCount = 0 uses all
+// hardware threads.
+NormalMapArray bake_lod_normal_maps(
+    SimpleMeshData const&,
+    MeshLodChain const&,
+    std::size_t aResolution,
+    std::size_t aThreadCount = 0
+);
+
+// Uploads the maps as a GL_TEXTURE_2D_ARRAY with mipmaps.
+GLuint create_normal_map_texture( NormalMapArray const& );
+
+#endif // NORMAL_BAKE_HPP_B51E07C2_94A3_4D6F_A8E0_6C2F3D91B7A4
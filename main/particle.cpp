@@ -1,8 +1,25 @@
 // https://learnopengl.com/index.php?p=In-Practice/2D-Game/Particles
 
 #include "particle.hpp"
+#include <algorithm>
 #include <cstdio>
 
+#include "../support/gl_state.hpp"
+#include "../support/gl_resources.hpp"
+
+namespace
+{
+    // One per live particle, written straight into the stream buffer
+    struct ParticleInstance_
+    {
+        Vec4f centerSize;   // World space center, billboard size
+        Vec4f color;
+    };
+
+    constexpr GLuint kParticleCenterSizeLocation_ = 2;
+    constexpr GLuint kParticleColorLocation_ = 3;
+}
+
 ParticleSystem::ParticleSystem( ShaderProgram& shader, GLuint textureId, unsigned int amount)
     : shader(shader),
       textureId(textureId),
@@ -37,6 +54,15 @@ void ParticleSystem::update( float dt, Vec3f objPosition, Vec3f objVelocity, uns
 
         if ( !p.isDead() ) {
             p.position += p.velocity * dt;
+
+            // Ground collision, bounce back up and lose most of the speed
+            if (this->ground) {
+                float groundHeight = height_at( *this->ground, p.position.x, p.position.z );
+                if (p.position.y < groundHeight) {
+                    p.position.y = groundHeight;
+                    p.velocity = Vec3f{ p.velocity.x * 0.6f, -p.velocity.y * 0.3f, p.velocity.z * 0.6f };
+                }
+            }
             p.color.w = smoothstep(0.0f, 1.0f, p.lifetime);     // Fade out over the lifetime
 
             // Make the particle smaller over its lifetime
@@ -92,6 +118,10 @@ void ParticleSystem::respawnParticle( Particle& particle, Vec3f objPosition, Vec
     particle.velocity = (objVelocity*-0.5f) + Vec3f{randomX*radius, randomY*radius, randomZ*radius} * randomVelocityFactor;
 }
 
+void ParticleSystem::setGround( Heightfield const* aGround ) {
+    this->ground = aGround;
+}
+
 void ParticleSystem::reset( Vec3f objPosition ) {
     for (unsigned int i = 0; i < this->numParticles; ++i) {
         this->particles[i].position = objPosition;
@@ -119,28 +149,6 @@ void ParticleSystem::orderParticles( Mat44f projCameraWorld ) {
 }
 
 void ParticleSystem::init() {
-    // Generate the uniform locations
-    this->uColorLocation  = glGetUniformLocation( this->shader.programId(), "uColor" );
-    this->uProjCameraWorldLocation = glGetUniformLocation( this->shader.programId(), "uProjCameraWorld" );
-
-    this->uParticleCenterWorldspaceLocation = glGetUniformLocation( this->shader.programId(), "uParticleCenterWorldSpace" );
-    this->uCameraRightWorldSpaceLocation = glGetUniformLocation( this->shader.programId(), "uCameraRightWorldSpace" );
-    this->uCameraUpWorldSpaceLocation = glGetUniformLocation( this->shader.programId(), "uCameraUpWorldSpace" );
-    this->uBillboardSizeLocation = glGetUniformLocation( this->shader.programId(), "uBillboardSize" );
-
-    if (this->uColorLocation == static_cast<GLuint>(-1))
-        std::fprintf(stderr, "Error: 'uColorLocation' not found");
-    if (this->uProjCameraWorldLocation == static_cast<GLuint>(-1))
-        std::fprintf(stderr, "Error: 'uProjCameraWorldLocation' not found");
-    if (this->uParticleCenterWorldspaceLocation == static_cast<GLuint>(-1))
-        std::fprintf(stderr, "Error: 'uParticleCenterWorldSpaceLocation' not found");
-    if (this->uCameraRightWorldSpaceLocation == static_cast<GLuint>(-1))
-        std::fprintf(stderr, "Error: 'uCameraRightWorldSpaceLocation' not found");
-    if (this->uCameraUpWorldSpaceLocation == static_cast<GLuint>(-1))
-        std::fprintf(stderr, "Error: 'uCameraUpWorldSpaceLocation' not found");
-    if (this->uBillboardSizeLocation == static_cast<GLuint>(-1))
-        std::fprintf(stderr, "Error: 'uBillboardSizeLocation' not found");
-
     float positions[] = {
         -0.5f,  0.5f, 0.0f,   // Top-left
         -0.5f, -0.5f, 0.0f,   // Bottom-left
@@ -162,35 +170,19 @@ void ParticleSystem::init() {
         1.0f, 0.0f    // Bottom-right
     };
 
-    // Position VBO
-    GLuint positionVBO = 0;
-    glGenBuffers( 1, &positionVBO );
-    glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(positions), positions, GL_STATIC_DRAW);
-
-    // Texture VBO
-    GLuint textureVBO = 0;
-    glGenBuffers( 1, &textureVBO );
-    glBindBuffer(GL_ARRAY_BUFFER, textureVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(texCoords), texCoords, GL_STATIC_DRAW);
-
-    // VAO
-    glGenVertexArrays( 1, &this->vao );
-    glBindVertexArray( this->vao );
-
-    // Add position attributes
-    glBindBuffer( GL_ARRAY_BUFFER, positionVBO );
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), 0);
-    glEnableVertexAttribArray( 0 );
-
-    // Add texture coordinates
-    glBindBuffer( GL_ARRAY_BUFFER, textureVBO );
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), nullptr);
-    glEnableVertexAttribArray( 1 );
-
-    // Clean up
-    glBindBuffer( GL_ARRAY_BUFFER, 0 );
-    glBindVertexArray( 0 );
+    GLuint positionVBO = create_buffer( sizeof(positions), positions );
+    GLuint textureVBO = create_buffer( sizeof(texCoords), texCoords );
+
+    this->vao = create_vertex_array();
+    set_vertex_attribute( this->vao, 0, positionVBO, 0, 3 * sizeof(float), 3, GL_FLOAT );
+    set_vertex_attribute( this->vao, 1, textureVBO, 0, 2 * sizeof(float), 2, GL_FLOAT );
+
+    // Per particle attributes, see ParticleInstance_. Where they come from
+    // changes every draw.
+    set_vertex_divisor( this->vao, kParticleCenterSizeLocation_, 1 );
+    set_vertex_divisor( this->vao, kParticleColorLocation_, 1 );
+
+    // Clean up, the VAO keeps the buffers alive
     glDeleteBuffers( 1, &positionVBO );
     glDeleteBuffers( 1, &textureVBO );
 
@@ -198,62 +190,96 @@ void ParticleSystem::init() {
         this->particles.push_back(Particle());
 }
 
-void ParticleSystem::draw( Mat44f projCameraWorld, Mat44f viewMatrix ) {
-    /*
-     *  GL_ONE allows 'additive blending', which gives us the glow effect when
-     *  sprites are stacked on each other
-     */
-    orderParticles( projCameraWorld );
-    glEnable(GL_BLEND);
-    glBlendFunc( GL_SRC_ALPHA, GL_ONE );
-
-    GLuint currentProgram;
-    glGetIntegerv(GL_CURRENT_PROGRAM, reinterpret_cast<GLint*>(&currentProgram));
+bool ParticleSystem::bounds( Vec3f& aMin, Vec3f& aMax ) const
+{
+    bool any = false;
 
-    if (this->shader.programId() != currentProgram)
-        glUseProgram( this->shader.programId() );   // Saves changing the shader if not needed
+    for (auto const& particle : this->particles) {
+        if (particle.lifetime <= 0.f)
+            continue;
 
-    glBindVertexArray(this->vao);
-    glActiveTexture( GL_TEXTURE0 );
-    glBindTexture(GL_TEXTURE_2D, this->textureId);
+        // The billboard turns with the camera, so allow for any direction
+        Vec3f const extent = { particle.size, particle.size, particle.size };
+        Vec3f const lo = particle.position - extent, hi = particle.position + extent;
 
-    // We need the camera's 'up' and 'right' vectors in world space
-    // This is the same as the inverse of the view matrix
-    // NOTE: The x and y are flipped in the viewMatrix because we are in ROW MAJOR
-    //      NOTE2: Took me 12 hours to realise this...
-    Vec3f cameraRightWorldSpace = normalize({ viewMatrix(0, 0), viewMatrix(0, 1), viewMatrix(0, 2) });
-    Vec3f cameraUpWorldSpace    = normalize({ viewMatrix(1, 0), viewMatrix(1, 1), viewMatrix(1, 2) });
+        if (!any) {
+            aMin = lo;
+            aMax = hi;
+            any = true;
+            continue;
+        }
 
-    glUniform3fv( this->uCameraRightWorldSpaceLocation, 1, &cameraRightWorldSpace.x );
-    glUniform3fv( this->uCameraUpWorldSpaceLocation, 1, &cameraUpWorldSpace.x );
+        aMin = Vec3f{ std::min( aMin.x, lo.x ), std::min( aMin.y, lo.y ), std::min( aMin.z, lo.z ) };
+        aMax = Vec3f{ std::max( aMax.x, hi.x ), std::max( aMax.y, hi.y ), std::max( aMax.z, hi.z ) };
+    }
 
-    // Doing one draw call for each particle is wasteful
-    // Instead use instancing:
-    //      https://www.opengl-tutorial.org/intermediate-tutorials/billboards-particles/particles-instancing/
-    for (Particle particle : this->particles) {
-        if (!particle.isDead()) {
+    return any;
+}
 
-            Mat44f model2worldParticle = make_translation(particle.position);
-            Vec4f particleCenterWorldSpace = model2worldParticle * Vec4f{ 0.f, 0.f, 0.f, 1.f };
+void ParticleSystem::prepare( Mat44f projCameraWorld, StreamBuffer& aStream ) {
+    // Blending is additive and the particles don't write depth (see
+    // draw()), so they can't hide each other, and one order does for every
+    // view
+    orderParticles( projCameraWorld );
 
-            glUniform3f(
-                this->uParticleCenterWorldspaceLocation,
-                particleCenterWorldSpace.x,
-                particleCenterWorldSpace.y,
-                particleCenterWorldSpace.z
-            );
+    // One instance per live particle, back to front like they are sorted
+    this->liveParticles = 0;
+    for (auto& particle : this->particles)
+        this->liveParticles += particle.isDead() ? 0 : 1;
 
-            glUniform2f( this->uBillboardSizeLocation, particle.size, particle.size );
-            glUniform4fv( this->uColorLocation, 1, &particle.color.x );
-            glUniformMatrix4fv(this->uProjCameraWorldLocation, 1, GL_TRUE, projCameraWorld.v);
+    if (0 == this->liveParticles)
+        return;
 
-            glDrawArrays( GL_TRIANGLES, 0, 6 );
+    auto const instances = aStream.allocate( GLsizeiptr(this->liveParticles * sizeof(ParticleInstance_)) );
+    auto* out = static_cast<ParticleInstance_*>( instances.data );
+    for (auto& particle : this->particles) {
+        if (!particle.isDead()) {
+            *out++ = ParticleInstance_{
+                { particle.position.x, particle.position.y, particle.position.z, particle.size },
+                particle.color
+            };
         }
     }
+    aStream.flush( instances );
+
+    set_vertex_attribute( this->vao, kParticleCenterSizeLocation_, aStream.buffer(), instances.offset, sizeof(ParticleInstance_), 4, GL_FLOAT );
+    set_vertex_attribute( this->vao, kParticleColorLocation_, aStream.buffer(), instances.offset + GLintptr(sizeof(Vec4f)), sizeof(ParticleInstance_), 4, GL_FLOAT );
+}
+
+void ParticleSystem::draw( GLuint aViewCount ) {
+    if (0 == this->liveParticles)
+        return;
+
+    /*
+     *  GL_ONE allows 'additive blending', which gives us the glow effect when
+     *  sprites are stacked on each other
+     */
+    // The state cache skips whatever is already set, e.g. everything for
+    // the second view when drawing view by view
+    gl_state().set_enabled( GL_BLEND, true );
+    gl_state().blend_func( GL_SRC_ALPHA, GL_ONE );
+
+    // Tested against the scene, but not against each other. Otherwise
+    // the nearer of two particles would clip the other wherever it was
+    // drawn first, and the draw order only suits the first view.
+    gl_state().depth_mask( false );
+
+    gl_state().use_program( this->shader.programId() );
+    gl_state().bind_vertex_array( this->vao );
+    gl_state().bind_texture( 0, GL_TEXTURE_2D, this->textureId );
+
+    // The cameras come from the ViewBlock, each particle is instanced once
+    // per view in it
+    if (aViewCount != this->viewDivisor) {
+        set_vertex_divisor( this->vao, kParticleCenterSizeLocation_, aViewCount );
+        set_vertex_divisor( this->vao, kParticleColorLocation_, aViewCount );
+        this->viewDivisor = aViewCount;
+    }
+
+    // https://www.opengl-tutorial.org/intermediate-tutorials/billboards-particles/particles-instancing/
+    glDrawArraysInstanced( GL_TRIANGLES, 0, 6, GLsizei(this->liveParticles * aViewCount) );
 
-    // Clean up
-    glBindVertexArray( 0 );
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);  // Reset blending
-    glUseProgram( 0 );
+    // No clean up, whoever draws next sets the state they need. Except
+    // for depth writes, which glClear() needs as well.
+    gl_state().depth_mask( true );
 }
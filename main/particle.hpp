@@ -5,6 +5,9 @@
 #include "../vmlib/vec4.hpp"
 #include "../vmlib/mat44.hpp"
 #include "../support/program.hpp"
+#include "../support/stream_buffer.hpp"
+
+#include "heightfield.hpp"
 
 #include <algorithm>
 /*
@@ -34,8 +37,22 @@ public:
 
     // Add offset?
     void update( float dt, Vec3f objPosition, Vec3f objVelocity, unsigned int newParticles, Vec3f cameraPos );
-    void draw( Mat44f, Mat44f );
+    // The live particles go to aStream as instances, sorted for the camera
+    // aProjCameraWorld. Once per frame, before draw().
+    void prepare( Mat44f aProjCameraWorld, StreamBuffer& aStream );
+
+    // Draws the prepared particles for the aViewCount views of the bound
+    // ViewBlock (see uniform_blocks.hpp), in one draw. They don't write
+    // depth, so the order from prepare() is right for every view.
+    void draw( GLuint aViewCount );
     void reset( Vec3f );
+
+    // World space box around the live particles' billboards. False if there
+    // are none.
+    bool bounds( Vec3f& aMin, Vec3f& aMax ) const;
+
+    // Particles bounce off this ground, if there is one
+    void setGround( Heightfield const* );
 private:
     const ShaderProgram &shader;
     const GLuint textureId;
@@ -44,16 +61,11 @@ private:
     std::vector<Particle> particles;
     GLuint vao;
 
-    // Uniform locations
-    GLuint uColorLocation;
-    GLuint uProjCameraWorldLocation;
+    // Instances written by prepare(), and the instance divisor they have
+    std::size_t liveParticles = 0;
+    GLuint viewDivisor = 1;
 
-    // Billboarding
-    // https://www.opengl-tutorial.org/intermediate-tutorials/billboards-particles/billboards/
-    GLuint uParticleCenterWorldspaceLocation;
-    GLuint uCameraRightWorldSpaceLocation;
-    GLuint uCameraUpWorldSpaceLocation;
-    GLuint uBillboardSizeLocation;
+    Heightfield const* ground = nullptr;
 
     void init();    // Initialises vao
     unsigned int firstUnusedParticle();
@@ -0,0 +1,56 @@
+#include "primitives.hpp"
+
+#include <algorithm>
+
+#include "shapes/cone.hpp"
+#include "shapes/cube.hpp"
+#include "shapes/cylinder.hpp"
+
+namespace
+{
+    bool same_( Vec3f const& aA, Vec3f const& aB ) noexcept
+    {
+        return aA.x == aB.x && aA.y == aB.y && aA.z == aB.z;
+    }
+}
+
+bool operator==( PrimitiveDesc const& aA, PrimitiveDesc const& aB ) noexcept
+{
+    return aA.shape == aB.shape
+        && aA.subdivs == aB.subdivs
+        && same_( aA.material.ambient, aB.material.ambient )
+        && same_( aA.material.diffuse, aB.material.diffuse )
+        && same_( aA.material.specular, aB.material.specular )
+        && aA.material.shininess == aB.material.shininess
+        && same_( aA.material.emissive, aB.material.emissive )
+        && aA.material.illum == aB.material.illum;
+}
+
+SimpleMeshData make_primitive( PrimitiveDesc const& aDesc, Mat44f aPreTransform )
+{
+    switch (aDesc.shape) {
+        case PrimitiveShape::cube:
+            return make_cube( aDesc.material, aPreTransform, aDesc.subdivs );
+        case PrimitiveShape::cone:
+            return make_cone( false, aDesc.subdivs, aDesc.material, aPreTransform );
+        case PrimitiveShape::cappedCone:
+            return make_cone( true, aDesc.subdivs, aDesc.material, aPreTransform );
+        case PrimitiveShape::cylinder:
+            return make_cylinder( false, aDesc.subdivs, aDesc.material, aPreTransform );
+        case PrimitiveShape::cappedCylinder:
+            return make_cylinder( true, aDesc.subdivs, aDesc.material, aPreTransform );
+    }
+
+    return {};
+}
+
+
+std::size_t find_or_add_primitive( std::vector<PrimitiveDesc>& aUnique, PrimitiveDesc const& aDesc )
+{
+    auto const it = std::find( aUnique.begin(), aUnique.end(), aDesc );
+    if (it != aUnique.end())
+        return std::size_t(it - aUnique.begin());
+
+    aUnique.emplace_back( aDesc );
+    return aUnique.size() - 1;
+}
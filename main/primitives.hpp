@@ -0,0 +1,57 @@
+#ifndef PRIMITIVES_HPP_8E2B4C17_3F6D_4A90_B1C5_7D29E0A4F83B
+#define PRIMITIVES_HPP_8E2B4C17_3F6D_4A90_B1C5_7D29E0A4F83B
+
+#include <glad/glad.h>
+
+#include <vector>
+
+#include <cstdlib>
+
+#include "simple_mesh.hpp"
+
+#include "../vmlib/mat44.hpp"
+
+/*
+ *  === Procedural primitives ===
+ *  https://learnopengl.com/Advanced-OpenGL/Instancing
+ *
+ *  Models like the vehicle are made from many copies of the same few
+ *  procedural shapes, each described by a (shape, subdivisions, material)
+ *  combination and placed with a transform. Instead of baking every copy
+ *  into one big mesh, each unique combination is uploaded once, and a model
+ *  draws its parts with one instanced draw per unique primitive. GPU memory
+ *  scales with the number of unique primitives, plus one draw record per
+ *  placed part. See vehicle.hpp.
+ */
+
+enum class PrimitiveShape
+{
+    cube,
+    cone,
+    cappedCone,
+    cylinder,
+    cappedCylinder
+};
+
+struct PrimitiveDesc
+{
+    PrimitiveShape shape;
+    std::size_t subdivs;
+    Material material;
+};
+
+bool operator==( PrimitiveDesc const&, PrimitiveDesc const& ) noexcept;
+
+// A primitive placed somewhere in a model
+struct PartInstance
+{
+    PrimitiveDesc primitive;
+    Mat44f transform;       // Part -> model
+};
+
+SimpleMeshData make_primitive( PrimitiveDesc const&, Mat44f aPreTransform = kIdentity44f );
+
+// Index of aDesc in aUnique, appending it on first use
+std::size_t find_or_add_primitive( std::vector<PrimitiveDesc>& aUnique, PrimitiveDesc const& aDesc );
+
+#endif // PRIMITIVES_HPP_8E2B4C17_3F6D_4A90_B1C5_7D29E0A4F83B
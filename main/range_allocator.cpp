@@ -0,0 +1,105 @@
+#include "range_allocator.hpp"
+
+#include <iterator>
+#include <algorithm>
+
+#include <cassert>
+
+float RangeAllocatorStats::fragmentation() const noexcept
+{
+    std::size_t const free = capacity - used;
+    return free ? 1.f - float(largestFree) / float(free) : 0.f;
+}
+
+float RangeAllocatorStats::occupancy() const noexcept
+{
+    return capacity ? float(used) / float(capacity) : 0.f;
+}
+
+RangeAllocator::RangeAllocator( std::size_t aCapacity )
+    : mCapacity( aCapacity )
+{
+    if (aCapacity)
+        mFree.emplace( 0, aCapacity );
+}
+
+bool RangeAllocator::allocate( std::size_t aSize, std::size_t& aOffset )
+{
+    if (0 == aSize)
+        return false;
+
+    auto best = mFree.end();
+    for (auto it = mFree.begin(); it != mFree.end(); ++it) {
+        if (it->second >= aSize && (best == mFree.end() || it->second < best->second))
+            best = it;
+    }
+
+    if (best == mFree.end())
+        return false;
+
+    // Take the front of the free range, the rest stays free
+    std::size_t const offset = best->first;
+    std::size_t const rest = best->second - aSize;
+
+    mFree.erase( best );
+    if (rest)
+        mFree.emplace( offset + aSize, rest );
+
+    mUsed += aSize;
+    ++mAllocations;
+
+    aOffset = offset;
+    return true;
+}
+
+void RangeAllocator::free( std::size_t aOffset, std::size_t aSize )
+{
+    if (0 == aSize)
+        return;
+
+    assert( aOffset + aSize <= mCapacity );
+    assert( aSize <= mUsed && mAllocations > 0 );
+
+    auto next = mFree.lower_bound( aOffset );
+    assert( next == mFree.end() || aOffset + aSize <= next->first );
+
+    std::size_t offset = aOffset;
+    std::size_t size = aSize;
+
+    // Merge with the free range right after...
+    if (next != mFree.end() && offset + size == next->first) {
+        size += next->second;
+        next = mFree.erase( next );
+    }
+
+    // ... and the one right before
+    if (next != mFree.begin()) {
+        auto const prev = std::prev( next );
+        assert( prev->first + prev->second <= aOffset );
+
+        if (prev->first + prev->second == offset) {
+            offset = prev->first;
+            size += prev->second;
+            mFree.erase( prev );
+        }
+    }
+
+    mFree.emplace( offset, size );
+
+    mUsed -= aSize;
+    --mAllocations;
+}
+
+RangeAllocatorStats RangeAllocator::stats() const noexcept
+{
+    RangeAllocatorStats ret;
+    ret.capacity = mCapacity;
+    ret.used = mUsed;
+    ret.allocations = mAllocations;
+    ret.freeRanges = mFree.size();
+
+    for (auto const& range : mFree)
+        ret.largestFree = std::max( ret.largestFree, range.second );
+
+    return ret;
+}
@@ -0,0 +1,65 @@
+#ifndef RANGE_ALLOCATOR_HPP_8B3E5F21_C7A4_4D96_B052_1E9D4A6C73F8
+#define RANGE_ALLOCATOR_HPP_8B3E5F21_C7A4_4D96_B052_1E9D4A6C73F8
+
+#include <map>
+
+#include <cstdlib>
+
+/*
+ *  === Range allocator ===
+ *  https://en.wikipedia.org/wiki/Free_list
+ *  https://www.gamedeveloper.com/programming/sub-allocation-of-gpu-memory
+ *
+ *  Hands out ranges of [0, capacity) from a free list, for sub-allocating
+ *  big GPU buffers (see SharedGeometry). Only the bookkeeping lives here; the
+ *  units are whatever the caller says (vertices, indices, ...).
+ *
+ *  Free ranges are kept sorted by offset, so a freed range merges with its
+ *  neighbours right away. Allocation is best fit, which keeps the big free
+ *  ranges intact for as long as possible. There are only ever a handful of
+ *  free ranges (one per hole left by a removed mesh), so a linear scan for
+ *  the best one is fine.
+ */
+
+struct RangeAllocatorStats
+{
+    std::size_t capacity = 0;
+    std::size_t used = 0;
+    std::size_t allocations = 0;
+
+    std::size_t freeRanges = 0;
+    std::size_t largestFree = 0;
+
+    // 0 when all free space is in one piece, towards 1 the more it is split up
+    float fragmentation() const noexcept;
+
+    // Fraction of the capacity in use
+    float occupancy() const noexcept;
+};
+
+class RangeAllocator
+{
+public:
+    RangeAllocator() = default;
+    explicit RangeAllocator( std::size_t aCapacity );
+
+    // Returns false (and leaves aOffset alone) if there is no free range of
+    // at least aSize
+    bool allocate( std::size_t aSize, std::size_t& aOffset );
+
+    // Gives back a range returned by allocate()
+    void free( std::size_t aOffset, std::size_t aSize );
+
+    std::size_t capacity() const noexcept { return mCapacity; }
+
+    RangeAllocatorStats stats() const noexcept;
+
+private:
+    std::size_t mCapacity = 0;
+    std::size_t mUsed = 0;
+    std::size_t mAllocations = 0;
+
+    std::map<std::size_t, std::size_t> mFree;    // Offset -> size
+};
+
+#endif // RANGE_ALLOCATOR_HPP_8B3E5F21_C7A4_4D96_B052_1E9D4A6C73F8
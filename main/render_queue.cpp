@@ -0,0 +1,97 @@
+#include "render_queue.hpp"
+
+#include <bit>
+#include <utility>
+#include <algorithm>
+
+namespace
+{
+    constexpr std::uint64_t kPassMask_ = 0xf000'0000'0000'0000ull;
+    constexpr std::uint64_t kProgramMask_ = 0x0ff0'0000'0000'0000ull;
+    constexpr std::uint64_t kMaterialMask_ = 0x000f'ff00'0000'0000ull;
+    constexpr std::uint64_t kVaoMask_ = 0x0000'00ff'0000'0000ull;
+
+    std::size_t changes_( std::uint64_t aPrev, std::uint64_t aNext, std::uint64_t aMask )
+    {
+        return (aPrev & aMask) != (aNext & aMask) ? 1 : 0;
+    }
+}
+
+std::uint64_t make_sort_key( RenderPass aPass, std::uint32_t aProgram, std::uint32_t aMaterial, std::uint32_t aVao, float aDepth )
+{
+    // Negative distances (just behind the camera) count as 0
+    std::uint32_t depth = std::bit_cast<std::uint32_t>( std::max( aDepth, 0.f ) );
+    if (kRenderPassTransparent == aPass)
+        depth = ~depth;
+
+    return (std::uint64_t(aPass & 0xfu) << 60)
+        | (std::uint64_t(aProgram & 0xffu) << 52)
+        | (std::uint64_t(aMaterial & 0xfffu) << 40)
+        | (std::uint64_t(aVao & 0xffu) << 32)
+        | std::uint64_t(depth);
+}
+
+void RenderQueue::clear() noexcept
+{
+    mEntries.clear();
+}
+
+void RenderQueue::reserve( std::size_t aCount )
+{
+    mEntries.reserve( aCount );
+    mScratch.reserve( aCount );
+}
+
+void RenderQueue::push( std::uint64_t aKey, std::uint32_t aItem )
+{
+    mEntries.emplace_back( Entry{ aKey, aItem } );
+}
+
+void RenderQueue::sort()
+{
+    mStats = RenderQueueStats{};
+    mStats.items = mEntries.size();
+
+    if (mEntries.empty())
+        return;
+
+    for (std::size_t i = 1; i < mEntries.size(); ++i) {
+        std::uint64_t const a = mEntries[i - 1].key, b = mEntries[i].key;
+        mStats.unsortedChanges += changes_( a, b, kPassMask_ ) + changes_( a, b, kProgramMask_ )
+            + changes_( a, b, kMaterialMask_ ) + changes_( a, b, kVaoMask_ );
+    }
+
+    // One histogram per byte, all in a single pass over the keys
+    std::size_t counts[8][256] = {};
+    for (auto const& entry : mEntries) {
+        for (std::size_t b = 0; b < 8; ++b)
+            ++counts[b][(entry.key >> (b * 8)) & 0xffu];
+    }
+
+    mScratch.resize( mEntries.size() );
+
+    for (std::size_t b = 0; b < 8; ++b) {
+        // Every key has the same byte here, nothing would move
+        std::uint32_t const byte = std::uint32_t((mEntries.front().key >> (b * 8)) & 0xffu);
+        if (counts[b][byte] == mEntries.size())
+            continue;
+
+        std::size_t offset = 0;
+        for (auto& count : counts[b])
+            offset += std::exchange( count, offset );
+
+        // Stable, so the lower bytes' order survives
+        for (auto const& entry : mEntries)
+            mScratch[counts[b][(entry.key >> (b * 8)) & 0xffu]++] = entry;
+
+        std::swap( mEntries, mScratch );
+    }
+
+    for (std::size_t i = 1; i < mEntries.size(); ++i) {
+        std::uint64_t const a = mEntries[i - 1].key, b = mEntries[i].key;
+        mStats.passChanges += changes_( a, b, kPassMask_ );
+        mStats.programChanges += changes_( a, b, kProgramMask_ );
+        mStats.materialChanges += changes_( a, b, kMaterialMask_ );
+        mStats.vaoChanges += changes_( a, b, kVaoMask_ );
+    }
+}
@@ -0,0 +1,100 @@
+#ifndef RENDER_QUEUE_HPP_7C2A9E41_D35B_4F86_B1E0_48A6F9C3D7E5
+#define RENDER_QUEUE_HPP_7C2A9E41_D35B_4F86_B1E0_48A6F9C3D7E5
+
+#include <vector>
+
+#include <cstdint>
+#include <cstdlib>
+
+/*
+ *  === Render queue / sort keys ===
+ *  https://realtimecollisiondetection.net/blog/?p=86
+ *  https://en.wikipedia.org/wiki/Radix_sort#Least_significant_digit
+ *
+ *  Draws aren't issued in the order the code happens to produce them. Each
+ *  one goes into the queue with a 64-bit key and an item (an index into the
+ *  caller's own list of draws), and the queue sorts by key:
+ *
+ *    63..60  pass         opaque first, then transparent
+ *    59..52  program      small ids, not GL names
+ *    51..40  material     textures and per-draw switches
+ *    39..32  vao          small ids, not GL names
+ *    31..0   depth        view distance, as float bits
+ *
+ *  So draws that need the same state end up next to each other, and within
+ *  those opaque ones go front to back, which lets early-z reject hidden
+ *  fragments. Transparent draws flip the depth bits and go back to front.
+ *  Non-negative floats compare like their bits, so the distance needs no
+ *  further quantisation.
+ *
+ *  The sort is an LSD radix sort on bytes. Bytes that are the same for every
+ *  key (most of the high ones, usually) are skipped, so the common case is
+ *  four or five linear passes, whatever the number of draws.
+ *
+ *  The stats count how often each field changes from one draw to the next,
+ *  which is the number of state changes drawing the queue in order takes,
+ *  both before and after sorting.
+ */
+
+enum RenderPass : std::uint32_t
+{
+    kRenderPassOpaque = 0,
+    kRenderPassTransparent = 1
+};
+
+std::uint64_t make_sort_key(
+    RenderPass aPass,
+    std::uint32_t aProgram,
+    std::uint32_t aMaterial,
+    std::uint32_t aVao,
+    float aDepth
+);
+
+struct RenderQueueStats
+{
+    std::size_t items = 0;
+
+    // Changes between consecutive items, in sorted order
+    std::size_t passChanges = 0;
+    std::size_t programChanges = 0;
+    std::size_t materialChanges = 0;
+    std::size_t vaoChanges = 0;
+
+    // All of the above, in the order the items were pushed
+    std::size_t unsortedChanges = 0;
+
+    std::size_t state_changes() const noexcept { return passChanges + programChanges + materialChanges + vaoChanges; }
+};
+
+class RenderQueue
+{
+public:
+    struct Entry
+    {
+        std::uint64_t key;
+        std::uint32_t item;
+    };
+
+    void clear() noexcept;
+    void reserve( std::size_t );
+
+    void push( std::uint64_t aKey, std::uint32_t aItem );
+
+    // Sorts by key. Items with equal keys keep the order they were pushed in.
+    void sort();
+
+    // In sorted order after sort()
+    std::vector<Entry> const& entries() const noexcept { return mEntries; }
+    std::size_t size() const noexcept { return mEntries.size(); }
+
+    // Of the last sort()
+    RenderQueueStats const& stats() const noexcept { return mStats; }
+
+private:
+    std::vector<Entry> mEntries;
+    std::vector<Entry> mScratch;
+
+    RenderQueueStats mStats;
+};
+
+#endif // RENDER_QUEUE_HPP_7C2A9E41_D35B_4F86_B1E0_48A6F9C3D7E5
@@ -19,7 +19,8 @@ SimpleMeshData make_cube(
                                  {0.0f, 0.0f, 0.0f},    // Emissive
                                  1.0f },                // Illum
 
-	Mat44f aPreTransform = kIdentity44f
+	Mat44f aPreTransform = kIdentity44f,
+	std::size_t aSubdivs = 1
 );
 
 #endif // CUBE_HPP_CB812C27_5E45_4ED9_9A7F_D66774954C29
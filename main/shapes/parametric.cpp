@@ -0,0 +1,189 @@
+#include "parametric.hpp"
+
+#include <numbers>
+
+namespace
+{
+    // cos/sin for each segment of a ring. Computed once per shape and shared
+    // by every row of the surface.
+    void make_ring_table_( std::size_t aSubdivs, std::vector<float>& aCos, std::vector<float>& aSin )
+    {
+        aCos.resize( aSubdivs );
+        aSin.resize( aSubdivs );
+
+        for (std::size_t i = 0; i < aSubdivs; ++i) {
+            float const angle = i / float(aSubdivs) * 2.f * std::numbers::pi_v<float>;
+            aCos[i] = std::cos( angle );
+            aSin[i] = std::sin( angle );
+        }
+    }
+}
+
+void append_revolution( SimpleMeshData& aMesh, std::vector<ProfilePoint> const& aProfile, std::size_t aSubdivs )
+{
+    if (aProfile.size() < 2 || aSubdivs < 3)
+        return;
+
+    std::vector<float> cosTable, sinTable;
+    make_ring_table_( aSubdivs, cosTable, sinTable );
+
+    std::size_t const rows = aProfile.size();
+
+    std::vector<std::uint32_t> rowStart( rows );
+    std::vector<bool> collapsed( rows );
+
+    aMesh.positions.reserve( aMesh.positions.size() + rows * aSubdivs );
+    aMesh.normals.reserve( aMesh.normals.size() + rows * aSubdivs );
+
+    // Vertices: one per ring segment, or just one for a collapsed row
+    for (std::size_t j = 0; j < rows; ++j) {
+        ProfilePoint const& p = aProfile[j];
+
+        rowStart[j] = std::uint32_t(aMesh.positions.size());
+        collapsed[j] = (0.f == p.radius && 0.f == p.normal.y);
+
+        if (collapsed[j]) {
+            aMesh.positions.emplace_back( Vec3f{ p.x, 0.f, 0.f } );
+            aMesh.normals.emplace_back( Vec3f{ p.normal.x > 0.f ? 1.f : -1.f, 0.f, 0.f } );
+            continue;
+        }
+
+        Vec2f const n = p.normal / length( p.normal );
+
+        for (std::size_t i = 0; i < aSubdivs; ++i) {
+            aMesh.positions.emplace_back( Vec3f{ p.x, p.radius * cosTable[i], p.radius * sinTable[i] } );
+            aMesh.normals.emplace_back( Vec3f{ n.x, n.y * cosTable[i], n.y * sinTable[i] } );
+        }
+    }
+
+    auto const vertex = [&] (std::size_t j, std::size_t i) {
+        return rowStart[j] + (collapsed[j] ? 0 : std::uint32_t(i % aSubdivs));
+    };
+
+    // Triangles
+    for (std::size_t j = 0; j + 1 < rows; ++j) {
+        for (std::size_t i = 0; i < aSubdivs; ++i) {
+            if (!collapsed[j]) {
+                aMesh.indices.push_back( vertex( j, i ) );
+                aMesh.indices.push_back( vertex( j, i + 1 ) );
+                aMesh.indices.push_back( vertex( j + 1, i ) );
+            }
+
+            if (!collapsed[j + 1]) {
+                aMesh.indices.push_back( vertex( j, i + 1 ) );
+                aMesh.indices.push_back( vertex( j + 1, i + 1 ) );
+                aMesh.indices.push_back( vertex( j + 1, i ) );
+            }
+        }
+    }
+}
+
+void append_cap( SimpleMeshData& aMesh, float aX, bool aFacingPositiveX, std::size_t aSubdivs )
+{
+    if (aSubdivs < 3)
+        return;
+
+    std::vector<float> cosTable, sinTable;
+    make_ring_table_( aSubdivs, cosTable, sinTable );
+
+    Vec3f const normal = { aFacingPositiveX ? 1.f : -1.f, 0.f, 0.f };
+
+    std::uint32_t const center = std::uint32_t(aMesh.positions.size());
+
+    aMesh.positions.emplace_back( Vec3f{ aX, 0.f, 0.f } );
+    aMesh.normals.emplace_back( normal );
+
+    for (std::size_t i = 0; i < aSubdivs; ++i) {
+        aMesh.positions.emplace_back( Vec3f{ aX, cosTable[i], sinTable[i] } );
+        aMesh.normals.emplace_back( normal );
+    }
+
+    for (std::size_t i = 0; i < aSubdivs; ++i) {
+        std::uint32_t const prev = center + 1 + std::uint32_t(i);
+        std::uint32_t const next = center + 1 + std::uint32_t((i + 1) % aSubdivs);
+
+        // Counter-clockwise when seen from the side the cap is facing
+        aMesh.indices.push_back( center );
+        aMesh.indices.push_back( aFacingPositiveX ? prev : next );
+        aMesh.indices.push_back( aFacingPositiveX ? next : prev );
+    }
+}
+
+void append_box( SimpleMeshData& aMesh, std::size_t aSubdivs )
+{
+    if (aSubdivs < 1)
+        return;
+
+    // Each face is a grid spanned by u and v, with u x v pointing outwards
+    struct Face { Vec3f origin, u, v; };
+
+    static Face const faces[] = {
+        { {  0.5f, -0.5f, -0.5f }, { 0.f, 1.f, 0.f }, { 0.f, 0.f, 1.f } },  // Right
+        { { -0.5f, -0.5f, -0.5f }, { 0.f, 0.f, 1.f }, { 0.f, 1.f, 0.f } },  // Left
+        { { -0.5f,  0.5f, -0.5f }, { 0.f, 0.f, 1.f }, { 1.f, 0.f, 0.f } },  // Top
+        { { -0.5f, -0.5f, -0.5f }, { 1.f, 0.f, 0.f }, { 0.f, 0.f, 1.f } },  // Bottom
+        { { -0.5f, -0.5f,  0.5f }, { 1.f, 0.f, 0.f }, { 0.f, 1.f, 0.f } },  // Back
+        { { -0.5f, -0.5f, -0.5f }, { 0.f, 1.f, 0.f }, { 1.f, 0.f, 0.f } }   // Front
+    };
+
+    std::size_t const side = aSubdivs + 1;
+
+    aMesh.positions.reserve( aMesh.positions.size() + 6 * side * side );
+    aMesh.normals.reserve( aMesh.normals.size() + 6 * side * side );
+    aMesh.indices.reserve( aMesh.indices.size() + 6 * 6 * aSubdivs * aSubdivs );
+
+    for (auto const& face : faces) {
+        Vec3f const normal = cross( face.u, face.v );
+        std::uint32_t const base = std::uint32_t(aMesh.positions.size());
+
+        for (std::size_t j = 0; j < side; ++j) {
+            for (std::size_t i = 0; i < side; ++i) {
+                float const s = i / float(aSubdivs);
+                float const t = j / float(aSubdivs);
+
+                aMesh.positions.emplace_back( face.origin + s * face.u + t * face.v );
+                aMesh.normals.emplace_back( normal );
+            }
+        }
+
+        for (std::size_t j = 0; j < aSubdivs; ++j) {
+            for (std::size_t i = 0; i < aSubdivs; ++i) {
+                std::uint32_t const a = base + std::uint32_t(j * side + i);
+                std::uint32_t const b = a + 1;
+                std::uint32_t const c = a + std::uint32_t(side) + 1;
+                std::uint32_t const d = a + std::uint32_t(side);
+
+                aMesh.indices.insert( aMesh.indices.end(), { a, b, c, a, c, d } );
+            }
+        }
+    }
+}
+
+void assign_material( SimpleMeshData& aMesh, Material const& aMaterial )
+{
+    aMesh.materials = { aMaterial };
+    aMesh.material_ids.assign( aMesh.positions.size(), 0 );
+}
+
+void apply_pre_transform( SimpleMeshData& aMesh, Mat44f const& aPreTransform )
+{
+    // Calculate normal matrix
+    Mat33f const N = mat44_to_mat33(transpose(invert(aPreTransform)));
+
+    // Affine transforms (all of ours) don't need the perspective division
+    bool const affine =
+        0.f == aPreTransform(3, 0) && 0.f == aPreTransform(3, 1) &&
+        0.f == aPreTransform(3, 2) && 1.f == aPreTransform(3, 3);
+
+    for (auto& p : aMesh.positions) {
+        Vec4f t = aPreTransform * Vec4f{ p.x, p.y, p.z, 1.f };
+
+        if (!affine)
+            t /= t.w;
+
+        p = Vec3f{ t.x, t.y, t.z };
+    }
+
+    for (auto& n : aMesh.normals)
+        n = normalize( N * n );
+}
@@ -0,0 +1,56 @@
+#ifndef PARAMETRIC_HPP_5A0C3E71_9B2D_4F6A_8E14_2C7D90B3F6A1
+#define PARAMETRIC_HPP_5A0C3E71_9B2D_4F6A_8E14_2C7D90B3F6A1
+
+#include <vector>
+
+#include <cstdlib>
+
+#include "../simple_mesh.hpp"
+
+#include "../../vmlib/vec2.hpp"
+#include "../../vmlib/vec3.hpp"
+#include "../../vmlib/mat44.hpp"
+#include "../../vmlib/mat33.hpp"
+
+/*
+ *  === Parametric surfaces ===
+ *
+ *  All of the procedural shapes are built from the helpers below. They emit
+ *  indexed geometry: every vertex on a ring or grid is generated once and then
+ *  shared between neighbouring triangles through SimpleMeshData::indices.
+ *
+ *  Shapes are built in "shape space" (surfaces of revolution go around the
+ *  x-axis, boxes are a unit cube around the origin) and then moved into place
+ *  with a single call to apply_pre_transform().
+ *
+ *  The subdivision counts are what callers tweak for LOD.
+ */
+
+// One row of a surface of revolution. The normal is given in the
+// (axial, radial) plane and gets rotated with the ring.
+struct ProfilePoint
+{
+    float x;
+    float radius;
+    Vec2f normal;   // { axial, radial }
+};
+
+// Sweeps a profile around the x-axis using aSubdivs segments. Rows with zero
+// radius and a purely axial normal (e.g. the tip of a cone) collapse into a
+// single vertex.
+void append_revolution( SimpleMeshData&, std::vector<ProfilePoint> const&, std::size_t aSubdivs );
+
+// Flat unit disk at x = aX, facing +x or -x.
+void append_cap( SimpleMeshData&, float aX, bool aFacingPositiveX, std::size_t aSubdivs );
+
+// Unit box around the origin. Each face is split into aSubdivs x aSubdivs quads.
+void append_box( SimpleMeshData&, std::size_t aSubdivs );
+
+// Gives every vertex in the mesh the same (single) material.
+void assign_material( SimpleMeshData&, Material const& );
+
+// Transforms all positions and normals in one pass each. The normal matrix is
+// only computed once per mesh.
+void apply_pre_transform( SimpleMeshData&, Mat44f const& );
+
+#endif // PARAMETRIC_HPP_5A0C3E71_9B2D_4F6A_8E14_2C7D90B3F6A1
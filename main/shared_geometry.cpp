@@ -0,0 +1,280 @@
+#include "shared_geometry.hpp"
+
+#include <numeric>
+#include <utility>
+#include <algorithm>
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+#include "../support/error.hpp"
+#include "../support/gl_state.hpp"
+#include "../support/gl_resources.hpp"
+
+namespace
+{
+    // Copies aData into range [aFirst, aFirst + size) of a buffer of Ts
+    template< typename tType >
+    void upload_( GLuint aBuffer, std::size_t aFirst, std::vector<tType> const& aData )
+    {
+        update_buffer( aBuffer, GLintptr(aFirst * sizeof(tType)), GLsizeiptr(aData.size() * sizeof(tType)), aData.data() );
+    }
+
+    // The optional streams of aMesh, or aDefault where it has none
+    template< typename tType >
+    std::vector<tType> or_default_( std::vector<tType> const& aData, std::size_t aCount, tType const& aDefault )
+    {
+        if (aData.size() == aCount)
+            return aData;
+        return std::vector<tType>( aCount, aDefault );
+    }
+}
+
+SharedGeometry::SharedGeometry( std::size_t aVertexCapacity, std::size_t aIndexCapacity, bool aVertexPulling )
+    : mPulling( aVertexPulling )
+    , mVertices( aVertexPulling ? aVertexCapacity * kVertexFloatWords : aVertexCapacity )
+    , mIndices( aIndexCapacity )
+    , mMaterials( aVertexPulling ? kMaxGeometryMaterials : 0 )
+{
+    std::size_t const elementSize[kStreamCount_] = {
+        sizeof(Vec3f),              // Positions
+        sizeof(Vec3f),              // Normals
+        sizeof(Vec2f),              // Texture coordinates
+        sizeof(Material),
+        sizeof(Vec4f),              // Tangents
+        sizeof(float)               // Ambient occlusion
+    };
+
+    // Fixed size from the start. With immutable storage the driver knows it
+    // will never have to move the buffers.
+    auto const allocate = [] (std::size_t aBytes) {
+        return create_buffer( GLsizeiptr(aBytes), nullptr, GL_DYNAMIC_STORAGE_BIT );
+    };
+
+    mVao = create_vertex_array();
+
+    // The element buffer binding is part of the VAO state
+    mIndexBuffer = allocate( aIndexCapacity * sizeof(std::uint32_t) );
+    set_element_buffer( mVao, mIndexBuffer );
+
+    if (mPulling) {
+        // Only the indices come through the VAO
+        mVertexBuffer = allocate( mVertices.capacity() * sizeof(std::uint32_t) );
+        mMaterialBuffer = allocate( mMaterials.capacity() * sizeof(PackedMaterial) );
+        return;
+    }
+
+    for (std::size_t i = 0; i < kStreamCount_; ++i)
+        mBuffers[i] = allocate( aVertexCapacity * elementSize[i] );
+
+    // Same attribute locations as always, see default.vert
+    auto const attribute = [this] (GLuint aBuffer, GLuint aLocation, GLint aSize, GLsizei aStride, std::size_t aOffset) {
+        set_vertex_attribute( mVao, aLocation, aBuffer, GLintptr(aOffset), aStride, aSize, GL_FLOAT );
+    };
+
+    attribute( mBuffers[kPositions_], 0, 3, 0, 0 );
+    attribute( mBuffers[kNormals_], 1, 3, 0, 0 );
+    attribute( mBuffers[kTexcoords_], 2, 2, 0, 0 );
+
+    attribute( mBuffers[kMaterials_], 3, 3, sizeof(Material), offsetof(Material, ambient) );
+    attribute( mBuffers[kMaterials_], 4, 3, sizeof(Material), offsetof(Material, diffuse) );
+    attribute( mBuffers[kMaterials_], 5, 3, sizeof(Material), offsetof(Material, specular) );
+    attribute( mBuffers[kMaterials_], 6, 1, sizeof(Material), offsetof(Material, shininess) );
+    attribute( mBuffers[kMaterials_], 7, 3, sizeof(Material), offsetof(Material, emissive) );
+    attribute( mBuffers[kMaterials_], 8, 1, sizeof(Material), offsetof(Material, illum) );
+
+    attribute( mBuffers[kTangents_], 14, 4, 0, 0 );
+    attribute( mBuffers[kOcclusion_], 15, 1, 0, 0 );
+}
+
+SharedGeometry::~SharedGeometry()
+{
+    if (mVao) {
+        gl_state().forget_vertex_array( mVao );
+        glDeleteVertexArrays( 1, &mVao );
+    }
+    if (mIndexBuffer)
+        glDeleteBuffers( 1, &mIndexBuffer );
+    if (mBuffers[0])
+        glDeleteBuffers( kStreamCount_, mBuffers );
+    if (mVertexBuffer)
+        glDeleteBuffers( 1, &mVertexBuffer );
+    if (mMaterialBuffer)
+        glDeleteBuffers( 1, &mMaterialBuffer );
+}
+
+SharedGeometry::SharedGeometry( SharedGeometry&& aOther ) noexcept
+    : mPulling( aOther.mPulling )
+    , mVertexBuffer( std::exchange( aOther.mVertexBuffer, 0 ) )
+    , mMaterialBuffer( std::exchange( aOther.mMaterialBuffer, 0 ) )
+    , mIndexBuffer( std::exchange( aOther.mIndexBuffer, 0 ) )
+    , mVao( std::exchange( aOther.mVao, 0 ) )
+    , mVertices( std::move(aOther.mVertices) )
+    , mIndices( std::move(aOther.mIndices) )
+    , mMaterials( std::move(aOther.mMaterials) )
+    , mMeshes( std::move(aOther.mMeshes) )
+    , mFreeIds( std::move(aOther.mFreeIds) )
+{
+    std::copy( std::begin(aOther.mBuffers), std::end(aOther.mBuffers), mBuffers );
+    std::fill( std::begin(aOther.mBuffers), std::end(aOther.mBuffers), 0 );
+}
+
+SharedGeometry& SharedGeometry::operator=( SharedGeometry&& aOther ) noexcept
+{
+    std::swap( mPulling, aOther.mPulling );
+    std::swap( mBuffers, aOther.mBuffers );
+    std::swap( mVertexBuffer, aOther.mVertexBuffer );
+    std::swap( mMaterialBuffer, aOther.mMaterialBuffer );
+    std::swap( mIndexBuffer, aOther.mIndexBuffer );
+    std::swap( mVao, aOther.mVao );
+    std::swap( mVertices, aOther.mVertices );
+    std::swap( mIndices, aOther.mIndices );
+    std::swap( mMaterials, aOther.mMaterials );
+    std::swap( mMeshes, aOther.mMeshes );
+    std::swap( mFreeIds, aOther.mFreeIds );
+    return *this;
+}
+
+std::size_t SharedGeometry::add( SimpleMeshData const& aMesh, VertexFormat aFormat )
+{
+    std::size_t const vertexCount = aMesh.positions.size();
+    std::size_t const indexCount = aMesh.indices.empty() ? vertexCount : aMesh.indices.size();
+
+    // Vertex pulling allocates words, and a mesh without materials still
+    // gets a default one to point at
+    std::size_t const vertexSize = mPulling ? vertexCount * vertex_stride( aFormat ) : vertexCount;
+    std::size_t const materialCount = mPulling ? std::max<std::size_t>( aMesh.materials.size(), 1 ) : 0;
+
+    std::size_t firstVertex = 0, firstIndex = 0, firstMaterial = 0;
+    if (!mVertices.allocate( vertexSize, firstVertex ))
+        throw Error( "SharedGeometry: no room for %zu vertices", vertexCount );
+
+    if (!mIndices.allocate( indexCount, firstIndex )) {
+        mVertices.free( firstVertex, vertexSize );
+        throw Error( "SharedGeometry: no room for %zu indices", indexCount );
+    }
+
+    if (mPulling && !mMaterials.allocate( materialCount, firstMaterial )) {
+        mVertices.free( firstVertex, vertexSize );
+        mIndices.free( firstIndex, indexCount );
+        throw Error( "SharedGeometry: no room for %zu materials", materialCount );
+    }
+
+    if (mPulling)
+        upload_pulled_( aMesh, aFormat, firstVertex, firstMaterial );
+    else
+        upload_attributes_( aMesh, firstVertex );
+
+    if (aMesh.indices.empty()) {
+        std::vector<std::uint32_t> indices( vertexCount );
+        std::iota( indices.begin(), indices.end(), 0u );
+        upload_( mIndexBuffer, firstIndex, indices );
+    }
+    else {
+        upload_( mIndexBuffer, firstIndex, aMesh.indices );
+    }
+
+    Mesh_ mesh;
+    mesh.range.firstIndex = GLuint(firstIndex);
+    mesh.range.indexCount = GLsizei(indexCount);
+    mesh.range.baseVertex = mPulling ? 0 : GLint(firstVertex);
+    mesh.range.vertexOffset = mPulling ? GLuint(firstVertex) : 0;
+    mesh.range.format = mPulling ? aFormat : kVertexFloat;
+    mesh.vertexFirst = firstVertex;
+    mesh.vertexSize = vertexSize;
+    mesh.materialFirst = firstMaterial;
+    mesh.materialCount = materialCount;
+    mesh.live = true;
+
+    if (mFreeIds.empty()) {
+        mMeshes.emplace_back( mesh );
+        return mMeshes.size() - 1;
+    }
+
+    std::size_t const id = mFreeIds.back();
+    mFreeIds.pop_back();
+    mMeshes[id] = mesh;
+    return id;
+}
+
+void SharedGeometry::remove( std::size_t aId )
+{
+    assert( aId < mMeshes.size() && mMeshes[aId].live );
+
+    Mesh_& mesh = mMeshes[aId];
+    mVertices.free( mesh.vertexFirst, mesh.vertexSize );
+    mIndices.free( mesh.range.firstIndex, std::size_t(mesh.range.indexCount) );
+    mMaterials.free( mesh.materialFirst, mesh.materialCount );
+
+    mesh.live = false;
+    mFreeIds.emplace_back( aId );
+}
+
+void SharedGeometry::bind_storage() const
+{
+    if (!mPulling)
+        return;
+
+    glBindBufferBase( GL_SHADER_STORAGE_BUFFER, kVertexBufferBinding, mVertexBuffer );
+    glBindBufferBase( GL_SHADER_STORAGE_BUFFER, kMaterialBufferBinding, mMaterialBuffer );
+}
+
+SharedGeometryStats SharedGeometry::stats() const noexcept
+{
+    SharedGeometryStats ret;
+    ret.meshes = mMeshes.size() - mFreeIds.size();
+    ret.pulled = mPulling;
+    ret.vertices = mVertices.stats();
+    ret.indices = mIndices.stats();
+    return ret;
+}
+
+void SharedGeometry::upload_attributes_( SimpleMeshData const& aMesh, std::size_t aFirstVertex )
+{
+    std::size_t const vertexCount = aMesh.positions.size();
+
+    // One material per vertex, like the attributes expect
+    std::vector<Material> materials( vertexCount, Material{} );
+    for (std::size_t i = 0; i < std::min( vertexCount, aMesh.material_ids.size() ); ++i)
+        materials[i] = aMesh.materials[aMesh.material_ids[i]];
+
+    upload_( mBuffers[kPositions_], aFirstVertex, aMesh.positions );
+    upload_( mBuffers[kNormals_], aFirstVertex, or_default_( aMesh.normals, vertexCount, Vec3f{ 0.f, 0.f, 0.f } ) );
+    upload_( mBuffers[kTexcoords_], aFirstVertex, or_default_( aMesh.texcoords, vertexCount, Vec2f{ 0.f, 0.f } ) );
+    upload_( mBuffers[kMaterials_], aFirstVertex, materials );
+    upload_( mBuffers[kTangents_], aFirstVertex, or_default_( aMesh.tangents, vertexCount, Vec4f{ 0.f, 0.f, 0.f, 1.f } ) );
+    upload_( mBuffers[kOcclusion_], aFirstVertex, or_default_( aMesh.occlusion, vertexCount, 1.f ) );
+}
+
+void SharedGeometry::upload_pulled_( SimpleMeshData const& aMesh, VertexFormat aFormat, std::size_t aFirstWord, std::size_t aFirstMaterial )
+{
+    std::vector<std::uint32_t> words;
+    pack_vertices( aMesh, aFormat, std::uint32_t(aFirstMaterial), words );
+
+    std::vector<PackedMaterial> materials;
+    for (auto const& material : aMesh.materials)
+        materials.emplace_back( pack_material( material ) );
+    if (materials.empty())
+        materials.emplace_back( pack_material( Material{} ) );
+
+    upload_( mVertexBuffer, aFirstWord, words );
+    upload_( mMaterialBuffer, aFirstMaterial, materials );
+}
+
+void shared_geometry_capacity(
+    std::vector<SimpleMeshData const*> const& aMeshes,
+    float aHeadroom,
+    std::size_t& aVertexCapacity,
+    std::size_t& aIndexCapacity
+)
+{
+    std::size_t vertices = 0, indices = 0;
+    for (auto const* mesh : aMeshes) {
+        vertices += mesh->positions.size();
+        indices += mesh->indices.empty() ? mesh->positions.size() : mesh->indices.size();
+    }
+
+    aVertexCapacity = vertices + std::size_t(float(vertices) * aHeadroom);
+    aIndexCapacity = indices + std::size_t(float(indices) * aHeadroom);
+}
@@ -0,0 +1,150 @@
+#ifndef SHARED_GEOMETRY_HPP_D4A17C93_5B2E_4F08_96C1_E38F0B7A5D26
+#define SHARED_GEOMETRY_HPP_D4A17C93_5B2E_4F08_96C1_E38F0B7A5D26
+
+#include <glad/glad.h>
+
+#include <vector>
+
+#include <cstdlib>
+
+#include "simple_mesh.hpp"
+#include "vertex_format.hpp"
+#include "range_allocator.hpp"
+
+/*
+ *  === Shared geometry / mesh mega-buffer ===
+ *  https://www.khronos.org/opengl/wiki/Buffer_Object#Immutable_Storage
+ *  https://www.khronos.org/opengl/wiki/Vertex_Rendering#Base_Index
+ *
+ *  All meshes live in a few big buffers: one per vertex attribute stream
+ *  (positions, normals, ...) and one for the indices. Their sizes are fixed
+ *  up front (immutable storage where GL 4.4 is available), and each mesh
+ *  gets a range of vertices and a range of indices from a RangeAllocator.
+ *  Removing a mesh gives its ranges back for the next one.
+ *
+ *  Indices stay relative to their mesh and draws add the mesh's base vertex,
+ *  so one VAO serves every mesh and switching meshes costs nothing.
+ *
+ *  Every vertex has every attribute. Meshes without tangents or ambient
+ *  occlusion get the same defaults that concatenate() uses.
+ *
+ *  With vertex pulling (GL 4.3) there are no attribute streams. The vertices
+ *  go into one storage buffer of 32-bit words instead, each mesh in the
+ *  format it was added with (see vertex_format.hpp), and the materials into
+ *  a second one. The VAO then only holds the index buffer. Every mesh has a
+ *  base vertex of 0; the shader finds its vertices through the draw record's
+ *  vertexOffset, see make_draw_record().
+ */
+
+// Shader storage buffer bindings for vertex pulling (kDrawRecordBinding, see
+// draw_batch.hpp, is 3)
+constexpr GLuint kVertexBufferBinding = 4;
+constexpr GLuint kMaterialBufferBinding = 5;
+
+// Room in the material table, for vertex pulling
+constexpr std::size_t kMaxGeometryMaterials = 1024;
+
+// A mesh's place in the shared buffers
+struct MeshRange
+{
+    GLuint firstIndex;
+    GLsizei indexCount;
+    GLint baseVertex;
+
+    // Vertex pulling only: the first word of the mesh's vertices and their
+    // format
+    GLuint vertexOffset;
+    VertexFormat format;
+};
+
+struct SharedGeometryStats
+{
+    std::size_t meshes = 0;
+    bool pulled = false;
+
+    RangeAllocatorStats vertices;       // In 32-bit words when pulled
+    RangeAllocatorStats indices;
+};
+
+class SharedGeometry
+{
+public:
+    SharedGeometry() = default;
+    // With aVertexPulling, there is room for aVertexCapacity vertices in the
+    // largest format
+    SharedGeometry( std::size_t aVertexCapacity, std::size_t aIndexCapacity, bool aVertexPulling = false );
+    ~SharedGeometry();
+
+    SharedGeometry( SharedGeometry const& ) = delete;
+    SharedGeometry& operator=( SharedGeometry const& ) = delete;
+
+    SharedGeometry( SharedGeometry&& ) noexcept;
+    SharedGeometry& operator=( SharedGeometry&& ) noexcept;
+
+    // Uploads a mesh and returns its id. Meshes without indices get trivial
+    // ones. Throws if there isn't enough room left. aFormat only matters with
+    // vertex pulling.
+    std::size_t add( SimpleMeshData const&, VertexFormat aFormat = kVertexFloat );
+
+    // Frees the mesh's ranges. The id may be handed out again.
+    void remove( std::size_t aId );
+
+    // Binds the vertex and material buffers, with vertex pulling
+    void bind_storage() const;
+
+    bool vertex_pulling() const noexcept { return mPulling; }
+
+    GLuint vao() const noexcept { return mVao; }
+    MeshRange const& range( std::size_t aId ) const { return mMeshes[aId].range; }
+
+    SharedGeometryStats stats() const noexcept;
+
+private:
+    enum Stream_
+    {
+        kPositions_,
+        kNormals_,
+        kTexcoords_,
+        kMaterials_,
+        kTangents_,
+        kOcclusion_,
+        kStreamCount_
+    };
+
+    struct Mesh_
+    {
+        MeshRange range;
+        std::size_t vertexFirst, vertexSize;        // In mVertices' units
+        std::size_t materialFirst, materialCount;   // Vertex pulling only
+        bool live;
+    };
+
+    void upload_attributes_( SimpleMeshData const&, std::size_t aFirstVertex );
+    void upload_pulled_( SimpleMeshData const&, VertexFormat, std::size_t aFirstWord, std::size_t aFirstMaterial );
+
+    bool mPulling = false;
+
+    GLuint mBuffers[kStreamCount_] = {};
+    GLuint mVertexBuffer = 0;           // Vertex pulling only
+    GLuint mMaterialBuffer = 0;         // Vertex pulling only
+    GLuint mIndexBuffer = 0;
+    GLuint mVao = 0;
+
+    RangeAllocator mVertices;
+    RangeAllocator mIndices;
+    RangeAllocator mMaterials;
+
+    std::vector<Mesh_> mMeshes;
+    std::vector<std::size_t> mFreeIds;
+};
+
+// Vertex and index counts that will hold all of aMeshes, plus aHeadroom
+// (e.g. 0.25 = 25%) for meshes added later
+void shared_geometry_capacity(
+    std::vector<SimpleMeshData const*> const& aMeshes,
+    float aHeadroom,
+    std::size_t& aVertexCapacity,
+    std::size_t& aIndexCapacity
+);
+
+#endif // SHARED_GEOMETRY_HPP_D4A17C93_5B2E_4F08_96C1_E38F0B7A5D26
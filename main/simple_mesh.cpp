@@ -1,7 +1,52 @@
 #include "simple_mesh.hpp"
 
+#include <numeric>
+
+#include <cmath>
+#include <cstddef>
+
 SimpleMeshData concatenate( SimpleMeshData aM, SimpleMeshData const& aN )
 {
+    // Indices. If only one of the meshes is indexed, the other one gets
+    // trivial (0, 1, 2, ...) indices so the result stays consistent.
+    std::uint32_t const indexOffset = std::uint32_t(aM.positions.size());
+
+    if (!aM.indices.empty() || !aN.indices.empty()) {
+        if (aM.indices.empty()) {
+            aM.indices.resize( aM.positions.size() );
+            std::iota( aM.indices.begin(), aM.indices.end(), 0u );
+        }
+
+        if (aN.indices.empty()) {
+            for (std::size_t i = 0; i < aN.positions.size(); ++i)
+                aM.indices.push_back( indexOffset + std::uint32_t(i) );
+        }
+        else {
+            for (auto const idx : aN.indices)
+                aM.indices.push_back( indexOffset + idx );
+        }
+    }
+
+    // Tangents. Vertices without one get a zero tangent.
+    if (!aM.tangents.empty() || !aN.tangents.empty()) {
+        aM.tangents.resize( aM.positions.size(), Vec4f{ 0.f, 0.f, 0.f, 1.f } );
+
+        if (aN.tangents.empty())
+            aM.tangents.resize( aM.positions.size() + aN.positions.size(), Vec4f{ 0.f, 0.f, 0.f, 1.f } );
+        else
+            aM.tangents.insert( aM.tangents.end(), aN.tangents.begin(), aN.tangents.end() );
+    }
+
+    // Ambient occlusion. Vertices without it are unoccluded.
+    if (!aM.occlusion.empty() || !aN.occlusion.empty()) {
+        aM.occlusion.resize( aM.positions.size(), 1.f );
+
+        if (aN.occlusion.empty())
+            aM.occlusion.resize( aM.positions.size() + aN.positions.size(), 1.f );
+        else
+            aM.occlusion.insert( aM.occlusion.end(), aN.occlusion.begin(), aN.occlusion.end() );
+    }
+
 	aM.positions.insert( aM.positions.end(), aN.positions.begin(), aN.positions.end() );
     aM.texcoords.insert( aM.texcoords.end(), aN.texcoords.begin(), aN.texcoords.end() );
     aM.normals.insert( aM.normals.end(), aN.normals.begin(), aN.normals.end() );
@@ -24,175 +69,68 @@ SimpleMeshData concatenate( SimpleMeshData aM, SimpleMeshData const& aN )
 	return aM;
 }
 
+GLsizei draw_count( SimpleMeshData const& aMeshData )
+{
+    if (!aMeshData.indices.empty())
+        return GLsizei(aMeshData.indices.size());
 
+    return GLsizei(aMeshData.positions.size());
+}
 
-GLuint create_vao( SimpleMeshData &aMeshData )
+void compute_tangents( SimpleMeshData& aMeshData )
 {
-    // Add defaults to the mesh if needed
-    if (aMeshData.texcoords.empty()) {
-        std::vector<Vec2f> defaultTexcoords(aMeshData.positions.size(), Vec2f{0.0f, 0.0f});
-        aMeshData.texcoords = std::move(defaultTexcoords);
-    }
+    // Lengyel, "Computing Tangent Space Basis Vectors for an Arbitrary Mesh"
+    // https://terathon.com/blog/tangent-space.html
+    std::size_t const count = aMeshData.positions.size();
 
-    // Generate object buffers for positions
-    GLuint positionVBO = 0;
-    glGenBuffers( 1, &positionVBO );
+    if (aMeshData.normals.size() != count || aMeshData.texcoords.size() != count)
+        return;
 
-    glBindBuffer( GL_ARRAY_BUFFER, positionVBO );
-    glBufferData( 
-        GL_ARRAY_BUFFER, 
-        aMeshData.positions.size() * sizeof(Vec3f),
-        aMeshData.positions.data(),     // This gives us the raw pointer to underlying data
-        GL_STATIC_DRAW 
-    );
+    std::vector<Vec3f> tan( count, Vec3f{ 0.f, 0.f, 0.f } );
+    std::vector<Vec3f> bitan( count, Vec3f{ 0.f, 0.f, 0.f } );
 
-    // Do the same for colors
-    GLuint texCoordVBO = 0;
-    glGenBuffers( 1, &texCoordVBO );
+    std::size_t const indexCount = aMeshData.indices.empty() ? count : aMeshData.indices.size();
+    auto const index = [&] (std::size_t i) {
+        return aMeshData.indices.empty() ? std::uint32_t(i) : aMeshData.indices[i];
+    };
 
-    glBindBuffer( GL_ARRAY_BUFFER, texCoordVBO );
-    glBufferData( 
-        GL_ARRAY_BUFFER, 
-        aMeshData.texcoords.size() * sizeof(Vec2f),
-        aMeshData.texcoords.data(),
-        GL_STATIC_DRAW 
-    );
+    for (std::size_t i = 0; i + 2 < indexCount; i += 3) {
+        std::uint32_t const i0 = index( i ), i1 = index( i+1 ), i2 = index( i+2 );
 
-    // Normals
-    GLuint normalsVBO = 0;
-    glGenBuffers( 1, &normalsVBO );
+        Vec3f const e1 = aMeshData.positions[i1] - aMeshData.positions[i0];
+        Vec3f const e2 = aMeshData.positions[i2] - aMeshData.positions[i0];
+        Vec2f const d1 = aMeshData.texcoords[i1] - aMeshData.texcoords[i0];
+        Vec2f const d2 = aMeshData.texcoords[i2] - aMeshData.texcoords[i0];
 
-    glBindBuffer( GL_ARRAY_BUFFER, normalsVBO );
-    glBufferData(
-        GL_ARRAY_BUFFER,
-        aMeshData.normals.size() * sizeof(Vec3f),
-        aMeshData.normals.data(),
-        GL_STATIC_DRAW
-    );
+        float const det = d1.x * d2.y - d2.x * d1.y;
+        if (0.f == det)
+            continue;
 
-    // Material properties 
-    GLuint materialVBO = 0;
-    glGenBuffers( 1, &materialVBO );
+        float const r = 1.f / det;
+        Vec3f const t = (e1 * d2.y - e2 * d1.y) * r;
+        Vec3f const b = (e2 * d1.x - e1 * d2.x) * r;
 
-    // get the material properties into a single array for each vertex
-    std::vector<Material> materials(aMeshData.material_ids.size());
-    for (std::size_t i = 0; i < aMeshData.material_ids.size(); ++i) {
-        // Copy the material for each vertex
-        std::size_t material_id = aMeshData.material_ids[i];
-        materials[i] = aMeshData.materials[material_id];
+        for (auto const v : { i0, i1, i2 }) {
+            tan[v] += t;
+            bitan[v] += b;
+        }
     }
 
-    glBindBuffer( GL_ARRAY_BUFFER, materialVBO );
-    glBufferData(
-        GL_ARRAY_BUFFER,
-        materials.size() * sizeof(Material),
-        materials.data(),
-        GL_STATIC_DRAW
-    );
-
-    // Generate VAO, define attributes
-    GLuint vao = 0;
-    glGenVertexArrays( 1, &vao );
-    glBindVertexArray( vao );
-
-    // Add positions
-    glBindBuffer( GL_ARRAY_BUFFER, positionVBO );
-    glVertexAttribPointer(
-        0,
-        3, GL_FLOAT, GL_FALSE,
-        0,
-        0
-    );
-    glEnableVertexAttribArray( 0 );
-
-    // Add normals
-    glBindBuffer( GL_ARRAY_BUFFER, normalsVBO );
-    glVertexAttribPointer(
-        1,
-        3, GL_FLOAT, GL_FALSE,
-        0,
-        0
-    );
-    glEnableVertexAttribArray( 1 );
-
-    // Texture coordinates
-    glBindBuffer( GL_ARRAY_BUFFER, texCoordVBO );
-    glVertexAttribPointer(
-        2,
-        2, GL_FLOAT, GL_FALSE,
-        0,
-        nullptr
-    );
-    glEnableVertexAttribArray( 2 );
-
-
-    // === Materials ===
-    // Then we add each of the material attributes, using respective offsets
-    glBindBuffer( GL_ARRAY_BUFFER, materialVBO );
-
-    glVertexAttribPointer(
-        3,
-        3, GL_FLOAT, GL_FALSE,
-        sizeof(Material),                   // Stride
-        (void*)offsetof(Material, ambient)  // The offset of ambient within Material
-    );
-    glEnableVertexAttribArray( 3 );
-
-    // Diffuse
-    glVertexAttribPointer(
-        4,
-        3, GL_FLOAT, GL_FALSE,
-        sizeof(Material),
-        (void*)offsetof(Material, diffuse)
-    );
-    glEnableVertexAttribArray( 4 );
-
-    // Specular
-    glVertexAttribPointer(
-        5,
-        3, GL_FLOAT, GL_FALSE,
-        sizeof(Material),
-        (void*)offsetof(Material, specular)
-    );
-    glEnableVertexAttribArray( 5 );
-
-    // Shininess
-    glVertexAttribPointer(
-        6,
-        1, GL_FLOAT, GL_FALSE,
-        sizeof(Material),
-        (void*)offsetof(Material, shininess)
-    );
-    glEnableVertexAttribArray( 6 );
-
-    // Emissive
-    glVertexAttribPointer(
-        7,
-        3, GL_FLOAT, GL_FALSE,
-        sizeof(Material),
-        (void*)offsetof(Material, emissive)
-    );
-    glEnableVertexAttribArray( 7 );
-
-    // Illum
-    glVertexAttribPointer(
-        8,
-        1, GL_FLOAT, GL_FALSE,
-        sizeof(Material),
-        (void*)offsetof(Material, illum)
-    );
-    glEnableVertexAttribArray( 8 );
+    aMeshData.tangents.resize( count );
 
-    // Cleanup
-    glBindVertexArray( 0 );
-    glBindBuffer( GL_ARRAY_BUFFER, 0 );
+    for (std::size_t v = 0; v < count; ++v) {
+        Vec3f const& n = aMeshData.normals[v];
 
-    // Delete buffers
-    glDeleteBuffers(1, &positionVBO);
-    glDeleteBuffers(1, &texCoordVBO);
-    glDeleteBuffers(1, &normalsVBO);
-    glDeleteBuffers(1, &materialVBO);
+        // Gram-Schmidt against the normal, with a fallback for vertices that
+        // had no usable UVs
+        Vec3f t = tan[v] - n * dot( n, tan[v] );
+        if (dot( t, t ) < 1e-12f) {
+            Vec3f const axis = std::abs( n.x ) < 0.9f ? Vec3f{ 1.f, 0.f, 0.f } : Vec3f{ 0.f, 1.f, 0.f };
+            t = cross( axis, n );
+        }
+        t = normalize( t );
 
-    return vao;
+        float const w = dot( cross( n, t ), bitan[v] ) < 0.f ? -1.f : 1.f;
+        aMeshData.tangents[v] = Vec4f{ t.x, t.y, t.z, w };
+    }
 }
-
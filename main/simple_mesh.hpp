@@ -6,8 +6,11 @@
 #include <vector>
 #include <algorithm>
 
+#include <cstdint>
+
 #include "../vmlib/vec2.hpp"
 #include "../vmlib/vec3.hpp"
+#include "../vmlib/vec4.hpp"
 
 struct Material {
 	Vec3f ambient;		// Ka
@@ -25,10 +28,26 @@ struct SimpleMeshData
 	std::vector<Vec3f> normals;
 	std::vector<int> material_ids;
 	std::vector<Material> materials;
+
+	// Optional. Empty means the mesh is a plain triangle soup (e.g. from an
+	// OBJ file); otherwise every three indices form a triangle.
+	std::vector<std::uint32_t> indices;
+
+	// Optional. Per-vertex tangent (xyz) and bitangent sign (w), for normal
+	// mapping. See compute_tangents().
+	std::vector<Vec4f> tangents;
+
+	// Optional. Per-vertex ambient occlusion, 1 = nothing in the way. See
+	// bake_vertex_ao().
+	std::vector<float> occlusion;
 };
 
 SimpleMeshData concatenate( SimpleMeshData, SimpleMeshData const& );
 
-GLuint create_vao( SimpleMeshData& );
+// Number of vertices to pass to glDrawArrays/glDrawElements
+GLsizei draw_count( SimpleMeshData const& );
+
+// Fills in tangents from the texture coordinates. Needs normals and texcoords.
+void compute_tangents( SimpleMeshData& );
 
 #endif // SIMPLE_MESH_HPP_C6B749D6_C83B_434C_9E58_F05FC27FEFC9
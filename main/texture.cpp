@@ -6,6 +6,7 @@
 #include <stb_image.h>
 
 #include "../support/error.hpp"
+#include "../support/gl_resources.hpp"
 
 GLuint load_texture_2d( char const* aPath )
 {
@@ -21,28 +22,25 @@ GLuint load_texture_2d( char const* aPath )
 	if( !ptr )
 		throw Error( "Unable to load image ’%s’\n", aPath );
 
-	// Generate texture object and initialize texture with image
+	// Generate texture object with room for the mipmap hierarchy, and
+	// initialize the first level with the image
+	GLuint tex = create_texture( GL_TEXTURE_2D, GL_SRGB8_ALPHA8, w, h, 1, mip_levels( w, h ) );
 
-	GLuint tex = 0;
-	glGenTextures( 1, &tex );
-
-	glBindTexture( GL_TEXTURE_2D, tex );
-
-	glTexImage2D( GL_TEXTURE_2D, 0, GL_SRGB8_ALPHA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, ptr );
+	upload_texture( tex, GL_TEXTURE_2D, w, h, 1, GL_RGBA, GL_UNSIGNED_BYTE, ptr );
 
 	stbi_image_free( ptr );
 
 	// Generate mipmap hierarchy
-	glGenerateMipmap( GL_TEXTURE_2D );
+	generate_texture_mipmaps( tex, GL_TEXTURE_2D );
 
 	// Configure texture
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+	set_texture_parameter( tex, GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+	set_texture_parameter( tex, GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
 
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+	set_texture_parameter( tex, GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+	set_texture_parameter( tex, GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
 
-	glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY, 6.f );
+	set_texture_parameter( tex, GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY, 6.f );
 
 	return tex;
 }
\ No newline at end of file
@@ -0,0 +1,114 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+namespace
+{
+    // Set on the pool's threads, and on a calling thread while it runs a
+    // loop, so that nested loops don't wait on themselves
+    thread_local bool tInsideLoop_ = false;
+}
+
+ThreadPool::ThreadPool( std::size_t aThreadCount )
+{
+    std::size_t const count = thread_count( aThreadCount );
+
+    mWorkers.reserve( count - 1 );
+    for (std::size_t i = 1; i < count; ++i)
+        mWorkers.emplace_back( [this, i] { worker_( i - 1 ); } );
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock( mMutex );
+        mStop = true;
+    }
+    mWake.notify_all();
+
+    for (auto& t : mWorkers)
+        t.join();
+}
+
+void ThreadPool::run_( std::size_t aCount, std::size_t aMaxThreads, Item_ aItem, void* aContext )
+{
+    if (0 == aCount)
+        return;
+
+    std::size_t const threads = std::min( { size(), aMaxThreads ? aMaxThreads : size(), aCount } );
+
+    if (tInsideLoop_ || threads <= 1) {
+        for (std::size_t i = 0; i < aCount; ++i)
+            aItem( aContext, i );
+        return;
+    }
+
+    std::lock_guard<std::mutex> loop( mLoopMutex );
+
+    {
+        std::lock_guard<std::mutex> lock( mMutex );
+        mItem = aItem;
+        mContext = aContext;
+        mCount = aCount;
+        mNext = 0;
+
+        // Counted up front, so the loop can't be over before a worker that
+        // takes part has even woken up
+        mParticipants = threads - 1;
+        mBusy = mParticipants;
+
+        ++mGeneration;
+    }
+    mWake.notify_all();
+
+    tInsideLoop_ = true;
+    work_();
+    tInsideLoop_ = false;
+
+    std::unique_lock<std::mutex> lock( mMutex );
+    mDone.wait( lock, [this] { return 0 == mBusy; } );
+}
+
+void ThreadPool::work_()
+{
+    for (std::size_t i; (i = mNext.fetch_add( 1 )) < mCount; )
+        mItem( mContext, i );
+}
+
+void ThreadPool::worker_( std::size_t aIndex )
+{
+    tInsideLoop_ = true;
+
+    std::size_t seen = 0;
+
+    std::unique_lock<std::mutex> lock( mMutex );
+    for (;;) {
+        mWake.wait( lock, [&] { return mStop || seen != mGeneration; } );
+        if (mStop)
+            return;
+
+        seen = mGeneration;
+        if (aIndex >= mParticipants)
+            continue;
+
+        lock.unlock();
+        work_();
+        lock.lock();
+
+        if (0 == --mBusy)
+            mDone.notify_one();
+    }
+}
+
+ThreadPool& shared_thread_pool()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+std::size_t thread_count( std::size_t aThreadCount ) noexcept
+{
+    if (0 == aThreadCount)
+        aThreadCount = std::max( 1u, std::thread::hardware_concurrency() );
+    return aThreadCount;
+}
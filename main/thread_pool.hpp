@@ -0,0 +1,100 @@
+#ifndef THREAD_POOL_HPP_2D8F4B16_C3A7_4E59_B0E1_7A94C25D6F38
+#define THREAD_POOL_HPP_2D8F4B16_C3A7_4E59_B0E1_7A94C25D6F38
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <utility>
+#include <type_traits>
+#include <condition_variable>
+
+#include <cstdlib>
+
+/*
+ *  === Thread pool ===
+ *  https://en.cppreference.com/w/cpp/thread/condition_variable
+ *
+ *  The bakers and builders (BVH, chunks, normals, normal maps, lightmap,
+ *  ambient occlusion) all split their work into independent items: rows,
+ *  batches, chunks, subtrees. parallel_for() runs such a loop on a set of
+ *  worker threads that are started once and then wait for the next loop,
+ *  instead of every loop starting and joining its own threads.
+ *
+ *  Items are handed out one at a time from a shared counter, so items that
+ *  take longer than others balance out by themselves. The calling thread
+ *  works on the loop too, and returns once every item is done.
+ *
+ *  A parallel_for() inside of another one (from an item) runs on the thread
+ *  that calls it, as every other thread is busy with the outer loop anyway.
+ */
+
+class ThreadPool final
+{
+public:
+    // aThreadCount counts the calling thread; 0 uses all hardware threads
+    explicit ThreadPool( std::size_t aThreadCount = 0 );
+    ~ThreadPool();
+
+    ThreadPool( ThreadPool const& ) = delete;
+    ThreadPool& operator= (ThreadPool const&) = delete;
+
+    // Threads that take part in a loop, the calling one included
+    std::size_t size() const noexcept { return mWorkers.size() + 1; }
+
+    // Calls aFunc( i ) for every i in [0, aCount), on at most aMaxThreads
+    // threads (0 = all of them)
+    template< typename tFunc >
+    void parallel_for( std::size_t aCount, std::size_t aMaxThreads, tFunc&& aFunc );
+
+private:
+    using Item_ = void (*)( void*, std::size_t );
+
+    void run_( std::size_t aCount, std::size_t aMaxThreads, Item_, void* aContext );
+    void work_();
+    void worker_( std::size_t aIndex );
+
+private:
+    std::vector<std::thread> mWorkers;
+
+    std::mutex mLoopMutex;      // One loop at a time
+
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    std::condition_variable mDone;
+
+    std::size_t mGeneration = 0;
+    std::size_t mParticipants = 0;  // Workers that take part in the current loop
+    std::size_t mBusy = 0;          // ... and haven't finished yet
+    bool mStop = false;
+
+    Item_ mItem = nullptr;
+    void* mContext = nullptr;
+    std::size_t mCount = 0;
+    std::atomic<std::size_t> mNext{ 0 };
+};
+
+// The pool shared by everything in main/, started on first use
+ThreadPool& shared_thread_pool();
+
+// aThreadCount, or the number of hardware threads for 0
+std::size_t thread_count( std::size_t aThreadCount ) noexcept;
+
+// shared_thread_pool().parallel_for(). aThreadCount = 0 uses all threads.
+template< typename tFunc >
+void parallel_for( std::size_t aCount, std::size_t aThreadCount, tFunc&& aFunc )
+{
+    shared_thread_pool().parallel_for( aCount, aThreadCount, std::forward<tFunc>( aFunc ) );
+}
+
+template< typename tFunc >
+void ThreadPool::parallel_for( std::size_t aCount, std::size_t aMaxThreads, tFunc&& aFunc )
+{
+    auto const item = [] (void* aContext, std::size_t aIndex) {
+        (*static_cast<std::remove_reference_t<tFunc>*>( aContext ))( aIndex );
+    };
+
+    run_( aCount, aMaxThreads, item, const_cast<void*>( static_cast<void const*>( &aFunc ) ) );
+}
+
+#endif // THREAD_POOL_HPP_2D8F4B16_C3A7_4E59_B0E1_7A94C25D6F38
@@ -0,0 +1,91 @@
+#include "uniform_blocks.hpp"
+
+#include <utility>
+#include <algorithm>
+
+#include <cstring>
+
+#include "../support/gl_resources.hpp"
+
+UniformBlockBuffer::UniformBlockBuffer( std::size_t aBlockSize, std::size_t aCount )
+    : mBlockSize( aBlockSize )
+    , mCount( aCount )
+{
+    GLint alignment = 0;
+    glGetIntegerv( GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment );
+
+    std::size_t const align = std::size_t(std::max( alignment, 1 ));
+    mStride = (aBlockSize + align - 1) / align * align;
+
+    mStaging.resize( mStride * aCount );
+
+    mBuffer = create_buffer( GLsizeiptr(mStaging.size()), nullptr, GL_DYNAMIC_STORAGE_BIT );
+}
+
+UniformBlockBuffer::~UniformBlockBuffer()
+{
+    if (mBuffer)
+        glDeleteBuffers( 1, &mBuffer );
+}
+
+UniformBlockBuffer::UniformBlockBuffer( UniformBlockBuffer&& aOther ) noexcept
+    : mBuffer( std::exchange( aOther.mBuffer, 0 ) )
+    , mBlockSize( std::exchange( aOther.mBlockSize, 0 ) )
+    , mStride( std::exchange( aOther.mStride, 0 ) )
+    , mCount( std::exchange( aOther.mCount, 0 ) )
+    , mStaging( std::move(aOther.mStaging) )
+{}
+
+UniformBlockBuffer& UniformBlockBuffer::operator=( UniformBlockBuffer&& aOther ) noexcept
+{
+    std::swap( mBuffer, aOther.mBuffer );
+    std::swap( mBlockSize, aOther.mBlockSize );
+    std::swap( mStride, aOther.mStride );
+    std::swap( mCount, aOther.mCount );
+    std::swap( mStaging, aOther.mStaging );
+    return *this;
+}
+
+void UniformBlockBuffer::update( void const* aBlocks, std::size_t aCount )
+{
+    aCount = std::min( aCount, mCount );
+    if (0 == aCount)
+        return;
+
+    // Spread the blocks out to their aligned slots, then upload the lot
+    auto const* src = static_cast<std::uint8_t const*>( aBlocks );
+    for (std::size_t i = 0; i < aCount; ++i)
+        std::memcpy( mStaging.data() + i * mStride, src + i * mBlockSize, mBlockSize );
+
+    update_buffer( mBuffer, 0, GLsizeiptr((aCount - 1) * mStride + mBlockSize), mStaging.data() );
+}
+
+void UniformBlockBuffer::bind( GLuint aBinding, std::size_t aIndex ) const
+{
+    glBindBufferRange( GL_UNIFORM_BUFFER, aBinding, mBuffer, GLintptr(aIndex * mStride), GLsizeiptr(mBlockSize) );
+}
+
+void set_view( ViewUniforms& aBlock, std::size_t aIndex, Mat44f const& aProjection, Mat44f const& aWorld2Camera )
+{
+    Mat44f const camera2world = invert( aWorld2Camera );
+
+    aBlock.projCamera[aIndex] = aProjection * aWorld2Camera;
+    aBlock.cameraPos[aIndex] = { camera2world(0, 3), camera2world(1, 3), camera2world(2, 3), 1.f };
+
+    // The camera's axes in world space are the rows of its rotation
+    Vec3f const right = normalize( Vec3f{ aWorld2Camera(0, 0), aWorld2Camera(0, 1), aWorld2Camera(0, 2) } );
+    Vec3f const up = normalize( Vec3f{ aWorld2Camera(1, 0), aWorld2Camera(1, 1), aWorld2Camera(1, 2) } );
+    aBlock.cameraRight[aIndex] = { right.x, right.y, right.z, 0.f };
+    aBlock.cameraUp[aIndex] = { up.x, up.y, up.z, 0.f };
+}
+
+bool bind_uniform_block( GLuint aProgram, char const* aName, GLuint aBinding )
+{
+    // Uniform blocks can't have layout(binding) in GLSL 4.10
+    GLuint const index = glGetUniformBlockIndex( aProgram, aName );
+    if (GL_INVALID_INDEX == index)
+        return false;
+
+    glUniformBlockBinding( aProgram, index, aBinding );
+    return true;
+}
@@ -0,0 +1,113 @@
+#ifndef UNIFORM_BLOCKS_HPP_41C8D2A6_7E3B_4F95_A0D7_5B9E16C3F284
+#define UNIFORM_BLOCKS_HPP_41C8D2A6_7E3B_4F95_A0D7_5B9E16C3F284
+
+#include <glad/glad.h>
+
+#include <vector>
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "../vmlib/vec4.hpp"
+#include "../vmlib/mat44.hpp"
+
+/*
+ *  === Uniform blocks ===
+ *  https://www.khronos.org/opengl/wiki/Uniform_Buffer_Object
+ *  https://www.khronos.org/opengl/wiki/Interface_Block_(GLSL)#Memory_layout
+ *
+ *  The uniforms of default.vert/.frag that don't change per draw live in two
+ *  std140 blocks, grouped by how often they change:
+ *
+ *   - FrameBlock: the directional light, and where the point lights are
+ *     (see light_clusters.hpp), once per frame
+ *   - ViewBlock: the cameras, once per frame
+ *
+ *  ViewBlock holds up to kMaxViews cameras. Drawing all views in a single
+ *  pass (see multi_view.hpp) uses one block with every view in it; drawing
+ *  view by view uses one block per view, with just that view in it. All of
+ *  them go into one buffer with a slot each, filled with a single buffer
+ *  write per frame, and each pass picks its own with glBindBufferRange()
+ *  instead of re-uploading anything. Per-draw data goes through draw
+ *  records instead, see draw_batch.hpp.
+ *
+ *  The blocks are declared row_major, like Mat44f, so matrices go in as
+ *  they are. std140 gives every vec3 16 bytes, hence the Vec4fs below.
+ */
+
+// Uniform buffer binding points (kPartPaletteBinding, see vehicle.hpp, is 0
+// and kDrawRecordBinding, see draw_batch.hpp, is 3)
+constexpr GLuint kFrameBlockBinding = 1;
+constexpr GLuint kViewBlockBinding = 2;
+
+// Must match MAX_VIEWS in default.vert/.frag and particle.vert
+constexpr std::size_t kMaxViews = 2;
+
+// Laid out like FrameBlock in default.frag
+struct FrameUniforms
+{
+    Vec4f directLightDir;           // xyz, towards the light
+    Vec4f directLightAmbient;       // rgb
+    Vec4f directLightDiffuse;       // rgb
+
+    // Point lights, see light_clusters.hpp
+    Vec4f pointLightAmbient;        // rgb, all of them together; w: emissive weight
+    std::uint32_t lightGrid[4];     // Tiles along x and y, slices, lights
+    Vec4f lightSlices;              // Slice = log(depth) * x + y; near, far
+};
+
+// Laid out like ViewBlock in default.vert/.frag and particle.vert
+struct ViewUniforms
+{
+    Mat44f projCamera[kMaxViews];       // World -> clip
+    Vec4f cameraPos[kMaxViews];         // xyz, world space
+    Vec4f cameraRight[kMaxViews];       // xyz, world space, for billboards
+    Vec4f cameraUp[kMaxViews];
+    std::uint32_t viewCount;            // Views in this block
+    std::uint32_t firstView;            // Frame's view that is view 0 here
+    std::uint32_t pad_[2];
+};
+
+// Fills in view aIndex of aBlock from its camera
+void set_view( ViewUniforms& aBlock, std::size_t aIndex, Mat44f const& aProjection, Mat44f const& aWorld2Camera );
+
+// A uniform buffer with room for aCount blocks of aBlockSize bytes, each at
+// a multiple of GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT so it can be bound on
+// its own.
+class UniformBlockBuffer
+{
+public:
+    UniformBlockBuffer() = default;
+    UniformBlockBuffer( std::size_t aBlockSize, std::size_t aCount );
+    ~UniformBlockBuffer();
+
+    UniformBlockBuffer( UniformBlockBuffer const& ) = delete;
+    UniformBlockBuffer& operator=( UniformBlockBuffer const& ) = delete;
+
+    UniformBlockBuffer( UniformBlockBuffer&& ) noexcept;
+    UniformBlockBuffer& operator=( UniformBlockBuffer&& ) noexcept;
+
+    GLuint buffer() const noexcept { return mBuffer; }
+    std::size_t count() const noexcept { return mCount; }
+
+    // Copies aCount tightly packed blocks into slots 0 .. aCount-1, with a
+    // single glBufferSubData()
+    void update( void const* aBlocks, std::size_t aCount );
+
+    // Binds slot aIndex to binding point aBinding
+    void bind( GLuint aBinding, std::size_t aIndex ) const;
+
+private:
+    GLuint mBuffer = 0;
+    std::size_t mBlockSize = 0;
+    std::size_t mStride = 0;
+    std::size_t mCount = 0;
+
+    std::vector<std::uint8_t> mStaging;
+};
+
+// Points the named block of aProgram at aBinding. Returns false if the
+// program has no such block.
+bool bind_uniform_block( GLuint aProgram, char const* aName, GLuint aBinding );
+
+#endif // UNIFORM_BLOCKS_HPP_41C8D2A6_7E3B_4F95_A0D7_5B9E16C3F284
@@ -1,6 +1,6 @@
 #include "user_interface.hpp"
 
-
+#include "../support/gl_resources.hpp"
 
 
 GLuint create_UI_vao( UserInterface &aUI )
@@ -67,62 +67,19 @@ GLuint create_UI_vao( UserInterface &aUI )
     }
 
 
-    // Generate object buffers for positions
-    GLuint positionVBO = 0;
-    glGenBuffers( 1, &positionVBO );
-
-    glBindBuffer( GL_ARRAY_BUFFER, positionVBO );
-    glBufferData( 
-        GL_ARRAY_BUFFER, 
-        positions.size() * sizeof(Vec2f),
-        positions.data(),     // This gives us the raw pointer to underlying data
-        GL_STATIC_DRAW 
-    );
+    // Generate object buffers for positions and colors
+    GLuint positionVBO = create_buffer( GLsizeiptr(positions.size() * sizeof(Vec2f)), positions.data() );
+    GLuint colorVBO = create_buffer( GLsizeiptr(colors.size() * sizeof(Vec4f)), colors.data() );
 
 
-    // Do the same for colors
-    GLuint colorVBO = 0;
-    glGenBuffers( 1, &colorVBO );
+    // Generate VAO, define attributes
+    GLuint vao = create_vertex_array();
 
-    glBindBuffer( GL_ARRAY_BUFFER, colorVBO );
-    glBufferData( 
-        GL_ARRAY_BUFFER, 
-        colors.size() * sizeof(Vec4f),
-        colors.data(),
-        GL_STATIC_DRAW 
-    );
+    set_vertex_attribute( vao, 0, positionVBO, 0, 0, 2, GL_FLOAT );
+    set_vertex_attribute( vao, 1, colorVBO, 0, 0, 4, GL_FLOAT );
 
 
-    // Generate VAO, define attributes
-    GLuint vao = 0;
-    glGenVertexArrays( 1, &vao );
-    glBindVertexArray( vao );
-
-    // Add positions
-    glBindBuffer( GL_ARRAY_BUFFER, positionVBO ); 
-    glVertexAttribPointer(
-        0,
-        2, GL_FLOAT, GL_FALSE,
-        0,
-        0
-    );
-    glEnableVertexAttribArray( 0 );
-
-    glBindBuffer( GL_ARRAY_BUFFER, colorVBO ); 
-    glVertexAttribPointer(
-        1,
-        4, GL_FLOAT, GL_FALSE,
-        0,
-        0
-    );
-    glEnableVertexAttribArray( 1 );
-
-
-    // Cleanup
-    glBindVertexArray( 0 );
-    glBindBuffer( GL_ARRAY_BUFFER, 0 );
-
-    // Delete buffers
+    // Delete buffers, the VAO keeps them alive
     glDeleteBuffers(1, &positionVBO);
     glDeleteBuffers(1, &colorVBO);
 
@@ -1,7 +1,9 @@
 #include "vehicle.hpp"
 
+#include <cassert>
 
-SimpleMeshData make_vehicle() {
+
+std::vector<VehiclePart> make_vehicle_rig() {
     Material spaceshipRed = {
         {0.5f, 0.0f, 0.0f },
         {0.9f, 0.1f, 0.1f},
@@ -38,105 +40,133 @@ SimpleMeshData make_vehicle() {
         1.0f               
     };
 
-    auto top = make_cone(
-        true, 16, spaceshipRed,
-        make_translation({0.f, 0.5f, 0.f}) *
-        make_scaling(.1f, .2f, .1f) *
-        make_rotation_z(0.5f * std::numbers::pi_v<float>)
-    );
+    auto const pi = std::numbers::pi_v<float>;
 
-    auto middle = make_cylinder(
-        true, 16, spaceshipLightGrey,
-        make_translation({0.f, 0.2f, 0.f}) * 
-        make_scaling(.1f, .3f, .1f) * 
-        make_rotation_z(0.5f * std::numbers::pi_v<float>)
-    );
+    // Shapes are built along x, rotate them to stand up
+    Mat44f const upright = make_rotation_z(0.5f * pi);
 
-    auto booster1 = make_cone(
-        false, 16, spaceshipGrey,
-        make_translation({0.04f, 0.17f, 0.04f}) * 
-        make_scaling(.04f, .06f, .04f) * 
-        make_rotation_z(0.5f * std::numbers::pi_v<float>)
-    );
+    PrimitiveDesc const top         = { PrimitiveShape::cappedCone, 16, spaceshipRed };
+    PrimitiveDesc const middle      = { PrimitiveShape::cappedCylinder, 16, spaceshipLightGrey };
+    PrimitiveDesc const booster     = { PrimitiveShape::cone, 16, spaceshipGrey };
+    PrimitiveDesc const leg         = { PrimitiveShape::cappedCylinder, 16, spaceshipRed };
+    PrimitiveDesc const point       = { PrimitiveShape::cube, 1, lightbulbMaterial };
 
-    auto booster2 = make_cone(
-        false, 16, spaceshipGrey,
-        make_translation({0.04f, 0.17f, -0.04f}) * 
-        make_scaling(.04f, .06f, .04f) * 
-        make_rotation_z(0.5f * std::numbers::pi_v<float>)
-    );
+    std::vector<VehiclePart> parts;
 
-    auto booster3 = make_cone(
-        false, 16, spaceshipGrey,
-        make_translation({-0.04f, 0.17f, 0.04f}) * 
-        make_scaling(.04f, .06f, .04f) * 
-        make_rotation_z(0.5f * std::numbers::pi_v<float>)
-    );
+    // Rigid parts have their joint at the vehicle origin. Legs and boosters
+    // get a joint where they attach to the body, so that they can rotate
+    // around that point.
+    auto const add_rigid = [&] (PrimitiveDesc const& aPrim, Mat44f const& aTransform, int aParent) {
+        parts.push_back( { { aPrim, aTransform }, kIdentity44f, aParent, VehicleJoint::rigid } );
+        return int(parts.size()) - 1;
+    };
 
-    auto booster4 = make_cone(
-        false, 16, spaceshipGrey,
-        make_translation({-0.04f, 0.17f, -0.04f}) *
-        make_scaling(.04f, .06f, .04f) * 
-        make_rotation_z(0.5f * std::numbers::pi_v<float>)
-    );
+    auto const add_jointed = [&] (PrimitiveDesc const& aPrim, Mat44f const& aTransform, int aParent, VehicleJoint aKind) {
+        // Shapes run from x = 0 to x = 1; the attachment point is the x = 1 end
+        Vec4f const p = aTransform * Vec4f{ 1.f, 0.f, 0.f, 1.f };
+        Vec3f const pivot = Vec3f{ p.x, p.y, p.z } / p.w;
 
-    // RED
-    auto leg1 = make_cylinder(
-        true, 16, spaceshipRed,
-        make_translation({0.15f, 0.05f, 0.15f}) *
-        make_rotation_y(-0.75f * std::numbers::pi_v<float>) *
-        make_rotation_x(0.15f * std::numbers::pi_v<float>) *
-        make_shearing(0.f, 0.f, 0.f, 1.f, 0.f, 0.f) *
-        make_scaling(.01f, .25f, .05f) * make_rotation_z(0.5f * std::numbers::pi_v<float>)
-    );
-
-    // RED
-    auto leg2 = make_cylinder(
-        true, 16, spaceshipRed,
-        make_translation({-0.15f, 0.05f, -0.15f}) *
-        make_rotation_y(0.25f * std::numbers::pi_v<float>) *
-        make_rotation_x(0.15f * std::numbers::pi_v<float>) *
-        make_shearing(0.f, 0.f, 0.f, 1.f, 0.f, 0.f) *
-        make_scaling(.01f, .25f, .05f) * make_rotation_z(0.5f * std::numbers::pi_v<float>)
-    );
+        parts.push_back( {
+            { aPrim, make_translation( -pivot ) * aTransform },
+            make_translation( pivot ),
+            aParent, aKind
+        } );
+    };
 
-    // RED
-    auto leg3 = make_cylinder(
-        true, 16, spaceshipRed,
-        make_translation({-0.15f, 0.05f, 0.15f}) *
-        make_rotation_y(0.75f * std::numbers::pi_v<float>) *
-        make_rotation_x(0.15f * std::numbers::pi_v<float>) *
-        make_shearing(0.f, 0.f, 0.f, 1.f, 0.f, 0.f) *
-        make_scaling(.01f, .25f, .05f) * make_rotation_z(0.5f * std::numbers::pi_v<float>)
+    int const body = add_rigid( middle,
+        make_translation({0.f, 0.2f, 0.f}) * 
+        make_scaling(.1f, .3f, .1f) * upright,
+        -1
     );
 
-    auto leg4 = make_cylinder(
-        true, 16, spaceshipRed,
-        make_translation({0.15f, 0.05f, -0.15f}) *
-        make_rotation_y(-0.25f * std::numbers::pi_v<float>) *
-        make_rotation_x(0.15f * std::numbers::pi_v<float>) *
-        make_shearing(0.f, 0.f, 0.f, 1.f, 0.f, 0.f) *
-        make_scaling(.01f, .25f, .05f) * make_rotation_z(0.5f * std::numbers::pi_v<float>)
+    int const nose = add_rigid( top,
+        make_translation({0.f, 0.5f, 0.f}) *
+        make_scaling(.1f, .2f, .1f) * upright,
+        body
     );
 
-    auto point = make_cube(
-        lightbulbMaterial,
-        make_translation({0.f, 0.7f, 0.f}) * make_scaling(.025f, .025f, .025f)
+    add_rigid( point,
+        make_translation({0.f, 0.7f, 0.f}) * make_scaling(.025f, .025f, .025f),
+        nose
     );
 
-    auto upper = concatenate(point, top);
-
-    auto shaft = concatenate(upper, middle);
-
-    auto b12 = concatenate(booster1, booster2);
-    auto b34 = concatenate(booster3, booster4);
-    auto boosters = concatenate(b12, b34);
-
-    auto l12 = concatenate(leg1, leg2);
-    auto l34 = concatenate(leg3, leg4);
-    auto legs = concatenate(l12, l34);
-
-    auto body = concatenate(shaft, legs);
-
-    return concatenate(body, boosters);
-}
\ No newline at end of file
+    // Legs
+    Vec2f const legPositions[] = { { 0.15f, 0.15f }, { -0.15f, -0.15f }, { -0.15f, 0.15f }, { 0.15f, -0.15f } };
+    float const legAngles[] = { -0.75f, 0.25f, 0.75f, -0.25f };
+
+    for (std::size_t i = 0; i < 4; ++i) {
+        add_jointed( leg,
+            make_translation({legPositions[i].x, 0.05f, legPositions[i].y}) *
+            make_rotation_y(legAngles[i] * pi) *
+            make_rotation_x(0.15f * pi) *
+            make_shearing(0.f, 0.f, 0.f, 1.f, 0.f, 0.f) *
+            make_scaling(.01f, .25f, .05f) * upright,
+            body, VehicleJoint::leg
+        );
+    }
+
+    // Boosters
+    Vec2f const boosterPositions[] = { { 0.04f, 0.04f }, { 0.04f, -0.04f }, { -0.04f, 0.04f }, { -0.04f, -0.04f } };
+
+    for (auto const& p : boosterPositions) {
+        add_jointed( booster,
+            make_translation({p.x, 0.17f, p.y}) * 
+            make_scaling(.04f, .06f, .04f) * upright,
+            body, VehicleJoint::booster
+        );
+    }
+
+    assert( parts.size() <= kMaxVehicleParts );
+    return parts;
+}
+
+VehicleModel make_vehicle_model( std::vector<VehiclePart> const& aParts )
+{
+    VehicleModel ret;
+
+    for (std::size_t i = 0; i < aParts.size(); ++i) {
+        std::size_t const primitive = find_or_add_primitive( ret.primitives, aParts[i].geometry.primitive );
+
+        ret.instances.resize( ret.primitives.size() );
+        ret.instances[primitive].emplace_back( std::uint32_t(i) );
+    }
+
+    return ret;
+}
+
+void pose_vehicle( std::vector<VehiclePart> const& aParts, VehicleCtrl_ const& aCtrl, std::vector<PartPaletteEntry>& aPalette )
+{
+    auto const pi = std::numbers::pi_v<float>;
+
+    std::vector<Mat44f> world( aParts.size() );
+    aPalette.resize( aParts.size() );
+
+    for (std::size_t i = 0; i < aParts.size(); ++i) {
+        VehiclePart const& part = aParts[i];
+
+        Mat44f articulation = kIdentity44f;
+
+        if (VehicleJoint::leg == part.kind) {
+            // Fold the leg up around the horizontal axis through its joint
+            // that is perpendicular to the direction the leg points in.
+            float const heading = std::atan2( part.joint(0, 3), part.joint(2, 3) );
+
+            articulation = make_rotation_y( heading ) *
+                make_rotation_x( -aCtrl.legFold * kLegFoldAngle * pi ) *
+                make_rotation_y( -heading );
+        }
+        else if (VehicleJoint::booster == part.kind) {
+            articulation = make_rotation_x( aCtrl.gimbal );
+        }
+
+        // Parents always come before their children
+        assert( part.parent < int(i) );
+        Mat44f const parent = part.parent < 0 ? kIdentity44f : world[part.parent];
+
+        world[i] = parent * part.joint * articulation;
+
+        // The meshes are shared between parts, so the palette places them
+        aPalette[i].transform = world[i] * part.geometry.transform;
+        aPalette[i].normal = transpose( invert( aPalette[i].transform ) );
+    }
+}
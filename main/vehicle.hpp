@@ -8,6 +8,7 @@
 #include "shapes/cylinder.hpp"
 #include "shapes/cone.hpp"
 #include "shapes/cube.hpp"
+#include "primitives.hpp"
 
 struct VehicleCtrl_ {
     bool hasLaunched = false;       // This lets us know if the ship has launched already (for particles)
@@ -18,6 +19,10 @@ struct VehicleCtrl_ {
     float time = 0.f;
     float theta = 0.f;
 
+    // Articulation, see pose_vehicle()
+    float legFold = 0.f;    // 0 = deployed, 1 = folded up
+    float gimbal = 0.f;     // Booster gimbal angle (radians)
+
     // This is needed for particles
     Vec3f velocity = { 0.f, 0.f, 0.f };
 
@@ -27,9 +32,83 @@ struct VehicleCtrl_ {
         position = origin;
         time = 0.f;
         theta = 0.f;
+        legFold = 0.f;
+        gimbal = 0.f;
+    }
+
+    // Touched down: stand up straight with the legs out. The next launch
+    // starts from here.
+    void land() {
+        launch = false;
+        time = 0.f;
+        theta = 0.f;
+        legFold = 0.f;
+        gimbal = 0.f;
+        velocity = { 0.f, 0.f, 0.f };
     }
 };
 
-SimpleMeshData make_vehicle();
+/*
+ *  === Vehicle parts ===
+ *
+ *  The vehicle is a small hierarchy of parts, each a copy of one of a few
+ *  procedural primitives (see primitives.hpp). Every unique primitive is
+ *  uploaded once, and drawn instanced with one instance per part that uses
+ *  it. Each instance has its own draw record, which holds the part's index
+ *  into a matrix palette (the PartPalette uniform block). default.vert looks
+ *  up the part's current transform there, so animating the legs or boosters
+ *  is one small buffer update, and the whole vehicle is one draw per unique
+ *  primitive in the scene's batch.
+ */
+
+// Must match MAX_PARTS in default.vert. 128 entries of 128 bytes fill the
+// 16 KiB that every GL implementation allows a uniform block.
+constexpr std::size_t kMaxVehicleParts = 128;
+
+// Uniform buffer binding point of the PartPalette block
+constexpr GLuint kPartPaletteBinding = 0;
+
+// How far the legs fold up (multiples of pi)
+constexpr float kLegFoldAngle = 0.6f;
+
+enum class VehicleJoint
+{
+    rigid,
+    leg,        // Folds up around its attachment point
+    booster     // Gimbals around its attachment point
+};
+
+struct VehiclePart
+{
+    PartInstance geometry;  // Primitive and primitive -> joint transform
+    Mat44f joint;           // Joint -> parent, in the rest pose
+    int parent;             // -1 = attached to the vehicle itself
+    VehicleJoint kind;
+};
+
+// One palette entry, laid out like the std140 block in default.vert. The
+// block is row_major, like the ones in uniform_blocks.hpp.
+struct PartPaletteEntry
+{
+    Mat44f transform;       // Primitive -> model, through the part's joint
+    Mat44f normal;          // Normal matrix, transpose(invert(transform))
+};
+
+// The vehicle's unique primitives, and which parts are copies of each
+struct VehicleModel
+{
+    std::vector<PrimitiveDesc> primitives;
+    std::vector<std::vector<std::uint32_t>> instances;     // Part indices, per primitive
+};
+
+// Parents are always listed before their children
+std::vector<VehiclePart> make_vehicle_rig();
+
+// Groups the parts by primitive. The meshes are make_primitive() of each
+// one, in the primitive's own space.
+VehicleModel make_vehicle_model( std::vector<VehiclePart> const& );
+
+// Computes the palette for the current articulation
+void pose_vehicle( std::vector<VehiclePart> const&, VehicleCtrl_ const&, std::vector<PartPaletteEntry>& );
 
 #endif // VEHICLE_HPP
\ No newline at end of file
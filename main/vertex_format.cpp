@@ -0,0 +1,139 @@
+#include "vertex_format.hpp"
+
+#include <bit>
+#include <algorithm>
+
+#include <cmath>
+#include <cassert>
+
+#include "../vmlib/vec2.hpp"
+#include "../vmlib/vec3.hpp"
+
+namespace
+{
+    std::uint32_t float_word_( float aValue )
+    {
+        return std::bit_cast<std::uint32_t>( aValue );
+    }
+
+    // Like packSnorm2x16()
+    std::uint32_t snorm2x16_( float aX, float aY )
+    {
+        auto const snorm = [] (float aValue) {
+            float const v = std::round( std::clamp( aValue, -1.f, 1.f ) * 32767.f );
+            return std::uint32_t(std::uint16_t(std::int16_t(v)));
+        };
+
+        return snorm( aX ) | (snorm( aY ) << 16);
+    }
+
+    // Round to nearest. Values too small for a normal half become 0, which
+    // is fine for texture coordinates.
+    std::uint32_t half_( float aValue )
+    {
+        std::uint32_t const bits = std::bit_cast<std::uint32_t>( aValue );
+        std::uint32_t const sign = (bits >> 16) & 0x8000u;
+        std::uint32_t const mantissa = bits & 0x7fffffu;
+        std::int32_t const exponent = std::int32_t((bits >> 23) & 0xffu) - 127 + 15;
+
+        if (0xffu == ((bits >> 23) & 0xffu))
+            return sign | 0x7c00u | (mantissa ? 0x200u : 0u);      // Inf, NaN
+        if (exponent >= 31)
+            return sign | 0x7c00u;
+        if (exponent <= 0)
+            return sign;
+
+        // A carry out of the mantissa correctly bumps the exponent
+        std::uint32_t half = sign | (std::uint32_t(exponent) << 10) | (mantissa >> 13);
+        if (mantissa & 0x1000u)
+            ++half;
+
+        return half;
+    }
+
+    // Like packHalf2x16()
+    std::uint32_t half2x16_( float aX, float aY )
+    {
+        return half_( aX ) | (half_( aY ) << 16);
+    }
+
+    // Octahedral encoding of a unit vector. Zero vectors come back as +z.
+    std::uint32_t octahedral_( Vec3f const& aVector )
+    {
+        float const sum = std::abs( aVector.x ) + std::abs( aVector.y ) + std::abs( aVector.z );
+        if (sum < 1e-12f)
+            return snorm2x16_( 0.f, 0.f );
+
+        float x = aVector.x / sum;
+        float y = aVector.y / sum;
+
+        // The lower half folds over the diagonals
+        if (aVector.z < 0.f) {
+            float const fx = (1.f - std::abs( y )) * (x >= 0.f ? 1.f : -1.f);
+            float const fy = (1.f - std::abs( x )) * (y >= 0.f ? 1.f : -1.f);
+            x = fx;
+            y = fy;
+        }
+
+        return snorm2x16_( x, y );
+    }
+}
+
+std::size_t vertex_stride( VertexFormat aFormat )
+{
+    return kVertexPacked == aFormat ? kVertexPackedWords : kVertexFloatWords;
+}
+
+void pack_vertices( SimpleMeshData const& aMesh, VertexFormat aFormat, std::uint32_t aMaterialBase, std::vector<std::uint32_t>& aWords )
+{
+    std::size_t const count = aMesh.positions.size();
+    aWords.reserve( aWords.size() + count * vertex_stride( aFormat ) );
+
+    for (std::size_t i = 0; i < count; ++i) {
+        Vec3f const& p = aMesh.positions[i];
+        Vec3f const n = i < aMesh.normals.size() ? aMesh.normals[i] : Vec3f{ 0.f, 0.f, 0.f };
+        Vec2f const uv = i < aMesh.texcoords.size() ? aMesh.texcoords[i] : Vec2f{ 0.f, 0.f };
+        Vec4f const t = i < aMesh.tangents.size() ? aMesh.tangents[i] : Vec4f{ 0.f, 0.f, 0.f, 1.f };
+        float const occlusion = i < aMesh.occlusion.size() ? aMesh.occlusion[i] : 1.f;
+        std::uint32_t const material = aMaterialBase + (i < aMesh.material_ids.size() ? std::uint32_t(aMesh.material_ids[i]) : 0u);
+
+        aWords.emplace_back( float_word_( p.x ) );
+        aWords.emplace_back( float_word_( p.y ) );
+        aWords.emplace_back( float_word_( p.z ) );
+
+        if (kVertexPacked == aFormat) {
+            assert( material < 65536 );
+
+            std::uint32_t const ao = std::uint32_t(std::round( std::clamp( occlusion, 0.f, 1.f ) * 255.f ));
+            std::uint32_t const flip = t.w < 0.f ? 1u : 0u;
+
+            aWords.emplace_back( octahedral_( n ) );
+            aWords.emplace_back( octahedral_( Vec3f{ t.x, t.y, t.z } ) );
+            aWords.emplace_back( half2x16_( uv.x, uv.y ) );
+            aWords.emplace_back( ao | (flip << 8) | ((material & 0xffffu) << 16) );
+        }
+        else {
+            aWords.emplace_back( float_word_( n.x ) );
+            aWords.emplace_back( float_word_( n.y ) );
+            aWords.emplace_back( float_word_( n.z ) );
+            aWords.emplace_back( float_word_( uv.x ) );
+            aWords.emplace_back( float_word_( uv.y ) );
+            aWords.emplace_back( float_word_( t.x ) );
+            aWords.emplace_back( float_word_( t.y ) );
+            aWords.emplace_back( float_word_( t.z ) );
+            aWords.emplace_back( float_word_( t.w ) );
+            aWords.emplace_back( float_word_( occlusion ) );
+            aWords.emplace_back( material );
+        }
+    }
+}
+
+PackedMaterial pack_material( Material const& aMaterial )
+{
+    PackedMaterial ret;
+    ret.ambientShininess = Vec4f{ aMaterial.ambient.x, aMaterial.ambient.y, aMaterial.ambient.z, aMaterial.shininess };
+    ret.diffuseIllum = Vec4f{ aMaterial.diffuse.x, aMaterial.diffuse.y, aMaterial.diffuse.z, aMaterial.illum };
+    ret.specular = Vec4f{ aMaterial.specular.x, aMaterial.specular.y, aMaterial.specular.z, 0.f };
+    ret.emissive = Vec4f{ aMaterial.emissive.x, aMaterial.emissive.y, aMaterial.emissive.z, 0.f };
+    return ret;
+}
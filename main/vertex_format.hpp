@@ -0,0 +1,76 @@
+#ifndef VERTEX_FORMAT_HPP_2E7B4C19_A86D_4F3E_9C05_7D1F3B8E6A42
+#define VERTEX_FORMAT_HPP_2E7B4C19_A86D_4F3E_9C05_7D1F3B8E6A42
+
+#include <vector>
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "simple_mesh.hpp"
+
+#include "../vmlib/vec4.hpp"
+
+/*
+ *  === Vertex formats for vertex pulling ===
+ *  https://www.khronos.org/opengl/wiki/Shader_Storage_Buffer_Object
+ *  https://jcgt.org/published/0003/02/01/ (octahedral normals)
+ *
+ *  With vertex pulling, default.vert has no vertex attributes. It reads the
+ *  vertices itself from one big buffer of 32-bit words, at the draw's
+ *  vertexOffset plus gl_VertexID times the format's stride. So meshes in
+ *  different formats are just different ranges of the same buffer, and can
+ *  go into the same batch.
+ *
+ *  kVertexFloat, 14 words:
+ *    0-2   position
+ *    3-5   normal
+ *    6-7   texture coordinates
+ *    8-11  tangent, bitangent sign
+ *    12    ambient occlusion
+ *    13    material index
+ *
+ *  kVertexPacked, 7 words:
+ *    0-2   position
+ *    3     normal, octahedral, 2x snorm16
+ *    4     tangent, octahedral, 2x snorm16
+ *    5     texture coordinates, 2x half
+ *    6     ambient occlusion (bits 0-7, unorm8), bitangent sign (bit 8, set
+ *          when negative), material index (bits 16-31)
+ *
+ *  The two-component words are laid out like packSnorm2x16() and
+ *  packHalf2x16() do in GLSL: x in the low 16 bits.
+ *
+ *  Materials aren't per vertex like the attributes have them; each vertex
+ *  only has an index into a separate table of PackedMaterials.
+ */
+
+// The strides must match pull_vertex() in default.vert
+enum VertexFormat : std::uint32_t
+{
+    kVertexFloat = 0,
+    kVertexPacked = 1
+};
+
+constexpr std::size_t kVertexFloatWords = 14;
+constexpr std::size_t kVertexPackedWords = 7;
+
+// Laid out like Material in default.vert (std430)
+struct PackedMaterial
+{
+    Vec4f ambientShininess;
+    Vec4f diffuseIllum;
+    Vec4f specular;             // w unused
+    Vec4f emissive;             // w unused
+};
+
+// Words per vertex
+std::size_t vertex_stride( VertexFormat );
+
+// Appends the vertices of aMesh in aFormat to aWords. The material indices
+// are offset by aMaterialBase, for where the mesh's materials are in the
+// material table. Missing optional streams get the usual defaults.
+void pack_vertices( SimpleMeshData const&, VertexFormat, std::uint32_t aMaterialBase, std::vector<std::uint32_t>& aWords );
+
+PackedMaterial pack_material( Material const& );
+
+#endif // VERTEX_FORMAT_HPP_2E7B4C19_A86D_4F3E_9C05_7D1F3B8E6A42
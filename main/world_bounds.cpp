@@ -0,0 +1,157 @@
+#include "world_bounds.hpp"
+
+#include <algorithm>
+
+#include <cassert>
+
+#if defined(__SSE__) || defined(_M_X64)
+#	include <xmmintrin.h>
+#	define WORLD_BOUNDS_USE_SSE 1
+#endif
+
+void compute_bounds( std::vector<Vec3f> const& aPoints, Vec3f& aMin, Vec3f& aMax ) noexcept
+{
+    if (aPoints.empty()) {
+        aMin = aMax = Vec3f{ 0.f, 0.f, 0.f };
+        return;
+    }
+
+    aMin = aMax = aPoints.front();
+    for (auto const& p : aPoints) {
+        aMin = Vec3f{ std::min( aMin.x, p.x ), std::min( aMin.y, p.y ), std::min( aMin.z, p.z ) };
+        aMax = Vec3f{ std::max( aMax.x, p.x ), std::max( aMax.y, p.y ), std::max( aMax.z, p.z ) };
+    }
+}
+
+void transform_box( Mat44f const& aModel2World, Vec3f const& aMin, Vec3f const& aMax, Vec3f& aOutMin, Vec3f& aOutMax ) noexcept
+{
+    // Each output coordinate is the translation plus, per input axis, the
+    // smaller (larger) of the two extremes scaled by the matrix entry
+    for (std::size_t i = 0; i < 3; ++i) {
+        float lo = aModel2World(i, 3), hi = aModel2World(i, 3);
+
+        for (std::size_t j = 0; j < 3; ++j) {
+            float const a = aModel2World(i, j) * aMin[j];
+            float const b = aModel2World(i, j) * aMax[j];
+            lo += std::min( a, b );
+            hi += std::max( a, b );
+        }
+
+        aOutMin[i] = lo;
+        aOutMax[i] = hi;
+    }
+}
+
+std::size_t WorldBounds::add( Vec3f const& aMin, Vec3f const& aMax, Mat44f const& aModel2World )
+{
+    std::size_t const id = size();
+
+    mLocalMin.emplace_back( aMin );
+    mLocalMax.emplace_back( aMax );
+
+    for (auto* soa : { &mCenterX, &mCenterY, &mCenterZ, &mRadius, &mMinX, &mMinY, &mMinZ, &mMaxX, &mMaxY, &mMaxZ })
+        soa->emplace_back( 0.f );
+
+    set_transform( id, aModel2World );
+    return id;
+}
+
+void WorldBounds::set_transform( std::size_t aId, Mat44f const& aModel2World )
+{
+    assert( aId < size() );
+
+    Vec3f lo, hi;
+    transform_box( aModel2World, mLocalMin[aId], mLocalMax[aId], lo, hi );
+
+    mMinX[aId] = lo.x; mMinY[aId] = lo.y; mMinZ[aId] = lo.z;
+    mMaxX[aId] = hi.x; mMaxY[aId] = hi.y; mMaxZ[aId] = hi.z;
+
+    Vec3f const center = 0.5f * (lo + hi);
+    mCenterX[aId] = center.x;
+    mCenterY[aId] = center.y;
+    mCenterZ[aId] = center.z;
+    mRadius[aId] = length( hi - center );
+}
+
+void WorldBounds::set_box( std::size_t aId, Vec3f const& aMin, Vec3f const& aMax, Mat44f const& aModel2World )
+{
+    assert( aId < size() );
+
+    mLocalMin[aId] = aMin;
+    mLocalMax[aId] = aMax;
+    set_transform( aId, aModel2World );
+}
+
+Vec3f WorldBounds::center( std::size_t aId ) const noexcept
+{
+    return Vec3f{ mCenterX[aId], mCenterY[aId], mCenterZ[aId] };
+}
+
+float WorldBounds::radius( std::size_t aId ) const noexcept
+{
+    return mRadius[aId];
+}
+
+std::size_t WorldBounds::cull( Frustum const& aFrustum, std::vector<std::uint8_t>& aVisible ) const
+{
+    std::size_t const count = size();
+    aVisible.resize( count );
+
+    std::size_t visible = 0;
+    std::size_t i = 0;
+
+#	if defined(WORLD_BOUNDS_USE_SSE)
+    for (; i + 4 <= count; i += 4) {
+        __m128 const cx = _mm_loadu_ps( mCenterX.data() + i );
+        __m128 const cy = _mm_loadu_ps( mCenterY.data() + i );
+        __m128 const cz = _mm_loadu_ps( mCenterZ.data() + i );
+        __m128 const negR = _mm_sub_ps( _mm_setzero_ps(), _mm_loadu_ps( mRadius.data() + i ) );
+
+        __m128 const minX = _mm_loadu_ps( mMinX.data() + i ), maxX = _mm_loadu_ps( mMaxX.data() + i );
+        __m128 const minY = _mm_loadu_ps( mMinY.data() + i ), maxY = _mm_loadu_ps( mMaxY.data() + i );
+        __m128 const minZ = _mm_loadu_ps( mMinZ.data() + i ), maxZ = _mm_loadu_ps( mMaxZ.data() + i );
+
+        __m128 inside = _mm_cmpeq_ps( cx, cx );
+        for (auto const& p : aFrustum.planes) {
+            __m128 const px = _mm_set1_ps( p.x ), py = _mm_set1_ps( p.y ), pz = _mm_set1_ps( p.z ), pw = _mm_set1_ps( p.w );
+
+            // Spheres
+            __m128 const d = _mm_add_ps(
+                _mm_add_ps( _mm_mul_ps( px, cx ), _mm_mul_ps( py, cy ) ),
+                _mm_add_ps( _mm_mul_ps( pz, cz ), pw )
+            );
+            inside = _mm_and_ps( inside, _mm_cmpge_ps( d, negR ) );
+
+            // Boxes, by the corner furthest along the plane normal. The plane
+            // is the same for all four, so is the choice of corner.
+            __m128 const vx = p.x >= 0.f ? maxX : minX;
+            __m128 const vy = p.y >= 0.f ? maxY : minY;
+            __m128 const vz = p.z >= 0.f ? maxZ : minZ;
+
+            __m128 const e = _mm_add_ps(
+                _mm_add_ps( _mm_mul_ps( px, vx ), _mm_mul_ps( py, vy ) ),
+                _mm_add_ps( _mm_mul_ps( pz, vz ), pw )
+            );
+            inside = _mm_and_ps( inside, _mm_cmpge_ps( e, _mm_setzero_ps() ) );
+        }
+
+        int const mask = _mm_movemask_ps( inside );
+        for (int b = 0; b < 4; ++b) {
+            std::uint8_t const in = (mask >> b) & 1;
+            aVisible[i + b] = in;
+            visible += in;
+        }
+    }
+#	endif // ~ WORLD_BOUNDS_USE_SSE
+
+    // Whatever is left (or everything, without SSE)
+    for (; i < count; ++i) {
+        bool const in = intersects_sphere( aFrustum, center( i ), mRadius[i] )
+            && intersects_box( aFrustum, Vec3f{ mMinX[i], mMinY[i], mMinZ[i] }, Vec3f{ mMaxX[i], mMaxY[i], mMaxZ[i] } );
+
+        aVisible[i] = in ? 1 : 0;
+        visible += in ? 1 : 0;
+    }
+
+    return visible;
+}
@@ -0,0 +1,67 @@
+#ifndef WORLD_BOUNDS_HPP_3B8E6D21_C07A_4F95_A2D4_6E19F7C05B83
+#define WORLD_BOUNDS_HPP_3B8E6D21_C07A_4F95_A2D4_6E19F7C05B83
+
+#include <vector>
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "frustum.hpp"
+
+#include "../vmlib/vec3.hpp"
+#include "../vmlib/mat44.hpp"
+
+/*
+ *  === World space bounds ===
+ *  Arvo, "Transforming Axis-Aligned Bounding Boxes", Graphics Gems (1990)
+ *
+ *  Every renderable keeps a box in its own model space. When its transform
+ *  changes, the box is carried over into world space (Arvo's method gives
+ *  the tightest world AABB of the transformed box) along with a sphere
+ *  around it.
+ *
+ *  The world bounds are kept as separate arrays (SoA), like the meshlets'
+ *  (see meshlets.hpp), so that each view can test four renderables at a
+ *  time against its frustum with SSE. The sphere goes first, and the box
+ *  catches what the sphere can't reject. Views cull before anything is
+ *  uploaded or drawn for them.
+ */
+
+// Box of the points, or an empty box at the origin if there are none
+void compute_bounds( std::vector<Vec3f> const& aPoints, Vec3f& aMin, Vec3f& aMax ) noexcept;
+
+// World AABB of the model space box [aMin, aMax]
+void transform_box( Mat44f const& aModel2World, Vec3f const& aMin, Vec3f const& aMax, Vec3f& aOutMin, Vec3f& aOutMax ) noexcept;
+
+class WorldBounds
+{
+public:
+    // Adds a renderable with the model space box [aMin, aMax] and returns
+    // its id. Ids are consecutive, starting at 0.
+    std::size_t add( Vec3f const& aMin, Vec3f const& aMax, Mat44f const& aModel2World = kIdentity44f );
+
+    void set_transform( std::size_t aId, Mat44f const& aModel2World );
+
+    // For renderables whose model space box changes as well, e.g. animated
+    // ones
+    void set_box( std::size_t aId, Vec3f const& aMin, Vec3f const& aMax, Mat44f const& aModel2World );
+
+    std::size_t size() const noexcept { return mLocalMin.size(); }
+
+    // World space sphere
+    Vec3f center( std::size_t aId ) const noexcept;
+    float radius( std::size_t aId ) const noexcept;
+
+    // aVisible[i] = 1 if renderable i may be visible, 0 if it is definitely
+    // outside aFrustum. Returns how many are visible.
+    std::size_t cull( Frustum const&, std::vector<std::uint8_t>& aVisible ) const;
+
+private:
+    std::vector<Vec3f> mLocalMin, mLocalMax;
+
+    std::vector<float> mCenterX, mCenterY, mCenterZ, mRadius;
+    std::vector<float> mMinX, mMinY, mMinZ;
+    std::vector<float> mMaxX, mMaxY, mMaxZ;
+};
+
+#endif // WORLD_BOUNDS_HPP_3B8E6D21_C07A_4F95_A2D4_6E19F7C05B83
@@ -128,6 +128,41 @@ project "vmlib-test"
 
 	links "x-catch2"
 
+project "main-test"
+	local sources = { 
+		"main-test/**.cpp",
+		"main-test/**.hpp",
+		"main-test/**.hxx",
+		"main-test/**.inl"
+	}
+
+	-- The parts of main under test. These don't need a GL context.
+	local tested = {
+		"main/range_allocator.cpp",
+		"main/render_queue.cpp",
+		"main/bvh.cpp",
+		"main/heightfield.cpp",
+		"main/mesh_lod.cpp",
+		"main/meshlets.cpp",
+		"main/frustum.cpp",
+		"main/thread_pool.cpp",
+		"main/vertex_format.cpp",
+		"main/vehicle.cpp",
+		"main/primitives.cpp",
+		"main/simple_mesh.cpp",
+		"main/shapes/*.cpp"
+	}
+
+	kind "ConsoleApp"
+	location "main-test"
+
+	files( sources )
+	files( tested )
+
+	links "vmlib"
+
+	links "x-catch2"
+
 project "support"
 	local sources = { 
 		"support/**.cpp",
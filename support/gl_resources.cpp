@@ -0,0 +1,278 @@
+#include "gl_resources.hpp"
+
+#include <algorithm>
+
+#include "gl_state.hpp"
+
+namespace
+{
+	// Fallback texture edits happen here, out of the way of the units that
+	// are used for drawing
+	constexpr GLuint kScratchUnit_ = GLStateCache::kMaxTextureUnits - 1;
+
+	bool dsa_() noexcept
+	{
+		return GLAD_GL_VERSION_4_5;
+	}
+
+	GLsizei type_size_( GLenum aType ) noexcept
+	{
+		switch( aType )
+		{
+			case GL_BYTE: case GL_UNSIGNED_BYTE: return 1;
+			case GL_SHORT: case GL_UNSIGNED_SHORT: case GL_HALF_FLOAT: return 2;
+		}
+
+		return 4;
+	}
+
+	// Binds a VAO for editing, and the previous one again afterwards
+	struct EditVertexArray_
+	{
+		explicit EditVertexArray_( GLuint aVao )
+			: previous( gl_state().vertex_array() )
+		{
+			gl_state().bind_vertex_array( aVao );
+		}
+
+		~EditVertexArray_()
+		{
+			gl_state().bind_vertex_array( previous );
+		}
+
+		GLuint previous;
+	};
+
+	void set_attribute_( GLuint aVao, GLuint aLocation, GLuint aBuffer, GLintptr aOffset, GLsizei aStride, GLint aSize, GLenum aType, bool aInteger )
+	{
+		if( dsa_() )
+		{
+			// Stride 0 means 0 here, not tightly packed. Each location gets
+			// the binding point with the same index.
+			GLsizei const stride = aStride ? aStride : aSize * type_size_( aType );
+
+			glVertexArrayVertexBuffer( aVao, aLocation, aBuffer, aOffset, stride );
+			if( aInteger )
+				glVertexArrayAttribIFormat( aVao, aLocation, aSize, aType, 0 );
+			else
+				glVertexArrayAttribFormat( aVao, aLocation, aSize, aType, GL_FALSE, 0 );
+			glVertexArrayAttribBinding( aVao, aLocation, aLocation );
+			glEnableVertexArrayAttrib( aVao, aLocation );
+			return;
+		}
+
+		EditVertexArray_ edit( aVao );
+
+		glBindBuffer( GL_ARRAY_BUFFER, aBuffer );
+		if( aInteger )
+			glVertexAttribIPointer( aLocation, aSize, aType, aStride, reinterpret_cast<void const*>(aOffset) );
+		else
+			glVertexAttribPointer( aLocation, aSize, aType, GL_FALSE, aStride, reinterpret_cast<void const*>(aOffset) );
+		glEnableVertexAttribArray( aLocation );
+		glBindBuffer( GL_ARRAY_BUFFER, 0 );
+	}
+}
+
+GLuint create_buffer( GLsizeiptr aSize, void const* aData, GLbitfield aFlags )
+{
+	GLuint buffer = 0;
+
+	if( dsa_() )
+	{
+		glCreateBuffers( 1, &buffer );
+		glNamedBufferStorage( buffer, aSize, aData, aFlags );
+		return buffer;
+	}
+
+	glGenBuffers( 1, &buffer );
+	glBindBuffer( GL_COPY_WRITE_BUFFER, buffer );
+
+	if( GLAD_GL_VERSION_4_4 )
+		glBufferStorage( GL_COPY_WRITE_BUFFER, aSize, aData, aFlags );
+	else
+		glBufferData( GL_COPY_WRITE_BUFFER, aSize, aData, (aFlags & GL_DYNAMIC_STORAGE_BIT) ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW );
+
+	glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+	return buffer;
+}
+
+void update_buffer( GLuint aBuffer, GLintptr aOffset, GLsizeiptr aSize, void const* aData )
+{
+	if( dsa_() )
+	{
+		glNamedBufferSubData( aBuffer, aOffset, aSize, aData );
+		return;
+	}
+
+	glBindBuffer( GL_COPY_WRITE_BUFFER, aBuffer );
+	glBufferSubData( GL_COPY_WRITE_BUFFER, aOffset, aSize, aData );
+	glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+}
+
+void* map_buffer( GLuint aBuffer, GLintptr aOffset, GLsizeiptr aSize, GLbitfield aAccess )
+{
+	if( dsa_() )
+		return glMapNamedBufferRange( aBuffer, aOffset, aSize, aAccess );
+
+	glBindBuffer( GL_COPY_WRITE_BUFFER, aBuffer );
+	void* ret = glMapBufferRange( GL_COPY_WRITE_BUFFER, aOffset, aSize, aAccess );
+	glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+	return ret;
+}
+
+GLuint create_texture( GLenum aTarget, GLenum aInternalFormat, GLsizei aWidth, GLsizei aHeight, GLsizei aLayers, GLsizei aLevels )
+{
+	bool const array = GL_TEXTURE_2D_ARRAY == aTarget;
+	GLuint tex = 0;
+
+	if( dsa_() )
+	{
+		glCreateTextures( aTarget, 1, &tex );
+		if( array )
+			glTextureStorage3D( tex, aLevels, aInternalFormat, aWidth, aHeight, aLayers );
+		else
+			glTextureStorage2D( tex, aLevels, aInternalFormat, aWidth, aHeight );
+		return tex;
+	}
+
+	glGenTextures( 1, &tex );
+	gl_state().bind_texture( kScratchUnit_, aTarget, tex );
+
+	if( GLAD_GL_VERSION_4_2 )
+	{
+		if( array )
+			glTexStorage3D( aTarget, aLevels, aInternalFormat, aWidth, aHeight, aLayers );
+		else
+			glTexStorage2D( aTarget, aLevels, aInternalFormat, aWidth, aHeight );
+	}
+	else
+	{
+		// Every level up front, like glTexStorage would
+		for( GLsizei level = 0; level < aLevels; ++level )
+		{
+			GLsizei const w = std::max( aWidth >> level, 1 );
+			GLsizei const h = std::max( aHeight >> level, 1 );
+
+			if( array )
+				glTexImage3D( aTarget, level, GLint(aInternalFormat), w, h, aLayers, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr );
+			else
+				glTexImage2D( aTarget, level, GLint(aInternalFormat), w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr );
+		}
+
+		glTexParameteri( aTarget, GL_TEXTURE_MAX_LEVEL, aLevels - 1 );
+	}
+
+	return tex;
+}
+
+void upload_texture( GLuint aTexture, GLenum aTarget, GLsizei aWidth, GLsizei aHeight, GLsizei aLayers, GLenum aFormat, GLenum aType, void const* aData )
+{
+	bool const array = GL_TEXTURE_2D_ARRAY == aTarget;
+
+	if( dsa_() )
+	{
+		if( array )
+			glTextureSubImage3D( aTexture, 0, 0, 0, 0, aWidth, aHeight, aLayers, aFormat, aType, aData );
+		else
+			glTextureSubImage2D( aTexture, 0, 0, 0, aWidth, aHeight, aFormat, aType, aData );
+		return;
+	}
+
+	gl_state().bind_texture( kScratchUnit_, aTarget, aTexture );
+	if( array )
+		glTexSubImage3D( aTarget, 0, 0, 0, 0, aWidth, aHeight, aLayers, aFormat, aType, aData );
+	else
+		glTexSubImage2D( aTarget, 0, 0, 0, aWidth, aHeight, aFormat, aType, aData );
+}
+
+void generate_texture_mipmaps( GLuint aTexture, GLenum aTarget )
+{
+	if( dsa_() )
+	{
+		glGenerateTextureMipmap( aTexture );
+		return;
+	}
+
+	gl_state().bind_texture( kScratchUnit_, aTarget, aTexture );
+	glGenerateMipmap( aTarget );
+}
+
+void set_texture_parameter( GLuint aTexture, GLenum aTarget, GLenum aName, GLint aValue )
+{
+	if( dsa_() )
+	{
+		glTextureParameteri( aTexture, aName, aValue );
+		return;
+	}
+
+	gl_state().bind_texture( kScratchUnit_, aTarget, aTexture );
+	glTexParameteri( aTarget, aName, aValue );
+}
+
+void set_texture_parameter( GLuint aTexture, GLenum aTarget, GLenum aName, GLfloat aValue )
+{
+	if( dsa_() )
+	{
+		glTextureParameterf( aTexture, aName, aValue );
+		return;
+	}
+
+	gl_state().bind_texture( kScratchUnit_, aTarget, aTexture );
+	glTexParameterf( aTarget, aName, aValue );
+}
+
+GLsizei mip_levels( GLsizei aWidth, GLsizei aHeight )
+{
+	GLsizei levels = 1;
+	for( GLsizei size = std::max( aWidth, aHeight ); size > 1; size >>= 1 )
+		++levels;
+
+	return levels;
+}
+
+GLuint create_vertex_array()
+{
+	GLuint vao = 0;
+
+	if( dsa_() )
+		glCreateVertexArrays( 1, &vao );
+	else
+		glGenVertexArrays( 1, &vao );
+
+	return vao;
+}
+
+void set_vertex_attribute( GLuint aVao, GLuint aLocation, GLuint aBuffer, GLintptr aOffset, GLsizei aStride, GLint aSize, GLenum aType )
+{
+	set_attribute_( aVao, aLocation, aBuffer, aOffset, aStride, aSize, aType, false );
+}
+
+void set_vertex_attribute_integer( GLuint aVao, GLuint aLocation, GLuint aBuffer, GLintptr aOffset, GLsizei aStride, GLint aSize, GLenum aType )
+{
+	set_attribute_( aVao, aLocation, aBuffer, aOffset, aStride, aSize, aType, true );
+}
+
+void set_vertex_divisor( GLuint aVao, GLuint aLocation, GLuint aDivisor )
+{
+	if( dsa_() )
+	{
+		// Binding point aLocation, see set_attribute_()
+		glVertexArrayBindingDivisor( aVao, aLocation, aDivisor );
+		return;
+	}
+
+	EditVertexArray_ edit( aVao );
+	glVertexAttribDivisor( aLocation, aDivisor );
+}
+
+void set_element_buffer( GLuint aVao, GLuint aBuffer )
+{
+	if( dsa_() )
+	{
+		glVertexArrayElementBuffer( aVao, aBuffer );
+		return;
+	}
+
+	EditVertexArray_ edit( aVao );
+	glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, aBuffer );
+}
@@ -0,0 +1,66 @@
+#ifndef GL_RESOURCES_HPP_A83F1D6C_4E20_4B97_8D5A_26C9E07B31F4
+#define GL_RESOURCES_HPP_A83F1D6C_4E20_4B97_8D5A_26C9E07B31F4
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <cstdlib>
+
+// Creating and updating buffers, textures and VAOs without binding them.
+// See https://www.khronos.org/opengl/wiki/Direct_State_Access
+//
+// With GL 4.5 everything goes through direct state access (glCreate*(),
+// glNamedBuffer*(), glTexture*(), glVertexArray*()), so nothing that is
+// bound for drawing changes, and the driver has no bound state to
+// revalidate. Buffers and textures get immutable storage.
+//
+// Older contexts fall back to bind-to-edit, but keep it out of the way:
+// buffers are edited through GL_COPY_WRITE_BUFFER, which drawing never
+// reads, textures on the last texture unit, and VAOs are bound only for the
+// edit and the previous one is bound again after. The texture and VAO
+// bindings go through the state cache (gl_state.hpp), so it stays right.
+// Immutable storage needs 4.4 for buffers and 4.2 for textures; 4.1 gets
+// mutable storage of the same size.
+
+// Buffers
+// aFlags are glBufferStorage() flags. Without GL_DYNAMIC_STORAGE_BIT the
+// buffer can't be updated with update_buffer() later (except on 4.1, where
+// nothing is immutable).
+GLuint create_buffer( GLsizeiptr aSize, void const* aData = nullptr, GLbitfield aFlags = 0 );
+
+void update_buffer( GLuint aBuffer, GLintptr aOffset, GLsizeiptr aSize, void const* aData );
+
+// glMapBufferRange(). A persistent mapping (GL_MAP_PERSISTENT_BIT, 4.4) stays
+// valid until the buffer is deleted.
+void* map_buffer( GLuint aBuffer, GLintptr aOffset, GLsizeiptr aSize, GLbitfield aAccess );
+
+// Textures
+// aTarget is GL_TEXTURE_2D or GL_TEXTURE_2D_ARRAY (aLayers layers). The
+// storage has aLevels mip levels, see mip_levels().
+GLuint create_texture( GLenum aTarget, GLenum aInternalFormat, GLsizei aWidth, GLsizei aHeight, GLsizei aLayers, GLsizei aLevels );
+
+// Replaces all of level 0
+void upload_texture( GLuint aTexture, GLenum aTarget, GLsizei aWidth, GLsizei aHeight, GLsizei aLayers, GLenum aFormat, GLenum aType, void const* aData );
+
+void generate_texture_mipmaps( GLuint aTexture, GLenum aTarget );
+
+void set_texture_parameter( GLuint aTexture, GLenum aTarget, GLenum aName, GLint aValue );
+void set_texture_parameter( GLuint aTexture, GLenum aTarget, GLenum aName, GLfloat aValue );
+
+// Levels in a full mip chain
+GLsizei mip_levels( GLsizei aWidth, GLsizei aHeight );
+
+// Vertex arrays
+GLuint create_vertex_array();
+
+// Attribute aLocation reads aSize components of aType from aBuffer, starting
+// at aOffset and aStride bytes apart (0 = tightly packed). The _integer
+// variant is for ivec/uvec inputs, like glVertexAttribIPointer().
+void set_vertex_attribute( GLuint aVao, GLuint aLocation, GLuint aBuffer, GLintptr aOffset, GLsizei aStride, GLint aSize, GLenum aType );
+void set_vertex_attribute_integer( GLuint aVao, GLuint aLocation, GLuint aBuffer, GLintptr aOffset, GLsizei aStride, GLint aSize, GLenum aType );
+
+void set_vertex_divisor( GLuint aVao, GLuint aLocation, GLuint aDivisor );
+
+void set_element_buffer( GLuint aVao, GLuint aBuffer );
+
+#endif // GL_RESOURCES_HPP_A83F1D6C_4E20_4B97_8D5A_26C9E07B31F4
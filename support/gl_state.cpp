@@ -0,0 +1,220 @@
+#include "gl_state.hpp"
+
+#include <iterator>
+#include <algorithm>
+
+namespace
+{
+	// Matches no GL name or enum we ever set
+	constexpr GLuint kUnknown_ = ~GLuint(0);
+
+	int capability_index_( GLenum aCapability ) noexcept
+	{
+		switch( aCapability )
+		{
+			case GL_BLEND: return 0;
+			case GL_DEPTH_TEST: return 1;
+			case GL_CULL_FACE: return 2;
+		}
+
+		return -1;
+	}
+
+	int target_index_( GLenum aTarget ) noexcept
+	{
+		switch( aTarget )
+		{
+			case GL_TEXTURE_2D: return 0;
+			case GL_TEXTURE_2D_ARRAY: return 1;
+			case GL_TEXTURE_3D: return 2;
+			case GL_TEXTURE_CUBE_MAP: return 3;
+		}
+
+		return -1;
+	}
+}
+
+GLStateCache::GLStateCache() noexcept
+{
+	invalidate();
+}
+
+void GLStateCache::invalidate() noexcept
+{
+	mProgram = kUnknown_;
+	mVertexArray = kUnknown_;
+
+	mActiveUnit = kUnknown_;
+	for( auto& unit : mTextures )
+		std::fill( std::begin(unit), std::end(unit), kUnknown_ );
+
+	std::fill( std::begin(mCapabilities), std::end(mCapabilities), std::int8_t(-1) );
+
+	mBlendSrc = mBlendDst = kUnknown_;
+	mDepthFunc = kUnknown_;
+	mDepthMask = kUnknown_;
+	mColorMask = kUnknown_;
+	mCullFace = kUnknown_;
+}
+
+void GLStateCache::use_program( GLuint aProgram )
+{
+	if( changed_( mProgram, aProgram ) )
+		glUseProgram( aProgram );
+}
+
+void GLStateCache::bind_vertex_array( GLuint aVertexArray )
+{
+	if( changed_( mVertexArray, aVertexArray ) )
+		glBindVertexArray( aVertexArray );
+}
+
+void GLStateCache::bind_texture( GLuint aUnit, GLenum aTarget, GLuint aTexture )
+{
+	int const target = target_index_( aTarget );
+	if( aUnit >= kMaxTextureUnits || target < 0 )
+	{
+		// Untracked, but the unit is known afterwards
+		mActiveUnit = aUnit;
+		glActiveTexture( GL_TEXTURE0 + aUnit );
+		glBindTexture( aTarget, aTexture );
+		mStats.calls += 2;
+		return;
+	}
+
+	if( mTextures[aUnit][target] == aTexture )
+	{
+		++mStats.avoided;
+		return;
+	}
+
+	if( changed_( mActiveUnit, aUnit ) )
+		glActiveTexture( GL_TEXTURE0 + aUnit );
+
+	mTextures[aUnit][target] = aTexture;
+	glBindTexture( aTarget, aTexture );
+	++mStats.calls;
+}
+
+void GLStateCache::set_enabled( GLenum aCapability, bool aEnabled )
+{
+	int const cap = capability_index_( aCapability );
+	if( cap >= 0 )
+	{
+		std::int8_t const value = aEnabled ? 1 : 0;
+		if( mCapabilities[cap] == value )
+		{
+			++mStats.avoided;
+			return;
+		}
+
+		mCapabilities[cap] = value;
+	}
+
+	if( aEnabled )
+		glEnable( aCapability );
+	else
+		glDisable( aCapability );
+
+	++mStats.calls;
+}
+
+void GLStateCache::blend_func( GLenum aSrcFactor, GLenum aDstFactor )
+{
+	if( mBlendSrc == aSrcFactor && mBlendDst == aDstFactor )
+	{
+		++mStats.avoided;
+		return;
+	}
+
+	mBlendSrc = aSrcFactor;
+	mBlendDst = aDstFactor;
+	glBlendFunc( aSrcFactor, aDstFactor );
+	++mStats.calls;
+}
+
+void GLStateCache::depth_func( GLenum aFunc )
+{
+	if( changed_( mDepthFunc, aFunc ) )
+		glDepthFunc( aFunc );
+}
+
+void GLStateCache::depth_mask( bool aWrite )
+{
+	if( changed_( mDepthMask, aWrite ? GL_TRUE : GL_FALSE ) )
+		glDepthMask( aWrite ? GL_TRUE : GL_FALSE );
+}
+
+void GLStateCache::color_mask( bool aWrite )
+{
+	if( changed_( mColorMask, aWrite ? GL_TRUE : GL_FALSE ) )
+	{
+		GLboolean const write = aWrite ? GL_TRUE : GL_FALSE;
+		glColorMask( write, write, write, write );
+	}
+}
+
+void GLStateCache::cull_face( GLenum aFace )
+{
+	if( changed_( mCullFace, aFace ) )
+		glCullFace( aFace );
+}
+
+GLuint GLStateCache::program() const noexcept
+{
+	return kUnknown_ == mProgram ? 0 : mProgram;
+}
+
+GLuint GLStateCache::vertex_array() const noexcept
+{
+	return kUnknown_ == mVertexArray ? 0 : mVertexArray;
+}
+
+void GLStateCache::forget_vertex_array( GLuint aVertexArray ) noexcept
+{
+	// GL falls back to VAO 0
+	if( mVertexArray == aVertexArray )
+		mVertexArray = 0;
+}
+
+void GLStateCache::forget_texture( GLuint aTexture ) noexcept
+{
+	// GL unbinds it from every unit
+	for( auto& unit : mTextures )
+	{
+		for( auto& texture : unit )
+		{
+			if( texture == aTexture )
+				texture = 0;
+		}
+	}
+}
+
+GLStateCache::Stats const& GLStateCache::stats() const noexcept
+{
+	return mStats;
+}
+
+void GLStateCache::reset_stats() noexcept
+{
+	mStats = Stats{};
+}
+
+bool GLStateCache::changed_( GLuint& aCached, GLuint aValue ) noexcept
+{
+	if( aCached == aValue )
+	{
+		++mStats.avoided;
+		return false;
+	}
+
+	aCached = aValue;
+	++mStats.calls;
+	return true;
+}
+
+GLStateCache& gl_state() noexcept
+{
+	static GLStateCache cache;
+	return cache;
+}
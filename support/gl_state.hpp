@@ -0,0 +1,115 @@
+#ifndef GL_STATE_HPP_5D0E8B3A_9F61_4C27_A4E8_C71B2D6F0935
+#define GL_STATE_HPP_5D0E8B3A_9F61_4C27_A4E8_C71B2D6F0935
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <cstdlib>
+
+// Shadow copy of the GL state that changes every frame: the current program
+// and VAO, the textures bound to each unit, and blend, depth, colour mask and
+// cull state.
+// Setting something that is already set skips the GL call. Reading state
+// back from the copy replaces glGet*() queries, which may have to wait for
+// the driver to catch up.
+//
+// The cache only knows about changes that go through it. Code that calls GL
+// directly (e.g. while creating objects) must either restore what it
+// changed, or call invalidate() afterwards. Deleting a bound VAO or texture
+// resets its binding in GL, so tell the cache with forget_*().
+//
+// There is one GL context, and so one cache, see gl_state().
+//
+// Example:
+//
+//	gl_state().use_program( prog.programId() );
+//	gl_state().bind_texture( 1, GL_TEXTURE_2D_ARRAY, normalMap );
+//
+class GLStateCache final
+{
+	public:
+		struct Stats
+		{
+			std::size_t calls = 0;      // Went to GL
+			std::size_t avoided = 0;    // Skipped, GL already had that state
+		};
+
+		static constexpr GLuint kMaxTextureUnits = 16;
+
+	public:
+		GLStateCache() noexcept;
+
+	public:
+		// Forgets everything. The next call of each kind goes to GL.
+		void invalidate() noexcept;
+
+		void use_program( GLuint );
+		void bind_vertex_array( GLuint );
+
+		// Switches the active texture unit only if it has to. Units past
+		// kMaxTextureUnits and targets other than 2D, 2D array, 3D and cube
+		// maps aren't tracked and always go to GL.
+		void bind_texture( GLuint aUnit, GLenum aTarget, GLuint aTexture );
+
+		// GL_BLEND, GL_DEPTH_TEST and GL_CULL_FACE are tracked, anything else
+		// always goes to GL
+		void set_enabled( GLenum aCapability, bool aEnabled );
+
+		void blend_func( GLenum aSrcFactor, GLenum aDstFactor );
+		void depth_func( GLenum );
+		void depth_mask( bool );
+		void cull_face( GLenum );
+
+		// All four channels at once
+		void color_mask( bool );
+
+		// Last program/VAO set through the cache, 0 if unknown
+		GLuint program() const noexcept;
+		GLuint vertex_array() const noexcept;
+
+		void forget_vertex_array( GLuint ) noexcept;
+		void forget_texture( GLuint ) noexcept;
+
+		Stats const& stats() const noexcept;
+		void reset_stats() noexcept;
+
+	private:
+		enum Capability_
+		{
+			kBlend_,
+			kDepthTest_,
+			kCullFace_,
+			kCapabilityCount_
+		};
+
+		enum TextureTarget_
+		{
+			kTexture2D_,
+			kTexture2DArray_,
+			kTexture3D_,
+			kTextureCubeMap_,
+			kTextureTargetCount_
+		};
+
+		bool changed_( GLuint& aCached, GLuint aValue ) noexcept;
+
+		GLuint mProgram;
+		GLuint mVertexArray;
+
+		GLuint mActiveUnit;
+		GLuint mTextures[kMaxTextureUnits][kTextureTargetCount_];
+
+		std::int8_t mCapabilities[kCapabilityCount_];   // -1 if unknown
+
+		GLuint mBlendSrc, mBlendDst;
+		GLuint mDepthFunc;
+		GLuint mDepthMask;
+		GLuint mColorMask;
+		GLuint mCullFace;
+
+		Stats mStats;
+};
+
+GLStateCache& gl_state() noexcept;
+
+#endif // GL_STATE_HPP_5D0E8B3A_9F61_4C27_A4E8_C71B2D6F0935
@@ -0,0 +1,121 @@
+#include "gpu_timer.hpp"
+
+#include <utility>
+#include <algorithm>
+
+#include <cassert>
+
+GpuTimer::GpuTimer() noexcept
+	: mFrame( 0 )
+	, mTotalFrames( 0 )
+{}
+
+GpuTimer::GpuTimer( std::size_t aSections )
+	: GpuTimer()
+{
+	mLast.assign( aSections, 0 );
+	mTotal.assign( aSections, 0 );
+}
+
+GpuTimer::~GpuTimer()
+{
+	for( auto& frame : mFrames )
+	{
+		if( !frame.queries.empty() )
+			glDeleteQueries( GLsizei(frame.queries.size()), frame.queries.data() );
+	}
+}
+
+GpuTimer::GpuTimer( GpuTimer&& aOther ) noexcept
+	: mFrame( std::exchange( aOther.mFrame, 0 ) )
+	, mLast( std::move(aOther.mLast) )
+	, mTotal( std::move(aOther.mTotal) )
+	, mTotalFrames( std::exchange( aOther.mTotalFrames, 0 ) )
+{
+	for( std::size_t i = 0; i < kFrames; ++i )
+		mFrames[i] = std::move(aOther.mFrames[i]);
+}
+
+GpuTimer& GpuTimer::operator=( GpuTimer&& aOther ) noexcept
+{
+	std::swap( mFrames, aOther.mFrames );
+	std::swap( mFrame, aOther.mFrame );
+	std::swap( mLast, aOther.mLast );
+	std::swap( mTotal, aOther.mTotal );
+	std::swap( mTotalFrames, aOther.mTotalFrames );
+	return *this;
+}
+
+void GpuTimer::begin( std::size_t aSection )
+{
+	assert( aSection < mLast.size() );
+
+	auto& frame = mFrames[mFrame];
+	std::size_t const first = frame.sections.size() * 2;
+
+	// Queries are kept, so this only happens while the frames find out how
+	// many they need
+	if( first + 2 > frame.queries.size() )
+	{
+		frame.queries.resize( first + 2 );
+		glGenQueries( 2, frame.queries.data() + first );
+	}
+
+	frame.sections.emplace_back( std::uint32_t(aSection) );
+	glQueryCounter( frame.queries[first], GL_TIMESTAMP );
+}
+
+void GpuTimer::end( std::size_t aSection )
+{
+	auto& frame = mFrames[mFrame];
+	assert( !frame.sections.empty() && aSection == frame.sections.back() );
+	(void)aSection;
+
+	glQueryCounter( frame.queries[frame.sections.size() * 2 - 1], GL_TIMESTAMP );
+}
+
+void GpuTimer::end_frame()
+{
+	mFrame = (mFrame + 1) % kFrames;
+
+	// The slot's previous frame was kFrames frames ago
+	auto& frame = mFrames[mFrame];
+	if( frame.sections.empty() )
+		return;
+
+	std::fill( mLast.begin(), mLast.end(), GLuint64(0) );
+
+	for( std::size_t i = 0; i < frame.sections.size(); ++i )
+	{
+		GLuint64 start = 0, stop = 0;
+		glGetQueryObjectui64v( frame.queries[i * 2], GL_QUERY_RESULT, &start );
+		glGetQueryObjectui64v( frame.queries[i * 2 + 1], GL_QUERY_RESULT, &stop );
+
+		mLast[frame.sections[i]] += stop - start;
+	}
+
+	for( std::size_t i = 0; i < mLast.size(); ++i )
+		mTotal[i] += mLast[i];
+	++mTotalFrames;
+
+	frame.sections.clear();
+}
+
+double GpuTimer::last( std::size_t aSection ) const noexcept
+{
+	return double(mLast[aSection]) * 1e-6;
+}
+
+double GpuTimer::average( std::size_t aSection ) const noexcept
+{
+	if( 0 == mTotalFrames )
+		return 0.0;
+
+	return double(mTotal[aSection]) * 1e-6 / double(mTotalFrames);
+}
+
+void GpuTimer::reset_average() noexcept
+{
+	std::fill( mTotal.begin(), mTotal.end(), GLuint64(0) );
+	mTotalFrames = 0;
+}
@@ -0,0 +1,79 @@
+#ifndef GPU_TIMER_HPP_7A1C3E95_2B4D_4F80_9E6A_C58D0B71F324
+#define GPU_TIMER_HPP_7A1C3E95_2B4D_4F80_9E6A_C58D0B71F324
+
+#include <glad/glad.h>
+
+#include <vector>
+
+#include <cstdint>
+#include <cstdlib>
+
+// GPU time spent in numbered sections of a frame, from GL_TIMESTAMP queries
+// (glQueryCounter(), GL 3.3).
+// See https://www.khronos.org/opengl/wiki/Query_Object#Timer_queries
+//
+// Each begin()/end() pair puts a timestamp before and after the commands in
+// between. A section may be entered any number of times per frame (e.g. once
+// per view), and its time is the sum. Sections must not overlap.
+//
+// The GPU runs behind the CPU, so the results of a frame are only read
+// kFrames frames later, when they are long done. Reading them right away
+// would wait for the GPU to catch up, and wreck what is being measured.
+// Each frame slot keeps its own queries, as many as it has needed so far.
+//
+// Example:
+//
+//	timer.begin( kSceneSection );
+//	batch.draw();
+//	timer.end( kSceneSection );
+//	...
+//	timer.end_frame();
+//	std::printf( "%.2f ms\n", timer.average( kSceneSection ) );
+//
+class GpuTimer final
+{
+	public:
+		static constexpr std::size_t kFrames = 4;
+
+	public:
+		GpuTimer() noexcept;
+		explicit GpuTimer( std::size_t aSections );
+
+		~GpuTimer();
+
+		GpuTimer( GpuTimer const& ) = delete;
+		GpuTimer& operator= (GpuTimer const&) = delete;
+
+		GpuTimer( GpuTimer&& ) noexcept;
+		GpuTimer& operator= (GpuTimer&&) noexcept;
+
+	public:
+		void begin( std::size_t aSection );
+		void end( std::size_t aSection );
+
+		// Reads back the oldest frame's results, and moves on
+		void end_frame();
+
+		// Milliseconds, of the most recent frame with results, and on
+		// average since the last reset_average()
+		double last( std::size_t aSection ) const noexcept;
+		double average( std::size_t aSection ) const noexcept;
+
+		void reset_average() noexcept;
+
+	private:
+		struct Frame_
+		{
+			std::vector<GLuint> queries;            // Two per begin()
+			std::vector<std::uint32_t> sections;    // One per begin()
+		};
+
+		Frame_ mFrames[kFrames];
+		std::size_t mFrame;
+
+		std::vector<GLuint64> mLast;        // Nanoseconds
+		std::vector<GLuint64> mTotal;
+		std::size_t mTotalFrames;
+};
+
+#endif // GPU_TIMER_HPP_7A1C3E95_2B4D_4F80_9E6A_C58D0B71F324
@@ -2,6 +2,7 @@
 
 #include <vector>
 #include <utility>
+#include <string_view>
 
 #include <cstdio>
 
@@ -14,7 +15,8 @@ namespace
 {
 	GLuint load_shader_( 
 		GLenum aShaderType, 
-		char const* aSourcePath
+		char const* aSourcePath,
+		std::string const& aPreamble
 	);
 
 	// lightweight std::experimental::scope_exit alternative
@@ -36,9 +38,10 @@ namespace
 	}
 }
 
-ShaderProgram::ShaderProgram( std::vector<ShaderSource> aShaderSources )
+ShaderProgram::ShaderProgram( std::vector<ShaderSource> aShaderSources, std::string aPreamble )
 	: mProgram( 0 )
 	, mSources( std::move(aShaderSources) )
+	, mPreamble( std::move(aPreamble) )
 {
 	reload();
 }
@@ -52,11 +55,13 @@ ShaderProgram::~ShaderProgram()
 ShaderProgram::ShaderProgram( ShaderProgram&& aOther ) noexcept
 	: mProgram( std::exchange( aOther.mProgram, 0 ) )
 	, mSources( std::move(aOther.mSources) )
+	, mPreamble( std::move(aOther.mPreamble) )
 {}
 ShaderProgram& ShaderProgram::operator= (ShaderProgram&& aOther) noexcept
 {
 	std::swap( mProgram, aOther.mProgram );
 	std::swap( mSources, aOther.mSources );
+	std::swap( mPreamble, aOther.mPreamble );
 	return *this;
 }
 
@@ -80,7 +85,7 @@ void ShaderProgram::reload()
 
 	// Load shaders
 	for( auto const& source : mSources )
-		shaders.emplace_back( load_shader_( source.type, source.sourcePath.c_str() ) );
+		shaders.emplace_back( load_shader_( source.type, source.sourcePath.c_str(), mPreamble ) );
 
 	// Create program object
 	OGL_CHECKPOINT_ALWAYS();
@@ -139,7 +144,7 @@ void ShaderProgram::reload()
 
 namespace
 {
-	GLuint load_shader_( GLenum aShaderType, char const* aSourcePath )
+	GLuint load_shader_( GLenum aShaderType, char const* aSourcePath, std::string const& aPreamble )
 	{
 		// Load the shader source code from file
 		std::vector<GLchar> source;
@@ -180,12 +185,34 @@ namespace
 
 		GLuint shader = glCreateShader( aShaderType );
 
+		// Split off the #version line, which has to stay in front of the
+		// preamble. The #line directive keeps the line numbers in the log
+		// matching the file.
+		std::string_view const text( source.data(), source.size() );
+		std::size_t versionEnd = 0;
+
+		if( !aPreamble.empty() && text.starts_with( "#version" ) )
+		{
+			versionEnd = text.find( '\n' );
+			versionEnd = (std::string_view::npos == versionEnd) ? text.size() : versionEnd + 1;
+		}
+
+		std::string_view const version = text.substr( 0, aPreamble.starts_with( "#version" ) ? 0 : versionEnd );
+
+		std::string header;
+		if( !aPreamble.empty() )
+			header = aPreamble + (versionEnd ? "\n#line 2\n" : "\n#line 1\n");
+
 		// Compile shader
 		GLchar const* sources[] = {
-			source.data()
+			version.data(),
+			header.data(),
+			text.data() + versionEnd
 		};
 		GLsizei lengths[] = {
-			GLsizei(source.size())
+			GLsizei(version.size()),
+			GLsizei(header.size()),
+			GLsizei(text.size() - versionEnd)
 		};
 
 		glShaderSource( shader, sizeof(sources)/sizeof(sources[0]), sources, lengths );
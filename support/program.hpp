@@ -19,8 +19,12 @@ class ShaderProgram final
 		};
 
 	public:
+		// aPreamble goes in front of every source, right after its #version
+		// line, e.g. for #defines that select a variant. If the preamble
+		// starts with its own #version, that one is used instead.
 		explicit ShaderProgram( 
-			std::vector<ShaderSource> = {}
+			std::vector<ShaderSource> = {},
+			std::string aPreamble = {}
 		);
 
 		~ShaderProgram();
@@ -39,6 +43,7 @@ class ShaderProgram final
 	private:
 		GLuint mProgram;
 		std::vector<ShaderSource> mSources;
+		std::string mPreamble;
 };
 
 #endif // PROGRAM_HPP_39793FD2_7845_47A7_9E21_6DDAD42C9A09
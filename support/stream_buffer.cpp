@@ -0,0 +1,181 @@
+#include "stream_buffer.hpp"
+
+#include <utility>
+#include <iterator>
+#include <algorithm>
+
+#include "error.hpp"
+#include "gl_resources.hpp"
+
+namespace
+{
+	constexpr GLbitfield kPersistentFlags_ = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+	GLsizeiptr align_up_( GLsizeiptr aValue, GLsizeiptr aAlignment ) noexcept
+	{
+		return (aValue + aAlignment - 1) / aAlignment * aAlignment;
+	}
+}
+
+StreamBuffer::StreamBuffer() noexcept
+	: mBuffer( 0 )
+	, mFrameSize( 0 )
+	, mAlignment( 1 )
+	, mMapped( nullptr )
+	, mFences{}
+	, mFrame( 0 )
+	, mHead( 0 )
+{}
+
+StreamBuffer::StreamBuffer( GLsizeiptr aFrameSize )
+	: StreamBuffer()
+{
+	// Every allocation may end up behind a uniform, storage or texture
+	// buffer binding. 16 bytes is also plenty for indirect commands and
+	// vertex attributes.
+	GLint alignment = 16;
+
+	GLint uniformAlignment = 0;
+	glGetIntegerv( GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment );
+	alignment = std::max( alignment, uniformAlignment );
+
+	if( GLAD_GL_VERSION_4_3 )
+	{
+		GLint storageAlignment = 0;
+		glGetIntegerv( GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment );
+		alignment = std::max( alignment, storageAlignment );
+
+		GLint textureAlignment = 0;
+		glGetIntegerv( GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT, &textureAlignment );
+		alignment = std::max( alignment, textureAlignment );
+	}
+
+	mAlignment = alignment;
+	mFrameSize = align_up_( aFrameSize, mAlignment );
+
+	GLsizeiptr const total = mFrameSize * GLsizeiptr(kFrames);
+
+	if( GLAD_GL_VERSION_4_4 )
+	{
+		mBuffer = create_buffer( total, nullptr, kPersistentFlags_ );
+		mMapped = static_cast<std::uint8_t*>(map_buffer( mBuffer, 0, total, kPersistentFlags_ ));
+		if( !mMapped )
+			throw Error( "StreamBuffer: unable to map %zu bytes", std::size_t(total) );
+	}
+	else
+	{
+		mBuffer = create_buffer( total, nullptr, GL_DYNAMIC_STORAGE_BIT );
+		mStaging.resize( std::size_t(mFrameSize) );
+	}
+}
+
+StreamBuffer::~StreamBuffer()
+{
+	for( auto const fence : mFences )
+	{
+		if( fence )
+			glDeleteSync( fence );
+	}
+
+	// Deleting the buffer unmaps it
+	if( mBuffer )
+		glDeleteBuffers( 1, &mBuffer );
+}
+
+StreamBuffer::StreamBuffer( StreamBuffer&& aOther ) noexcept
+	: StreamBuffer()
+{
+	*this = std::move(aOther);
+}
+StreamBuffer& StreamBuffer::operator= (StreamBuffer&& aOther) noexcept
+{
+	std::swap( mBuffer, aOther.mBuffer );
+	std::swap( mFrameSize, aOther.mFrameSize );
+	std::swap( mAlignment, aOther.mAlignment );
+	std::swap( mMapped, aOther.mMapped );
+	std::swap( mStaging, aOther.mStaging );
+	std::swap( mFences, aOther.mFences );
+	std::swap( mFrame, aOther.mFrame );
+	std::swap( mHead, aOther.mHead );
+	std::swap( mStats, aOther.mStats );
+	return *this;
+}
+
+void StreamBuffer::begin_frame()
+{
+	mHead = 0;
+	mStats.used = 0;
+
+	GLsync& fence = mFences[mFrame];
+	if( !fence )
+		return;
+
+	// Usually signalled long ago. If not, flush so that the fence gets to
+	// the GPU at all, and wait.
+	GLenum result = glClientWaitSync( fence, 0, 0 );
+	if( GL_TIMEOUT_EXPIRED == result )
+	{
+		++mStats.waits;
+
+		do
+		{
+			result = glClientWaitSync( fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1'000'000'000 );
+		} while( GL_TIMEOUT_EXPIRED == result );
+	}
+
+	glDeleteSync( fence );
+	fence = nullptr;
+}
+
+void StreamBuffer::end_frame()
+{
+	mFences[mFrame] = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+
+	mStats.peak = std::max( mStats.peak, mStats.used );
+	mFrame = (mFrame + 1) % kFrames;
+}
+
+StreamBuffer::Allocation StreamBuffer::allocate( GLsizeiptr aSize )
+{
+	GLsizeiptr const first = align_up_( mHead, mAlignment );
+	if( first + aSize > mFrameSize )
+		throw Error( "StreamBuffer: %zu more bytes don't fit in a frame of %zu", std::size_t(aSize), std::size_t(mFrameSize) );
+
+	mHead = first + aSize;
+	mStats.used = std::size_t(mHead);
+
+	Allocation ret;
+	ret.offset = GLintptr(mFrame) * mFrameSize + first;
+	ret.size = aSize;
+	ret.data = mMapped ? mMapped + ret.offset : mStaging.data() + first;
+	return ret;
+}
+
+void StreamBuffer::flush( Allocation const& aAllocation )
+{
+	// Coherent, the GPU sees the writes already
+	if( mMapped || 0 == aAllocation.size )
+		return;
+
+	update_buffer( mBuffer, aAllocation.offset, aAllocation.size, aAllocation.data );
+}
+
+GLuint StreamBuffer::buffer() const noexcept
+{
+	return mBuffer;
+}
+
+bool StreamBuffer::persistent() const noexcept
+{
+	return nullptr != mMapped;
+}
+
+GLsizeiptr StreamBuffer::frame_size() const noexcept
+{
+	return mFrameSize;
+}
+
+StreamBuffer::Stats const& StreamBuffer::stats() const noexcept
+{
+	return mStats;
+}
@@ -0,0 +1,112 @@
+#ifndef STREAM_BUFFER_HPP_C4E7192B_6A3D_4F08_B15E_8D2F0A96E371
+#define STREAM_BUFFER_HPP_C4E7192B_6A3D_4F08_B15E_8D2F0A96E371
+
+#include <glad/glad.h>
+
+#include <vector>
+
+#include <cstdint>
+#include <cstdlib>
+
+// Ring buffer for data that is written by the CPU once per frame and read by
+// the GPU during that frame: draw records, indirect commands, particle
+// instances, and so on.
+// See https://www.khronos.org/opengl/wiki/Buffer_Object_Streaming
+//
+// The buffer is split into kFrames regions, one per frame in flight. Each
+// frame allocates from its own region, and end_frame() puts a fence behind
+// the frame's commands. When begin_frame() comes back around to a region,
+// it waits for that fence, so the GPU is done with the old data before the
+// CPU writes over it. With three regions that wait is normally over before
+// it starts.
+//
+// With GL 4.4 the whole buffer is mapped once, persistently and coherently
+// (GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT). Allocations point straight
+// into GPU visible memory, there are no copies and no orphaning, and the
+// driver never has to synchronize behind our back. The memory may be
+// write-combined: write it in order, and don't read it back.
+//
+// Older contexts get a staging copy of one region instead, and flush()
+// uploads each allocation with glBufferSubData(). Call flush() after
+// writing either way, it costs nothing with the persistent mapping.
+//
+// Example:
+//
+//	stream.begin_frame();
+//	auto records = stream.allocate( count * sizeof(DrawRecord) );
+//	std::memcpy( records.data, src, records.size );
+//	stream.flush( records );
+//	glBindBufferRange( GL_SHADER_STORAGE_BUFFER, 3, stream.buffer(), records.offset, records.size );
+//	...
+//	stream.end_frame();
+//
+class StreamBuffer final
+{
+	public:
+		struct Allocation
+		{
+			void* data;             // Write here
+			GLintptr offset;        // Offset in buffer()
+			GLsizeiptr size;
+		};
+
+		struct Stats
+		{
+			std::size_t used = 0;   // Bytes allocated so far this frame
+			std::size_t peak = 0;   // Most bytes any one frame used
+			std::size_t waits = 0;  // Frames that had to wait for the GPU
+		};
+
+		static constexpr std::size_t kFrames = 3;
+
+	public:
+		StreamBuffer() noexcept;
+
+		// aFrameSize bytes per frame, kFrames times that in total
+		explicit StreamBuffer( GLsizeiptr aFrameSize );
+
+		~StreamBuffer();
+
+		StreamBuffer( StreamBuffer const& ) = delete;
+		StreamBuffer& operator= (StreamBuffer const&) = delete;
+
+		StreamBuffer( StreamBuffer&& ) noexcept;
+		StreamBuffer& operator= (StreamBuffer&&) noexcept;
+
+	public:
+		// Waits until the GPU is done with this frame's region
+		void begin_frame();
+
+		// Fences the frame's commands, and moves on to the next region
+		void end_frame();
+
+		// Offsets are aligned for glBindBufferRange() with uniform and
+		// shader storage buffers, and for glTexBufferRange(). Throws Error
+		// if the frame is out of room.
+		Allocation allocate( GLsizeiptr aSize );
+
+		void flush( Allocation const& );
+
+		GLuint buffer() const noexcept;
+		bool persistent() const noexcept;
+
+		GLsizeiptr frame_size() const noexcept;
+
+		Stats const& stats() const noexcept;
+
+	private:
+		GLuint mBuffer;
+		GLsizeiptr mFrameSize;
+		GLsizeiptr mAlignment;
+
+		std::uint8_t* mMapped;                  // Persistent mapping
+		std::vector<std::uint8_t> mStaging;     // One region, without it
+
+		GLsync mFences[kFrames];
+		std::size_t mFrame;
+		GLsizeiptr mHead;
+
+		Stats mStats;
+};
+
+#endif // STREAM_BUFFER_HPP_C4E7192B_6A3D_4F08_B15E_8D2F0A96E371